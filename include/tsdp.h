@@ -31,15 +31,30 @@ struct qname {
 	int i;
 	int wild;
 
-	size_t len;
+	size_t len;     /* octets of flat in use                     */
+	size_t cap;     /* octets allocated to flat                  */
 	char *flat;
+	int borrowed;   /* flat is caller-owned (qname_parse_into) */
+
+	char *canon;    /* cached canonical form (see qname_string) */
+	size_t clen;    /* length of canon, sans NUL terminator     */
+};
+
+struct qname_arena {
+	size_t n;             /* number of names (parsed or not)   */
+	size_t failed;        /* how many failed to parse          */
+	struct qname *names;  /* the names; failures are zeroed    */
+	char *buf;            /* backing storage shared by names[] */
 };
 
 struct qname* qname_new();
 struct qname* qname_parse(const char *s);
+int qname_parse_into(struct qname *q, char *scratch, size_t cap, const char *s, size_t len);
+void qname_clear(struct qname *q);
 struct qname* qname_dup();
 void qname_free(struct qname *q);
 char* qname_string(struct qname *q);
+size_t qname_string_into(struct qname *q, char *buf, size_t len);
 int qname_equal(struct qname *a, struct qname *b);
 int qname_match(struct qname *q, struct qname *pattern);
 const char* qname_get(struct qname *q, const char *k);
@@ -47,6 +62,46 @@ int qname_set(struct qname *q, const char *k, const char *v);
 int qname_unset(struct qname *q, const char *k);
 int qname_merge(struct qname *a, struct qname *b);
 
+struct qname_arena* qname_parse_many(const char **s, size_t n, int threads);
+struct qname_arena* qname_parse_lines(const char *buf, size_t len, int threads);
+void qname_arena_free(struct qname_arena *a);
+
+struct tsdp_relabel; /* opaque */
+
+struct tsdp_relabel* tsdp_relabel_compile(const char *rules);
+void tsdp_relabel_free(struct tsdp_relabel *r);
+size_t tsdp_relabel_apply(struct tsdp_relabel *r, struct qname *q, char *buf, size_t len);
+
+
+#define QNAME_SYM_NONE   0   /* key has no value       */
+#define QNAME_SYM_ANY    1   /* key has wildcard value */
+
+struct qname_symtab; /* opaque */
+
+struct qname_sym {
+	uint32_t metric;      /* symbol id of the metric name */
+	int n;                /* number of key/value pairs    */
+	int wild;             /* trailing wildcard?           */
+
+	struct {
+		uint32_t key;     /* symbol id of the key         */
+		uint32_t value;   /* symbol id of the value, or   */
+		                  /* QNAME_SYM_NONE / _ANY        */
+	} pairs[];            /* ordered by key id            */
+};
+
+struct qname_symtab* qname_symtab_new(void);
+void qname_symtab_free(struct qname_symtab *t);
+uint32_t qname_symtab_intern(struct qname_symtab *t, const char *s, size_t len);
+uint32_t qname_symtab_lookup(struct qname_symtab *t, const char *s, size_t len);
+const char* qname_symtab_string(struct qname_symtab *t, uint32_t id);
+size_t qname_symtab_size(struct qname_symtab *t);
+
+struct qname_sym* qname_sym_new(struct qname_symtab *t, struct qname *q);
+int qname_sym_equal(struct qname_sym *a, struct qname_sym *b);
+int qname_sym_match(struct qname_sym *qn, struct qname_sym *pattern);
+size_t qname_sym_string_into(struct qname_symtab *t, struct qname_sym *s, char *buf, size_t len);
+
 
 #define TSDP_PROTOCOL_V1       1
 #define tsdp_version_ok(v) ((v) == TSDP_PROTOCOL_V1)
@@ -70,8 +125,9 @@ int qname_merge(struct qname *a, struct qname *b);
 #define TSDP_PAYLOAD_STATE     0x0008
 #define TSDP_PAYLOAD_EVENT     0x0010
 #define TSDP_PAYLOAD_FACT      0x0020
+#define TSDP_PAYLOAD_HISTOGRAM 0x0040
 // ......................      ......
-#define TSDP_PAYLOAD_RSVP      0xffc0
+#define TSDP_PAYLOAD_RSVP      0xff80
 #define TSDP_PAYLOAD_ALL      (0xffff & ~TSDP_PAYLOAD_RSVP)
 #define tsdp_payload_ok(p) (((p) & TSDP_PAYLOAD_RSVP) == 0)
 
@@ -238,4 +294,246 @@ unsigned int
 tsdp_frame_length(struct tsdp_frame *f);
 
 
+
+struct tsdp_subidx; /* opaque */
+
+struct tsdp_subidx* tsdp_subidx_new(void);
+void tsdp_subidx_free(struct tsdp_subidx *x);
+int tsdp_subidx_add(struct tsdp_subidx *x, struct qname *pattern, unsigned int payloads, void *sub);
+int tsdp_subidx_subscribe(struct tsdp_subidx *x, struct tsdp_msg *m, void *sub);
+int tsdp_subidx_remove(struct tsdp_subidx *x, int id);
+struct qname* tsdp_subidx_pattern(struct tsdp_subidx *x, int id);
+size_t tsdp_subidx_count(struct tsdp_subidx *x);
+size_t tsdp_subidx_lookup(struct tsdp_subidx *x, struct qname *q, unsigned int payload, void **subs, size_t max);
+int tsdp_subidx_cache(struct tsdp_subidx *x, size_t entries);
+void tsdp_subidx_cache_stats(struct tsdp_subidx *x, uint64_t *hits, uint64_t *misses);
+
+struct tsdp_tagidx; /* opaque */
+
+struct tsdp_tagidx* tsdp_tagidx_new(void);
+void tsdp_tagidx_free(struct tsdp_tagidx *x);
+int tsdp_tagidx_add(struct tsdp_tagidx *x, struct qname *q, unsigned int payload);
+int tsdp_tagidx_lookup(struct tsdp_tagidx *x, struct qname *q, unsigned int payload);
+int tsdp_tagidx_remove(struct tsdp_tagidx *x, int id);
+struct qname* tsdp_tagidx_series(struct tsdp_tagidx *x, int id);
+unsigned int tsdp_tagidx_payload(struct tsdp_tagidx *x, int id);
+size_t tsdp_tagidx_count(struct tsdp_tagidx *x);
+int tsdp_tagidx_select(struct tsdp_tagidx *x, struct qname *pattern, unsigned int payloads, int (*fn)(int id, void *udata), void *udata);
+int tsdp_tagidx_forget(struct tsdp_tagidx *x, struct qname *pattern, unsigned int payloads);
+
+struct tsdp_qset; /* opaque */
+
+struct tsdp_qset* tsdp_qset_build(struct qname **names, size_t n);
+struct tsdp_qset* tsdp_qset_open(const char *path);
+int tsdp_qset_write(struct tsdp_qset *s, int fd);
+void tsdp_qset_free(struct tsdp_qset *s);
+size_t tsdp_qset_count(struct tsdp_qset *s);
+size_t tsdp_qset_size(struct tsdp_qset *s);
+int64_t tsdp_qset_find(struct tsdp_qset *s, struct qname *q);
+size_t tsdp_qset_get(struct tsdp_qset *s, uint64_t i, char *buf, size_t len);
+int64_t tsdp_qset_prefix(struct tsdp_qset *s, const char *prefix, int (*fn)(const char *name, size_t len, void *udata), void *udata);
+int64_t tsdp_qset_metric(struct tsdp_qset *s, const char *metric, int (*fn)(const char *name, size_t len, void *udata), void *udata);
+
+struct tsdp_card; /* opaque */
+
+struct tsdp_card* tsdp_card_new(int precision);
+void tsdp_card_free(struct tsdp_card *c);
+int tsdp_card_observe(struct tsdp_card *c, struct qname *q);
+int tsdp_card_observe_msg(struct tsdp_card *c, struct tsdp_msg *m);
+uint64_t tsdp_card_estimate(struct tsdp_card *c, const char *metric, const char *key);
+int tsdp_card_each(struct tsdp_card *c, int (*fn)(const char *metric, const char *key, uint64_t estimate, void *udata), void *udata);
+struct tsdp_msg* tsdp_card_sample(struct tsdp_card *c, const char *metric, const char *key, uint64_t ts);
+struct tsdp_msg* tsdp_card_fact(struct tsdp_card *c, const char *metric, const char *key);
+
+struct tsdp_topk; /* opaque */
+
+struct tsdp_topk_item {
+	const char *key;       /* the key (NUL-terminated)       */
+	uint64_t hash;         /* 64-bit hash of the key         */
+	uint64_t count;        /* estimated count (never under)  */
+	uint64_t error;        /* most count may be over by      */
+
+	uint64_t opcodes[TSDP_OPCODE_SUBSCRIBE + 1]; /* by opcode      */
+	uint64_t payloads[16];                       /* by payload bit */
+};
+
+struct tsdp_topk* tsdp_topk_new(size_t k);
+void tsdp_topk_free(struct tsdp_topk *t);
+int tsdp_topk_observe(struct tsdp_topk *t, const char *key, size_t len, int opcode, int payload);
+int tsdp_topk_observe_msg(struct tsdp_topk *t, struct tsdp_msg *m);
+uint64_t tsdp_topk_estimate(struct tsdp_topk *t, const char *key, size_t len);
+uint64_t tsdp_topk_total(struct tsdp_topk *t);
+size_t tsdp_topk_list(struct tsdp_topk *t, struct tsdp_topk_item *items, size_t max);
+int tsdp_topk_merge(struct tsdp_topk *dst, struct tsdp_topk *src);
+
+struct tsdp_wheel; /* opaque */
+
+struct tsdp_wheel* tsdp_wheel_new(uint64_t now);
+void tsdp_wheel_free(struct tsdp_wheel *w);
+uint64_t tsdp_wheel_now(struct tsdp_wheel *w);
+size_t tsdp_wheel_count(struct tsdp_wheel *w);
+int tsdp_wheel_arm(struct tsdp_wheel *w, uint64_t deadline, void *data);
+int tsdp_wheel_rearm(struct tsdp_wheel *w, int id, uint64_t deadline);
+int tsdp_wheel_cancel(struct tsdp_wheel *w, int id);
+int tsdp_wheel_heartbeat(struct tsdp_wheel *w, int id, struct tsdp_msg *m, uint64_t timeout);
+size_t tsdp_wheel_advance(struct tsdp_wheel *w, uint64_t now, void (*fn)(int id, void *data, void *udata), void *udata);
+
+struct tsdp_tally; /* opaque */
+
+struct tsdp_tally* tsdp_tally_new(unsigned int window, size_t capacity, int shards);
+void tsdp_tally_free(struct tsdp_tally *t);
+int tsdp_tally_add(struct tsdp_tally *t, const char *name, size_t len, uint64_t inc);
+int tsdp_tally_submit(struct tsdp_tally *t, struct tsdp_msg *m);
+int tsdp_tally_flush(struct tsdp_tally *t, uint64_t ts, void (*fn)(struct tsdp_msg *m, void *udata), void *udata);
+
+struct tsdp_sketch; /* opaque */
+
+#define TSDP_SKETCH_MAX_BINS 512
+
+struct tsdp_sketch* tsdp_sketch_new(double alpha, unsigned int maxbins);
+void tsdp_sketch_free(struct tsdp_sketch *s);
+void tsdp_sketch_clear(struct tsdp_sketch *s);
+int tsdp_sketch_add(struct tsdp_sketch *s, double v);
+uint64_t tsdp_sketch_count(struct tsdp_sketch *s);
+double tsdp_sketch_quantile(struct tsdp_sketch *s, double q);
+int tsdp_sketch_merge(struct tsdp_sketch *dst, struct tsdp_sketch *src);
+ssize_t tsdp_sketch_pack(void *buf, size_t len, struct tsdp_sketch *s);
+struct tsdp_sketch* tsdp_sketch_unpack(const void *buf, size_t len);
+
+struct tsdp_sample; /* opaque */
+
+#define TSDP_SAMPLE_MAX_QUANTILES 8
+
+struct tsdp_sample_stats {
+	uint64_t count;     /* how many measurements          */
+	double   min;       /* smallest measurement           */
+	double   max;       /* largest measurement            */
+	double   sum;       /* sum of all measurements        */
+	double   mean;      /* arithmetic mean                */
+	double   variance;  /* sample variance (0 if count<2) */
+};
+
+struct tsdp_sample* tsdp_sample_new(unsigned int window);
+void tsdp_sample_free(struct tsdp_sample *s);
+int tsdp_sample_add(struct tsdp_sample *s, const char *name, size_t len, const double *v, size_t n);
+int tsdp_sample_submit(struct tsdp_sample *s, struct tsdp_msg *m);
+int tsdp_sample_get(struct tsdp_sample *s, const char *name, size_t len, struct tsdp_sample_stats *stats);
+int tsdp_sample_flush(struct tsdp_sample *s, uint64_t ts, void (*fn)(struct tsdp_msg *m, void *udata), void *udata);
+int tsdp_sample_quantiles(struct tsdp_sample *s, const double *q, size_t n);
+struct tsdp_sketch* tsdp_sample_sketch(struct tsdp_sample *s, const char *name, size_t len);
+
+struct tsdp_delta; /* opaque */
+
+struct tsdp_delta* tsdp_delta_new(unsigned int window, size_t capacity);
+void tsdp_delta_free(struct tsdp_delta *d);
+size_t tsdp_delta_count(struct tsdp_delta *d);
+int tsdp_delta_update(struct tsdp_delta *d, const char *name, size_t len, uint64_t ts, double value);
+int tsdp_delta_submit(struct tsdp_delta *d, struct tsdp_msg *m);
+int tsdp_delta_get(struct tsdp_delta *d, const char *name, size_t len, double *increase);
+int tsdp_delta_forget(struct tsdp_delta *d, const char *name, size_t len);
+int tsdp_delta_flush(struct tsdp_delta *d, uint64_t ts, void (*fn)(struct tsdp_msg *m, void *udata), void *udata);
+
+struct tsdp_state; /* opaque */
+
+struct tsdp_state* tsdp_state_new(size_t capacity);
+void tsdp_state_free(struct tsdp_state *s);
+size_t tsdp_state_count(struct tsdp_state *s);
+int tsdp_state_update(struct tsdp_state *s, const char *name, size_t len, uint64_t ts, uint32_t status, const char *summary, size_t slen, void (*fn)(struct tsdp_msg *m, void *udata), void *udata);
+int tsdp_state_submit(struct tsdp_state *s, struct tsdp_msg *m, void (*fn)(struct tsdp_msg *m, void *udata), void *udata);
+int tsdp_state_get(struct tsdp_state *s, const char *name, size_t len, uint32_t *status, uint64_t *ts, const char **summary);
+int tsdp_state_forget(struct tsdp_state *s, const char *name, size_t len);
+int tsdp_state_replay(struct tsdp_state *s, void (*fn)(struct tsdp_msg *m, void *udata), void *udata);
+
+struct tsdp_histogram; /* opaque */
+
+#define TSDP_HISTOGRAM_MAX_BUCKETS 256
+
+struct tsdp_histogram* tsdp_histogram_new(const double *bounds, size_t n);
+void tsdp_histogram_free(struct tsdp_histogram *h);
+void tsdp_histogram_clear(struct tsdp_histogram *h);
+size_t tsdp_histogram_buckets(struct tsdp_histogram *h);
+double tsdp_histogram_bound(struct tsdp_histogram *h, size_t i);
+uint64_t tsdp_histogram_count(struct tsdp_histogram *h, size_t i);
+uint64_t tsdp_histogram_total(struct tsdp_histogram *h);
+int tsdp_histogram_observe(struct tsdp_histogram *h, double v, uint64_t n);
+int tsdp_histogram_merge(struct tsdp_histogram *dst, struct tsdp_histogram *src);
+struct tsdp_msg* tsdp_histogram_to_msg(struct tsdp_histogram *h, int opcode, const char *name, uint64_t ts, unsigned int window);
+struct tsdp_histogram* tsdp_histogram_from_msg(struct tsdp_msg *m);
+
+struct tsdp_groupby; /* opaque */
+
+#define TSDP_GROUPBY_SUM   1
+#define TSDP_GROUPBY_COUNT 2
+#define TSDP_GROUPBY_MIN   3
+#define TSDP_GROUPBY_MAX   4
+#define TSDP_GROUPBY_MEAN  5
+
+struct tsdp_groupby* tsdp_groupby_new(const char *pattern, const char **keys, size_t nkeys, int op, unsigned int window);
+void tsdp_groupby_free(struct tsdp_groupby *g);
+size_t tsdp_groupby_count(struct tsdp_groupby *g);
+int tsdp_groupby_add(struct tsdp_groupby *g, struct qname *q, double v);
+int tsdp_groupby_submit(struct tsdp_groupby *g, struct tsdp_msg *m);
+int tsdp_groupby_get(struct tsdp_groupby *g, const char *group, size_t len, double *value);
+int tsdp_groupby_forget(struct tsdp_groupby *g, const char *name, size_t len);
+int tsdp_groupby_flush(struct tsdp_groupby *g, uint64_t ts, void (*fn)(struct tsdp_msg *m, void *udata), void *udata);
+
+
+struct tsdp_window; /* opaque */
+
+struct tsdp_window* tsdp_window_new(unsigned int window, size_t capacity);
+void tsdp_window_free(struct tsdp_window *w);
+size_t tsdp_window_count(struct tsdp_window *w);
+int tsdp_window_series(struct tsdp_window *w, const char *name, size_t len);
+const char* tsdp_window_name(struct tsdp_window *w, int id);
+int tsdp_window_add(struct tsdp_window *w, int id, const double *v, size_t n);
+int tsdp_window_submit(struct tsdp_window *w, struct tsdp_msg *m);
+int tsdp_window_get(struct tsdp_window *w, int id, struct tsdp_sample_stats *stats);
+int tsdp_window_flush(struct tsdp_window *w, uint64_t ts, void (*fn)(struct tsdp_msg *m, void *udata), void *udata);
+
+
+struct tsdp_store;      /* opaque */
+struct tsdp_store_iter; /* opaque */
+
+struct tsdp_bucket {
+	uint64_t ts;     /* start of the bucket           */
+	uint64_t count;  /* how many values fell into it  */
+	double   min;    /* smallest value                */
+	double   max;    /* largest value                 */
+	double   sum;    /* sum of all values             */
+};
+
+struct tsdp_store* tsdp_store_new(void);
+void tsdp_store_free(struct tsdp_store *s);
+size_t tsdp_store_count(struct tsdp_store *s);
+uint64_t tsdp_store_points(struct tsdp_store *s);
+size_t tsdp_store_octets(struct tsdp_store *s);
+int tsdp_store_append(struct tsdp_store *s, const char *name, size_t len, uint64_t ts, double v);
+int tsdp_store_submit(struct tsdp_store *s, struct tsdp_msg *m);
+int tsdp_store_forget(struct tsdp_store *s, const char *name, size_t len);
+struct tsdp_store_iter* tsdp_store_iter(struct tsdp_store *s, const char *name, size_t len, uint64_t from, uint64_t until);
+int tsdp_store_next(struct tsdp_store_iter *it, uint64_t *ts, double *v);
+int tsdp_store_bucket(struct tsdp_store_iter *it, struct tsdp_bucket *b);
+void tsdp_store_iter_free(struct tsdp_store_iter *it);
+
+
+struct tsdp_segment; /* opaque */
+
+int tsdp_segment_write(struct tsdp_store *s, int fd);
+struct tsdp_segment* tsdp_segment_open(const char *path);
+void tsdp_segment_free(struct tsdp_segment *seg);
+size_t tsdp_segment_count(struct tsdp_segment *seg);
+uint64_t tsdp_segment_points(struct tsdp_segment *seg);
+const char* tsdp_segment_series(struct tsdp_segment *seg, uint64_t i);
+int tsdp_segment_span(struct tsdp_segment *seg, uint64_t *first, uint64_t *last);
+int tsdp_segment_has(struct tsdp_segment *seg, const char *name, size_t len);
+uint64_t tsdp_segment_width(struct tsdp_segment *seg);
+struct tsdp_segment* tsdp_segment_pick(struct tsdp_segment **segs, size_t n, uint64_t from, uint64_t until, uint64_t resolution);
+int tsdp_segment_compact(struct tsdp_segment **segs, size_t n, uint64_t width, uint64_t rate, int fd);
+
+struct tsdp_compactor; /* opaque */
+
+struct tsdp_compactor* tsdp_compactor_start(struct tsdp_segment **segs, size_t n, uint64_t width, uint64_t rate, const char *path);
+int tsdp_compactor_wait(struct tsdp_compactor *c);
+struct tsdp_store_iter* tsdp_segment_iter(struct tsdp_segment *seg, const char *name, size_t len, uint64_t from, uint64_t until);
+
 #endif
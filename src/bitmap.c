@@ -0,0 +1,385 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bitmap.h"
+
+/* containers with more than this many ids are stored as
+   bitsets, which is where a bitset gets smaller than the
+   equivalent array of 16-bit values */
+#define ARRAY_MAX     4096
+#define BITSET_WORDS  (65536 / 64)
+
+struct s_container {
+	uint16_t key;      /* high 16 bits of every id within */
+	uint16_t dense;    /* bitset (1) or sorted array (0)? */
+	uint32_t n;        /* number of ids within            */
+	uint32_t max;      /* allocated length of array       */
+	union {
+		uint16_t *array;
+		uint64_t *bits;
+	} u;
+};
+
+struct bitmap {
+	uint32_t n, max;   /* containers used / allocated     */
+	struct s_container *c;
+	uint64_t card;     /* total number of ids             */
+};
+
+static void
+s_container_free(struct s_container *c)
+{
+	if (c->dense) free(c->u.bits);
+	else          free(c->u.array);
+}
+
+/* binary search for the container with key `k`; returns its
+   index, or -(insertion point) - 1 if there is none */
+static int64_t
+s_find(const struct bitmap *b, uint16_t k)
+{
+	int64_t lo, hi, mid;
+
+	lo = 0; hi = (int64_t)b->n - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if      (b->c[mid].key < k) lo = mid + 1;
+		else if (b->c[mid].key > k) hi = mid - 1;
+		else return mid;
+	}
+	return -lo - 1;
+}
+
+/* binary search for `v` in a sorted array; as for s_find */
+static int64_t
+s_search(const uint16_t *a, uint32_t n, uint16_t v)
+{
+	int64_t lo, hi, mid;
+
+	lo = 0; hi = (int64_t)n - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if      (a[mid] < v) lo = mid + 1;
+		else if (a[mid] > v) hi = mid - 1;
+		else return mid;
+	}
+	return -lo - 1;
+}
+
+static int
+s_popcount(uint64_t w)
+{
+	return __builtin_popcountll(w);
+}
+
+static int
+s_to_bitset(struct s_container *c)
+{
+	uint64_t *bits;
+	uint32_t i;
+
+	bits = calloc(BITSET_WORDS, sizeof(uint64_t));
+	if (!bits) return -1;
+
+	for (i = 0; i < c->n; i++)
+		bits[c->u.array[i] >> 6] |= 1ULL << (c->u.array[i] & 63);
+	free(c->u.array);
+	c->u.bits = bits;
+	c->dense  = 1;
+	c->max    = 0;
+	return 0;
+}
+
+static int
+s_to_array(struct s_container *c)
+{
+	uint16_t *array;
+	uint32_t i, n;
+	uint64_t w;
+
+	array = malloc((c->n ? c->n : 1) * sizeof(uint16_t));
+	if (!array) return -1;
+
+	for (i = n = 0; i < BITSET_WORDS; i++)
+		for (w = c->u.bits[i]; w; w &= w - 1)
+			array[n++] = (uint16_t)(i * 64 + __builtin_ctzll(w));
+	free(c->u.bits);
+	c->u.array = array;
+	c->dense   = 0;
+	c->max     = c->n ? c->n : 1;
+	return 0;
+}
+
+
+struct bitmap *
+bitmap_new(void)
+{
+	return calloc(1, sizeof(struct bitmap));
+}
+
+void
+bitmap_free(struct bitmap *b)
+{
+	uint32_t i;
+
+	if (!b) return;
+	for (i = 0; i < b->n; i++)
+		s_container_free(&b->c[i]);
+	free(b->c);
+	free(b);
+}
+
+struct bitmap *
+bitmap_copy(const struct bitmap *b)
+{
+	struct bitmap *copy;
+	struct s_container *c;
+	uint32_t i;
+	size_t size;
+
+	copy = bitmap_new();
+	if (!copy) return NULL;
+	if (b->n == 0) return copy;
+
+	copy->c = malloc(b->n * sizeof(struct s_container));
+	if (!copy->c) goto fail;
+
+	for (i = 0; i < b->n; i++) {
+		c = &copy->c[i];
+		*c = b->c[i];
+		if (c->dense) {
+			size = BITSET_WORDS * sizeof(uint64_t);
+		} else {
+			size = c->n * sizeof(uint16_t);
+			c->max = c->n;
+		}
+		c->u.bits = malloc(size ? size : 1);
+		if (!c->u.bits) goto fail;
+		memcpy(c->u.bits, b->c[i].u.bits, size);
+		copy->n++;
+	}
+	copy->max  = b->n;
+	copy->card = b->card;
+	return copy;
+
+fail:
+	bitmap_free(copy);
+	errno = ENOMEM;
+	return NULL;
+}
+
+int
+bitmap_add(struct bitmap *b, uint32_t id)
+{
+	struct s_container *c;
+	int64_t at;
+	uint16_t lo;
+	void *p;
+
+	at = s_find(b, id >> 16);
+	if (at < 0) {
+		at = -at - 1;
+		if (b->n == b->max) {
+			p = realloc(b->c, (b->max ? b->max * 2 : 4) * sizeof(struct s_container));
+			if (!p) return -1;
+			b->c = p;
+			b->max = b->max ? b->max * 2 : 4;
+		}
+		memmove(&b->c[at + 1], &b->c[at], (b->n - at) * sizeof(struct s_container));
+		c = &b->c[at];
+		memset(c, 0, sizeof(struct s_container));
+		c->key = id >> 16;
+		b->n++;
+	}
+	c  = &b->c[at];
+	lo = id & 0xffff;
+
+	if (c->dense) {
+		if (c->u.bits[lo >> 6] & (1ULL << (lo & 63))) return 0;
+		c->u.bits[lo >> 6] |= 1ULL << (lo & 63);
+
+	} else {
+		at = s_search(c->u.array, c->n, lo);
+		if (at >= 0) return 0;
+		at = -at - 1;
+
+		if (c->n == ARRAY_MAX) {
+			if (s_to_bitset(c) != 0) return -1;
+			c->u.bits[lo >> 6] |= 1ULL << (lo & 63);
+
+		} else {
+			if (c->n == c->max) {
+				p = realloc(c->u.array, (c->max ? c->max * 2 : 4) * sizeof(uint16_t));
+				if (!p) return -1;
+				c->u.array = p;
+				c->max = c->max ? c->max * 2 : 4;
+			}
+			memmove(&c->u.array[at + 1], &c->u.array[at], (c->n - at) * sizeof(uint16_t));
+			c->u.array[at] = lo;
+		}
+	}
+	c->n++;
+	b->card++;
+	return 0;
+}
+
+int
+bitmap_remove(struct bitmap *b, uint32_t id)
+{
+	struct s_container *c;
+	int64_t at, i;
+	uint16_t lo;
+
+	at = s_find(b, id >> 16);
+	if (at < 0) return 0;
+	c  = &b->c[at];
+	lo = id & 0xffff;
+
+	if (c->dense) {
+		if (!(c->u.bits[lo >> 6] & (1ULL << (lo & 63)))) return 0;
+		c->u.bits[lo >> 6] &= ~(1ULL << (lo & 63));
+		/* if this fails, we just stay dense for a while */
+		if (--c->n == ARRAY_MAX) s_to_array(c);
+
+	} else {
+		i = s_search(c->u.array, c->n, lo);
+		if (i < 0) return 0;
+		memmove(&c->u.array[i], &c->u.array[i + 1], (c->n - i - 1) * sizeof(uint16_t));
+		c->n--;
+	}
+	b->card--;
+
+	if (c->n == 0) {
+		s_container_free(c);
+		memmove(&b->c[at], &b->c[at + 1], (b->n - at - 1) * sizeof(struct s_container));
+		b->n--;
+	}
+	return 1;
+}
+
+int
+bitmap_has(const struct bitmap *b, uint32_t id)
+{
+	const struct s_container *c;
+	int64_t at;
+	uint16_t lo;
+
+	at = s_find(b, id >> 16);
+	if (at < 0) return 0;
+	c  = &b->c[at];
+	lo = id & 0xffff;
+
+	if (c->dense) return !!(c->u.bits[lo >> 6] & (1ULL << (lo & 63)));
+	return s_search(c->u.array, c->n, lo) >= 0;
+}
+
+uint64_t
+bitmap_count(const struct bitmap *b)
+{
+	return b->card;
+}
+
+/* intersect container `c` with `o`, in place */
+static int
+s_and(struct s_container *c, const struct s_container *o)
+{
+	uint32_t i, j, n;
+	uint16_t *array;
+
+	if (!c->dense && !o->dense) {
+		for (i = j = n = 0; i < c->n && j < o->n; ) {
+			if      (c->u.array[i] < o->u.array[j]) i++;
+			else if (c->u.array[i] > o->u.array[j]) j++;
+			else { c->u.array[n++] = c->u.array[i]; i++; j++; }
+		}
+		c->n = n;
+
+	} else if (!c->dense) {
+		for (i = n = 0; i < c->n; i++)
+			if (o->u.bits[c->u.array[i] >> 6] & (1ULL << (c->u.array[i] & 63)))
+				c->u.array[n++] = c->u.array[i];
+		c->n = n;
+
+	} else if (!o->dense) {
+		array = malloc((o->n ? o->n : 1) * sizeof(uint16_t));
+		if (!array) return -1;
+		for (i = n = 0; i < o->n; i++)
+			if (c->u.bits[o->u.array[i] >> 6] & (1ULL << (o->u.array[i] & 63)))
+				array[n++] = o->u.array[i];
+		free(c->u.bits);
+		c->u.array = array;
+		c->dense   = 0;
+		c->max     = o->n ? o->n : 1;
+		c->n       = n;
+
+	} else {
+		for (i = n = 0; i < BITSET_WORDS; i++) {
+			c->u.bits[i] &= o->u.bits[i];
+			n += s_popcount(c->u.bits[i]);
+		}
+		c->n = n;
+		/* if this fails, we just stay dense for a while */
+		if (n > 0 && n <= ARRAY_MAX) s_to_array(c);
+	}
+	return 0;
+}
+
+int
+bitmap_and(struct bitmap *b, const struct bitmap *other)
+{
+	uint32_t i, j, n;
+	int rc;
+
+	rc = 0;
+	b->card = 0;
+	for (i = j = n = 0; i < b->n; i++) {
+		while (j < other->n && other->c[j].key < b->c[i].key) j++;
+		if (rc != 0 || j == other->n || other->c[j].key != b->c[i].key) {
+			s_container_free(&b->c[i]);
+			continue;
+		}
+		if (s_and(&b->c[i], &other->c[j]) != 0) {
+			/* leave `b` consistent, if incomplete */
+			s_container_free(&b->c[i]);
+			rc = -1;
+			continue;
+		}
+		if (b->c[i].n == 0) {
+			s_container_free(&b->c[i]);
+			continue;
+		}
+		b->card += b->c[i].n;
+		b->c[n++] = b->c[i];
+	}
+	b->n = n;
+	if (rc != 0) errno = ENOMEM;
+	return rc;
+}
+
+int
+bitmap_each(const struct bitmap *b, int (*fn)(uint32_t id, void *udata), void *udata)
+{
+	const struct s_container *c;
+	uint32_t i, j, hi;
+	uint64_t w;
+	int rc;
+
+	for (i = 0; i < b->n; i++) {
+		c  = &b->c[i];
+		hi = (uint32_t)c->key << 16;
+
+		if (c->dense) {
+			for (j = 0; j < BITSET_WORDS; j++)
+				for (w = c->u.bits[j]; w; w &= w - 1)
+					if ((rc = fn(hi | (j * 64 + __builtin_ctzll(w)), udata)) != 0)
+						return rc;
+		} else {
+			for (j = 0; j < c->n; j++)
+				if ((rc = fn(hi | c->u.array[j], udata)) != 0)
+					return rc;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef TSDP_BITMAP_H
+#define TSDP_BITMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* compressed sets of 32-bit ids, for internal use by the
+   various indexes.  Ids are bucketed by their high 16 bits
+   into containers (a la roaring bitmaps), each of which is
+   either a sorted array of the low 16 bits, while sparse,
+   or a plain 65536-bit bitset, once dense. */
+struct bitmap;
+
+struct bitmap *
+bitmap_new(void);
+
+void
+bitmap_free(struct bitmap *b);
+
+/* returns a new bitmap holding the same ids as `b` */
+struct bitmap *
+bitmap_copy(const struct bitmap *b);
+
+/* returns 0 on success, or -1 if we ran out of memory */
+int
+bitmap_add(struct bitmap *b, uint32_t id);
+
+/* returns 1 if `id` was removed, 0 if it wasn't there */
+int
+bitmap_remove(struct bitmap *b, uint32_t id);
+
+int
+bitmap_has(const struct bitmap *b, uint32_t id);
+
+uint64_t
+bitmap_count(const struct bitmap *b);
+
+/* intersects `b` with `other`, in place.
+   returns 0 on success, or -1 if we ran out of memory */
+int
+bitmap_and(struct bitmap *b, const struct bitmap *other);
+
+/* calls `fn` for each id, in ascending order, stopping early
+   (and returning what `fn` returned) if `fn` returns non-zero */
+int
+bitmap_each(const struct bitmap *b, int (*fn)(uint32_t id, void *udata), void *udata);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef TSDP_BYTES_H
+#define TSDP_BYTES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* helpers for reading and writing the fixed-width (network
+   byte-order) and variable-width integers of on-disk formats,
+   regardless of host alignment or byte order. */
+
+static inline void
+put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static inline void
+put64(unsigned char *p, uint64_t v)
+{
+	put32(p, v >> 32);
+	put32(p + 4, (uint32_t)v);
+}
+
+static inline uint32_t
+get32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+	     | ((uint32_t)p[2] <<  8) |  (uint32_t)p[3];
+}
+
+static inline uint64_t
+get64(const unsigned char *p)
+{
+	return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+/* unsigned LEB128; at most 10 octets for a 64-bit value */
+#define VARINT_MAX 10
+
+static inline size_t
+putvar(unsigned char *p, uint64_t v)
+{
+	size_t n = 0;
+	while (v >= 0x80) {
+		p[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (unsigned char)v;
+	return n;
+}
+
+/* decodes a varint from `*p`, advancing it; returns 0 on
+   success, or -1 if the varint runs past `end` */
+static inline int
+getvar(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+	unsigned int shift = 0;
+
+	*v = 0;
+	while (*p < end && shift < 64) {
+		*v |= (uint64_t)(**p & 0x7f) << shift;
+		if (!(*(*p)++ & 0x80)) return 0;
+		shift += 7;
+	}
+	return -1;
+}
+
+#endif
@@ -0,0 +1,377 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "hash.h"
+#include "strmap.h"
+
+#define CARD_DEFAULT_PRECISION 12
+#define CARD_MIN_PRECISION      4
+#define CARD_MAX_PRECISION     16
+
+#define CARD_METRIC "tsdp.cardinality"
+
+/* a HyperLogLog sketch of 2^p registers, each holding the
+   longest run of leading zeroes (plus one) seen amongst the
+   hashes that were routed to it.  `sum` and `zeros` track
+   the harmonic sum of the registers, and how many are still
+   zero, as the registers change, so that estimates don't
+   have to visit every register. */
+struct s_hll {
+	double   sum;    /* sum of 2^-reg[i]        */
+	uint32_t zeros;  /* registers still at zero */
+	uint8_t  reg[];
+};
+
+struct tsdp_card {
+	int            p;         /* precision: log2(registers) */
+	uint32_t       m;         /* registers per sketch       */
+	double         alpha;     /* bias correction for m      */
+	struct strmap *sketches;  /* metric[\0key] -> sketch    */
+};
+
+static void
+s_add(struct tsdp_card *c, struct s_hll *h, uint64_t hash)
+{
+	uint32_t i;
+	uint8_t rho;
+	uint64_t w;
+
+	i = hash >> (64 - c->p);
+	w = hash << c->p;
+	rho = w ? __builtin_clzll(w) + 1 : 64 - c->p + 1;
+	if (rho > 64 - c->p + 1) rho = 64 - c->p + 1;
+
+	if (rho <= h->reg[i]) return;
+	if (h->reg[i] == 0) h->zeros--;
+	h->sum += 1.0 / (1ULL << rho) - 1.0 / (1ULL << h->reg[i]);
+	h->reg[i] = rho;
+}
+
+static uint64_t
+s_estimate(struct tsdp_card *c, struct s_hll *h)
+{
+	double e;
+
+	e = c->alpha * c->m * c->m / h->sum;
+	if (e <= 2.5 * c->m && h->zeros > 0)
+		e = c->m * log((double)c->m / h->zeros); /* linear counting */
+	return (uint64_t)(e + 0.5);
+}
+
+/* find (or create) the sketch stored under `k` */
+static struct s_hll *
+s_sketch(struct tsdp_card *c, const char *k, size_t len)
+{
+	struct s_hll **slot;
+
+	slot = (struct s_hll **)strmap_slot(c->sketches, k, len);
+	if (!slot) return NULL;
+	if (!*slot) {
+		*slot = calloc(1, sizeof(struct s_hll) + c->m);
+		if (!*slot) {
+			strmap_del(c->sketches, k, len);
+			return NULL;
+		}
+		(*slot)->sum   = c->m;
+		(*slot)->zeros = c->m;
+	}
+	return *slot;
+}
+
+/* build the sketch key for `metric` (and `key`, if not NULL) */
+static size_t
+s_key(char *buf, const char *metric, const char *key)
+{
+	size_t lm, lk;
+
+	lm = strlen(metric);
+	if (lm > QNAME_MAX_LEN) return 0;
+	memcpy(buf, metric, lm);
+	if (!key) return lm;
+
+	lk = strlen(key);
+	if (lm + 1 + lk > 2 * QNAME_MAX_LEN) return 0;
+	buf[lm] = '\0';
+	memcpy(buf + lm + 1, key, lk);
+	return lm + 1 + lk;
+}
+
+
+/**
+  Allocates a new cardinality tracker, which estimates how
+  many distinct series (qualified names) have been seen for
+  each metric name, and how many distinct values have been
+  seen for each tag key of each metric.
+
+  Each estimate comes from a HyperLogLog sketch of 2^precision
+  one-octet registers, so that memory use is fixed per metric
+  (and per key), no matter how many series there are.  The
+  standard error of each estimate is 1.04 / sqrt(2^precision);
+  a precision of 0 picks the default of 12 (4096 registers,
+  for an error of about 1.6%).  Precisions must be between
+  4 and 16.
+
+  Cardinality trackers are not thread-safe; callers must
+  serialize access to them.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_card *
+tsdp_card_new(int precision)
+{
+	struct tsdp_card *c;
+
+	if (precision == 0) precision = CARD_DEFAULT_PRECISION;
+	errno = EINVAL;
+	if (precision < CARD_MIN_PRECISION || precision > CARD_MAX_PRECISION) return NULL;
+
+	c = calloc(1, sizeof(struct tsdp_card));
+	if (!c) return NULL;
+
+	c->p = precision;
+	c->m = 1 << precision;
+	switch (c->m) {
+	case 16: c->alpha = 0.673; break;
+	case 32: c->alpha = 0.697; break;
+	case 64: c->alpha = 0.709; break;
+	default: c->alpha = 0.7213 / (1.0 + 1.079 / c->m);
+	}
+
+	c->sketches = strmap_new();
+	if (!c->sketches) {
+		free(c);
+		return NULL;
+	}
+	return c;
+}
+
+
+/**
+  Frees a cardinality tracker.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_card_free(struct tsdp_card *c)
+{
+	if (!c) return;
+	strmap_free(c->sketches, free);
+	free(c);
+}
+
+
+/**
+  Records an observation of the series `q`, against the
+  sketch for its metric name, and the sketches for each of
+  its tag keys (which see the tag values).
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_card_observe(struct tsdp_card *c, struct qname *q)
+{
+	char buf[2 * QNAME_MAX_LEN + 1];
+	struct s_hll *h;
+	size_t len;
+	int i;
+
+	errno = EINVAL;
+	if (!c || !q || !q->metric) return -1;
+
+	len = qname_string_into(q, buf, sizeof(buf));
+	if (len >= sizeof(buf)) return -1;
+
+	errno = ENOMEM;
+	h = s_sketch(c, q->metric, strlen(q->metric));
+	if (!h) return -1;
+	s_add(c, h, hashmix64(hash64(buf, len)));
+
+	for (i = 0; i < q->i; i++) {
+		if (i > 0 && strcmp(q->pairs[i].key, q->pairs[i-1].key) == 0) continue;
+
+		errno = EINVAL;
+		len = s_key(buf, q->metric, q->pairs[i].key);
+		if (!len) return -1;
+
+		errno = ENOMEM;
+		h = s_sketch(c, buf, len);
+		if (!h) return -1;
+
+		/* valueless keys count as a single (empty) value */
+		if (q->pairs[i].value) s_add(c, h, hashmix64(hash64(q->pairs[i].value, strlen(q->pairs[i].value))));
+		else                   s_add(c, h, hashmix64(hash64("", 0)));
+	}
+	return 0;
+}
+
+
+/**
+  Records an observation of the series named by the decoded
+  SUBMIT message `m`, as for `tsdp_card_observe()`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_card_observe_msg(struct tsdp_card *c, struct tsdp_msg *m)
+{
+	struct qname q;
+	char scratch[QNAME_MAX_LEN + 1];
+	int rc;
+
+	errno = EINVAL;
+	if (!c || !m || m->opcode != TSDP_OPCODE_SUBMIT) return -1;
+	if (m->nframes < 1 || m->frames->type != TSDP_FRAME_STRING) return -1;
+
+	/* STRING frames carry their NUL terminator */
+	if (qname_parse_into(&q, scratch, sizeof(scratch), m->frames->payload.string,
+	                     strnlen(m->frames->payload.string, m->frames->length)) != 0)
+		return -1;
+
+	rc = tsdp_card_observe(c, &q);
+	qname_clear(&q);
+	return rc;
+}
+
+
+/**
+  Estimates the number of distinct series seen for `metric`
+  or, if `key` is not NULL, the number of distinct values seen
+  for `key` amongst the series of `metric`.  This does not
+  visit the registers of the sketch, and is cheap enough to
+  call after every observation (to cap runaway metrics, say).
+
+  Returns 0 if nothing has been seen for `metric` (or `key`).
+ **/
+uint64_t
+tsdp_card_estimate(struct tsdp_card *c, const char *metric, const char *key)
+{
+	char buf[2 * QNAME_MAX_LEN + 1];
+	struct s_hll *h;
+	size_t len;
+
+	if (!c || !metric) return 0;
+	len = s_key(buf, metric, key);
+	if (!len || !(h = strmap_get(c->sketches, buf, len))) return 0;
+	return s_estimate(c, h);
+}
+
+struct s_each {
+	struct tsdp_card *c;
+	int (*fn)(const char *, const char *, uint64_t, void *);
+	void *udata;
+};
+
+static int
+s_each(const void *k, size_t len, void *value, void *udata)
+{
+	struct s_each *e = (struct s_each *)udata;
+	char buf[2 * QNAME_MAX_LEN + 2];
+	size_t lm;
+
+	memcpy(buf, k, len);
+	buf[len] = '\0';
+	lm = strlen(buf);
+	return e->fn(buf, lm < len ? buf + lm + 1 : NULL, s_estimate(e->c, value), e->udata);
+}
+
+
+/**
+  Calls `fn` for each metric name, and each tag key of each
+  metric (with `key` set to NULL for the metrics themselves),
+  with its current estimate, in no particular order.  If `fn`
+  returns non-zero, iteration stops, and that value is
+  returned.
+ **/
+int
+tsdp_card_each(struct tsdp_card *c,
+               int (*fn)(const char *metric, const char *key, uint64_t estimate, void *udata),
+               void *udata)
+{
+	struct s_each e = { c, fn, udata };
+
+	errno = EINVAL;
+	if (!c || !fn) return -1;
+	return strmap_each(c->sketches, s_each, &e);
+}
+
+/* build the qualified name for reporting on `metric` (and `key`) */
+static int
+s_report_name(char *buf, size_t len, const char *metric, const char *key)
+{
+	int n;
+
+	if (key) n = snprintf(buf, len, CARD_METRIC " key=%s,metric=%s", key, metric);
+	else     n = snprintf(buf, len, CARD_METRIC " metric=%s", metric);
+	return n < 0 || (size_t)n >= len ? -1 : n + 1;
+}
+
+
+/**
+  Builds a SUBMIT SAMPLE message reporting the current
+  estimate for `metric` (and `key`, if not NULL), measured
+  at `ts`.  The sample is named `tsdp.cardinality metric=...`
+  (with `key=...` added for per-key estimates).
+
+  Returns NULL on failure, and sets `errno`.  The caller
+  must free the message with `tsdp_msg_free()`.
+ **/
+struct tsdp_msg *
+tsdp_card_sample(struct tsdp_card *c, const char *metric, const char *key, uint64_t ts)
+{
+	struct tsdp_msg *m;
+	char name[QNAME_MAX_LEN + 1];
+	double v;
+	int len;
+
+	errno = EINVAL;
+	if (!c || !metric) return NULL;
+	if ((len = s_report_name(name, sizeof(name), metric, key)) < 0) return NULL;
+	v = (double)tsdp_card_estimate(c, metric, key);
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_SAMPLE);
+	if (!m) return NULL;
+	if (tsdp_msg_extend(m, TSDP_FRAME_STRING, name, len) != 0
+	 || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, sizeof(ts)) != 0
+	 || tsdp_msg_extend(m, TSDP_FRAME_FLOAT,  &v,  sizeof(v))  != 0) {
+		tsdp_msg_free(m);
+		return NULL;
+	}
+	return m;
+}
+
+
+/**
+  Builds a SUBMIT FACT message reporting the current estimate
+  for `metric` (and `key`, if not NULL), in decimal, named as
+  for `tsdp_card_sample()`.
+
+  Returns NULL on failure, and sets `errno`.  The caller
+  must free the message with `tsdp_msg_free()`.
+ **/
+struct tsdp_msg *
+tsdp_card_fact(struct tsdp_card *c, const char *metric, const char *key)
+{
+	struct tsdp_msg *m;
+	char name[QNAME_MAX_LEN + 1], value[32];
+	int len;
+
+	errno = EINVAL;
+	if (!c || !metric) return NULL;
+	if ((len = s_report_name(name, sizeof(name), metric, key)) < 0) return NULL;
+	snprintf(value, sizeof(value), "%llu", (unsigned long long)tsdp_card_estimate(c, metric, key));
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_FACT);
+	if (!m) return NULL;
+	if (tsdp_msg_extend(m, TSDP_FRAME_STRING, name,  len) != 0
+	 || tsdp_msg_extend(m, TSDP_FRAME_STRING, value, strlen(value) + 1) != 0) {
+		tsdp_msg_free(m);
+		return NULL;
+	}
+	return m;
+}
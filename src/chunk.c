@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "chunk.h"
+
+/* the most a single point can cost: a 4-bit timestamp prefix and
+   a raw 64-bit delta-of-delta, plus a 2-bit value prefix, 12 bits
+   of leading zero / length, and a raw 64-bit XOR. */
+#define MAX_POINT_BITS (4 + 64 + 2 + 12 + 64)
+
+#define NO_WINDOW 0xff
+
+/* delta-of-delta buckets: a prefix, and a signed payload width */
+static const struct {
+	int prefix, plen, width;
+} DOD[] = {
+	{ 0x2, 2,  7 },  /* 10   [-64, 63]     */
+	{ 0x6, 3,  9 },  /* 110  [-256, 255]   */
+	{ 0xe, 4, 12 },  /* 1110 [-2048, 2047] */
+};
+
+static void
+s_put(uint8_t *data, uint32_t *pos, uint64_t v, int nbits)
+{
+	int off, take;
+
+	while (nbits > 0) {
+		off  = *pos & 7;
+		take = 8 - off < nbits ? 8 - off : nbits;
+		data[*pos >> 3] |= (uint8_t)(((v >> (nbits - take)) & ((1u << take) - 1)) << (8 - off - take));
+		*pos  += take;
+		nbits -= take;
+	}
+}
+
+static uint64_t
+s_get(struct chunk_cursor *cur, int nbits)
+{
+	uint64_t v = 0;
+	int off, take;
+
+	if (cur->pos + nbits > cur->limit) {
+		cur->bad = 1;
+		return 0;
+	}
+	while (nbits > 0) {
+		off  = cur->pos & 7;
+		take = 8 - off < nbits ? 8 - off : nbits;
+		v = (v << take) | ((cur->data[cur->pos >> 3] >> (8 - off - take)) & ((1u << take) - 1));
+		cur->pos += take;
+		nbits    -= take;
+	}
+	return v;
+}
+
+static int
+s_clz(uint64_t x)
+{
+	int n = 0;
+	for (; !(x & (UINT64_C(1) << 63)); x <<= 1) n++;
+	return n;
+}
+
+static int
+s_ctz(uint64_t x)
+{
+	int n = 0;
+	for (; !(x & 1); x >>= 1) n++;
+	return n;
+}
+
+static void
+s_put_dod(struct chunk *c, int64_t dod)
+{
+	size_t i;
+
+	if (dod == 0) {
+		s_put(c->data, &c->bits, 0, 1);
+		return;
+	}
+	for (i = 0; i < sizeof(DOD) / sizeof(DOD[0]); i++) {
+		if (dod >= -(INT64_C(1) << (DOD[i].width - 1)) && dod < (INT64_C(1) << (DOD[i].width - 1))) {
+			s_put(c->data, &c->bits, DOD[i].prefix, DOD[i].plen);
+			s_put(c->data, &c->bits, (uint64_t)dod, DOD[i].width);
+			return;
+		}
+	}
+	s_put(c->data, &c->bits, 0xf, 4);
+	s_put(c->data, &c->bits, (uint64_t)dod, 64);
+}
+
+static int64_t
+s_get_dod(struct chunk_cursor *cur)
+{
+	uint64_t u;
+	int i, w;
+
+	for (i = 0; i < 4 && s_get(cur, 1); i++)
+		;
+	if (i == 0) return 0;
+	if (i == 4) return (int64_t)s_get(cur, 64);
+
+	w = DOD[i - 1].width;
+	u = s_get(cur, w);
+	if (u & (UINT64_C(1) << (w - 1))) u |= ~UINT64_C(0) << w; /* sign-extend */
+	return (int64_t)u;
+}
+
+static void
+s_put_value(struct chunk *c, struct chunk_encoder *e, uint64_t v)
+{
+	uint64_t x = v ^ e->value;
+	int lead, trail;
+
+	e->value = v;
+	if (x == 0) {
+		s_put(c->data, &c->bits, 0, 1);
+		return;
+	}
+
+	lead  = s_clz(x);
+	trail = s_ctz(x);
+	if (e->lead != NO_WINDOW && lead >= e->lead && trail >= e->trail) {
+		/* the meaningful bits fit in the last window */
+		s_put(c->data, &c->bits, 0x2, 2);
+		s_put(c->data, &c->bits, x >> e->trail, 64 - e->lead - e->trail);
+		return;
+	}
+
+	e->lead  = lead;
+	e->trail = trail;
+	s_put(c->data, &c->bits, 0x3, 2);
+	s_put(c->data, &c->bits, lead, 6);
+	s_put(c->data, &c->bits, 64 - lead - trail - 1, 6);
+	s_put(c->data, &c->bits, x >> trail, 64 - lead - trail);
+}
+
+static uint64_t
+s_get_value(struct chunk_cursor *cur)
+{
+	int lead, sig;
+
+	if (!s_get(cur, 1)) return cur->value;
+	if (s_get(cur, 1)) {
+		lead = s_get(cur, 6);
+		sig  = s_get(cur, 6) + 1;
+		if (lead + sig > 64) {
+			cur->bad = 1;
+			return 0;
+		}
+		cur->lead  = lead;
+		cur->trail = 64 - lead - sig;
+	}
+	sig = 64 - cur->lead - cur->trail;
+	return cur->value ^ (s_get(cur, sig) << cur->trail);
+}
+
+
+int
+chunk_append(struct chunk *c, struct chunk_encoder *e, uint64_t ts, uint64_t v)
+{
+	int64_t delta;
+
+	if (c->bits + MAX_POINT_BITS > CHUNK_OCTETS * 8) return -1;
+
+	if (c->n == 0) {
+		/* the first point goes in the clear */
+		c->first = c->last = ts;
+		e->delta = 0;
+		e->value = v;
+		e->lead  = NO_WINDOW;
+		s_put(c->data, &c->bits, ts, 64);
+		s_put(c->data, &c->bits, v,  64);
+
+	} else {
+		delta = (int64_t)(ts - c->last);
+		s_put_dod(c, (int64_t)((uint64_t)delta - (uint64_t)e->delta));
+		s_put_value(c, e, v);
+		e->delta = delta;
+		c->last  = ts;
+	}
+	c->n++;
+	return 0;
+}
+
+void
+chunk_cursor_init(struct chunk_cursor *cur, const uint8_t *data, uint32_t n, uint32_t bits)
+{
+	memset(cur, 0, sizeof(*cur));
+	cur->data  = data;
+	cur->n     = n;
+	cur->limit = bits;
+}
+
+int
+chunk_cursor_next(struct chunk_cursor *cur, uint64_t *ts, uint64_t *v)
+{
+	if (cur->i == cur->n || cur->bad) return 0;
+
+	if (cur->i == 0) {
+		cur->ts    = s_get(cur, 64);
+		cur->value = s_get(cur, 64);
+	} else {
+		cur->delta  = (int64_t)((uint64_t)cur->delta + (uint64_t)s_get_dod(cur));
+		cur->ts    += (uint64_t)cur->delta;
+		cur->value  = s_get_value(cur);
+	}
+	if (cur->bad) return 0;
+
+	cur->i++;
+	*ts = cur->ts;
+	*v  = cur->value;
+	return 1;
+}
@@ -0,0 +1,83 @@
+#ifndef TSDP_CHUNK_H
+#define TSDP_CHUNK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* compressed runs of (timestamp, value) points, for internal
+   use by the series store and its segment files.  Timestamps
+   are encoded as the difference between successive deltas,
+   and values as the XOR with the previous value (a la
+   Facebook's Gorilla).  The first point of every chunk is
+   stored in full, so that chunks decode independently. */
+
+#define CHUNK_OCTETS 1024
+
+struct chunk {
+	struct chunk *next;
+	uint64_t first, last;  /* timestamps of first / last point */
+	uint32_t n;            /* points in the chunk              */
+	uint32_t bits;         /* bits of data[] in use            */
+	uint8_t  data[CHUNK_OCTETS];
+};
+
+/* where the encoder left off, in the last chunk of a series */
+struct chunk_encoder {
+	int64_t  delta;
+	uint64_t value;
+	uint8_t  lead, trail;
+};
+
+/* where the decoder is, in a block of `limit` bits */
+struct chunk_cursor {
+	const uint8_t *data;
+	uint32_t n, i;
+	uint32_t pos, limit;
+	int      bad;
+
+	uint64_t ts;
+	int64_t  delta;
+	uint64_t value;
+	uint8_t  lead, trail;
+};
+
+/* appends a point (`v` being the bits of a FLOAT/64) to `c`.
+   returns 0 on success, or -1 if `c` has no room left for it */
+int
+chunk_append(struct chunk *c, struct chunk_encoder *e, uint64_t ts, uint64_t v);
+
+void
+chunk_cursor_init(struct chunk_cursor *cur, const uint8_t *data, uint32_t n, uint32_t bits);
+
+/* decodes the next point into `ts` and `v`; returns 1 if there
+   was one, or 0 at the end of the block (or if it is corrupt) */
+int
+chunk_cursor_next(struct chunk_cursor *cur, uint64_t *ts, uint64_t *v);
+
+/* store iterators read from chunks in memory, and from blocks in
+   segment files alike; `advance` loads the next block of the
+   series into `cur`, `first` and `last`, returning 0 when there
+   are no more. */
+struct tsdp_store_iter {
+	int (*advance)(struct tsdp_store_iter *it);
+	struct chunk_cursor cur;
+	uint64_t first, last;
+	uint64_t from, until;
+	uint64_t width;              /* of rollup buckets, or 0    */
+	int      loaded, done;
+
+	struct chunk        *chunk;  /* next chunk, in memory      */
+	const unsigned char *block;  /* next index entry, on disk  */
+	size_t               left;   /* index entries left         */
+	const unsigned char *base;   /* the mapped segment file    */
+	size_t               size;
+};
+
+/* calls `fn` for each series in the store (in no particular
+   order), stopping early (and returning what `fn` returned)
+   if `fn` returns non-zero. */
+struct tsdp_store;
+int
+store_each(struct tsdp_store *s, int (*fn)(const char *name, size_t len, struct chunk *head, uint64_t points, void *udata), void *udata);
+
+#endif
@@ -0,0 +1,284 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "debug.h"
+#include "segment.h"
+
+/* where each input segment is, in the series being merged */
+struct s_input {
+	struct tsdp_store_iter *it;
+	struct tsdp_bucket      b;
+	int                     live;
+};
+
+struct tsdp_compactor {
+	pthread_t             tid;
+	struct tsdp_segment **segs;
+	size_t                n;
+	uint64_t              width, rate;
+	char                 *path, *tmp;
+
+	int                   rc, error;
+};
+
+static int
+s_emit(struct tsdp_store *out, const char *name, size_t len, uint64_t width, const struct tsdp_bucket *b)
+{
+	if (!width) return tsdp_store_append(out, name, len, b->ts, b->sum);
+	return tsdp_store_append(out, name, len, b->ts, b->min)
+	    || tsdp_store_append(out, name, len, b->ts, b->max)
+	    || tsdp_store_append(out, name, len, b->ts, b->sum)
+	    || tsdp_store_append(out, name, len, b->ts, (double)b->count);
+}
+
+/* merges the history of `name` out of those inputs that have it
+   (those with a non-NULL iterator), in time order, rolling it up
+   into `width`-wide buckets along the way, if `width` is non-zero */
+static int
+s_merge(struct s_input *in, size_t n, const char *name, size_t len, uint64_t width, struct tsdp_store *out)
+{
+	struct tsdp_bucket acc, b;
+	size_t i, min;
+	int have = 0;
+
+	for (i = 0; i < n; i++)
+		in[i].live = in[i].it && tsdp_store_bucket(in[i].it, &in[i].b);
+
+	for (;;) {
+		for (min = n, i = 0; i < n; i++)
+			if (in[i].live && (min == n || in[i].b.ts < in[min].b.ts)) min = i;
+		if (min == n) break;
+
+		b = in[min].b;
+		in[min].live = tsdp_store_bucket(in[min].it, &in[min].b);
+		if (!width) {
+			if (s_emit(out, name, len, 0, &b) != 0) return -1;
+			continue;
+		}
+
+		b.ts -= b.ts % width;
+		if (have && acc.ts == b.ts) {
+			if (b.min < acc.min) acc.min = b.min;
+			if (b.max > acc.max) acc.max = b.max;
+			acc.sum   += b.sum;
+			acc.count += b.count;
+			continue;
+		}
+		if (have && s_emit(out, name, len, width, &acc) != 0) return -1;
+		acc  = b;
+		have = 1;
+	}
+	if (have && s_emit(out, name, len, width, &acc) != 0) return -1;
+	return 0;
+}
+
+static void *
+s_compactor(void *udata)
+{
+	struct tsdp_compactor *c = (struct tsdp_compactor *)udata;
+	int fd;
+
+#ifdef __linux__
+	/* stay out of the way of ingest; on Linux, this only
+	   lowers the priority of the calling thread. */
+	setpriority(PRIO_PROCESS, 0, 19);
+#endif
+
+	c->rc = -1;
+	fd = open(c->tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		c->error = errno;
+		return NULL;
+	}
+	if (tsdp_segment_compact(c->segs, c->n, c->width, c->rate, fd) != 0 || fsync(fd) != 0) {
+		c->error = errno;
+		close(fd);
+		unlink(c->tmp);
+		return NULL;
+	}
+	if (close(fd) != 0 || rename(c->tmp, c->path) != 0) {
+		c->error = errno;
+		unlink(c->tmp);
+		return NULL;
+	}
+	c->rc = 0;
+	return NULL;
+}
+
+
+/**
+  Merges the `n` segments in `segs` into a single segment, and
+  writes it to the file descriptor `fd`, at no more than `rate`
+  octets per second (or as fast as it can, if `rate` is 0).
+
+  If `width` is non-zero, the merged history is rolled up into
+  buckets `width` wide, each keeping the minimum, maximum, sum
+  and count of the values that fell into it (see
+  `tsdp_store_bucket()`).  Widths are in the same units as the
+  timestamps: seconds, for points from SUBMIT messages, so a
+  width of 60 makes a 1m tier.  Inputs may themselves be rollups,
+  so long as their buckets evenly divide `width`; a 1h tier can
+  be made from 1m tiers, say, but not the other way around.
+
+  The inputs are expected to hold disjoint stretches of history
+  (successive segments off of the same ingest, say); points that
+  appear in more than one input are merged as often as they do.
+  The merged segment is built in memory before it is written.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Inputs that cannot be rolled up to `width` fail with EINVAL.
+ **/
+int
+tsdp_segment_compact(struct tsdp_segment **segs, size_t n, uint64_t width, uint64_t rate, int fd)
+{
+	struct tsdp_store *out;
+	struct s_input *in;
+	uint64_t *pos, w;
+	const char *name, *have;
+	size_t i;
+	int rc;
+
+	errno = EINVAL;
+	if (!segs || n == 0 || fd < 0) return -1;
+	for (i = 0; i < n; i++) {
+		if (!segs[i]) return -1;
+		w = tsdp_segment_width(segs[i]);
+		if (w && (!width || width % w != 0)) return -1;
+	}
+
+	errno = ENOMEM;
+	out = tsdp_store_new();
+	in  = calloc(n, sizeof(struct s_input));
+	pos = calloc(n, sizeof(uint64_t));
+	if (!out || !in || !pos) {
+		tsdp_store_free(out);
+		free(in);
+		free(pos);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* walk the (sorted) catalogs of all the inputs in step,
+	   merging each series from every input that has it */
+	for (rc = 0; rc == 0; ) {
+		for (name = NULL, i = 0; i < n; i++) {
+			have = tsdp_segment_series(segs[i], pos[i]);
+			if (have && (!name || strcmp(have, name) < 0)) name = have;
+		}
+		if (!name) break;
+
+		for (i = 0; rc == 0 && i < n; i++) {
+			have = tsdp_segment_series(segs[i], pos[i]);
+			if (!have || strcmp(have, name) != 0) continue;
+			in[i].it = tsdp_segment_iter(segs[i], name, strlen(name), 0, UINT64_MAX);
+			if (!in[i].it) rc = -1;
+			pos[i]++;
+		}
+
+		rc = rc || s_merge(in, n, name, strlen(name), width, out);
+		for (i = 0; i < n; i++) {
+			tsdp_store_iter_free(in[i].it);
+			in[i].it = NULL;
+		}
+	}
+
+	rc = rc || segment_write(out, fd, width, rate);
+	tsdp_store_free(out);
+	free(in);
+	free(pos);
+	return rc ? -1 : 0;
+}
+
+
+/**
+  Starts compacting the `n` segments in `segs` (as for
+  `tsdp_segment_compact()`) into a new segment file at `path`,
+  on a background thread of its own.  The thread runs at the
+  lowest priority it can, and writes at no more than `rate`
+  octets per second, so as not to compete with ingest.
+
+  The merged segment is written to a temporary file alongside
+  `path`, synced, and only then renamed into place, so readers
+  will never see it half-written.
+
+  The input segments must not be freed until the compaction
+  has been waited on, via `tsdp_compactor_wait()`.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_compactor *
+tsdp_compactor_start(struct tsdp_segment **segs, size_t n, uint64_t width, uint64_t rate, const char *path)
+{
+	struct tsdp_compactor *c;
+	size_t len;
+	int rc;
+
+	errno = EINVAL;
+	if (!segs || n == 0 || !path) return NULL;
+
+	errno = ENOMEM;
+	c = calloc(1, sizeof(struct tsdp_compactor));
+	if (!c) return NULL;
+
+	len     = strlen(path);
+	c->segs = calloc(n, sizeof(struct tsdp_segment *));
+	c->path = strdup(path);
+	c->tmp  = malloc(len + 5);
+	if (!c->segs || !c->path || !c->tmp) goto fail;
+	memcpy(c->segs, segs, n * sizeof(struct tsdp_segment *));
+	snprintf(c->tmp, len + 5, "%s.tmp", path);
+	c->n     = n;
+	c->width = width;
+	c->rate  = rate;
+
+	rc = pthread_create(&c->tid, NULL, s_compactor, c);
+	if (rc != 0) {
+		errno = rc;
+		goto fail;
+	}
+	return c;
+
+fail:
+	rc = errno;
+	free(c->segs);
+	free(c->path);
+	free(c->tmp);
+	free(c);
+	errno = rc;
+	return NULL;
+}
+
+
+/**
+  Waits for a background compaction (see `tsdp_compactor_start()`)
+  to finish, and frees it.
+
+  Returns 0 if the compacted segment was written, or -1 if it
+  was not, and sets `errno` to why.
+ **/
+int
+tsdp_compactor_wait(struct tsdp_compactor *c)
+{
+	int rc;
+
+	errno = EINVAL;
+	if (!c) return -1;
+
+	pthread_join(c->tid, NULL);
+	rc = c->rc;
+	if (rc != 0) errno = c->error;
+
+	free(c->segs);
+	free(c->path);
+	free(c->tmp);
+	free(c);
+	return rc;
+}
@@ -0,0 +1,22 @@
+#ifndef TSDP_COUNTER_H
+#define TSDP_COUNTER_H
+
+/* how much has a counter gone up by, going from `was` to `now`?
+   A decrease is either a wraparound (the counter was near the
+   top of the 32- or 64-bit range, and is now near the bottom),
+   or else a reset (the counter went back to zero, and counted
+   up to `now` since). */
+static inline double
+counter_increase(double was, double now)
+{
+	const double wrap32 = 4294967296.0, wrap64 = 18446744073709551616.0;
+
+	if (now >= was) return now - was;
+	if (was < wrap32 && was >= wrap32 * 0.75 && now < wrap32 * 0.25)
+		return (wrap32 - was) + now;
+	if (was >= wrap64 * 0.75 && now < wrap64 * 0.25)
+		return (wrap64 - was) + now;
+	return now;
+}
+
+#endif
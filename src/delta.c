@@ -0,0 +1,279 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "slots.h"
+#include "submit.h"
+#include "counter.h"
+
+#define DELTA_MIN_SLOTS        1024
+#define DELTA_DEFAULT_CAPACITY 4096
+
+#define S_UPDATED  0x1   /* updated during the current window */
+
+/* every update is a random access into a table with (maybe)
+   millions of series in it, so each one costs one 40-octet
+   slot, stored inline: no pointers to chase, and no more than
+   a cache line to touch.  Names are only needed at flush time,
+   so they live off to the side, in a single string pool. */
+struct s_slot {
+	uint64_t hash;      /* 0 if empty                       */
+	uint64_t ts;        /* timestamp of the last value      */
+	double   last;      /* last value seen                  */
+	double   increase;  /* so far, in the current window    */
+	uint32_t name;      /* offset into the pool             */
+	uint32_t flags;     /* S_*                              */
+};
+
+struct tsdp_delta {
+	uint32_t     window;  /* width, in seconds */
+	struct slots t;
+};
+
+
+/**
+  Allocates a new DELTA rate engine, which turns the successive
+  values of monotonic counters (from SUBMIT DELTA messages) into
+  per-second rates, averaged over windows `window` seconds wide,
+  for broadcast (see `tsdp_delta_flush()`).
+
+  The table starts out with room for `capacity` series (0 picks
+  a default of 4096), and grows as needed.
+
+  DELTA engines are not thread-safe; callers must serialize
+  access to them.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_delta *
+tsdp_delta_new(unsigned int window, size_t capacity)
+{
+	struct tsdp_delta *d;
+
+	errno = EINVAL;
+	if (window == 0) return NULL;
+	if (capacity == 0) capacity = DELTA_DEFAULT_CAPACITY;
+
+	errno = ENOMEM;
+	d = calloc(1, sizeof(struct tsdp_delta));
+	if (!d) return NULL;
+
+	d->window = window;
+	if (slots_init(&d->t, sizeof(struct s_slot), offsetof(struct s_slot, name), DELTA_MIN_SLOTS, capacity) != 0) {
+		free(d);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return d;
+}
+
+
+/**
+  Frees a DELTA rate engine.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_delta_free(struct tsdp_delta *d)
+{
+	if (!d) return;
+	slots_free(&d->t);
+	free(d);
+}
+
+
+/**
+  Returns how many series the engine is tracking.
+ **/
+size_t
+tsdp_delta_count(struct tsdp_delta *d)
+{
+	return d ? d->t.n : 0;
+}
+
+
+/**
+  Records that the counter named by the first `len` octets of
+  `name` had the value `value` at time `ts`, and adds how far
+  it has gone up since its last value to the increase for the
+  current window.  Names are compared as given, so callers
+  should canonicalize them first (`tsdp_delta_submit()` does
+  this for SUBMIT DELTA messages).
+
+  The first value seen for a series only sets its baseline.
+  A decrease counts as a wraparound if the counter was in the
+  top quarter of the 32-bit (or 64-bit) range, and is now in
+  the bottom quarter; otherwise, it counts as a reset to zero,
+  followed by an increase to `value`.  Values older than the
+  last one seen are ignored.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_delta_update(struct tsdp_delta *d, const char *name, size_t len, uint64_t ts, double value)
+{
+	struct s_slot *slot;
+	uint64_t h;
+
+	errno = EINVAL;
+	if (!d || !name || len == 0 || len > QNAME_MAX_LEN || value != value) return -1;
+
+	h = slots_hash(name, len);
+	slot = slots_find(&d->t, h, name, len);
+	if (!slot->hash) {
+		slot = slots_insert(&d->t, h, name, len);
+		if (!slot) return -1;
+		slot->ts   = ts;
+		slot->last = value;
+		return 0;
+	}
+
+	if (ts < slot->ts) return 0; /* stale */
+	slot->increase += counter_increase(slot->last, value);
+	slot->last   = value;
+	slot->ts     = ts;
+	slot->flags |= S_UPDATED;
+	return 0;
+}
+
+
+/**
+  Records the value carried by the SUBMIT DELTA message `m`,
+  as for `tsdp_delta_update()`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Anything other than a well-formed SUBMIT DELTA fails with
+  EINVAL.
+ **/
+int
+tsdp_delta_submit(struct tsdp_delta *d, struct tsdp_msg *m)
+{
+	char buf[QNAME_MAX_LEN + 1];
+	size_t len;
+
+	errno = EINVAL;
+	if (!d || !m || m->opcode != TSDP_OPCODE_SUBMIT || m->payload != TSDP_PAYLOAD_DELTA) return -1;
+	if (m->nframes != 3
+	 || m->frames->type             != TSDP_FRAME_STRING
+	 || m->frames->next->type       != TSDP_FRAME_TSTAMP
+	 || m->frames->next->next->type != TSDP_FRAME_FLOAT || m->frames->next->next->length != 8)
+		return -1;
+
+	if (submit_name(m->frames, buf, &len) != 0) return -1;
+	return tsdp_delta_update(d, buf, len, m->frames->next->payload.tstamp, m->last->payload.float64);
+}
+
+
+/**
+  Copies the increase seen so far in the current window, for
+  the first `len` octets of `name`, into `increase`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Names that are not being tracked fail with ENOENT.
+ **/
+int
+tsdp_delta_get(struct tsdp_delta *d, const char *name, size_t len, double *increase)
+{
+	struct s_slot *slot;
+
+	errno = EINVAL;
+	if (!d || !name || !increase) return -1;
+
+	errno = ENOENT;
+	slot = slots_find(&d->t, slots_hash(name, len), name, len);
+	if (!slot->hash) return -1;
+
+	*increase = slot->increase;
+	return 0;
+}
+
+
+/**
+  Stops tracking the first `len` octets of `name` (in response
+  to a FORGET, say), discarding its baseline and whatever it
+  has accumulated in the current window.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Names that are not being tracked fail with ENOENT.
+ **/
+int
+tsdp_delta_forget(struct tsdp_delta *d, const char *name, size_t len)
+{
+	struct s_slot *slot;
+
+	errno = EINVAL;
+	if (!d || !name) return -1;
+
+	errno = ENOENT;
+	slot = slots_find(&d->t, slots_hash(name, len), name, len);
+	if (!slot->hash) return -1;
+
+	slots_delete(&d->t, slot);
+	return 0;
+}
+
+
+/**
+  Closes the current window, and starts a new one, calling `fn`
+  with a BROADCAST DELTA message for each series that was
+  updated in the window just closed (in no particular order),
+  carrying its average rate (the increase, divided by the
+  window width), stamped with `ts` and the window width.  Each
+  message is freed once `fn` returns.
+
+  This is a single sequential sweep of the table.  Baselines
+  carry over into the next window, so that no increase is ever
+  lost between windows.
+
+  Returns how many messages were emitted, or -1 on failure,
+  and sets `errno`.  Either way, every series is reset for the
+  next window.
+ **/
+int
+tsdp_delta_flush(struct tsdp_delta *d, uint64_t ts, void (*fn)(struct tsdp_msg *m, void *udata), void *udata)
+{
+	struct s_slot *slot, *end;
+	struct tsdp_msg *m;
+	const char *name;
+	double rate;
+	int n, rc;
+
+	errno = EINVAL;
+	if (!d || !fn) return -1;
+
+	n = 0; rc = 0;
+	slot = (struct s_slot *)d->t.slots;
+	for (end = slot + d->t.mask + 1; slot < end; slot++) {
+		if (!(slot->flags & S_UPDATED)) continue;
+
+		rate = slot->increase / d->window;
+		slot->increase = 0;
+		slot->flags &= ~S_UPDATED;
+		if (rc != 0) continue;
+
+		name = slots_name(&d->t, slot);
+		m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_BROADCAST, 0, TSDP_PAYLOAD_DELTA);
+		if (!m
+		 || tsdp_msg_extend(m, TSDP_FRAME_STRING, name,       strlen(name) + 1) != 0
+		 || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts,        8) != 0
+		 || tsdp_msg_extend(m, TSDP_FRAME_UINT,   &d->window, 4) != 0
+		 || tsdp_msg_extend(m, TSDP_FRAME_FLOAT,  &rate,      8) != 0) {
+			tsdp_msg_free(m);
+			rc = -1;
+			continue;
+		}
+		fn(m, udata);
+		tsdp_msg_free(m);
+		n++;
+	}
+
+	if (rc != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return n;
+}
@@ -0,0 +1,477 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "slots.h"
+#include "counter.h"
+
+#define GROUPBY_MIN_SLOTS 256
+
+#define S_UPDATED  0x1   /* folded into during the current window */
+
+/* one accumulator per group, stored inline, as for DELTA rates;
+   every operator is derived from the same four running values,
+   so they are all kept, whichever one was asked for. */
+struct s_slot {
+	uint64_t hash;   /* 0 if empty                  */
+	uint32_t name;   /* offset into the pool        */
+	uint32_t flags;  /* S_*                         */
+	uint64_t count;  /* values folded in, so far    */
+	double   sum;
+	double   min;
+	double   max;
+};
+
+/* the last value of a DELTA series, so that it is how far the
+   counter went up that gets folded in, as for DELTA rates */
+struct s_baseline {
+	uint64_t hash;   /* 0 if empty                  */
+	uint32_t name;   /* offset into the pool        */
+	uint32_t _pad;
+	uint64_t ts;     /* timestamp of the last value */
+	double   last;   /* last value seen             */
+};
+
+struct tsdp_groupby {
+	struct qname  *pattern;
+	char         **keys;    /* grouping keys, sorted lexically */
+	size_t         nkeys;
+	int            op;      /* TSDP_GROUPBY_*                  */
+	uint32_t       window;  /* width, in seconds               */
+
+	struct slots   t;       /* group name -> accumulator       */
+	struct slots   deltas;  /* series name -> s_baseline       */
+};
+
+static int
+s_cmpkey(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static size_t
+s_append(char *buf, size_t cap, size_t at, const char *s)
+{
+	size_t n = strlen(s);
+	if (at + n < cap) memcpy(buf + at, s, n);
+	return at + n;
+}
+
+/* project `q` onto the grouping keys, writing the name of its
+   group ("metric key=value,...", in key order) into `buf`.
+   Every grouping key is named, as a bare `key` if `q` lacks
+   it, so that the name is always a well-formed qname.  Both
+   lists of keys are sorted, so this is a single merge pass
+   over the two of them.  Returns the length of the name,
+   which is >= cap if it did not fit. */
+static size_t
+s_project(struct tsdp_groupby *g, struct qname *q, char *buf, size_t cap)
+{
+	size_t at, i, j;
+	int cmp;
+
+	at = s_append(buf, cap, 0, q->metric);
+	for (i = 0, j = 0; j < g->nkeys; j++) {
+		for (cmp = 1; i < (size_t)q->i && (cmp = strcmp(q->pairs[i].key, g->keys[j])) < 0; i++)
+			;
+
+		at = s_append(buf, cap, at, j == 0 ? " " : ",");
+		at = s_append(buf, cap, at, g->keys[j]);
+		if (cmp == 0 && q->pairs[i].value) {
+			at = s_append(buf, cap, at, "=");
+			at = s_append(buf, cap, at, q->pairs[i].value);
+		}
+	}
+	if (at < cap) buf[at] = '\0';
+	return at;
+}
+
+static double
+s_value(struct tsdp_groupby *g, struct s_slot *slot)
+{
+	switch (g->op) {
+	case TSDP_GROUPBY_COUNT: return (double)slot->count;
+	case TSDP_GROUPBY_MIN:   return slot->min;
+	case TSDP_GROUPBY_MAX:   return slot->max;
+	case TSDP_GROUPBY_MEAN:  return slot->sum / slot->count;
+	default:                 return slot->sum;
+	}
+}
+
+
+/**
+  Allocates a new group-by aggregation, which folds the values
+  of every series matching the qualified name `pattern` into one
+  accumulator per distinct combination of values for the `nkeys`
+  grouping keys in `keys` -- as in "the sum of all requests, by
+  datacenter".  Groups are named for the metric and the grouping
+  keys, in key order ("requests dc=eu,host=a"); series that lack
+  one of the grouping keys are grouped under the bare key instead
+  ("requests dc,host=a"), along with any that have it, but with
+  no value.  Groups are per-metric, so that a wildcard metric in
+  `pattern` does not mix the values of different metrics together.
+
+  `op` determines what each group computes: one of
+  TSDP_GROUPBY_SUM, TSDP_GROUPBY_COUNT, TSDP_GROUPBY_MIN,
+  TSDP_GROUPBY_MAX, or TSDP_GROUPBY_MEAN.  Results are
+  broadcast every `window` seconds (see `tsdp_groupby_flush()`).
+
+  Group-by aggregations are not thread-safe; callers must
+  serialize access to them.
+
+  Returns NULL on failure, and sets `errno`.  Unparseable
+  patterns, unknown operators, and missing, duplicate (or more
+  than QNAME_MAX_PAIRS) grouping keys fail with EINVAL.
+ **/
+struct tsdp_groupby *
+tsdp_groupby_new(const char *pattern, const char **keys, size_t nkeys, int op, unsigned int window)
+{
+	struct tsdp_groupby *g;
+	size_t i;
+	int e;
+
+	errno = EINVAL;
+	if (!pattern || !keys || nkeys == 0 || nkeys > QNAME_MAX_PAIRS || window == 0) return NULL;
+	if (op < TSDP_GROUPBY_SUM || op > TSDP_GROUPBY_MEAN) return NULL;
+	for (i = 0; i < nkeys; i++)
+		if (!keys[i] || !*keys[i]) return NULL;
+
+	errno = ENOMEM;
+	g = calloc(1, sizeof(struct tsdp_groupby));
+	if (!g) return NULL;
+	g->op     = op;
+	g->window = window;
+	g->keys   = calloc(nkeys, sizeof(char *));
+	if (slots_init(&g->t, sizeof(struct s_slot), offsetof(struct s_slot, name), GROUPBY_MIN_SLOTS, 0) != 0
+	 || slots_init(&g->deltas, sizeof(struct s_baseline), offsetof(struct s_baseline, name), GROUPBY_MIN_SLOTS, 0) != 0
+	 || !g->keys) goto fail;
+	for (g->nkeys = 0; g->nkeys < nkeys; g->nkeys++)
+		if (!(g->keys[g->nkeys] = strdup(keys[g->nkeys]))) goto fail;
+
+	errno = EINVAL;
+	qsort(g->keys, g->nkeys, sizeof(char *), s_cmpkey);
+	for (i = 1; i < g->nkeys; i++)
+		if (strcmp(g->keys[i - 1], g->keys[i]) == 0) goto fail;
+
+	g->pattern = qname_parse(pattern);
+	if (!g->pattern) {
+		errno = EINVAL;
+		goto fail;
+	}
+	return g;
+
+fail:
+	e = errno;
+	tsdp_groupby_free(g);
+	errno = e;
+	return NULL;
+}
+
+
+/**
+  Frees a group-by aggregation.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_groupby_free(struct tsdp_groupby *g)
+{
+	size_t i;
+
+	if (!g) return;
+	for (i = 0; i < g->nkeys; i++)
+		free(g->keys[i]);
+	free(g->keys);
+	qname_free(g->pattern);
+	slots_free(&g->t);
+	slots_free(&g->deltas);
+	free(g);
+}
+
+
+/**
+  Returns how many groups the aggregation has seen.
+ **/
+size_t
+tsdp_groupby_count(struct tsdp_groupby *g)
+{
+	return g ? g->t.n : 0;
+}
+
+
+/**
+  Folds the value `v`, measured for the series `q`, into the
+  accumulator for its group, if `q` matches the pattern.
+
+  Returns 1 if the value was folded in, 0 if `q` does not match
+  the pattern, or -1 on failure, and sets `errno`.  Values that
+  are not a number, and wildcard names, fail with EINVAL.
+ **/
+int
+tsdp_groupby_add(struct tsdp_groupby *g, struct qname *q, double v)
+{
+	struct s_slot *slot;
+	char buf[QNAME_MAX_LEN + 1];
+	size_t len;
+	uint64_t h;
+
+	errno = EINVAL;
+	if (!g || !q || !q->metric || q->wild || v != v) return -1;
+	if (!qname_match(q, g->pattern)) return 0;
+
+	len = s_project(g, q, buf, sizeof(buf));
+	if (len >= sizeof(buf)) return -1;
+
+	h = slots_hash(buf, len);
+	slot = slots_find(&g->t, h, buf, len);
+	if (!slot->hash) {
+		slot = slots_insert(&g->t, h, buf, len);
+		if (!slot) return -1;
+	}
+
+	if (!(slot->flags & S_UPDATED)) {
+		slot->count = 0;
+		slot->sum   = 0;
+		slot->min   = slot->max = v;
+		slot->flags |= S_UPDATED;
+	}
+	slot->count++;
+	slot->sum += v;
+	if (v < slot->min) slot->min = v;
+	if (v > slot->max) slot->max = v;
+	return 1;
+}
+
+
+/* folds in how far the DELTA counter `q` has gone up since its
+   last value, which becomes the new baseline, as for
+   `tsdp_delta_update()` */
+static int
+s_delta(struct tsdp_groupby *g, struct qname *q, uint64_t ts, double v)
+{
+	struct s_baseline *b;
+	char buf[QNAME_MAX_LEN + 1];
+	size_t len;
+	uint64_t h;
+	double was;
+
+	errno = EINVAL;
+	if (q->wild || v != v) return -1;
+	if (!qname_match(q, g->pattern)) return 0;
+
+	len = qname_string_into(q, buf, sizeof(buf));
+	if (len >= sizeof(buf)) return -1;
+
+	h = slots_hash(buf, len);
+	b = slots_find(&g->deltas, h, buf, len);
+	if (!b->hash) {
+		b = slots_insert(&g->deltas, h, buf, len);
+		if (!b) return -1;
+		b->ts   = ts;
+		b->last = v;
+		return 0;
+	}
+	if (ts < b->ts) return 0; /* stale */
+
+	was = b->last;
+	b->last = v;
+	b->ts   = ts;
+	return tsdp_groupby_add(g, q, counter_increase(was, v));
+}
+
+
+/**
+  Folds the values carried by the SUBMIT message `m` into the
+  aggregation, as for `tsdp_groupby_add()`.  SAMPLE measurements
+  are folded in one at a time, and TALLY increments (1, if none
+  is given) as they are.
+
+  DELTA counters are folded in as the amount they have gone up
+  by since their last value, with wraparounds and resets taken
+  care of as for `tsdp_delta_update()`.  The first value seen
+  for a series (or one older than the last) only sets its
+  baseline, and folds nothing in.
+
+  Returns how many values were folded in (0 if the series does
+  not match the pattern), or -1 on failure, and sets `errno`.
+  Anything other than a well-formed SUBMIT SAMPLE, TALLY or
+  DELTA message fails with EINVAL.
+ **/
+int
+tsdp_groupby_submit(struct tsdp_groupby *g, struct tsdp_msg *m)
+{
+	struct qname q;
+	struct tsdp_frame *f;
+	char scratch[QNAME_MAX_LEN + 1];
+	int n, rc, e;
+
+	errno = EINVAL;
+	if (!g || !m || m->opcode != TSDP_OPCODE_SUBMIT || m->nframes < 2
+	 || m->frames->type       != TSDP_FRAME_STRING
+	 || m->frames->next->type != TSDP_FRAME_TSTAMP)
+		return -1;
+
+	switch (m->payload) {
+	case TSDP_PAYLOAD_SAMPLE:
+		if (m->nframes < 3) return -1;
+		for (f = m->frames->next->next; f; f = f->next)
+			if (f->type != TSDP_FRAME_FLOAT || f->length != 8) return -1;
+		break;
+
+	case TSDP_PAYLOAD_TALLY:
+		if (m->nframes > 3) return -1;
+		if (m->nframes == 3 && (m->last->type != TSDP_FRAME_UINT || m->last->length != 8)) return -1;
+		break;
+
+	case TSDP_PAYLOAD_DELTA:
+		if (m->nframes != 3 || m->last->type != TSDP_FRAME_FLOAT || m->last->length != 8) return -1;
+		break;
+
+	default:
+		return -1;
+	}
+
+	/* STRING frames carry their NUL terminator */
+	if (qname_parse_into(&q, scratch, sizeof(scratch), m->frames->payload.string,
+	                     strnlen(m->frames->payload.string, m->frames->length)) != 0)
+		return -1;
+
+	n = 0; rc = 0;
+	switch (m->payload) {
+	case TSDP_PAYLOAD_SAMPLE:
+		for (f = m->frames->next->next; f; f = f->next) {
+			rc = tsdp_groupby_add(g, &q, f->payload.float64);
+			if (rc <= 0) break;
+			n++;
+		}
+		break;
+
+	case TSDP_PAYLOAD_TALLY:
+		rc = tsdp_groupby_add(g, &q, m->nframes == 3 ? (double)m->last->payload.uint64 : 1.0);
+		n = rc;
+		break;
+
+	default:
+		rc = s_delta(g, &q, m->frames->next->payload.tstamp, m->last->payload.float64);
+		n = rc;
+		break;
+	}
+
+	e = errno;
+	qname_clear(&q);
+	errno = e;
+	return rc < 0 ? -1 : n;
+}
+
+
+/**
+  Copies the result so far in the current window, for the group
+  named by the first `len` octets of `group` (as it would be
+  broadcast), into `value`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Groups that have nothing folded into them in the current
+  window fail with ENOENT.
+ **/
+int
+tsdp_groupby_get(struct tsdp_groupby *g, const char *group, size_t len, double *value)
+{
+	struct s_slot *slot;
+
+	errno = EINVAL;
+	if (!g || !group || !value) return -1;
+
+	errno = ENOENT;
+	slot = slots_find(&g->t, slots_hash(group, len), group, len);
+	if (!slot->hash || !(slot->flags & S_UPDATED)) return -1;
+
+	*value = s_value(g, slot);
+	return 0;
+}
+
+
+/**
+  Forgets the baseline of the DELTA series named by the first
+  `len` octets of `name` (in response to a FORGET, say), so that
+  its next value is taken as a new baseline.  Groups are not
+  affected.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Series without a baseline fail with ENOENT.
+ **/
+int
+tsdp_groupby_forget(struct tsdp_groupby *g, const char *name, size_t len)
+{
+	struct s_baseline *b;
+
+	errno = EINVAL;
+	if (!g || !name) return -1;
+
+	errno = ENOENT;
+	b = slots_find(&g->deltas, slots_hash(name, len), name, len);
+	if (!b->hash) return -1;
+
+	slots_delete(&g->deltas, b);
+	return 0;
+}
+
+
+/**
+  Closes the current window, and starts a new one, calling `fn`
+  with a BROADCAST SAMPLE message for each group that had values
+  folded into it in the window just closed (in no particular
+  order), carrying the group name, `ts`, the window width, and
+  the result of the aggregation, as a single measurement.  Each
+  message is freed once `fn` returns.
+
+  Returns how many messages were emitted, or -1 on failure,
+  and sets `errno`.  Either way, every group is reset for the
+  next window.
+ **/
+int
+tsdp_groupby_flush(struct tsdp_groupby *g, uint64_t ts, void (*fn)(struct tsdp_msg *m, void *udata), void *udata)
+{
+	struct s_slot *slot, *end;
+	struct tsdp_msg *m;
+	const char *name;
+	double v;
+	int n, rc;
+
+	errno = EINVAL;
+	if (!g || !fn) return -1;
+
+	n = 0; rc = 0;
+	slot = (struct s_slot *)g->t.slots;
+	for (end = slot + g->t.mask + 1; slot < end; slot++) {
+		if (!(slot->flags & S_UPDATED)) continue;
+
+		v = s_value(g, slot);
+		slot->flags &= ~S_UPDATED;
+		if (rc != 0) continue;
+
+		name = slots_name(&g->t, slot);
+		m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_BROADCAST, 0, TSDP_PAYLOAD_SAMPLE);
+		if (!m
+		 || tsdp_msg_extend(m, TSDP_FRAME_STRING, name,       strlen(name) + 1) != 0
+		 || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts,        8) != 0
+		 || tsdp_msg_extend(m, TSDP_FRAME_UINT,   &g->window, 4) != 0
+		 || tsdp_msg_extend(m, TSDP_FRAME_FLOAT,  &v,         8) != 0) {
+			tsdp_msg_free(m);
+			rc = -1;
+			continue;
+		}
+		fn(m, udata);
+		tsdp_msg_free(m);
+		n++;
+	}
+
+	if (rc != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return n;
+}
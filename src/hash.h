@@ -0,0 +1,34 @@
+#ifndef TSDP_HASH_H
+#define TSDP_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 64-bit FNV-1a, over `len` octets of `buf` */
+static inline uint64_t
+hash64(const void *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* a final avalanche for integer keys (and weak hashes),
+   from the 64-bit finalizer of MurmurHash3 */
+static inline uint64_t
+hashmix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+#endif
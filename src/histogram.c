@@ -0,0 +1,326 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "debug.h"
+
+/* a histogram is a fixed layout of `n` buckets, the i-th of
+   which counts measurements in (bounds[i-1], bounds[i]]; the
+   first bucket takes in everything up to bounds[0].  Both
+   arrays live in the same allocation as the header. */
+struct tsdp_histogram {
+	size_t    n;
+	double   *bounds;
+	uint64_t *counts;
+};
+
+static struct tsdp_histogram *
+s_alloc(size_t n)
+{
+	struct tsdp_histogram *h;
+
+	h = calloc(1, sizeof(struct tsdp_histogram) + n * (sizeof(double) + sizeof(uint64_t)));
+	if (!h) return NULL;
+	h->n      = n;
+	h->counts = (uint64_t *)(h + 1);
+	h->bounds = (double *)(h->counts + n);
+	return h;
+}
+
+/* index of the bucket that `v` falls into, or n if it is
+   above the last bound */
+static size_t
+s_bucket(const double *bounds, size_t n, double v)
+{
+	size_t lo, hi, mid;
+
+	for (lo = 0, hi = n; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if (bounds[mid] < v) lo = mid + 1;
+		else                 hi = mid;
+	}
+	return lo;
+}
+
+
+/**
+  Allocates a new, empty histogram, with `n` buckets whose upper
+  bounds (inclusive) are given, in strictly increasing order, by
+  `bounds`.  To catch everything, make the last bound INFINITY.
+
+  Returns NULL on failure, and sets `errno`.  Bounds that are
+  out of order or not a number, and bucket counts of zero or
+  more than TSDP_HISTOGRAM_MAX_BUCKETS, fail with EINVAL.
+ **/
+struct tsdp_histogram *
+tsdp_histogram_new(const double *bounds, size_t n)
+{
+	struct tsdp_histogram *h;
+	size_t i;
+
+	errno = EINVAL;
+	if (!bounds || n == 0 || n > TSDP_HISTOGRAM_MAX_BUCKETS) return NULL;
+	for (i = 0; i < n; i++)
+		if (bounds[i] != bounds[i] || (i > 0 && bounds[i] <= bounds[i - 1])) return NULL;
+
+	errno = ENOMEM;
+	h = s_alloc(n);
+	if (!h) return NULL;
+	memcpy(h->bounds, bounds, n * sizeof(double));
+	return h;
+}
+
+
+/**
+  Frees a histogram.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_histogram_free(struct tsdp_histogram *h)
+{
+	free(h);
+}
+
+
+/**
+  Zeroes all of the counts of a histogram, keeping its layout.
+ **/
+void
+tsdp_histogram_clear(struct tsdp_histogram *h)
+{
+	if (h) memset(h->counts, 0, h->n * sizeof(uint64_t));
+}
+
+
+/**
+  Returns how many buckets the histogram has.
+ **/
+size_t
+tsdp_histogram_buckets(struct tsdp_histogram *h)
+{
+	return h ? h->n : 0;
+}
+
+
+/**
+  Returns the (inclusive) upper bound of the `i`-th bucket, or
+  NaN if there is no such bucket.
+ **/
+double
+tsdp_histogram_bound(struct tsdp_histogram *h, size_t i)
+{
+	return h && i < h->n ? h->bounds[i] : NAN;
+}
+
+
+/**
+  Returns the count of the `i`-th bucket, or 0 if there is no
+  such bucket.
+ **/
+uint64_t
+tsdp_histogram_count(struct tsdp_histogram *h, size_t i)
+{
+	return h && i < h->n ? h->counts[i] : 0;
+}
+
+
+/**
+  Returns the sum of the counts of all buckets.
+ **/
+uint64_t
+tsdp_histogram_total(struct tsdp_histogram *h)
+{
+	uint64_t total;
+	size_t i;
+
+	if (!h) return 0;
+	for (total = 0, i = 0; i < h->n; i++)
+		total += h->counts[i];
+	return total;
+}
+
+
+/**
+  Counts `n` occurrences of the measurement `v`, in whichever
+  bucket it falls into.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Measurements that are not a number fail with EINVAL; those
+  above the last bound fail with ERANGE.
+ **/
+int
+tsdp_histogram_observe(struct tsdp_histogram *h, double v, uint64_t n)
+{
+	size_t i;
+
+	errno = EINVAL;
+	if (!h || v != v) return -1;
+
+	errno = ERANGE;
+	i = s_bucket(h->bounds, h->n, v);
+	if (i == h->n) return -1;
+
+	h->counts[i] += n;
+	return 0;
+}
+
+
+/**
+  Adds the counts of `src` into `dst`.  The layouts need not be
+  the same, so long as every bucket of `src` fits entirely inside
+  a bucket of `dst`: a fine-grained histogram can be merged into
+  a coarser one (whose bounds are a subset of its own), but not
+  the other way around.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Incompatible layouts fail with EINVAL, and leave `dst` as it
+  was.
+ **/
+int
+tsdp_histogram_merge(struct tsdp_histogram *dst, struct tsdp_histogram *src)
+{
+	size_t i, j;
+
+	errno = EINVAL;
+	if (!dst || !src) return -1;
+
+	if (dst->n == src->n && memcmp(dst->bounds, src->bounds, dst->n * sizeof(double)) == 0) {
+		for (i = 0; i < dst->n; i++)
+			dst->counts[i] += src->counts[i];
+		return 0;
+	}
+
+	/* check everything before touching anything */
+	for (i = 0; i < src->n; i++) {
+		j = s_bucket(dst->bounds, dst->n, src->bounds[i]);
+		if (j == dst->n) return -1;
+		if (j > 0 && (i == 0 || src->bounds[i - 1] < dst->bounds[j - 1])) return -1;
+	}
+	for (i = 0; i < src->n; i++)
+		dst->counts[s_bucket(dst->bounds, dst->n, src->bounds[i])] += src->counts[i];
+	return 0;
+}
+
+
+/**
+  Builds a HISTOGRAM message carrying the layout and counts of
+  `h`, for the qualified name `name`, measured at `ts`.  The
+  opcode must be either TSDP_OPCODE_SUBMIT or (for aggregated
+  histograms) TSDP_OPCODE_BROADCAST, in which case `window` is
+  the width of the aggregation window, in seconds; it is
+  ignored for SUBMITs.
+
+  Each bucket costs a FLOAT/8 frame for its bound, and a UINT
+  frame for its count, as narrow as the count allows.
+
+  The returned message must be freed by the caller, via
+  `tsdp_msg_free()`, when no longer needed.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_msg *
+tsdp_histogram_to_msg(struct tsdp_histogram *h, int opcode, const char *name, uint64_t ts, unsigned int window)
+{
+	struct tsdp_msg *m;
+	uint64_t u64;
+	uint32_t u32;
+	uint16_t u16;
+	size_t i;
+	int rc;
+
+	errno = EINVAL;
+	if (!h || !name || (opcode != TSDP_OPCODE_SUBMIT && opcode != TSDP_OPCODE_BROADCAST)) return NULL;
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, opcode, 0, TSDP_PAYLOAD_HISTOGRAM);
+	if (!m) return NULL;
+
+	u32 = window;
+	rc = tsdp_msg_extend(m, TSDP_FRAME_STRING, name, strlen(name) + 1) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts,  8) != 0
+	  || (opcode == TSDP_OPCODE_BROADCAST && tsdp_msg_extend(m, TSDP_FRAME_UINT, &u32, 4) != 0);
+
+	for (i = 0; rc == 0 && i < h->n; i++) {
+		rc = tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &h->bounds[i], 8) != 0;
+		if (rc) break;
+
+		u64 = h->counts[i];
+		if (u64 <= UINT16_MAX) {
+			u16 = u64;
+			rc = tsdp_msg_extend(m, TSDP_FRAME_UINT, &u16, 2) != 0;
+		} else if (u64 <= UINT32_MAX) {
+			u32 = u64;
+			rc = tsdp_msg_extend(m, TSDP_FRAME_UINT, &u32, 4) != 0;
+		} else {
+			rc = tsdp_msg_extend(m, TSDP_FRAME_UINT, &u64, 8) != 0;
+		}
+	}
+
+	if (rc) {
+		tsdp_msg_free(m);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return m;
+}
+
+
+/**
+  Decodes the buckets of the SUBMIT or BROADCAST HISTOGRAM
+  message `m` into a new histogram.
+
+  The returned histogram must be freed by the caller, via
+  `tsdp_histogram_free()`, when no longer needed.
+
+  Returns NULL on failure, and sets `errno`.  Anything other
+  than a well-formed HISTOGRAM message fails with EINVAL.
+ **/
+struct tsdp_histogram *
+tsdp_histogram_from_msg(struct tsdp_msg *m)
+{
+	struct tsdp_histogram *h;
+	struct tsdp_frame *f;
+	size_t i, n;
+	int first;
+
+	errno = EINVAL;
+	if (!m || m->payload != TSDP_PAYLOAD_HISTOGRAM) return NULL;
+	if      (m->opcode == TSDP_OPCODE_SUBMIT)    first = 2;
+	else if (m->opcode == TSDP_OPCODE_BROADCAST) first = 3;
+	else return NULL;
+
+	if (m->nframes < first + 2 || (m->nframes - first) % 2 != 0) return NULL;
+	if (m->frames->type != TSDP_FRAME_STRING || m->frames->next->type != TSDP_FRAME_TSTAMP) return NULL;
+	n = (m->nframes - first) / 2;
+	if (n > TSDP_HISTOGRAM_MAX_BUCKETS) return NULL;
+
+	errno = ENOMEM;
+	h = s_alloc(n);
+	if (!h) return NULL;
+
+	errno = EINVAL;
+	for (f = m->frames, i = 0; (int)i < first; i++)
+		f = f->next;
+	for (i = 0; i < n; i++, f = f->next->next) {
+		if (f->type != TSDP_FRAME_FLOAT || f->length != 8
+		 || f->payload.float64 != f->payload.float64
+		 || (i > 0 && f->payload.float64 <= h->bounds[i - 1]))
+			goto fail;
+		h->bounds[i] = f->payload.float64;
+
+		switch (f->next->type == TSDP_FRAME_UINT ? f->next->length : 0) {
+		case 2:  h->counts[i] = f->next->payload.uint16; break;
+		case 4:  h->counts[i] = f->next->payload.uint32; break;
+		case 8:  h->counts[i] = f->next->payload.uint64; break;
+		default: goto fail;
+		}
+	}
+	return h;
+
+fail:
+	free(h);
+	return NULL;
+}
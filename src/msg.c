@@ -389,6 +389,31 @@ s_nth_frame(struct tsdp_msg *m, int n)
 	return f;
 }
 
+/* HISTOGRAM buckets run from frame `first` to the end, as pairs
+   of a FLOAT/8 upper bound and a UINT count, of whatever width
+   suits it; the bounds must go strictly up. */
+static int
+s_buckets_valid(struct tsdp_msg *m, int first)
+{
+	struct tsdp_frame *f;
+	double last = 0;
+	int n;
+
+	f = s_nth_frame(m, first);
+	for (n = 0; f; n++) {
+		if (f->type != TSDP_FRAME_FLOAT || f->length != 8) return 0;
+		if (f->payload.float64 != f->payload.float64) return 0; /* NaN */
+		if (n > 0 && f->payload.float64 <= last) return 0;
+		last = f->payload.float64;
+
+		f = f->next;
+		if (!f || f->type != TSDP_FRAME_UINT
+		 || (f->length != 2 && f->length != 4 && f->length != 8)) return 0;
+		f = f->next;
+	}
+	return n > 0 && n <= TSDP_HISTOGRAM_MAX_BUCKETS;
+}
+
 /* hamming weight algorithm, in 8-bit */
 static unsigned char
 bits8(unsigned char b)
@@ -515,6 +540,17 @@ tsdp_msg_valid(struct tsdp_msg *m)
 			requires_frame(0, TSDP_FRAME_STRING, 0);
 			requires_frame(1, TSDP_FRAME_STRING, 0);
 			return 1;
+
+		case TSDP_PAYLOAD_HISTOGRAM:
+			errno = TSDP_E_INVALID_ARITY;
+			requires_min_frame_count(4);
+			if (m->nframes % 2 != 0) return 0;
+
+			errno = TSDP_E_INVALID_FRAME;
+			requires_frame(0, TSDP_FRAME_STRING, 0); /* qualified name   */
+			requires_frame(1, TSDP_FRAME_TSTAMP, 8); /* measurement time */
+			if (!s_buckets_valid(m, 2)) return 0;    /* (bound, count)+  */
+			return 1;
 		}
 		return 0;
 
@@ -602,6 +638,18 @@ tsdp_msg_valid(struct tsdp_msg *m)
 			requires_frame(1, TSDP_FRAME_STRING, 0);
 			return 1;
 
+		case TSDP_PAYLOAD_HISTOGRAM:
+			errno = TSDP_E_INVALID_ARITY;
+			requires_min_frame_count(5);
+			if (m->nframes % 2 != 1) return 0;
+
+			errno = TSDP_E_INVALID_FRAME;
+			requires_frame(0, TSDP_FRAME_STRING, 0);
+			requires_frame(1, TSDP_FRAME_TSTAMP, 8);
+			requires_frame(2, TSDP_FRAME_UINT,   4);
+			if (!s_buckets_valid(m, 3)) return 0;
+			return 1;
+
 		}
 		return 0;
 
@@ -610,7 +658,8 @@ tsdp_msg_valid(struct tsdp_msg *m)
 		requires_payloads(TSDP_PAYLOAD_SAMPLE
 		                | TSDP_PAYLOAD_TALLY
 		                | TSDP_PAYLOAD_DELTA
-		                | TSDP_PAYLOAD_STATE);
+		                | TSDP_PAYLOAD_STATE
+		                | TSDP_PAYLOAD_HISTOGRAM);
 
 		errno = TSDP_E_INVALID_ARITY;
 		requires_exact_frame_count(1);
@@ -764,6 +813,7 @@ tsdp_msg_fdump(FILE *io, struct tsdp_msg *m)
 	if (m->payload & TSDP_PAYLOAD_STATE)  fprintf(io, "          - STATE  (%04x)\n", TSDP_PAYLOAD_STATE);
 	if (m->payload & TSDP_PAYLOAD_EVENT)  fprintf(io, "          - EVENT  (%04x)\n", TSDP_PAYLOAD_EVENT);
 	if (m->payload & TSDP_PAYLOAD_FACT)   fprintf(io, "          - FACT   (%04x)\n", TSDP_PAYLOAD_FACT);
+	if (m->payload & TSDP_PAYLOAD_HISTOGRAM) fprintf(io, "          - HISTOGRAM (%04x)\n", TSDP_PAYLOAD_HISTOGRAM);
 
 	fprintf(io, "frames:  %d\n", m->nframes);
 	for (i = 0, f = m->frames; f; f = f->next, i++) {
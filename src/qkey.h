@@ -0,0 +1,58 @@
+#ifndef TSDP_QKEY_H
+#define TSDP_QKEY_H
+
+#include <tsdp.h>
+#include <string.h>
+
+#define QKEY_VALUE 'v'   /* key=value */
+#define QKEY_NONE  '-'   /* key       */
+#define QKEY_ANY   '*'   /* key=*     */
+
+/* room for the key of any name that qname_parse() will take
+   (names that have since been mutated may need more) */
+#define QKEY_MAX (QNAME_MAX_LEN + QNAME_MAX_PAIRS + 2)
+
+/* encodes `q` into the first `cap` octets of `buf`, as a key
+   for hashing and comparing names by.  The canonical string
+   form will not do: it does not escape its separators, so
+   "cpu a\,b=c" and "cpu a,b=c" render the same.  Instead, the
+   metric, keys and values are each NUL-terminated (they cannot
+   contain a NUL), and each key is followed by the kind of
+   value it has (QKEY_*).  Returns the length of the key, or 0
+   if it would not fit. */
+static inline size_t
+qname_key(struct qname *q, char *buf, size_t cap)
+{
+	const char *v;
+	size_t n, l;
+	int i;
+
+	n = strlen(q->metric) + 1;
+	if (n > cap) return 0;
+	memcpy(buf, q->metric, n);
+
+	for (i = 0; i < q->i; i++) {
+		l = strlen(q->pairs[i].key) + 1;
+		if (n + l + 1 > cap) return 0;
+		memcpy(buf + n, q->pairs[i].key, l);
+		n += l;
+
+		v = q->pairs[i].value;
+		if (!v)                      { buf[n++] = QKEY_NONE; continue; }
+		if (strcmp(v, "*") == 0)     { buf[n++] = QKEY_ANY;  continue; }
+		buf[n++] = QKEY_VALUE;
+
+		l = strlen(v) + 1;
+		if (n + l > cap) return 0;
+		memcpy(buf + n, v, l);
+		n += l;
+	}
+
+	if (q->wild) {
+		if (n + 1 > cap) return 0;
+		buf[n++] = '*';
+	}
+	return n;
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "debug.h"
 
@@ -17,9 +18,6 @@
 
 static char *__QNAME_WILDCARD = "*";
 
-#define qfree(x) do { if ((x) != __QNAME_WILDCARD) free((x)); } while (0)
-#define qvalue(x) ((x) && (x) != __QNAME_WILDCARD)
-
 #include "qname_chars.inc"
 #define s_is_character(c)  (TBL_QNAME_CHARACTER[((c) & 0xff)] == 1)
 #define s_is_wildcard(c)   ((c) == '*')
@@ -30,53 +28,103 @@ static char *__QNAME_WILDCARD = "*";
 	x = (char *)((uintptr_t)(x) ^ (uintptr_t)(y)); \
 } while (0)
 
-static void
-s_qname_expand(struct qname *q)
+/* drop the cached canonical form, after a modification.
+   It lives in the slack space of flat, so there is nothing
+   to free; the next write to the slack overwrites it. */
+static inline void
+s_qname_touch(struct qname *q)
 {
-	int i;
+	q->canon = NULL;
+	q->clen  = 0;
+}
 
-	if (!q->flat) return; /* already expanded */
-	q->metric = strdup(q->metric);
-	for (i = 0; i < q->i; i++) {
-		if (qvalue(q->pairs[i].key))   q->pairs[i].key = strdup(q->pairs[i].key);
-		if (qvalue(q->pairs[i].value)) q->pairs[i].value = strdup(q->pairs[i].value);
-	}
-	free(q->flat);
-	q->flat = NULL;
+static const char *s_qname_canon(struct qname *q);
+
+/* re-cache the canonical form, once `q` has been (re)built.
+   The cache is only ever filled here, at parse and mutation
+   time, so that readers (qname_string() et al.) never write to
+   the qname, and can share it across threads. */
+static inline void
+s_qname_settle(struct qname *q)
+{
+	s_qname_touch(q);
+	s_qname_canon(q);
 }
 
-static void
-s_qname_contract(struct qname *q)
+/* is `p` one of the strings stored in the flat buffer of `q`?
+   (NULL and the wildcard value are not) */
+#define s_in_flat(q,p) ((p) && (p) != __QNAME_WILDCARD && (q)->flat \
+                        && (p) >= (q)->flat && (p) < (q)->flat + (q)->cap)
+
+/* make sure there are at least `need` octets of slack at the
+   end of the flat buffer of `q`.  If there are not, the live
+   strings are compacted into a new, larger buffer, owned by
+   `q` (copying borrowed storage on the first write), and the
+   old buffer (if `q` owned it) is handed back via `old`, for
+   the caller to free once it no longer needs the arguments it
+   was given (which may well point into it).
+
+   returns 0 on success, or -1 if we ran out of memory. */
+static int
+s_qname_reserve(struct qname *q, size_t need, char **old)
 {
+	size_t live, cap;
+	char *flat, *f;
 	int i;
-	size_t len;
-	char *f, *t;
 
-	if (q->flat) return; /* already contracted */
-	len = strlen(q->metric) + 1;
-	for (i = 0; i < q->i; i++)
-		len = len + strlen(q->pairs[i].key)   + 1
-		          + strlen(q->pairs[i].value) + 1;
+	*old = NULL;
+	if (q->flat && q->cap - q->len >= need) return 0;
 
-	q->len = len;
-	q->flat = malloc(len);
-	if (!q->flat) return;
+	live = q->metric ? strlen(q->metric) + 1 : 0;
+	for (i = 0; i < q->i; i++) {
+		live += strlen(q->pairs[i].key) + 1;
+		if (s_in_flat(q, q->pairs[i].value))
+			live += strlen(q->pairs[i].value) + 1;
+	}
 
-	f = q->flat;
-#define copy(s) do { \
-	memcpy(f, (s), strlen(s)); \
-	t = f + strlen(s); *t++ = '\0'; \
-	qfree(s); \
-	(s) = t; \
-} while (0);
+	/* leave room for the canonical form (which is about as
+	   long as the strings it is made of), and then as much
+	   again to grow into, so that the next few modifications
+	   (and the re-caching after them) don't have to allocate. */
+	cap = 3 * (live + need) + 16;
+	flat = malloc(cap);
+	if (!flat) return -1;
+
+	f = flat;
+#define move(s) do { \
+	size_t __n = strlen(s) + 1; \
+	memcpy(f, (s), __n); \
+	(s) = f; f += __n; \
+} while (0)
 
-	copy(q->metric);
+	if (q->metric) move(q->metric);
 	for (i = 0; i < q->i; i++) {
-		copy(q->pairs[i].key);
-		copy(q->pairs[i].value);
+		if (s_in_flat(q, q->pairs[i].value)) move(q->pairs[i].value);
+		move(q->pairs[i].key);
 	}
+#undef move
 
-#undef copy
+	if (!q->borrowed) *old = q->flat;
+	q->flat     = flat;
+	q->cap      = cap;
+	q->len      = f - flat;
+	q->borrowed = 0;
+	return 0;
+}
+
+/* append `n` octets of `s` (and a NUL) to the slack space
+   of `q`, which must have been reserved beforehand, and
+   return a pointer to the stored copy. */
+static char *
+s_qname_store(struct qname *q, const char *s, size_t n)
+{
+	char *p;
+
+	p = q->flat + q->len;
+	memmove(p, s, n);
+	p[n] = '\0';
+	q->len += n + 1;
+	return p;
 }
 
 static inline int
@@ -105,53 +153,37 @@ qname_new()
 }
 
 
-/**
-   Parse a qualified name from an input string,
-   returning the `struct qname *` that results,
-   or NULL on error, with `errno` set appropriately.
+/* parse `len` octets of `s` (stopping early at a NUL) into the
+   (zeroed) qname `q`, writing keys, values and the metric name
+   into `fill`, which must have room for at least `len + 1` octets.
 
-   This function allocates memory, and may fail
-   if insufficient memory is available.
- **/
-struct qname *
-qname_parse(const char *s)
+   returns 0 on success, or -1 if `s` is not a valid qname. */
+static int
+s_qname_parse(struct qname *q, char *fill, const char *s, size_t len)
 {
-	struct qname *q;
-	const char *p;
-	char *fill;
+	const char *p, *end;
 	int fsm, esc, i;
-	size_t len;
 
-	if (!s) return NULL;
-	if (strlen(s) > QNAME_MAX_LEN) {
-		debugf("input string %p is %lu octets long (>%u)\n", string, strlen(string), TSDP_MAX_QNAME_LEN);
-		return NULL;
-	}
-
-	q = qname_new();
-	if (!q) return NULL;
-
-	q->len  = strlen(s) + 1;
-	q->flat = strdup(s);
-	if (!q->flat) goto cleanup;
+	end = s + len;
+#define more() (p < end && *p)
 
 	/* skip whitespace */
-	for (p = s; *p && *p == ' '; p++);
+	for (p = s; more() && *p == ' '; p++);
 
 	/* metric name */
-	q->metric = fill = q->flat;
-	while (*p && *p != ' ') *fill++ = *p++;
+	q->metric = fill;
+	while (more() && *p != ' ') *fill++ = *p++;
 
 	/* is metric name empty? */
-	if (fill == q->metric) goto cleanup;
+	if (fill == q->metric) return -1;
 
 	/* do we have tags? */
-	if (*p) { p++; *fill++ = '\0'; }
+	if (more()) { p++; *fill++ = '\0'; }
 
 	esc = 0;
 	q->i = 0;
 	fsm = TSDP_PFSM_K1;
-	for (; *p; p++) {
+	for (; more(); p++) {
 		if (*p == '\\') { esc = 1; continue; }
 		if (esc) {
 			switch (fsm) {
@@ -166,7 +198,7 @@ qname_parse(const char *s)
 			                   break;
 
 			default: debugf("invalid FSM state [%d] for escape sequence\n", fsm);
-			         goto cleanup;
+			         return -1;
 			}
 			esc = 0;
 			continue;
@@ -188,7 +220,7 @@ qname_parse(const char *s)
 
 			} else {
 				debugf("invalid token (%c / %#02x) for transition from state K1\n", *p, *p);
-				goto cleanup;
+				return -1;
 			}
 			break;
 
@@ -201,7 +233,7 @@ qname_parse(const char *s)
 			} else if (*p == ',') {
 				*fill++ = '\0';
 				q->pairs[q->i].value = NULL;
-				if (s_qname_next(q) != 0) goto cleanup;
+				if (s_qname_next(q) != 0) return -1;
 				fsm = TSDP_PFSM_K1;
 
 			} else if (s_is_character(*p)) {
@@ -209,7 +241,7 @@ qname_parse(const char *s)
 
 			} else {
 				debugf("invalid token (%c / %#02x) for transition from state K2\n", *p, *p);
-				goto cleanup;
+				return -1;
 			}
 			break;
 
@@ -227,12 +259,12 @@ qname_parse(const char *s)
 
 			} else if (*p == ',') {
 				*fill++ = '\0';
-				if (s_qname_next(q) != 0) goto cleanup;
+				if (s_qname_next(q) != 0) return -1;
 				fsm = TSDP_PFSM_K1;
 
 			} else {
 				debugf("invalid token (%c / %#02x) for transition from state V1\n", *p, *p);
-				goto cleanup;
+				return -1;
 			}
 			break;
 
@@ -240,7 +272,7 @@ qname_parse(const char *s)
 		case TSDP_PFSM_V2:
 			if (*p == ',') {
 				*fill++ = '\0';
-				if (s_qname_next(q) != 0) goto cleanup;
+				if (s_qname_next(q) != 0) return -1;
 				fsm = TSDP_PFSM_K1;
 
 			} else if (s_is_character(*p)) {
@@ -248,7 +280,7 @@ qname_parse(const char *s)
 
 			} else {
 				debugf("invalid token (%c / %#02x) for transition from state V2\n", *p, *p);
-				goto cleanup;
+				return -1;
 			}
 			break;
 
@@ -256,21 +288,22 @@ qname_parse(const char *s)
 		case TSDP_PFSM_M:
 			if (*p == ',') {
 				*fill++ = '\0';
-				if (s_qname_next(q) != 0) goto cleanup;
+				if (s_qname_next(q) != 0) return -1;
 				fsm = TSDP_PFSM_K1;
 
 			} else {
 				debugf("invalid token (%c / %#02x) for transition from state M\n", *p, *p);
-				goto cleanup;
+				return -1;
 			}
 			break;
 
 
-		defaut:
+		default:
 			debugf("invalid FSM state [%d]\n", fsm);
-			goto cleanup;
+			return -1;
 		}
 	}
+#undef more
 
 	/* EOF; check states that can legitimately lead to DONE */
 	switch (fsm) {
@@ -284,13 +317,13 @@ qname_parse(const char *s)
 
 	default:
 		debugf("invalid final FSM state [%d]\n", fsm);
-		goto cleanup;
+		return -1;
 	}
 
 	/* remove trailing and leading whitespace from keys
 	   and values, adjusting length as necessary */
 	for (i = 0; i < q->i; i++) {
-		if (fill = q->pairs[i].key) {
+		if ((fill = q->pairs[i].key) != NULL) {
 			/* leading space on key */
 			while (*fill == ' ') fill++;
 			if (!*fill) {
@@ -298,7 +331,7 @@ qname_parse(const char *s)
 				         K1 -> K2 (on whitespace) state transition in the FSM,
 				         but it doesn't hurt to be cautious. */
 				debugf("key %d was pure whitespace\n", i+1);
-				goto cleanup;
+				return -1;
 			}
 			q->pairs[i].key = fill;
 
@@ -306,7 +339,7 @@ qname_parse(const char *s)
 			while (*fill) fill++; fill--; while (*fill == ' ') *fill-- = '\0';
 		}
 
-		if (fill = q->pairs[i].value) {
+		if ((fill = q->pairs[i].value) != NULL) {
 			/* leading space on value */
 			while (*fill == ' ') fill++;
 			q->pairs[i].value = fill;
@@ -323,8 +356,48 @@ qname_parse(const char *s)
 		while (j > 0 && strcmp(q->pairs[j-1].key, q->pairs[j].key) > 0) {
 			swap(q->pairs[j-1].key,   q->pairs[j].key);
 			swap(q->pairs[j-1].value, q->pairs[j].value);
+			j--;
 		}
 	}
+	return 0;
+}
+
+
+/**
+   Parse a qualified name from an input string,
+   returning the `struct qname *` that results,
+   or NULL on error, with `errno` set appropriately.
+
+   This function allocates memory, and may fail
+   if insufficient memory is available.
+ **/
+struct qname *
+qname_parse(const char *s)
+{
+	struct qname *q;
+	size_t len;
+
+	if (!s) return NULL;
+	len = strlen(s);
+	if (len > QNAME_MAX_LEN) {
+		debugf("input string %p is %lu octets long (>%u)\n", s, len, QNAME_MAX_LEN);
+		return NULL;
+	}
+
+	q = qname_new();
+	if (!q) return NULL;
+
+	/* leave room after the name for its canonical form */
+	q->len  = len + 1;
+	q->cap  = 2 * (len + 1);
+	q->flat = malloc(q->cap);
+	if (!q->flat) goto cleanup;
+
+	if (s_qname_parse(q, q->flat, s, len) != 0) {
+		errno = EINVAL;
+		goto cleanup;
+	}
+	s_qname_settle(q);
 	return q;
 
 cleanup:
@@ -333,6 +406,69 @@ cleanup:
 }
 
 
+/**
+   Parse the first `len` octets of `s` into the caller-supplied
+   qname structure `q`, using the `cap` octets of `scratch` to
+   store the metric name, keys and values.  Parsing stops early
+   if a NUL octet is found, so `s` can point straight into the
+   data of a TSDP STRING frame, terminated or not.
+
+   `scratch` must be able to hold `len + 1` octets, and must
+   outlive `q`; the qname will refer to it, not to a copy.
+
+   This function never allocates memory.  Previous contents of
+   `q` are discarded (without being freed), so callers who wish
+   to reuse a qname should pass it through `qname_clear()` first.
+
+   Returns 0 on success, or -1 on failure, and sets `errno`:
+
+     EINVAL   Arguments were NULL, or `s` is not a valid qname.
+     ENOBUFS  `scratch` is too small, or `len` exceeds the
+              maximum length of a qname (QNAME_MAX_LEN).
+ **/
+int
+qname_parse_into(struct qname *q, char *scratch, size_t cap, const char *s, size_t len)
+{
+	errno = EINVAL;
+	if (!q || !scratch || !s) return -1;
+
+	errno = ENOBUFS;
+	if (len > QNAME_MAX_LEN || cap < len + 1) return -1;
+
+	memset(q, 0, sizeof(struct qname));
+	q->len      = len + 1;
+	q->cap      = cap;
+	q->flat     = scratch;
+	q->borrowed = 1;
+
+	if (s_qname_parse(q, scratch, s, len) != 0) {
+		errno = EINVAL;
+		memset(q, 0, sizeof(struct qname));
+		return -1;
+	}
+	s_qname_settle(q);
+	return 0;
+}
+
+
+/**
+  Resets a qualified name structure to the empty state,
+  releasing any memory it owns (but not caller-supplied
+  scratch storage), so that it can be reused by a call to
+  `qname_parse_into()`.  Unlike `qname_free()`, the
+  structure itself is not freed.
+ **/
+void
+qname_clear(struct qname *q)
+{
+	if (!q) return;
+
+	s_qname_touch(q);
+	if (!q->borrowed) free(q->flat);
+	memset(q, 0, sizeof(struct qname));
+}
+
+
 /**
    Duplicate a qualified name into a newly allocated
    qname structure.
@@ -351,35 +487,31 @@ qname_dup(struct qname *q)
 	dup = malloc(sizeof(struct qname));
 	if (!dup) return NULL;
 
-	dup->wild = q->wild;
-	dup->i    = q->i;
-
-	if (!q->flat) { /* expanded */
-		dup->flat = NULL;
-		dup->metric = q->metric ? strdup(q->metric) : NULL;
-		for (i = 0; i < q->i; i++) {
-			dup->pairs[i].key   = strdup(q->pairs[i].key);
-			dup->pairs[i].value = q->pairs[i].value;
-			if (dup->pairs[i].value && dup->pairs[i].value != __QNAME_WILDCARD)
-				dup->pairs[i].value = strdup(dup->pairs[i].value);
-		}
-	} else { /* contracted */
-		dup->len = q->len;
-		dup->flat = malloc(dup->len);
-		if (!dup->flat) {
-			qname_free(dup);
-			return NULL;
-		}
-		memcpy(dup->flat, q->flat, dup->len);
-		dup->metric = q->metric - q->flat + dup->flat;
-		for (i = 0; i < q->i; i++) {
-			dup->pairs[i].key   = q->pairs[i].key - q->flat + dup->flat;
-			dup->pairs[i].value = q->pairs[i].value;
-			if (q->pairs[i].value && q->pairs[i].value != __QNAME_WILDCARD)
-				dup->pairs[i].value = dup->pairs[i].value - q->flat + dup->flat;
-		}
+	memcpy(dup, q, sizeof(struct qname));
+	dup->borrowed = 0;
+	dup->canon    = NULL;
+	dup->clen     = 0;
+	if (!q->flat) return dup; /* empty */
+
+	dup->len  = q->len;
+	dup->cap  = q->len + q->clen + 1;
+	dup->flat = malloc(dup->cap);
+	if (!dup->flat) {
+		free(dup);
+		return NULL;
+	}
+	memcpy(dup->flat, q->flat, dup->len);
+
+#define rebase(p) ((p) - q->flat + dup->flat)
+	if (q->metric) dup->metric = rebase(q->metric);
+	for (i = 0; i < q->i; i++) {
+		dup->pairs[i].key = rebase(q->pairs[i].key);
+		if (s_in_flat(q, q->pairs[i].value))
+			dup->pairs[i].value = rebase(q->pairs[i].value);
 	}
+#undef rebase
 
+	s_qname_settle(dup);
 	return dup;
 }
 
@@ -391,18 +523,74 @@ qname_dup(struct qname *q)
 void
 qname_free(struct qname *q)
 {
-	int i;
 	if (!q) return;
 
-	if (q->flat) free(q->flat);
-	else {
-		free(q->metric);
-		for (i = 0; i < q->i; i++) {
-			qfree(q->pairs[i].key);
-			qfree(q->pairs[i].value);
+	s_qname_touch(q);
+	if (!q->borrowed) free(q->flat);
+	free(q);
+}
+
+
+/* render the canonical form of `q` into the first `cap` octets
+   of `buf` (always NUL-terminating, if `cap` is non-zero), and
+   return the length of the full canonical form, sans NUL, even
+   if it did not all fit. */
+static size_t
+s_qname_render(struct qname *q, char *buf, size_t cap)
+{
+	int i;
+	size_t n;
+
+	n = 0;
+#define put(c) do { if (n < cap) buf[n] = (c); n++; } while (0)
+#define copy(s) do { \
+	const char *__s = (s); \
+	for (; *__s; __s++) put(*__s); \
+} while (0)
+
+	if (q->metric) copy(q->metric);
+	put(' ');
+	for (i = 0; i < q->i; i++) {
+		copy(q->pairs[i].key);
+		if (q->pairs[i].value) {
+			put('=');
+			copy(q->pairs[i].value);
 		}
+		put(',');
 	}
-	free(q);
+	if (q->wild) put('*');
+	else n--;
+
+	if (cap > 0) buf[n < cap ? n : cap - 1] = '\0';
+	return n;
+#undef copy
+#undef put
+}
+
+/* build (if necessary) and return the cached canonical form
+   of `q`, for s_qname_settle().  The cache goes into the slack
+   space at the end of flat, which is grown to make room for it
+   if need be, unless flat is borrowed (copying a borrowed name
+   out of its storage just to cache it would defeat the point
+   of borrowing).  Returns NULL if the form could not be cached. */
+static const char *
+s_qname_canon(struct qname *q)
+{
+	size_t len;
+	char *old;
+
+	if (q->canon) return q->canon;
+
+	len = q->flat ? s_qname_render(q, q->flat + q->len, q->cap - q->len)
+	              : s_qname_render(q, NULL, 0);
+	if (!q->flat || len >= q->cap - q->len) {
+		if (q->borrowed || s_qname_reserve(q, len + 1, &old) != 0) return NULL;
+		free(old);
+		s_qname_render(q, q->flat + q->len, len + 1);
+	}
+	q->canon = q->flat + q->len;
+	q->clen  = len;
+	return q->canon;
 }
 
 
@@ -411,48 +599,82 @@ qname_free(struct qname *q)
   contains the canonical representation of the
   given qualified name.
 
+  The canonical form is rendered and cached inside
+  the qname when it is parsed or modified, so calls
+  only cost an allocation and a copy.  Names parsed
+  into borrowed storage only cache it if their
+  scratch buffer has room to spare; otherwise it is
+  rendered afresh, every time.
+
+  This never modifies the qname, so any number of
+  threads may stringify a shared qname at once (so
+  long as none of them is modifying it).
+
   Returns the empty string for a null qname.
  **/
 char *
 qname_string(struct qname *q)
 {
-	int i;
+	const char *c;
+	char *s;
 	size_t len;
-	char *f, *s;
 
 	if (!q) return strdup("");
 
-	len = strlen(q->metric) + 1;
-	for (i = 0; i < q->i; i++) {
-		len += strlen(q->pairs[i].key)   + 1;
-		if (q->pairs[i].value)
-			len += strlen(q->pairs[i].value) + 1;
+	c = q->canon;
+	if (!c) {
+		/* uncacheable; render a one-off */
+		len = s_qname_render(q, NULL, 0);
+		s = malloc(len + 1);
+		if (!s) return NULL;
+		s_qname_render(q, s, len + 1);
+		return s;
 	}
-	if (q->wild) len += 2;
 
-	s = malloc(len);
+	s = malloc(q->clen + 1);
 	if (!s) return NULL;
 
-	f = s;
-#define copy(s) do { \
-	memcpy(f, (s), strlen(s)); \
-	f += strlen(s); \
-} while (0);
+	memcpy(s, c, q->clen + 1);
+	return s;
+}
 
-	copy(q->metric); *f++ = ' ';
-	for (i = 0; i < q->i; i++) {
-		copy(q->pairs[i].key);
-		if (q->pairs[i].value) {
-			*f++ = '=';
-			copy(q->pairs[i].value);
+
+/**
+  Writes the canonical representation of the given
+  qualified name into the first `len` octets of `buf`,
+  always null-terminating it (unless `len` is 0).
+
+  Returns the length of the canonical form, not
+  counting the null terminator.  If this is not less
+  than `len`, truncation has occurred.  As with
+  `tsdp_msg_pack()`, it is valid to pass `buf` as NULL
+  and `len` as 0 to find out how much room is needed.
+
+  This function never allocates memory (or modifies
+  the qname); the cached canonical form (see
+  `qname_string()`) is copied, if there is one,
+  otherwise the name is rendered in place.
+
+  A null qname renders as the empty string.
+ **/
+size_t
+qname_string_into(struct qname *q, char *buf, size_t len)
+{
+	if (!buf) len = 0;
+	if (!q) {
+		if (len > 0) *buf = '\0';
+		return 0;
+	}
+
+	if (q->canon) {
+		if (len > 0) {
+			size_t n = q->clen < len ? q->clen : len - 1;
+			memcpy(buf, q->canon, n);
+			buf[n] = '\0';
 		}
-		*f++ = ',';
+		return q->clen;
 	}
-	if (q->wild) *f++ = '*';
-	else f--;
-	*f = '\0';
-	return s;
-#undef copy
+	return s_qname_render(q, buf, len);
 }
 
 
@@ -557,54 +779,124 @@ qname_match(struct qname *qn, struct qname *pattern)
 
 
 
-int
-qname_set(struct qname *q, const char *key, const char *value)
+/**
+  Sets the value of `key` in the qualified name to `value`,
+  adding the key (in lexical order) if it is not already
+  present.  A `value` of "*" makes the key a wildcard, and a
+  NULL `value` leaves the key without a value.
+
+  Modifications work directly on the flat buffer of the
+  qname: shorter (or equal length) values overwrite old ones
+  in place, and new keys and longer values go into the slack
+  space at the end of the buffer.  Only when that runs out is
+  a new buffer allocated (with plenty of slack, for next time),
+  which is also how names in borrowed storage are copied out
+  of it, on their first growth.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+static int
+s_qname_set(struct qname *q, const char *key, const char *value)
 {
-	int i;
+	int i, c, wild;
+	size_t klen, vlen;
+	char *old, *cur;
 
-	errno = EINVAL;
-	if (!q) return -1;
-	s_qname_expand(q);
+	s_qname_touch(q);
 
-	for (i = 0; i < q->i; i++) {
-		if (strcmp(q->pairs[i].key, key) == 0) {
-			free(q->pairs[i].value);
-			q->pairs[i].value = value ? strdup(value) : NULL;
+	wild = value && strcmp(value, __QNAME_WILDCARD) == 0;
+	klen = strlen(key);
+	vlen = value && !wild ? strlen(value) : 0;
+
+	/* pairs are kept in lexical order; find our key,
+	   or the place it ought to go. */
+	c = 1;
+	for (i = 0; i < q->i; i++)
+		if ((c = strcmp(q->pairs[i].key, key)) >= 0)
+			break;
+
+	if (i < q->i && c == 0) {
+		cur = q->pairs[i].value;
+		if (!value || wild) {
+			q->pairs[i].value = wild ? __QNAME_WILDCARD : NULL;
+			return 0;
+		}
+		if (s_in_flat(q, cur) && strlen(cur) >= vlen) {
+			memmove(cur, value, vlen);
+			cur[vlen] = '\0';
 			return 0;
 		}
+
+		errno = ENOMEM;
+		if (s_qname_reserve(q, vlen + 1, &old) != 0) return -1;
+		q->pairs[i].value = s_qname_store(q, value, vlen);
+		free(old);
+		return 0;
 	}
+
 	if (q->i + 1 >= QNAME_MAX_PAIRS) {
 		errno = ENOBUFS;
 		return -1;
 	}
 
-	q->pairs[q->i].key = strdup(key);
-	q->pairs[q->i].value = strcmp(value, __QNAME_WILDCARD) == 0
-	                     ? __QNAME_WILDCARD
-	                     : value ? strdup(value) : NULL;
+	errno = ENOMEM;
+	if (s_qname_reserve(q, klen + 1 + (vlen ? vlen + 1 : 1), &old) != 0) return -1;
+
+	for (c = q->i; c > i; c--) {
+		q->pairs[c].key   = q->pairs[c-1].key;
+		q->pairs[c].value = q->pairs[c-1].value;
+	}
+	q->pairs[i].key   = s_qname_store(q, key, klen);
+	q->pairs[i].value = !value ? NULL
+	                  : wild   ? __QNAME_WILDCARD
+	                  :          s_qname_store(q, value, vlen);
 	q->i++;
+	free(old);
 	return 0;
 }
 
 
+int
+qname_set(struct qname *q, const char *key, const char *value)
+{
+	errno = EINVAL;
+	if (!q || !key) return -1;
+
+	if (s_qname_set(q, key, value) != 0) {
+		s_qname_settle(q);
+		return -1;
+	}
+	s_qname_settle(q);
+	return 0;
+}
+
+
+/**
+  Removes `key` (and its value) from the qualified name.
+  It is not an error if the key is not present.
+
+  This never allocates memory; the space the pair took
+  up in the flat buffer is reclaimed the next time that
+  buffer has to grow.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
 int
 qname_unset(struct qname *q, const char *key)
 {
 	int i, j;
 	errno = EINVAL;
-	if (!q) return -1;
-	s_qname_expand(q);
+	if (!q || !key) return -1;
 
 	for (i = 0; i < q->i; i++) {
 		if (strcmp(q->pairs[i].key, key) == 0) {
-			qfree(q->pairs[i].key);
-			qfree(q->pairs[i].value);
-
+			s_qname_touch(q);
 			for (j = i+1; j < q->i; j++) {
 				q->pairs[j-1].key   = q->pairs[j].key;
 				q->pairs[j-1].value = q->pairs[j].value;
 			}
 			q->i--;
+			s_qname_settle(q);
 			return 0;
 		}
 	}
@@ -627,20 +919,262 @@ qname_get(struct qname *q, const char *key)
 }
 
 
+/**
+  Merges the key/value pairs of `b` into `a`, overriding
+  the values of any keys they have in common.  `b` is
+  left untouched.
+
+  Space for all of the pairs in `b` is reserved up front,
+  so a merge costs at most one allocation.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
 int
 qname_merge(struct qname *a, struct qname *b)
 {
 	int i, rc;
+	size_t need;
+	char *old;
+
 	errno = EINVAL;
 	if (!a || !b) return -1;
-	s_qname_expand(a);
-	s_qname_expand(b);
+	if (a == b) return 0;
+	s_qname_touch(a);
+
+	need = 0;
+	for (i = 0; i < b->i; i++) {
+		if (!b->pairs[i].key) continue;
+		need += strlen(b->pairs[i].key) + 1;
+		if (s_in_flat(b, b->pairs[i].value))
+			need += strlen(b->pairs[i].value) + 1;
+		else
+			need++;
+	}
+	errno = ENOMEM;
+	if (s_qname_reserve(a, need, &old) != 0) return -1;
 
 	for (i = 0; i < b->i; i++) {
 		if (b->pairs[i].key) {
-			rc = qname_set(a, b->pairs[i].key, b->pairs[i].value);
-			if (rc != 0) return rc;
+			rc = s_qname_set(a, b->pairs[i].key, b->pairs[i].value);
+			if (rc != 0) {
+				s_qname_settle(a);
+				free(old);
+				return rc;
+			}
 		}
 	}
+	s_qname_settle(a);
+	free(old);
 	return 0;
 }
+
+
+/* a contiguous slice of the inputs to qname_parse_many(),
+   to be parsed by a single thread. */
+struct s_arena_job {
+	struct qname_arena *arena;
+	const char  **src;  /* input strings                      */
+	const size_t *lens; /* lengths of each input string       */
+	const size_t *offs; /* where each name goes in arena->buf */
+	size_t lo, hi;      /* [lo, hi) range of inputs to parse  */
+	size_t failed;      /* how many inputs failed to parse    */
+};
+
+static void *
+s_arena_parse(void *_job)
+{
+	struct s_arena_job *job = (struct s_arena_job *)_job;
+	size_t i;
+
+	for (i = job->lo; i < job->hi; i++) {
+		if (qname_parse_into(&job->arena->names[i],
+		                     job->arena->buf + job->offs[i], job->lens[i] + 1,
+		                     job->src[i], job->lens[i]) != 0)
+			job->failed++;
+	}
+	return NULL;
+}
+
+static struct qname_arena *
+s_arena_build(const char **src, const size_t *lens, size_t n, int threads)
+{
+	struct qname_arena *a;
+	struct s_arena_job *jobs;
+	pthread_t *tids;
+	int *started;
+	size_t i, total, *offs;
+	int t;
+
+	a = calloc(1, sizeof(struct qname_arena));
+	if (!a) return NULL;
+
+	total = 0;
+	offs = malloc((n ? n : 1) * sizeof(size_t));
+	if (!offs) goto fail;
+	for (i = 0; i < n; i++) {
+		offs[i] = total;
+		if (lens[i] <= QNAME_MAX_LEN)
+			total += lens[i] + 1;
+	}
+
+	a->n     = n;
+	a->names = calloc(n ? n : 1, sizeof(struct qname));
+	a->buf   = malloc(total ? total : 1);
+	if (!a->names || !a->buf) goto fail;
+
+	if (threads < 1) threads = 1;
+	if ((size_t)threads > n) threads = n ? n : 1;
+
+	jobs    = calloc(threads, sizeof(struct s_arena_job));
+	tids    = calloc(threads, sizeof(pthread_t));
+	started = calloc(threads, sizeof(int));
+	if (!jobs || !tids || !started) {
+		free(jobs); free(tids); free(started);
+		goto fail;
+	}
+
+	for (t = 0; t < threads; t++) {
+		jobs[t].arena = a;
+		jobs[t].src   = src;
+		jobs[t].lens  = lens;
+		jobs[t].offs  = offs;
+		jobs[t].lo    = n *  t      / threads;
+		jobs[t].hi    = n * (t + 1) / threads;
+	}
+
+	/* the calling thread takes the first slice itself; if we
+	   can't start a thread for any other slice, it does that
+	   one too, once it's done with its own. */
+	for (t = 1; t < threads; t++)
+		started[t] = pthread_create(&tids[t], NULL, s_arena_parse, &jobs[t]) == 0;
+	s_arena_parse(&jobs[0]);
+	for (t = 1; t < threads; t++) {
+		if (started[t]) pthread_join(tids[t], NULL);
+		else            s_arena_parse(&jobs[t]);
+	}
+
+	for (t = 0; t < threads; t++)
+		a->failed += jobs[t].failed;
+
+	free(jobs);
+	free(tids);
+	free(started);
+	free(offs);
+	return a;
+
+fail:
+	free(offs);
+	qname_arena_free(a);
+	return NULL;
+}
+
+
+/**
+  Parses `n` qualified names, from the strings in `s`, into a
+  single arena.  All of the names share one backing buffer, and
+  the whole set is freed at once with `qname_arena_free()`, at a
+  cost that does not depend on how many names were parsed.
+
+  The parsed names are found in `names[0]` through `names[n-1]`
+  of the returned arena, in the same order as their inputs.  If
+  an input fails to parse, its slot is left zeroed (and so will
+  never be equal to, or match, anything), and the `failed`
+  counter of the arena is incremented.
+
+  If `threads` is greater than 1, parsing is split across that
+  many threads (including the caller's).
+
+  Names in an arena share storage.  They can be modified, but
+  any name that outgrows its share of the backing buffer (via
+  `qname_set()` or `qname_merge()`) is copied out to the heap,
+  and must be passed through `qname_clear()` before the arena
+  is freed.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct qname_arena *
+qname_parse_many(const char **s, size_t n, int threads)
+{
+	struct qname_arena *a;
+	size_t i, *lens;
+
+	errno = EINVAL;
+	if (!s) return NULL;
+
+	lens = malloc((n ? n : 1) * sizeof(size_t));
+	if (!lens) return NULL;
+	for (i = 0; i < n; i++)
+		lens[i] = s[i] ? strlen(s[i]) : 0;
+
+	a = s_arena_build(s, lens, n, threads);
+	free(lens);
+	return a;
+}
+
+
+/**
+  Parses a buffer of `len` octets, containing newline-separated
+  qualified names (as might be read, whole, from a snapshot or a
+  configuration file) into a single arena.  Blank lines are
+  skipped; carriage returns before each newline are ignored.
+
+  Otherwise, behaves exactly like `qname_parse_many()`, with
+  `names[i]` holding the i-th non-blank line.
+ **/
+struct qname_arena *
+qname_parse_lines(const char *buf, size_t len, int threads)
+{
+	struct qname_arena *a;
+	const char *p, *end, *nl, **src;
+	size_t n, *lens;
+
+	errno = EINVAL;
+	if (!buf) return NULL;
+
+	n = 0;
+	end = buf + len;
+	for (p = buf; p < end; p = nl + 1) {
+		nl = memchr(p, '\n', end - p);
+		if (!nl) nl = end;
+		if (nl > p && !(nl == p + 1 && *p == '\r')) n++;
+	}
+
+	src  = malloc((n ? n : 1) * sizeof(char *));
+	lens = malloc((n ? n : 1) * sizeof(size_t));
+	if (!src || !lens) {
+		free(src);
+		free(lens);
+		return NULL;
+	}
+
+	n = 0;
+	for (p = buf; p < end; p = nl + 1) {
+		nl = memchr(p, '\n', end - p);
+		if (!nl) nl = end;
+		src[n]  = p;
+		lens[n] = nl - p;
+		if (lens[n] > 0 && p[lens[n] - 1] == '\r') lens[n]--;
+		if (lens[n] > 0) n++;
+	}
+
+	a = s_arena_build(src, lens, n, threads);
+	free(src);
+	free(lens);
+	return a;
+}
+
+
+/**
+  Frees an arena of qualified names, and all of the names
+  in it, in one go.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+qname_arena_free(struct qname_arena *a)
+{
+	if (!a) return;
+	free(a->names);
+	free(a->buf);
+	free(a);
+}
@@ -0,0 +1,536 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "bytes.h"
+
+/* on-disk (and in-memory) layout, all integers in network
+   byte order:
+
+     0   8  magic ("TSDPQSET")
+     8   4  format version (1)
+    12   4  names per block
+    16   8  number of names
+    24   8  number of blocks
+    32   8  length of the block data
+    40  8n  offset of each block, from the start of block data
+     .   .  block data
+
+   Each block starts with a name, in full (varint length,
+   then octets); each name after that is stored as the
+   length of the prefix it shares with its predecessor,
+   and the remaining suffix (varint, varint, octets). */
+#define QSET_MAGIC    "TSDPQSET"
+#define QSET_VERSION  1
+#define QSET_HEADER   40
+#define QSET_BLOCK    16
+
+struct tsdp_qset {
+	const unsigned char *base;    /* start of encoded form       */
+	size_t               size;    /* ... and its length          */
+	int                  mapped;  /* mmap'd (1) or malloc'd (0)? */
+
+	uint32_t             bsize;   /* names per block             */
+	uint64_t             n;       /* total number of names       */
+	uint64_t             nblocks;
+	const unsigned char *offsets;
+	const unsigned char *data;
+	uint64_t             dlen;
+};
+
+/* sequential decoder, for walking the names of a block */
+struct s_cursor {
+	const unsigned char *p, *end;
+	uint32_t left;                /* names left in this block    */
+	int      first;               /* next name is stored in full */
+	size_t   len;
+	char     name[QNAME_MAX_LEN + 1];
+};
+
+static int
+s_block(const struct tsdp_qset *s, struct s_cursor *c, uint64_t b)
+{
+	uint64_t start, end;
+
+	start = get64(s->offsets + 8 * b);
+	end   = b + 1 < s->nblocks ? get64(s->offsets + 8 * (b + 1)) : s->dlen;
+	if (start > end || end > s->dlen) return -1;
+
+	c->p    = s->data + start;
+	c->end  = s->data + end;
+	c->left = b + 1 < s->nblocks ? s->bsize : (uint32_t)(s->n - b * s->bsize);
+	c->len  = 0;
+	c->first = 1;
+	return 0;
+}
+
+/* decode the next name of the block into c->name;
+   returns 1 if there was one, 0 if not, -1 on corruption */
+static int
+s_next(struct s_cursor *c)
+{
+	uint64_t shared, suffix;
+
+	if (c->left == 0) return 0;
+
+	shared = 0;
+	if (!c->first && getvar(&c->p, c->end, &shared) != 0) return -1;
+	if (getvar(&c->p, c->end, &suffix) != 0) return -1;
+	if (shared > c->len || suffix > (uint64_t)(c->end - c->p)
+	 || shared + suffix > QNAME_MAX_LEN) return -1;
+
+	memcpy(c->name + shared, c->p, suffix);
+	c->p  += suffix;
+	c->len = shared + suffix;
+	c->name[c->len] = '\0';
+	c->first = 0;
+	c->left--;
+	return 1;
+}
+
+static int
+s_cmp(const char *a, size_t la, const char *b, size_t lb)
+{
+	int rc = memcmp(a, b, la < lb ? la : lb);
+	if (rc != 0) return rc;
+	return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+/* find the block that `key` would be in: the last block whose
+   first name is not greater than `key` (or block 0) */
+static int64_t
+s_seek(const struct tsdp_qset *s, const char *key, size_t len)
+{
+	struct s_cursor c;
+	int64_t lo, hi, mid, found;
+
+	found = 0;
+	lo = 0; hi = (int64_t)s->nblocks - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (s_block(s, &c, mid) != 0 || s_next(&c) != 1) return -1;
+		if (s_cmp(c.name, c.len, key, len) <= 0) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return found;
+}
+
+static int
+s_names_cmp(const void *a, const void *b)
+{
+	const char *x = *(const char **)a, *y = *(const char **)b;
+	return strcmp(x, y);
+}
+
+/* validate the header of an encoded set, and fill out
+   the rest of `s` from it */
+static int
+s_header(struct tsdp_qset *s)
+{
+	if (s->size < QSET_HEADER || memcmp(s->base, QSET_MAGIC, 8) != 0) return -1;
+	if (get32(s->base + 8) != QSET_VERSION) return -1;
+
+	s->bsize   = get32(s->base + 12);
+	s->n       = get64(s->base + 16);
+	s->nblocks = get64(s->base + 24);
+	s->dlen    = get64(s->base + 32);
+
+	if (s->bsize == 0 || s->nblocks != (s->n + s->bsize - 1) / s->bsize) return -1;
+	if (s->nblocks > (s->size - QSET_HEADER) / 8) return -1;
+	if (s->dlen != s->size - QSET_HEADER - 8 * s->nblocks) return -1;
+
+	s->offsets = s->base + QSET_HEADER;
+	s->data    = s->offsets + 8 * s->nblocks;
+	return 0;
+}
+
+
+/**
+  Builds an immutable, sorted set of the canonical forms of
+  the `n` qualified names in `names`, skipping duplicates.
+
+  Names are front-coded: within each block of 16 names, each
+  is stored as the length of the prefix it shares with the
+  previous name, and the rest.  Since sorted series names
+  tend to share their metric name and leading tags, this
+  usually takes a fraction of the space of the strings
+  themselves.  The first name of each block is stored in full,
+  so that names can be found by binary search.
+
+  The encoded form is position-independent, and can be
+  written out with `tsdp_qset_write()` and mapped back into
+  memory, without parsing, by `tsdp_qset_open()`.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_qset *
+tsdp_qset_build(struct qname **names, size_t n)
+{
+	struct tsdp_qset *s;
+	char **strings, *prev;
+	unsigned char *buf, *p;
+	size_t i, m, len, plen, shared, total, size;
+	uint64_t nblocks, b;
+	int ok = 0;
+
+	errno = EINVAL;
+	if (!names && n > 0) return NULL;
+
+	errno = ENOMEM;
+	strings = calloc(n ? n : 1, sizeof(char *));
+	if (!strings) return NULL;
+
+	s = NULL;
+	buf = NULL;
+	total = 0;
+	for (i = 0; i < n; i++) {
+		errno = EINVAL;
+		if (!names[i] || !names[i]->metric) goto done;
+		len = qname_string_into(names[i], NULL, 0);
+		if (len > QNAME_MAX_LEN) goto done;
+
+		errno = ENOMEM;
+		strings[i] = malloc(len + 1);
+		if (!strings[i]) goto done;
+		qname_string_into(names[i], strings[i], len + 1);
+		total += len;
+	}
+
+	/* sort, and drop the duplicates */
+	qsort(strings, n, sizeof(char *), s_names_cmp);
+	for (i = m = 0; i < n; i++) {
+		if (m > 0 && strcmp(strings[i], strings[m - 1]) == 0) {
+			free(strings[i]);
+			continue;
+		}
+		strings[m++] = strings[i];
+	}
+	for (i = m; i < n; i++) strings[i] = NULL;
+
+	/* every name costs at most two varints, and its octets */
+	nblocks = (m + QSET_BLOCK - 1) / QSET_BLOCK;
+	size = QSET_HEADER + 8 * nblocks + total + 2 * VARINT_MAX * m;
+
+	errno = ENOMEM;
+	s   = calloc(1, sizeof(struct tsdp_qset));
+	buf = malloc(size);
+	if (!s || !buf) goto done;
+
+	p = buf + QSET_HEADER + 8 * nblocks;
+	prev = NULL; plen = 0;
+	for (i = 0, b = 0; i < m; i++) {
+		len = strlen(strings[i]);
+		if (i % QSET_BLOCK == 0) {
+			put64(buf + QSET_HEADER + 8 * b++, p - (buf + QSET_HEADER + 8 * nblocks));
+			p += putvar(p, len);
+			memcpy(p, strings[i], len);
+			p += len;
+
+		} else {
+			for (shared = 0; shared < len && shared < plen && strings[i][shared] == prev[shared]; shared++)
+				;
+			p += putvar(p, shared);
+			p += putvar(p, len - shared);
+			memcpy(p, strings[i] + shared, len - shared);
+			p += len - shared;
+		}
+		prev = strings[i]; plen = len;
+	}
+
+	memcpy(buf, QSET_MAGIC, 8);
+	put32(buf +  8, QSET_VERSION);
+	put32(buf + 12, QSET_BLOCK);
+	put64(buf + 16, m);
+	put64(buf + 24, nblocks);
+	put64(buf + 32, p - (buf + QSET_HEADER + 8 * nblocks));
+
+	/* give back what the worst-case estimate didn't use */
+	size = p - buf;
+	if ((p = realloc(buf, size ? size : 1)) != NULL) buf = p;
+
+	s->base = buf;
+	s->size = size;
+	if (s_header(s) != 0) { /* can't happen */
+		errno = EINVAL;
+		goto done;
+	}
+	ok = 1;
+
+done:
+	for (i = 0; i < n; i++)
+		free(strings[i]);
+	free(strings);
+	if (!ok) {
+		free(buf);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+
+/**
+  Maps the qname set previously written to the file at `path`
+  (see `tsdp_qset_write()`) into memory.  Nothing is decoded
+  up front; names are decoded as they are looked up.
+
+  Returns NULL on failure, and sets `errno`.  A file that
+  is not a valid qname set fails with EINVAL.
+ **/
+struct tsdp_qset *
+tsdp_qset_open(const char *path)
+{
+	struct tsdp_qset *s;
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size < QSET_HEADER) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return NULL;
+
+	s = calloc(1, sizeof(struct tsdp_qset));
+	if (!s) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+	s->base   = base;
+	s->size   = st.st_size;
+	s->mapped = 1;
+	if (s_header(s) != 0) {
+		tsdp_qset_free(s);
+		errno = EINVAL;
+		return NULL;
+	}
+	return s;
+}
+
+
+/**
+  Writes the encoded form of the qname set to the file
+  descriptor `fd`, for later use by `tsdp_qset_open()`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_qset_write(struct tsdp_qset *s, int fd)
+{
+	size_t off;
+	ssize_t n;
+
+	errno = EINVAL;
+	if (!s) return -1;
+
+	for (off = 0; off < s->size; off += n) {
+		n = write(fd, s->base + off, s->size - off);
+		if (n < 0) {
+			if (errno == EINTR) { n = 0; continue; }
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+  Frees (or unmaps) the qname set.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_qset_free(struct tsdp_qset *s)
+{
+	if (!s) return;
+	if (s->mapped) munmap((void *)s->base, s->size);
+	else           free((void *)s->base);
+	free(s);
+}
+
+
+/**
+  Returns how many (distinct) names are in the set.
+ **/
+size_t
+tsdp_qset_count(struct tsdp_qset *s)
+{
+	return s ? s->n : 0;
+}
+
+
+/**
+  Returns the size of the encoded form of the set, in octets.
+ **/
+size_t
+tsdp_qset_size(struct tsdp_qset *s)
+{
+	return s ? s->size : 0;
+}
+
+
+/**
+  Looks up the canonical form of `q` in the set, by binary
+  search over the first names of each block, followed by a
+  sequential scan of (at most) one block.
+
+  Returns the position of the name in the set (in sorted
+  order), or -1 if it is not in the set, and sets `errno`.
+ **/
+int64_t
+tsdp_qset_find(struct tsdp_qset *s, struct qname *q)
+{
+	struct s_cursor c;
+	char key[QNAME_MAX_LEN + 1];
+	size_t len;
+	int64_t b, i;
+	int rc;
+
+	errno = EINVAL;
+	if (!s || !q || !q->metric) return -1;
+
+	errno = ENOENT;
+	len = qname_string_into(q, key, sizeof(key));
+	if (len >= sizeof(key) || s->n == 0) return -1;
+
+	b = s_seek(s, key, len);
+	if (b < 0 || s_block(s, &c, b) != 0) goto corrupt;
+
+	for (i = 0; (rc = s_next(&c)) == 1; i++) {
+		rc = s_cmp(c.name, c.len, key, len);
+		if (rc == 0) return b * s->bsize + i;
+		if (rc > 0)  return -1;
+	}
+	if (rc == 0) return -1;
+
+corrupt:
+	errno = EINVAL;
+	return -1;
+}
+
+
+/**
+  Writes the `i`th name of the set (in sorted order) into the
+  first `len` octets of `buf`, always null-terminating it
+  (unless `len` is 0), as for `qname_string_into()`.
+
+  Returns the length of the name, not counting the null
+  terminator; if this is not less than `len`, truncation has
+  occurred.  Returns 0 (and sets `errno`) if there is no such
+  name.
+ **/
+size_t
+tsdp_qset_get(struct tsdp_qset *s, uint64_t i, char *buf, size_t len)
+{
+	struct s_cursor c;
+	uint64_t j;
+	size_t n;
+
+	if (!buf) len = 0;
+	if (len > 0) *buf = '\0';
+
+	errno = ENOENT;
+	if (!s || i >= s->n) return 0;
+
+	errno = EINVAL;
+	if (s_block(s, &c, i / s->bsize) != 0) return 0;
+	for (j = 0; j <= i % s->bsize; j++)
+		if (s_next(&c) != 1) return 0;
+
+	if (len > 0) {
+		n = c.len < len ? c.len : len - 1;
+		memcpy(buf, c.name, n);
+		buf[n] = '\0';
+	}
+	return c.len;
+}
+
+
+/**
+  Calls `fn` for every name in the set that starts with
+  `prefix`, in sorted order, stopping early if `fn` returns
+  non-zero.  Names are passed to `fn` null-terminated, and
+  are only valid for the duration of the call.
+
+  Returns the number of names visited, or -1 on failure,
+  and sets `errno`.
+ **/
+int64_t
+tsdp_qset_prefix(struct tsdp_qset *s, const char *prefix,
+                 int (*fn)(const char *name, size_t len, void *udata), void *udata)
+{
+	struct s_cursor c;
+	size_t len;
+	int64_t b, found;
+	int rc;
+
+	errno = EINVAL;
+	if (!s || !prefix || !fn) return -1;
+	if (s->n == 0) return 0;
+
+	len = strlen(prefix);
+	b = s_seek(s, prefix, len);
+	if (b < 0) return -1;
+
+	for (found = 0; (uint64_t)b < s->nblocks; b++) {
+		if (s_block(s, &c, b) != 0) return -1;
+		while ((rc = s_next(&c)) == 1) {
+			rc = memcmp(c.name, prefix, c.len < len ? c.len : len);
+			if (rc < 0 || (rc == 0 && c.len < len)) continue; /* not there yet */
+			if (rc > 0) return found;                         /* gone past */
+
+			found++;
+			if (fn(c.name, c.len, udata) != 0) return found;
+		}
+		if (rc < 0) return -1;
+	}
+	return found;
+}
+
+
+/**
+  Calls `fn` for every name in the set with the metric name
+  `metric`, in sorted order, as for `tsdp_qset_prefix()`.
+
+  Returns the number of names visited, or -1 on failure,
+  and sets `errno`.
+ **/
+int64_t
+tsdp_qset_metric(struct tsdp_qset *s, const char *metric,
+                 int (*fn)(const char *name, size_t len, void *udata), void *udata)
+{
+	char prefix[QNAME_MAX_LEN + 2];
+	size_t len;
+
+	errno = EINVAL;
+	if (!metric || (len = strlen(metric)) > QNAME_MAX_LEN) return -1;
+
+	/* canonical names separate the metric from the pairs
+	   with a single space */
+	memcpy(prefix, metric, len);
+	prefix[len]     = ' ';
+	prefix[len + 1] = '\0';
+	return tsdp_qset_prefix(s, prefix, fn, udata);
+}
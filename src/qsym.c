@@ -0,0 +1,499 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "hash.h"
+
+/* strings are copied into pools of this size, so that
+   they never move once they have been interned */
+#define SYMTAB_POOL_SIZE  65536
+#define SYMTAB_MIN_SLOTS   1024
+#define SYMTAB_MIN_SYMS     256
+
+struct s_pool {
+	struct s_pool *next;
+	size_t used, size;
+	char data[];
+};
+
+struct qname_symtab {
+	pthread_rwlock_t lock;
+
+	uint32_t  n;        /* number of ids handed out (incl. reserved) */
+	uint32_t  max;      /* allocated length of the per-id arrays     */
+	char    **strings;  /* id -> interned string                     */
+	uint32_t *lens;     /* id -> length of interned string           */
+	uint64_t *hashes;   /* id -> hash of interned string             */
+
+	uint32_t  nslots;   /* size of the hash table (a power of 2)     */
+	uint32_t *slots;    /* open-addressed; 0 is empty, else an id    */
+
+	struct s_pool *pool;
+};
+
+static char *
+s_pool_copy(struct qname_symtab *t, const char *s, size_t len)
+{
+	struct s_pool *p;
+	size_t size;
+	char *dst;
+
+	p = t->pool;
+	if (!p || p->size - p->used < len + 1) {
+		size = len + 1 > SYMTAB_POOL_SIZE ? len + 1 : SYMTAB_POOL_SIZE;
+		p = malloc(sizeof(struct s_pool) + size);
+		if (!p) return NULL;
+		p->size = size;
+		p->used = 0;
+
+		/* keep the fullest pools out of the way */
+		if (t->pool && size > SYMTAB_POOL_SIZE) {
+			p->next = t->pool->next;
+			t->pool->next = p;
+		} else {
+			p->next = t->pool;
+			t->pool = p;
+		}
+	}
+
+	dst = p->data + p->used;
+	memcpy(dst, s, len);
+	dst[len] = '\0';
+	p->used += len + 1;
+	return dst;
+}
+
+static int
+s_rehash(struct qname_symtab *t, uint32_t nslots)
+{
+	uint32_t *slots, id, i, mask;
+
+	slots = calloc(nslots, sizeof(uint32_t));
+	if (!slots) return -1;
+
+	mask = nslots - 1;
+	for (id = QNAME_SYM_ANY + 1; id < t->n; id++) {
+		for (i = t->hashes[id] & mask; slots[i]; i = (i + 1) & mask)
+			;
+		slots[i] = id;
+	}
+
+	free(t->slots);
+	t->slots  = slots;
+	t->nslots = nslots;
+	return 0;
+}
+
+/* look up (and, if `insert` is set, intern) a string; the
+   caller must hold the lock, for writing if `insert` is set.
+   returns the id, or 0 if not found (or on failure). */
+static uint32_t
+s_resolve(struct qname_symtab *t, const char *s, size_t len, int insert)
+{
+	uint64_t h;
+	uint32_t i, id, mask;
+	void *p;
+
+	h = hash64(s, len);
+	mask = t->nslots - 1;
+	for (i = h & mask; (id = t->slots[i]) != 0; i = (i + 1) & mask)
+		if (t->hashes[id] == h && t->lens[id] == len
+		 && memcmp(t->strings[id], s, len) == 0)
+			return id;
+
+	if (!insert) return 0;
+
+	errno = ENOSPC;
+	if (t->n == UINT32_MAX) return 0;
+
+	if (t->n == t->max) {
+		uint32_t max = t->max * 2;
+
+#define grow(a) do { \
+	p = realloc((a), max * sizeof(*(a))); \
+	if (!p) return 0; \
+	(a) = p; \
+} while (0)
+		grow(t->strings);
+		grow(t->lens);
+		grow(t->hashes);
+#undef grow
+		t->max = max;
+	}
+
+	id = t->n;
+	t->strings[id] = s_pool_copy(t, s, len);
+	if (!t->strings[id]) return 0;
+	t->lens[id]   = len;
+	t->hashes[id] = h;
+	t->n++;
+
+	/* keep the table at most half full */
+	if (t->n * 2 >= t->nslots) {
+		if (s_rehash(t, t->nslots * 2) != 0) {
+			t->n--;
+			return 0;
+		}
+	} else {
+		t->slots[i] = id;
+	}
+	return id;
+}
+
+
+/**
+  Allocates a new, empty symbol table, for mapping qualified
+  name metrics, keys and values to dense integer identifiers.
+
+  Identifiers 0 (QNAME_SYM_NONE) and 1 (QNAME_SYM_ANY) are
+  reserved to mean "no value" and "wildcard value"; interned
+  strings are numbered from 2, in the order they are seen.
+
+  Symbol tables can be shared between threads.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct qname_symtab *
+qname_symtab_new(void)
+{
+	struct qname_symtab *t;
+
+	t = calloc(1, sizeof(struct qname_symtab));
+	if (!t) return NULL;
+
+	t->max     = SYMTAB_MIN_SYMS;
+	t->strings = calloc(t->max, sizeof(char *));
+	t->lens    = calloc(t->max, sizeof(uint32_t));
+	t->hashes  = calloc(t->max, sizeof(uint64_t));
+	t->nslots  = SYMTAB_MIN_SLOTS;
+	t->slots   = calloc(t->nslots, sizeof(uint32_t));
+	if (!t->strings || !t->lens || !t->hashes || !t->slots)
+		goto fail;
+
+	if (pthread_rwlock_init(&t->lock, NULL) != 0)
+		goto fail;
+
+	t->strings[QNAME_SYM_NONE] = NULL;
+	t->strings[QNAME_SYM_ANY]  = "*";
+	t->lens[QNAME_SYM_ANY]     = 1;
+	t->n = QNAME_SYM_ANY + 1;
+	return t;
+
+fail:
+	free(t->strings);
+	free(t->lens);
+	free(t->hashes);
+	free(t->slots);
+	free(t);
+	return NULL;
+}
+
+
+/**
+  Frees a symbol table, and all of the strings interned in it.
+  Symbolized qnames built against the table can no longer be
+  turned back into strings.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+qname_symtab_free(struct qname_symtab *t)
+{
+	struct s_pool *p, *next;
+
+	if (!t) return;
+
+	for (p = t->pool; p; p = next) {
+		next = p->next;
+		free(p);
+	}
+	pthread_rwlock_destroy(&t->lock);
+	free(t->strings);
+	free(t->lens);
+	free(t->hashes);
+	free(t->slots);
+	free(t);
+}
+
+
+/**
+  Returns the identifier of the first `len` octets of `s`,
+  interning them into the symbol table if they have not been
+  seen before.
+
+  Returns 0 on failure, and sets `errno`.
+ **/
+uint32_t
+qname_symtab_intern(struct qname_symtab *t, const char *s, size_t len)
+{
+	uint32_t id;
+
+	errno = EINVAL;
+	if (!t || !s) return 0;
+
+	pthread_rwlock_rdlock(&t->lock);
+	id = s_resolve(t, s, len, 0);
+	pthread_rwlock_unlock(&t->lock);
+	if (id) return id;
+
+	pthread_rwlock_wrlock(&t->lock);
+	id = s_resolve(t, s, len, 1);
+	pthread_rwlock_unlock(&t->lock);
+	return id;
+}
+
+
+/**
+  Returns the identifier of the first `len` octets of `s`,
+  without interning them.
+
+  Returns 0 if the string is not in the symbol table.
+ **/
+uint32_t
+qname_symtab_lookup(struct qname_symtab *t, const char *s, size_t len)
+{
+	uint32_t id;
+
+	if (!t || !s) return 0;
+
+	pthread_rwlock_rdlock(&t->lock);
+	id = s_resolve(t, s, len, 0);
+	pthread_rwlock_unlock(&t->lock);
+	return id;
+}
+
+
+/**
+  Returns the (null-terminated) string interned as `id`, which
+  remains valid for the lifetime of the symbol table, or NULL
+  if there is no such identifier.
+ **/
+const char *
+qname_symtab_string(struct qname_symtab *t, uint32_t id)
+{
+	const char *s;
+
+	if (!t) return NULL;
+
+	pthread_rwlock_rdlock(&t->lock);
+	s = id < t->n ? t->strings[id] : NULL;
+	pthread_rwlock_unlock(&t->lock);
+	return s;
+}
+
+
+/**
+  Returns how many distinct strings have been interned.
+ **/
+size_t
+qname_symtab_size(struct qname_symtab *t)
+{
+	size_t n;
+
+	if (!t) return 0;
+
+	pthread_rwlock_rdlock(&t->lock);
+	n = t->n - (QNAME_SYM_ANY + 1);
+	pthread_rwlock_unlock(&t->lock);
+	return n;
+}
+
+
+/* resolve all of the strings in `q` into `s`; returns 0
+   if everything resolved, 1 if something was missing (and
+   `insert` was not set), or -1 on failure. */
+static int
+s_symbolize(struct qname_symtab *t, struct qname *q, struct qname_sym *s, int insert)
+{
+	const char *v;
+	int i;
+
+#define resolve(dst, str) do { \
+	if (!(dst)) { \
+		(dst) = s_resolve(t, (str), strlen(str), insert); \
+		if (!(dst)) return insert ? -1 : 1; \
+	} \
+} while (0)
+
+	resolve(s->metric, q->metric);
+	for (i = 0; i < q->i; i++) {
+		resolve(s->pairs[i].key, q->pairs[i].key);
+
+		v = q->pairs[i].value;
+		if (!v)                       s->pairs[i].value = QNAME_SYM_NONE;
+		else if (strcmp(v, "*") == 0) s->pairs[i].value = QNAME_SYM_ANY;
+		else                          resolve(s->pairs[i].value, v);
+	}
+	return 0;
+#undef resolve
+}
+
+
+/**
+  Builds a symbolized form of the qualified name `q`, with its
+  metric, keys and values replaced by their identifiers in the
+  symbol table `t` (interning any that are new).  Its key/value
+  pairs are sorted by key identifier, so that comparisons with
+  other symbolized names are simple integer comparisons.
+
+  The returned structure is allocated to fit the name exactly,
+  and must be freed by the caller, via `free(3)`.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct qname_sym *
+qname_sym_new(struct qname_symtab *t, struct qname *q)
+{
+	struct qname_sym *s;
+	uint32_t k, v;
+	int i, j, rc;
+
+	errno = EINVAL;
+	if (!t || !q || !q->metric) return NULL;
+
+	s = calloc(1, sizeof(struct qname_sym) + q->i * sizeof(s->pairs[0]));
+	if (!s) return NULL;
+	s->n    = q->i;
+	s->wild = q->wild;
+
+	pthread_rwlock_rdlock(&t->lock);
+	rc = s_symbolize(t, q, s, 0);
+	pthread_rwlock_unlock(&t->lock);
+
+	if (rc == 1) {
+		pthread_rwlock_wrlock(&t->lock);
+		rc = s_symbolize(t, q, s, 1);
+		pthread_rwlock_unlock(&t->lock);
+	}
+	if (rc != 0) {
+		free(s);
+		return NULL;
+	}
+
+	for (i = 1; i < s->n; i++) {
+		k = s->pairs[i].key;
+		v = s->pairs[i].value;
+		for (j = i; j > 0 && s->pairs[j-1].key > k; j--)
+			s->pairs[j] = s->pairs[j-1];
+		s->pairs[j].key   = k;
+		s->pairs[j].value = v;
+	}
+	return s;
+}
+
+
+/**
+  Returns non-zero if the two symbolized names are exactly
+  equivalent, with the same semantics as `qname_equal()`.
+  Both must have been built against the same symbol table.
+ **/
+int
+qname_sym_equal(struct qname_sym *a, struct qname_sym *b)
+{
+	if (!a || !b) return 0;
+	if (a->wild != b->wild || a->n != b->n || a->metric != b->metric) return 0;
+	return memcmp(a->pairs, b->pairs, a->n * sizeof(a->pairs[0])) == 0;
+}
+
+
+/**
+  Returns non-zero if the symbolized name `qn` matches the
+  symbolized `pattern`, with the same semantics as
+  `qname_match()`.  Both must have been built against the
+  same symbol table.
+
+  Since pairs are ordered by key identifier, this is a single
+  merge pass over the two pair arrays.
+ **/
+int
+qname_sym_match(struct qname_sym *qn, struct qname_sym *pattern)
+{
+	int i, j;
+
+	if (!qn || !pattern) return 0;
+	if (qn->metric != pattern->metric) return 0;
+	if (qn->n != pattern->n && !pattern->wild) return 0;
+
+	for (i = j = 0; i < pattern->n; i++) {
+		while (j < qn->n && qn->pairs[j].key < pattern->pairs[i].key) j++;
+		if (j == qn->n || qn->pairs[j].key != pattern->pairs[i].key)
+			return 0; /* pattern constraint not met */
+		if (pattern->pairs[i].value != QNAME_SYM_ANY
+		 && pattern->pairs[i].value != qn->pairs[j].value)
+			return 0; /* value mismatch */
+		j++;
+	}
+	return 1;
+}
+
+
+/**
+  Renders the canonical string form of the symbolized name `s`
+  into the first `len` octets of `buf`, exactly as
+  `qname_string_into()` would have for the original name.
+
+  Returns the length of the canonical form, not counting the
+  null terminator, or 0 (and an empty `buf`) if any of its
+  identifiers are unknown to the symbol table `t`, or if its
+  metric or any of its keys is QNAME_SYM_NONE.
+ **/
+size_t
+qname_sym_string_into(struct qname_symtab *t, struct qname_sym *s, char *buf, size_t len)
+{
+	int order[QNAME_MAX_PAIRS], i, j, k;
+	size_t n;
+
+	if (!buf) len = 0;
+	if (len > 0) *buf = '\0';
+	if (!t || !s || s->n > QNAME_MAX_PAIRS) return 0;
+
+	pthread_rwlock_rdlock(&t->lock);
+	/* QNAME_SYM_NONE has no string; it is only valid as a value */
+	if (s->metric == QNAME_SYM_NONE || s->metric >= t->n) goto unknown;
+	for (i = 0; i < s->n; i++)
+		if (s->pairs[i].key == QNAME_SYM_NONE
+		 || s->pairs[i].key >= t->n || s->pairs[i].value >= t->n) goto unknown;
+
+	/* canonical names are in lexical (not identifier) order */
+	for (i = 0; i < s->n; i++) {
+		k = i;
+		for (j = i; j > 0 && strcmp(t->strings[s->pairs[order[j-1]].key],
+		                            t->strings[s->pairs[k].key]) > 0; j--)
+			order[j] = order[j-1];
+		order[j] = k;
+	}
+
+	n = 0;
+#define put(c) do { if (n < len) buf[n] = (c); n++; } while (0)
+#define copy(id) do { \
+	const char *__s = t->strings[(id)]; \
+	for (; *__s; __s++) put(*__s); \
+} while (0)
+
+	copy(s->metric);
+	put(' ');
+	for (i = 0; i < s->n; i++) {
+		copy(s->pairs[order[i]].key);
+		if (s->pairs[order[i]].value != QNAME_SYM_NONE) {
+			put('=');
+			copy(s->pairs[order[i]].value);
+		}
+		put(',');
+	}
+	if (s->wild) put('*');
+	else n--;
+#undef copy
+#undef put
+	pthread_rwlock_unlock(&t->lock);
+
+	if (len > 0) buf[n < len ? n : len - 1] = '\0';
+	return n;
+
+unknown:
+	pthread_rwlock_unlock(&t->lock);
+	return 0;
+}
@@ -0,0 +1,292 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "debug.h"
+
+#define OP_DROP    1
+#define OP_RENAME  2
+
+struct s_rule {
+	const char *key;       /* key the rule applies to       */
+	int         op;        /* OP_DROP or OP_RENAME          */
+	const char *to;        /* new key name (OP_RENAME only) */
+};
+
+/* a key/value pair (value is NULL for a bare key), either
+   a default, or on its way into the rewritten name */
+struct s_pair {
+	const char *key;
+	const char *value;
+};
+
+struct tsdp_relabel {
+	int               nrules;
+	struct s_rule    *rules;     /* sorted by key           */
+	int               ndefaults;
+	struct s_pair    *defaults;  /* sorted by key           */
+	char             *strings;   /* all of the above point  */
+	                             /* into here               */
+};
+
+static int
+s_rule_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct s_rule *)a)->key, ((const struct s_rule *)b)->key);
+}
+
+static int
+s_default_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct s_pair *)a)->key, ((const struct s_pair *)b)->key);
+}
+
+/* is `s` usable as a key (or value) in a qualified name? */
+static int
+s_token_ok(const char *s)
+{
+	if (!*s || strcmp(s, "*") == 0) return 0;
+	for (; *s; s++)
+		if (*s == ',' || *s == '=' || *s == ' ') return 0;
+	return 1;
+}
+
+/* split the next whitespace-delimited token off of `*s`,
+   NUL-terminating it in place */
+static char *
+s_token(char **s)
+{
+	char *tok;
+
+	while (**s && isspace((unsigned char)**s)) (*s)++;
+	if (!**s) return NULL;
+
+	tok = *s;
+	while (**s && !isspace((unsigned char)**s)) (*s)++;
+	if (**s) *(*s)++ = '\0';
+	return tok;
+}
+
+
+/**
+  Compiles a set of tag relabelling rules, for application
+  (via `tsdp_relabel_apply()`) to many qualified names.
+
+  Rules are separated by newlines or semicolons, and take
+  one of the following forms:
+
+      drop KEY            remove every KEY pair
+      rename KEY NEW      rename KEY pairs to NEW, replacing
+                          any NEW pairs already there
+      default KEY=VALUE   add KEY=VALUE, unless there is
+      default KEY         already a KEY pair (after renames)
+
+  Blank lines, and everything after a `#`, are ignored.  Each
+  key can be dropped or renamed by at most one rule.
+
+  Returns NULL on failure, and sets `errno`; syntax errors
+  fail with EINVAL.
+ **/
+struct tsdp_relabel *
+tsdp_relabel_compile(const char *rules)
+{
+	struct tsdp_relabel *r;
+	char *s, *line, *end, *op, *a, *b, *eq;
+	size_t n;
+	int i;
+
+	errno = EINVAL;
+	if (!rules) return NULL;
+
+	errno = ENOMEM;
+	r = calloc(1, sizeof(struct tsdp_relabel));
+	if (!r) return NULL;
+
+	/* every rule takes at least two octets of source text,
+	   so that bounds how many we could possibly need */
+	n = strlen(rules) / 2 + 1;
+	r->strings  = strdup(rules);
+	r->rules    = calloc(n, sizeof(struct s_rule));
+	r->defaults = calloc(n, sizeof(struct s_pair));
+	if (!r->strings || !r->rules || !r->defaults) goto fail;
+
+	errno = EINVAL;
+	for (s = r->strings; s && *s; s = end) {
+		line = s;
+		end  = line + strcspn(line, "\n;");
+		if (*end) *end++ = '\0';
+		if ((a = strchr(line, '#')) != NULL) *a = '\0';
+
+		if (!(op = s_token(&line))) continue;
+		a = s_token(&line);
+		b = s_token(&line);
+		if (!a || s_token(&line)) goto fail;
+
+		if (strcmp(op, "drop") == 0 && !b && s_token_ok(a)) {
+			r->rules[r->nrules].key = a;
+			r->rules[r->nrules].op  = OP_DROP;
+			r->nrules++;
+
+		} else if (strcmp(op, "rename") == 0 && b && s_token_ok(a) && s_token_ok(b)) {
+			r->rules[r->nrules].key = a;
+			r->rules[r->nrules].op  = OP_RENAME;
+			r->rules[r->nrules].to  = b;
+			r->nrules++;
+
+		} else if (strcmp(op, "default") == 0 && !b) {
+			if ((eq = strchr(a, '=')) != NULL) *eq++ = '\0';
+			if (!s_token_ok(a) || (eq && !s_token_ok(eq))) goto fail;
+			r->defaults[r->ndefaults].key   = a;
+			r->defaults[r->ndefaults].value = eq;
+			r->ndefaults++;
+
+		} else {
+			goto fail;
+		}
+	}
+
+	qsort(r->rules,    r->nrules,    sizeof(struct s_rule),    s_rule_cmp);
+	qsort(r->defaults, r->ndefaults, sizeof(struct s_pair), s_default_cmp);
+	for (i = 1; i < r->nrules; i++)
+		if (strcmp(r->rules[i].key, r->rules[i-1].key) == 0) goto fail;
+	for (i = 1; i < r->ndefaults; i++)
+		if (strcmp(r->defaults[i].key, r->defaults[i-1].key) == 0) goto fail;
+
+	return r;
+
+fail:
+	tsdp_relabel_free(r);
+	return NULL;
+}
+
+
+/**
+  Frees a compiled rule set.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_relabel_free(struct tsdp_relabel *r)
+{
+	int e = errno;
+
+	if (!r) return;
+	free(r->strings);
+	free(r->rules);
+	free(r->defaults);
+	free(r);
+	errno = e;
+}
+
+
+/**
+  Applies the compiled rules `r` to the qualified name `q`,
+  writing the canonical form of the rewritten name into the
+  first `len` octets of `buf`, as for `qname_string_into()`.
+  `q` itself is not modified.
+
+  Since the pairs of a parsed qname, the rules and the
+  defaults are all sorted by key, the rewrite is a single
+  merge of the three, and never allocates memory.  Only
+  renamed pairs need to be put back into order.
+
+  Returns the length of the rewritten name, not counting
+  the null terminator.  If this is not less than `len`,
+  truncation has occurred.  Returns 0 (and sets `errno` to
+  EINVAL) if the rules leave `q` without any pairs, since
+  it then no longer names anything.
+ **/
+size_t
+tsdp_relabel_apply(struct tsdp_relabel *r, struct qname *q, char *buf, size_t len)
+{
+	struct s_pair kept[QNAME_MAX_PAIRS], renamed[QNAME_MAX_PAIRS], *x;
+	const char *override, *last;
+	int i, j, k, nk, nr, d, which;
+	size_t n;
+
+	if (!buf) len = 0;
+	if (len > 0) *buf = '\0';
+
+	errno = EINVAL;
+	if (!r || !q || !q->metric) return 0;
+
+	/* pass 1: merge the (sorted) pairs with the (sorted) rules */
+	nk = nr = 0;
+	for (i = j = 0; i < q->i; i++) {
+		while (j < r->nrules && strcmp(r->rules[j].key, q->pairs[i].key) < 0) j++;
+		if (j < r->nrules && strcmp(r->rules[j].key, q->pairs[i].key) == 0) {
+			if (r->rules[j].op == OP_DROP) continue;
+
+			/* insertion sort; there are never many */
+			for (k = nr++; k > 0 && strcmp(renamed[k-1].key, r->rules[j].to) > 0; k--)
+				renamed[k] = renamed[k-1];
+			renamed[k].key   = r->rules[j].to;
+			renamed[k].value = q->pairs[i].value;
+			continue;
+		}
+		kept[nk].key   = q->pairs[i].key;
+		kept[nk].value = q->pairs[i].value;
+		nk++;
+	}
+
+	n = 0;
+#define put(c) do { if (n < len) buf[n] = (c); n++; } while (0)
+#define copy(s) do { \
+	const char *__s = (s); \
+	for (; *__s; __s++) put(*__s); \
+} while (0)
+
+	copy(q->metric);
+	put(' ');
+
+	/* pass 2: merge kept, renamed and default pairs.  On equal
+	   keys, renamed pairs win over kept ones (which are skipped
+	   entirely), and either wins over defaults. */
+	override = last = NULL;
+	for (i = j = d = 0; i < nk || j < nr || d < r->ndefaults; ) {
+		which = 0; x = NULL;
+		if (j < nr) { which = 'r'; x = &renamed[j]; }
+		if (i < nk && (!x || strcmp(kept[i].key, x->key) < 0)) { which = 'k'; x = &kept[i]; }
+		if (d < r->ndefaults && (!x || strcmp(r->defaults[d].key, x->key) < 0)) which = 'd';
+
+		switch (which) {
+		case 'r':
+			x = &renamed[j++];
+			override = x->key;
+			break;
+
+		case 'k':
+			x = &kept[i++];
+			if (override && strcmp(x->key, override) == 0) continue;
+			break;
+
+		case 'd':
+			x = &r->defaults[d++];
+			if (last && strcmp(x->key, last) == 0) continue;
+			break;
+		}
+
+		last = x->key;
+		copy(x->key);
+		if (x->value) {
+			put('=');
+			copy(x->value);
+		}
+		put(',');
+	}
+	if (q->wild) {
+		put('*');
+	} else if (!last) {
+		if (len > 0) *buf = '\0';
+		return 0;
+	} else {
+		n--;
+	}
+
+	if (len > 0) buf[n < len ? n : len - 1] = '\0';
+	return n;
+#undef copy
+#undef put
+}
@@ -0,0 +1,480 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "debug.h"
+#include "strmap.h"
+#include "submit.h"
+
+#define SAMPLE_MIN_SERIES  64
+#define SAMPLE_BATCH       64   /* measurements gathered per bulk update */
+#define SAMPLE_LANES        4   /* independent partial reductions        */
+
+/* a running summary of one series, for one window.  `mean` and
+   `m2` (the sum of squared deviations from the mean) are kept
+   by Welford's method, which doesn't lose precision when the
+   variance is small relative to the mean, as the textbook
+   sum-of-squares formula does. */
+struct s_acc {
+	uint64_t n;
+	double   mean, m2;
+	double   min, max, sum;
+};
+
+struct tsdp_sample {
+	uint32_t       window;  /* width, for the UINT/4 frame */
+	struct strmap *series;  /* name -> accumulator index + 1 */
+	struct s_acc  *accs;
+	size_t         n, cap;
+
+	/* quantiles to broadcast, if any, and a sketch per series
+	   (by accumulator index) to estimate them from */
+	double               quantiles[TSDP_SAMPLE_MAX_QUANTILES];
+	size_t               nq;
+	struct tsdp_sketch **sketches;
+};
+
+/* fold one measurement into `a` */
+static void
+s_welford(struct s_acc *a, double v)
+{
+	double d;
+
+	if (a->n == 0 || v < a->min) a->min = v;
+	if (a->n == 0 || v > a->max) a->max = v;
+	a->n++;
+	a->sum += v;
+	d = v - a->mean;
+	a->mean += d / a->n;
+	a->m2   += d * (v - a->mean);
+}
+
+/* summarize `n` (> 0) measurements in one go, and fold them
+   into `a`.  The reductions are spread across independent
+   lanes, so that the compiler can keep them in vector
+   registers (it may not reorder floating point additions
+   across a single accumulator); the batch mean comes first,
+   so that the deviations (and their squares) stay small. */
+static void
+s_bulk(struct s_acc *a, const double *v, size_t n)
+{
+	double sum[SAMPLE_LANES] = { 0 }, dev[SAMPLE_LANES] = { 0 },
+	       lo[SAMPLE_LANES], hi[SAMPLE_LANES];
+	double bsum, bmean, bm2, bmin, bmax, d;
+	size_t i, j, tail;
+	uint64_t total;
+
+	for (j = 0; j < SAMPLE_LANES; j++)
+		lo[j] = hi[j] = v[0];
+
+	tail = n - n % SAMPLE_LANES;
+	for (i = 0; i < tail; i += SAMPLE_LANES) {
+		for (j = 0; j < SAMPLE_LANES; j++) {
+			sum[j] += v[i + j];
+			lo[j] = v[i + j] < lo[j] ? v[i + j] : lo[j];
+			hi[j] = v[i + j] > hi[j] ? v[i + j] : hi[j];
+		}
+	}
+	for (; i < n; i++) {
+		sum[0] += v[i];
+		lo[0] = v[i] < lo[0] ? v[i] : lo[0];
+		hi[0] = v[i] > hi[0] ? v[i] : hi[0];
+	}
+
+	bsum = bmin = bmax = 0;
+	for (j = 0; j < SAMPLE_LANES; j++) {
+		bsum += sum[j];
+		if (j == 0 || lo[j] < bmin) bmin = lo[j];
+		if (j == 0 || hi[j] > bmax) bmax = hi[j];
+	}
+	bmean = bsum / n;
+
+	for (i = 0; i < tail; i += SAMPLE_LANES) {
+		for (j = 0; j < SAMPLE_LANES; j++) {
+			d = v[i + j] - bmean;
+			dev[j] += d * d;
+		}
+	}
+	for (; i < n; i++) {
+		d = v[i] - bmean;
+		dev[0] += d * d;
+	}
+	for (bm2 = 0, j = 0; j < SAMPLE_LANES; j++)
+		bm2 += dev[j];
+
+	/* combine with what we had (Chan, Golub & LeVeque) */
+	if (a->n == 0) {
+		a->min = bmin;
+		a->max = bmax;
+		a->mean = bmean;
+		a->m2 = bm2;
+	} else {
+		if (bmin < a->min) a->min = bmin;
+		if (bmax > a->max) a->max = bmax;
+		total = a->n + n;
+		d = bmean - a->mean;
+		a->mean += d * n / total;
+		a->m2   += bm2 + d * d * ((double)a->n * n / total);
+	}
+	a->n   += n;
+	a->sum += bsum;
+}
+
+/* find (or create) the accumulator for `name` */
+static struct s_acc *
+s_series(struct tsdp_sample *s, const char *name, size_t len)
+{
+	struct s_acc *accs;
+	struct tsdp_sketch **sketches;
+	void **slot;
+	size_t cap;
+
+	slot = strmap_slot(s->series, name, len);
+	if (!slot) return NULL;
+	if (*slot) return &s->accs[(uintptr_t)*slot - 1];
+
+	if (s->n == s->cap) {
+		cap = s->cap ? s->cap * 2 : SAMPLE_MIN_SERIES;
+		accs = realloc(s->accs, cap * sizeof(struct s_acc));
+		if (accs) s->accs = accs;
+		sketches = accs ? realloc(s->sketches, cap * sizeof(struct tsdp_sketch *)) : NULL;
+		if (!sketches) {
+			strmap_del(s->series, name, len);
+			return NULL;
+		}
+		s->sketches = sketches;
+		s->cap = cap;
+	}
+	memset(&s->accs[s->n], 0, sizeof(struct s_acc));
+	s->sketches[s->n] = NULL;
+	*slot = (void *)(uintptr_t)(++s->n);
+	return &s->accs[s->n - 1];
+}
+
+
+/**
+  Allocates a new SAMPLE aggregation engine, which summarizes
+  the measurements of SUBMIT SAMPLE messages, per qualified
+  name, over windows `window` seconds wide, for broadcast
+  (see `tsdp_sample_flush()`).
+
+  Each series costs a fixed-size accumulator, which is reset
+  (not freed) at the end of each window, so that steady-state
+  aggregation never allocates memory.
+
+  SAMPLE engines are not thread-safe; callers must serialize
+  access to them.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_sample *
+tsdp_sample_new(unsigned int window)
+{
+	struct tsdp_sample *s;
+
+	errno = EINVAL;
+	if (window == 0) return NULL;
+
+	errno = ENOMEM;
+	s = calloc(1, sizeof(struct tsdp_sample));
+	if (!s) return NULL;
+
+	s->window = window;
+	s->series = strmap_new();
+	if (!s->series) {
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+
+/**
+  Frees a SAMPLE aggregation engine, discarding whatever has
+  not been flushed.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_sample_free(struct tsdp_sample *s)
+{
+	size_t i;
+
+	if (!s) return;
+	strmap_free(s->series, NULL);
+	for (i = 0; i < s->n; i++)
+		tsdp_sketch_free(s->sketches[i]);
+	free(s->sketches);
+	free(s->accs);
+	free(s);
+}
+
+
+/**
+  Asks the engine to estimate the `n` quantiles in `q` (each
+  between 0 and 1; 0.5 is the median, 0.99 the 99th percentile,
+  etc.) for every series, and to broadcast them along with the
+  rest of the summary (see `tsdp_sample_flush()`).  Passing no
+  quantiles turns estimation back off.
+
+  Estimates come from a quantile sketch per series (see
+  `tsdp_sketch_new()`), which is accurate to within 2% of the
+  true value, costs a few KiB at most, and can be had, for
+  merging across engines, from `tsdp_sample_sketch()`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  More than TSDP_SAMPLE_MAX_QUANTILES quantiles, or quantiles
+  out of range, fail with EINVAL.
+ **/
+int
+tsdp_sample_quantiles(struct tsdp_sample *s, const double *q, size_t n)
+{
+	size_t i;
+
+	errno = EINVAL;
+	if (!s || n > TSDP_SAMPLE_MAX_QUANTILES || (n && !q)) return -1;
+	for (i = 0; i < n; i++)
+		if (!(q[i] >= 0 && q[i] <= 1)) return -1;
+
+	memcpy(s->quantiles, q, n * sizeof(double));
+	s->nq = n;
+	return 0;
+}
+
+
+/**
+  Adds the `n` measurements in `v` to the summary for the first
+  `len` octets of `name`, in the current window.  Names are
+  compared as given, so callers should canonicalize them first
+  (`tsdp_sample_submit()` does this for SUBMIT SAMPLE messages).
+
+  Measurements that are not a number (NaN) are ignored.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_sample_add(struct tsdp_sample *s, const char *name, size_t len, const double *v, size_t n)
+{
+	struct s_acc *a;
+	struct tsdp_sketch **sk;
+	size_t i, j;
+
+	errno = EINVAL;
+	if (!s || !name || len == 0 || len > QNAME_MAX_LEN || (n && !v)) return -1;
+
+	errno = ENOMEM;
+	if (!(a = s_series(s, name, len))) return -1;
+
+	if (s->nq) {
+		sk = &s->sketches[a - s->accs];
+		if (!*sk && !(*sk = tsdp_sketch_new(0, 0))) {
+			errno = ENOMEM;
+			return -1;
+		}
+		for (i = 0; i < n; i++)
+			if (isfinite(v[i]) && tsdp_sketch_add(*sk, v[i]) != 0) return -1;
+	}
+
+	/* runs of numbers go in bulk; NaNs split them up */
+	for (i = 0; i < n; i = j + 1) {
+		for (j = i; j < n && v[j] == v[j]; j++)
+			;
+		if (j - i == 1) s_welford(a, v[i]);
+		else if (j > i) s_bulk(a, v + i, j - i);
+	}
+	return 0;
+}
+
+
+/**
+  Adds the measurements of the SUBMIT SAMPLE message `m` to the
+  summary for its qualified name, as for `tsdp_sample_add()`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Anything other than a well-formed SUBMIT SAMPLE fails with
+  EINVAL.
+ **/
+int
+tsdp_sample_submit(struct tsdp_sample *s, struct tsdp_msg *m)
+{
+	struct tsdp_frame *f;
+	char buf[QNAME_MAX_LEN + 1];
+	double batch[SAMPLE_BATCH];
+	size_t len, n;
+
+	errno = EINVAL;
+	if (!s || !m || m->opcode != TSDP_OPCODE_SUBMIT || m->payload != TSDP_PAYLOAD_SAMPLE) return -1;
+	if (m->nframes < 3
+	 || m->frames->type       != TSDP_FRAME_STRING
+	 || m->frames->next->type != TSDP_FRAME_TSTAMP)
+		return -1;
+	for (f = m->frames->next->next; f; f = f->next)
+		if (f->type != TSDP_FRAME_FLOAT || f->length != 8) return -1;
+
+	if (submit_name(m->frames, buf, &len) != 0) return -1;
+
+	/* measurements are strung out across frames; gather them
+	   up into batches, for bulk updates */
+	n = 0;
+	for (f = m->frames->next->next; f; f = f->next) {
+		batch[n++] = f->payload.float64;
+		if (n == SAMPLE_BATCH || !f->next) {
+			if (tsdp_sample_add(s, buf, len, batch, n) != 0) return -1;
+			n = 0;
+		}
+	}
+	return 0;
+}
+
+
+/**
+  Returns the quantile sketch of the current window for the
+  first `len` octets of `name`, so that it can be merged with
+  those of other engines (or shards, or nodes), or packed up
+  for the trip.  The sketch belongs to the engine, and is only
+  good until the next flush.
+
+  Returns NULL on failure, and sets `errno`.  Names that have
+  not been seen fail with ENOENT, as do all names if quantiles
+  are not being estimated (see `tsdp_sample_quantiles()`).
+ **/
+struct tsdp_sketch *
+tsdp_sample_sketch(struct tsdp_sample *s, const char *name, size_t len)
+{
+	void *idx;
+
+	errno = EINVAL;
+	if (!s || !name) return NULL;
+
+	errno = ENOENT;
+	if (!(idx = strmap_get(s->series, name, len))) return NULL;
+	return s->sketches[(uintptr_t)idx - 1];
+}
+
+
+/**
+  Copies the summary of the current window for the first `len`
+  octets of `name` into `stats`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Names that have not been seen fail with ENOENT.
+ **/
+int
+tsdp_sample_get(struct tsdp_sample *s, const char *name, size_t len, struct tsdp_sample_stats *stats)
+{
+	void *idx;
+	struct s_acc *a;
+
+	errno = EINVAL;
+	if (!s || !name || !stats) return -1;
+
+	errno = ENOENT;
+	if (!(idx = strmap_get(s->series, name, len))) return -1;
+
+	a = &s->accs[(uintptr_t)idx - 1];
+	stats->count    = a->n;
+	stats->min      = a->min;
+	stats->max      = a->max;
+	stats->sum      = a->sum;
+	stats->mean     = a->mean;
+	stats->variance = a->n > 1 ? a->m2 / (a->n - 1) : 0.0;
+	return 0;
+}
+
+struct s_flush {
+	struct tsdp_sample *s;
+	uint64_t ts;
+	void (*fn)(struct tsdp_msg *, void *);
+	void *udata;
+	int n;
+};
+
+static int
+s_flush(const void *key, size_t len, void *value, void *udata)
+{
+	struct s_flush *f = (struct s_flush *)udata;
+	struct tsdp_sample_stats st;
+	struct tsdp_sketch *sk;
+	struct tsdp_msg *m;
+	char name[QNAME_MAX_LEN + 1];
+	double count, qv[TSDP_SAMPLE_MAX_QUANTILES];
+	size_t i, nq;
+	int rc;
+
+	memcpy(name, key, len);
+	name[len] = '\0';
+	tsdp_sample_get(f->s, name, len, &st);
+	memset(&f->s->accs[(uintptr_t)value - 1], 0, sizeof(struct s_acc));
+
+	nq = f->s->nq;
+	sk = f->s->sketches[(uintptr_t)value - 1];
+	for (i = 0; i < nq; i++) {
+		qv[i] = sk ? tsdp_sketch_quantile(sk, f->s->quantiles[i]) : NAN;
+		if (qv[i] != qv[i]) qv[i] = st.mean; /* only infinities seen */
+	}
+	tsdp_sketch_clear(sk);
+	if (st.count == 0) return 0;
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_BROADCAST, 0, TSDP_PAYLOAD_SAMPLE);
+	if (!m) return -1;
+
+	count = (double)st.count;
+	rc = tsdp_msg_extend(m, TSDP_FRAME_STRING, name,           len + 1) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &f->ts,         8) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_UINT,   &f->s->window,  4) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_FLOAT,  &st.min,        8) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_FLOAT,  &st.max,        8) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_FLOAT,  &st.sum,        8) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_FLOAT,  &count,         8) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_FLOAT,  &st.mean,       8) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_FLOAT,  &st.variance,   8) != 0;
+	for (i = 0; rc == 0 && i < nq; i++)
+		rc = tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &qv[i], 8) != 0;
+	if (rc == 0) {
+		f->fn(m, f->udata);
+		f->n++;
+	}
+	tsdp_msg_free(m);
+	return rc ? -1 : 0;
+}
+
+
+/**
+  Closes the current window, and starts a new one, calling `fn`
+  with a BROADCAST SAMPLE message for each series that saw any
+  measurements in the window just closed (in no particular
+  order), stamped with `ts` and the window width.  The message
+  carries six FLOAT/64 measurements: the minimum, maximum, sum,
+  count, mean and (sample) variance, followed by an estimate
+  for each of the quantiles asked for by `tsdp_sample_quantiles()`,
+  in order.  Each message is freed once `fn` returns.
+
+  Returns how many messages were emitted, or -1 on failure,
+  and sets `errno`.  Either way, every series is reset for the
+  next window.
+ **/
+int
+tsdp_sample_flush(struct tsdp_sample *s, uint64_t ts, void (*fn)(struct tsdp_msg *m, void *udata), void *udata)
+{
+	struct s_flush f;
+	size_t i;
+	int rc;
+
+	errno = EINVAL;
+	if (!s || !fn) return -1;
+
+	f.s = s; f.ts = ts; f.fn = fn; f.udata = udata; f.n = 0;
+	rc = strmap_each(s->series, s_flush, &f);
+	if (rc != 0) {
+		/* reset whatever we didn't get to */
+		memset(s->accs, 0, s->n * sizeof(struct s_acc));
+		for (i = 0; i < s->n; i++)
+			tsdp_sketch_clear(s->sketches[i]);
+		errno = ENOMEM;
+		return -1;
+	}
+	return f.n;
+}
@@ -0,0 +1,745 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "bytes.h"
+#include "hash.h"
+#include "chunk.h"
+#include "segment.h"
+
+/* on-disk layout, all integers in network byte order:
+
+     0   8  magic ("TSDPSEGM")
+     8   4  format version (2)
+    12   4  (reserved; 0)
+    16   8  number of series
+    24   8  number of blocks
+    32   8  number of points
+    40   8  offset of the block index
+    48   8  offset of the series catalog
+    56   8  offset of the series names
+    64   8  timestamp of the earliest point
+    72   8  timestamp of the latest point
+    80   4  number of bits of bloom filter (a power of two)
+    84   4  number of bloom filter probes per name
+    88   8  width of rollup buckets, or 0 for raw points
+    96   .  bloom filter, over the hashes of all series names
+     .   .  block data
+     .  32b block index; per block:
+              8  timestamp of the first point
+              8  timestamp of the last point
+              8  offset of the block data
+              4  number of points
+              4  number of bits of block data
+     .  32s series catalog, sorted by name; per series:
+              8  offset of the name
+              4  length of the name
+              4  number of blocks
+              8  index of the first block
+              8  number of points
+     .   .  series names, NUL-terminated
+
+   Blocks are the compressed chunks of the series store (see
+   chunk.h), trimmed to the octets they use, and laid out
+   series by series, in the same order as the catalog, so that
+   the whole file can be written in a single sequential pass.
+
+   Readers juggling many segments can rule most of them out from
+   the header and bloom filter alone (see `tsdp_segment_span()`
+   and `tsdp_segment_has()`); within a segment, the blocks of a
+   series are in time order, so the block index doubles as a
+   sparse time index, and range reads binary-search it for the
+   first block they need.
+
+   Rollup segments (see compact.c) hold, for each bucket of each
+   series, four points at the start of the bucket: the minimum,
+   maximum and sum of the values that fell into it, and how many
+   of them there were. */
+#define SEGMENT_MAGIC   "TSDPSEGM"
+#define SEGMENT_VERSION 2
+#define SEGMENT_HEADER  96
+#define SEGMENT_ENTRY   32
+
+/* ~1% false positives at 10 bits per series and 7 probes */
+#define BLOOM_BITS_PER  10
+#define BLOOM_PROBES    7
+#define BLOOM_MIN_BITS  512
+
+struct tsdp_segment {
+	const unsigned char *base;
+	size_t               size;
+
+	uint64_t             nseries;
+	uint64_t             nblocks;
+	uint64_t             points;
+	uint64_t             first, last;
+	uint64_t             width;
+	const unsigned char *bloom;
+	uint32_t             bloom_bits;
+	uint32_t             probes;
+	const unsigned char *index;
+	const unsigned char *catalog;
+	uint64_t             names;   /* offset */
+};
+
+struct s_series {
+	const char   *name;
+	size_t        len;
+	struct chunk *head;
+	uint64_t      points;
+};
+
+struct s_collect {
+	struct s_series *series;
+	size_t           n, cap;
+	uint64_t         nblocks, octets, names, points;
+	uint64_t         first, last;
+};
+
+/* buffered, sequential writes to a file descriptor, at no more
+   than `rate` octets per second (if non-zero) */
+struct s_writer {
+	int             fd;
+	uint64_t        rate, written;
+	struct timespec start;
+	size_t          n;
+	unsigned char   buf[65536];
+};
+
+static int
+s_cmp(const char *a, size_t la, const char *b, size_t lb)
+{
+	int rc = memcmp(a, b, la < lb ? la : lb);
+	if (rc != 0) return rc;
+	return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+static int
+s_series_cmp(const void *a, const void *b)
+{
+	const struct s_series *x = (const struct s_series *)a, *y = (const struct s_series *)b;
+	return s_cmp(x->name, x->len, y->name, y->len);
+}
+
+static int
+s_collect(const char *name, size_t len, struct chunk *head, uint64_t points, void *udata)
+{
+	struct s_collect *c = (struct s_collect *)udata;
+	struct s_series *series;
+	struct chunk *k;
+	size_t cap;
+
+	if (c->n == c->cap) {
+		cap = c->cap ? c->cap * 2 : 1024;
+		series = realloc(c->series, cap * sizeof(struct s_series));
+		if (!series) return -1;
+		c->series = series;
+		c->cap    = cap;
+	}
+	c->series[c->n].name   = name;
+	c->series[c->n].len    = len;
+	c->series[c->n].head   = head;
+	c->series[c->n].points = points;
+	c->n++;
+
+	for (k = head; k; k = k->next) {
+		if (c->nblocks == 0 || k->first < c->first) c->first = k->first;
+		if (c->nblocks == 0 || k->last  > c->last)  c->last  = k->last;
+		c->nblocks++;
+		c->octets += (k->bits + 7) / 8;
+	}
+	c->names  += len + 1;
+	c->points += points;
+	return 0;
+}
+
+static uint64_t
+s_elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000
+	     + (uint64_t)now.tv_nsec - (uint64_t)start->tv_nsec;
+}
+
+static int
+s_flush(struct s_writer *w)
+{
+	struct timespec pause;
+	uint64_t due, spent;
+	size_t off;
+	ssize_t n;
+
+	for (off = 0; off < w->n; off += n) {
+		n = write(w->fd, w->buf + off, w->n - off);
+		if (n < 0) {
+			if (errno == EINTR) { n = 0; continue; }
+			return -1;
+		}
+	}
+	w->written += w->n;
+	w->n = 0;
+
+	if (w->rate) {
+		/* don't get ahead of the rate we've been allowed */
+		due   = (uint64_t)((double)w->written / w->rate * 1e9);
+		spent = s_elapsed(&w->start);
+		if (due > spent) {
+			pause.tv_sec  = (due - spent) / 1000000000;
+			pause.tv_nsec = (due - spent) % 1000000000;
+			while (nanosleep(&pause, &pause) != 0 && errno == EINTR)
+				;
+		}
+	}
+	return 0;
+}
+
+static int
+s_write(struct s_writer *w, const void *p, size_t len)
+{
+	size_t n;
+
+	while (len > 0) {
+		if (w->n == sizeof(w->buf) && s_flush(w) != 0) return -1;
+		n = sizeof(w->buf) - w->n < len ? sizeof(w->buf) - w->n : len;
+		memcpy(w->buf + w->n, p, n);
+		w->n += n;
+		p    = (const unsigned char *)p + n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* the bit of a `bits`-bit bloom filter for probe `i` of the
+   name that hashes to `h` (by double hashing) */
+static uint32_t
+s_probe(uint64_t h, uint32_t i, uint32_t bits)
+{
+	return (uint32_t)((h + i * ((h >> 32) | 1)) & (bits - 1));
+}
+
+/* 0 if the bloom filter rules `name` out of the segment */
+static int
+s_maybe(const struct tsdp_segment *seg, const char *name, size_t len)
+{
+	uint64_t h = hashmix64(hash64(name, len));
+	uint32_t i, bit;
+
+	for (i = 0; i < seg->probes; i++) {
+		bit = s_probe(h, i, seg->bloom_bits);
+		if (!(seg->bloom[bit >> 3] & (1 << (bit & 7)))) return 0;
+	}
+	return 1;
+}
+
+/* validate the header of a mapped segment, and fill out the
+   rest of `seg` from it */
+static int
+s_header(struct tsdp_segment *seg)
+{
+	uint64_t index, catalog, names;
+
+	if (seg->size < SEGMENT_HEADER || memcmp(seg->base, SEGMENT_MAGIC, 8) != 0) return -1;
+	if (get32(seg->base + 8) != SEGMENT_VERSION) return -1;
+
+	seg->nseries    = get64(seg->base + 16);
+	seg->nblocks    = get64(seg->base + 24);
+	seg->points     = get64(seg->base + 32);
+	index           = get64(seg->base + 40);
+	catalog         = get64(seg->base + 48);
+	names           = get64(seg->base + 56);
+	seg->first      = get64(seg->base + 64);
+	seg->last       = get64(seg->base + 72);
+	seg->bloom_bits = get32(seg->base + 80);
+	seg->probes     = get32(seg->base + 84);
+	seg->width      = get64(seg->base + 88);
+
+	if (seg->bloom_bits < 8 || (seg->bloom_bits & (seg->bloom_bits - 1)) != 0) return -1;
+	if (seg->probes < 1 || seg->probes > 32) return -1;
+	if (seg->bloom_bits / 8 > seg->size - SEGMENT_HEADER) return -1;
+	if (index < SEGMENT_HEADER + seg->bloom_bits / 8 || index > seg->size) return -1;
+	if (seg->nblocks > (seg->size - index) / SEGMENT_ENTRY) return -1;
+	if (catalog != index + SEGMENT_ENTRY * seg->nblocks) return -1;
+	if (seg->nseries > (seg->size - catalog) / SEGMENT_ENTRY) return -1;
+	if (names != catalog + SEGMENT_ENTRY * seg->nseries) return -1;
+
+	seg->bloom   = seg->base + SEGMENT_HEADER;
+	seg->index   = seg->base + index;
+	seg->catalog = seg->base + catalog;
+	seg->names   = names;
+	return 0;
+}
+
+/* the name of the i-th series of the catalog, or NULL if the
+   catalog entry is corrupt */
+static const char *
+s_name(const struct tsdp_segment *seg, uint64_t i, size_t *len)
+{
+	const unsigned char *e = seg->catalog + SEGMENT_ENTRY * i;
+	uint64_t off = get64(e);
+
+	*len = get32(e + 8);
+	if (off < seg->names || off >= seg->size || *len >= seg->size - off) return NULL;
+	if (seg->base[off + *len] != '\0') return NULL;
+	return (const char *)seg->base + off;
+}
+
+static int
+s_advance(struct tsdp_store_iter *it)
+{
+	const unsigned char *e = it->block;
+	uint64_t off;
+	uint32_t n, bits;
+
+	if (it->left == 0) return 0;
+	it->block += SEGMENT_ENTRY;
+	it->left--;
+
+	it->first = get64(e);
+	it->last  = get64(e + 8);
+	off       = get64(e + 16);
+	n         = get32(e + 24);
+	bits      = get32(e + 28);
+	/* (in 64 bits, lest a huge `bits` wrap around to fit;
+	   the first point of a block alone takes 128 of them) */
+	if (off < SEGMENT_HEADER || off > it->size || ((uint64_t)bits + 7) / 8 > it->size - off
+	 || (n > 0 && bits < 128)) {
+		it->left = 0; /* corrupt; stop here */
+		return 0;
+	}
+	chunk_cursor_init(&it->cur, it->base + off, n, bits);
+	return 1;
+}
+
+
+int
+segment_write(struct tsdp_store *s, int fd, uint64_t width, uint64_t rate)
+{
+	struct s_collect c;
+	struct s_writer *w;
+	struct chunk *k;
+	unsigned char e[SEGMENT_ENTRY], *bloom;
+	uint64_t index, catalog, names, off, block, h;
+	uint32_t nblocks, bits, j;
+	size_t i;
+	int rc;
+
+	errno = EINVAL;
+	if (!s || fd < 0) return -1;
+
+	errno = ENOMEM;
+	memset(&c, 0, sizeof(c));
+	w = malloc(sizeof(struct s_writer));
+	if (!w || store_each(s, s_collect, &c) != 0) {
+		free(c.series);
+		free(w);
+		errno = ENOMEM;
+		return -1;
+	}
+	if (c.n > 0) qsort(c.series, c.n, sizeof(struct s_series), s_series_cmp);
+	w->fd      = fd;
+	w->n       = 0;
+	w->rate    = rate;
+	w->written = 0;
+	clock_gettime(CLOCK_MONOTONIC, &w->start);
+
+	for (bits = BLOOM_MIN_BITS; bits < c.n * BLOOM_BITS_PER && bits < UINT32_C(1) << 31; bits <<= 1)
+		;
+	bloom = calloc(bits / 8, 1);
+	if (!bloom) {
+		free(c.series);
+		free(w);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < c.n; i++) {
+		h = hashmix64(hash64(c.series[i].name, c.series[i].len));
+		for (j = 0; j < BLOOM_PROBES; j++)
+			bloom[s_probe(h, j, bits) >> 3] |= 1 << (s_probe(h, j, bits) & 7);
+	}
+
+	index   = SEGMENT_HEADER + bits / 8 + c.octets;
+	catalog = index + SEGMENT_ENTRY * c.nblocks;
+	names   = catalog + SEGMENT_ENTRY * c.n;
+
+	memset(e, 0, sizeof(e));
+	memcpy(e, SEGMENT_MAGIC, 8);
+	put32(e + 8, SEGMENT_VERSION);
+	put64(e + 16, c.n);
+	put64(e + 24, c.nblocks);
+	rc = s_write(w, e, SEGMENT_ENTRY);
+	put64(e +  0, c.points);
+	put64(e +  8, index);
+	put64(e + 16, catalog);
+	put64(e + 24, names);
+	rc = rc || s_write(w, e, SEGMENT_ENTRY);
+	memset(e, 0, sizeof(e));
+	put64(e +  0, c.first);
+	put64(e +  8, c.last);
+	put32(e + 16, bits);
+	put32(e + 20, BLOOM_PROBES);
+	put64(e + 24, width);
+	rc = rc || s_write(w, e, SEGMENT_ENTRY);
+	rc = rc || s_write(w, bloom, bits / 8);
+
+	/* block data */
+	for (i = 0; rc == 0 && i < c.n; i++)
+		for (k = c.series[i].head; rc == 0 && k; k = k->next)
+			rc = s_write(w, k->data, (k->bits + 7) / 8);
+
+	/* block index */
+	for (off = SEGMENT_HEADER + bits / 8, i = 0; rc == 0 && i < c.n; i++) {
+		for (k = c.series[i].head; rc == 0 && k; k = k->next) {
+			put64(e +  0, k->first);
+			put64(e +  8, k->last);
+			put64(e + 16, off);
+			put32(e + 24, k->n);
+			put32(e + 28, k->bits);
+			rc = s_write(w, e, SEGMENT_ENTRY);
+			off += (k->bits + 7) / 8;
+		}
+	}
+
+	/* series catalog */
+	for (off = names, block = 0, i = 0; rc == 0 && i < c.n; i++) {
+		for (nblocks = 0, k = c.series[i].head; k; k = k->next)
+			nblocks++;
+		put64(e +  0, off);
+		put32(e +  8, c.series[i].len);
+		put32(e + 12, nblocks);
+		put64(e + 16, block);
+		put64(e + 24, c.series[i].points);
+		rc = s_write(w, e, SEGMENT_ENTRY);
+		off   += c.series[i].len + 1;
+		block += nblocks;
+	}
+
+	/* series names */
+	for (i = 0; rc == 0 && i < c.n; i++)
+		rc = s_write(w, c.series[i].name, c.series[i].len)
+		  || s_write(w, "", 1);
+
+	rc = rc || s_flush(w);
+	free(c.series);
+	free(bloom);
+	free(w);
+	return rc ? -1 : 0;
+}
+
+
+/**
+  Writes the contents of the series store `s` to the file
+  descriptor `fd`, as an immutable segment file, for later
+  use by `tsdp_segment_open()`.  Series are sorted by name,
+  and their chunks are written out as they are, in a single
+  sequential pass, without decompressing anything.
+
+  Callers that want the file to appear atomically should write
+  to a temporary file, sync it, and rename it into place.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_segment_write(struct tsdp_store *s, int fd)
+{
+	return segment_write(s, fd, 0, 0);
+}
+
+
+/**
+  Maps the segment file at `path` (see `tsdp_segment_write()`)
+  into memory.  Nothing is decoded up front, and nothing is
+  copied out of the page cache later: series are found by
+  binary search over the catalog, and their points decoded
+  straight out of the mapped blocks.
+
+  Returns NULL on failure, and sets `errno`.  A file that is
+  not a valid segment fails with EINVAL.
+ **/
+struct tsdp_segment *
+tsdp_segment_open(const char *path)
+{
+	struct tsdp_segment *seg;
+	struct stat st;
+	void *base;
+	int fd;
+
+	errno = EINVAL;
+	if (!path) return NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size < SEGMENT_HEADER) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return NULL;
+
+	seg = calloc(1, sizeof(struct tsdp_segment));
+	if (!seg) {
+		munmap(base, st.st_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	seg->base = base;
+	seg->size = st.st_size;
+	if (s_header(seg) != 0) {
+		tsdp_segment_free(seg);
+		errno = EINVAL;
+		return NULL;
+	}
+	return seg;
+}
+
+
+/**
+  Unmaps the segment.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_segment_free(struct tsdp_segment *seg)
+{
+	if (!seg) return;
+	munmap((void *)seg->base, seg->size);
+	free(seg);
+}
+
+
+/**
+  Returns how many series are in the segment.
+ **/
+size_t
+tsdp_segment_count(struct tsdp_segment *seg)
+{
+	return seg ? seg->nseries : 0;
+}
+
+
+/**
+  Returns how many points are in the segment, across all series.
+ **/
+uint64_t
+tsdp_segment_points(struct tsdp_segment *seg)
+{
+	return seg ? seg->points : 0;
+}
+
+
+/**
+  Returns the name of the `i`-th series of the segment (in
+  sorted order), straight out of the mapped file.
+
+  Returns NULL if there is no such series.
+ **/
+const char *
+tsdp_segment_series(struct tsdp_segment *seg, uint64_t i)
+{
+	size_t len;
+
+	if (!seg || i >= seg->nseries) return NULL;
+	return s_name(seg, i, &len);
+}
+
+
+/**
+  Retrieves the timestamps of the earliest and latest points in
+  the segment, across all series, into `first` and `last`, from
+  the header alone.  Readers can skip segments whose span does
+  not overlap the range they are after.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Segments without any points fail with ENOENT.
+ **/
+int
+tsdp_segment_span(struct tsdp_segment *seg, uint64_t *first, uint64_t *last)
+{
+	errno = EINVAL;
+	if (!seg) return -1;
+
+	errno = ENOENT;
+	if (seg->points == 0) return -1;
+
+	if (first) *first = seg->first;
+	if (last)  *last  = seg->last;
+	return 0;
+}
+
+
+/**
+  Returns the width of the segment's rollup buckets, or 0 if the
+  segment holds raw points.  Widths are in the same units as the
+  timestamps of the points (seconds, for those from SUBMIT
+  messages; see `tsdp_store_submit()`).
+ **/
+uint64_t
+tsdp_segment_width(struct tsdp_segment *seg)
+{
+	return seg ? seg->width : 0;
+}
+
+
+/* does `seg` hold all of [`from`, `until`]?  The last bucket
+   of a rollup runs on for `width` past its timestamp. */
+static int
+s_covers(struct tsdp_segment *seg, uint64_t from, uint64_t until)
+{
+	if (seg->first > from) return 0;
+	return until <= seg->last || until - seg->last < seg->width;
+}
+
+/**
+  Picks the segment to read for a query over [`from`, `until`]
+  that needs no finer than `resolution`, out of the `n` segments
+  in `segs` (raw segments, and rollup tiers made by
+  `tsdp_segment_compact()`), among those whose buckets are no
+  wider than `resolution`: the coarsest of those that cover the
+  whole range, or, if none of them do, the finest of those that
+  overlap it.  Finer tiers are (usually) the ones that have not
+  been rolled up yet, so they reach furthest forward; callers
+  should read more than one segment for a range that no single
+  segment covers.  Ties go to whichever comes first in `segs`.
+
+  `resolution` is in the same units as the timestamps (see
+  `tsdp_segment_width()`).
+
+  Returns NULL on failure, and sets `errno`.  If no segment will
+  do, fails with ENOENT.
+ **/
+struct tsdp_segment *
+tsdp_segment_pick(struct tsdp_segment **segs, size_t n, uint64_t from, uint64_t until, uint64_t resolution)
+{
+	struct tsdp_segment *best = NULL, *part = NULL;
+	size_t i;
+
+	errno = EINVAL;
+	if (!segs && n > 0) return NULL;
+
+	for (i = 0; i < n; i++) {
+		if (!segs[i] || segs[i]->points == 0) continue;
+		if (segs[i]->last < from || segs[i]->first > until) continue;
+		if (segs[i]->width > resolution) continue;
+		if (!s_covers(segs[i], from, until)) {
+			if (!part || segs[i]->width < part->width) part = segs[i];
+			continue;
+		}
+		if (!best || segs[i]->width > best->width) best = segs[i];
+	}
+
+	errno = ENOENT;
+	return best ? best : part;
+}
+
+
+/**
+  Checks the segment's bloom filter for the first `len` octets
+  of `name`, without touching the catalog.
+
+  Returns 0 if the series is definitely not in the segment, or
+  1 if it (most likely) is; about 1% of names not in a segment
+  will be reported as being in it.
+ **/
+int
+tsdp_segment_has(struct tsdp_segment *seg, const char *name, size_t len)
+{
+	if (!seg || !name) return 0;
+	return s_maybe(seg, name, len);
+}
+
+
+/**
+  Starts reading the history of the first `len` octets of
+  `name` from the segment, from `from` to `until` (both
+  inclusive), via `tsdp_store_next()`, just as for a series
+  store (see `tsdp_store_iter()`).  Blocks that fall entirely
+  outside of the range are skipped without being decoded; the
+  first block needed is found by binary search.
+
+  The returned iterator must be freed by the caller, via
+  `tsdp_store_iter_free()`, and before the segment is.
+
+  Returns NULL on failure, and sets `errno`.  Names that are
+  not in the segment fail with ENOENT.
+ **/
+struct tsdp_store_iter *
+tsdp_segment_iter(struct tsdp_segment *seg, const char *name, size_t len, uint64_t from, uint64_t until)
+{
+	struct tsdp_store_iter *it;
+	const unsigned char *e;
+	const char *have;
+	size_t hlen;
+	uint64_t lo, hi, mid, first, n;
+	int rc;
+
+	errno = EINVAL;
+	if (!seg || !name) return NULL;
+
+	errno = ENOENT;
+	if (!s_maybe(seg, name, len)) return NULL;
+
+	for (lo = 0, hi = seg->nseries; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if (!(have = s_name(seg, mid, &hlen))) {
+			errno = EINVAL;
+			return NULL;
+		}
+		rc = s_cmp(have, hlen, name, len);
+		if (rc == 0) break;
+		if (rc < 0) lo = mid + 1;
+		else        hi = mid;
+	}
+	errno = ENOENT;
+	if (lo >= hi) return NULL;
+
+	e = seg->catalog + SEGMENT_ENTRY * mid;
+	n     = get32(e + 12);
+	first = get64(e + 16);
+	errno = EINVAL;
+	if (first > seg->nblocks || n > seg->nblocks - first) return NULL;
+
+	/* the first block that ends at or after `from` */
+	e = seg->index + SEGMENT_ENTRY * first;
+	if (from > until || from > seg->last || until < seg->first) {
+		n = 0;
+	} else {
+		for (lo = 0, hi = n; lo < hi; ) {
+			mid = lo + (hi - lo) / 2;
+			if (get64(e + SEGMENT_ENTRY * mid + 8) < from) lo = mid + 1;
+			else                                           hi = mid;
+		}
+		e += SEGMENT_ENTRY * lo;
+		n -= lo;
+	}
+
+	errno = ENOMEM;
+	it = calloc(1, sizeof(struct tsdp_store_iter));
+	if (!it) return NULL;
+
+	it->advance = s_advance;
+	it->block   = e;
+	it->width   = seg->width;
+	it->left    = n;
+	it->base    = seg->base;
+	it->size    = seg->size;
+	it->from    = from;
+	it->until   = until;
+	return it;
+}
@@ -0,0 +1,16 @@
+#ifndef TSDP_SEGMENT_H
+#define TSDP_SEGMENT_H
+
+#include <stdint.h>
+
+/* segment file internals, for the compactor (see compact.c) */
+
+struct tsdp_store;
+
+/* writes `s` to `fd` as for tsdp_segment_write(), marking it as
+   a rollup of `width`-wide buckets (or raw points, if 0), and
+   writing no more than `rate` octets per second (if non-zero) */
+int
+segment_write(struct tsdp_store *s, int fd, uint64_t width, uint64_t rate);
+
+#endif
@@ -0,0 +1,439 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+
+#include "debug.h"
+#include "bytes.h"
+
+#define SKETCH_DEFAULT_ALPHA   0.02
+#define SKETCH_DEFAULT_BINS    256
+#define SKETCH_VERSION         1
+
+/* a DDSketch (Masson, Rim & Lee, 2019).  Each measurement goes
+   into the bin whose index is ceil(log_gamma(|v|)), where gamma
+   is (1 + alpha) / (1 - alpha); any value within a bin is then
+   within `alpha` (relative) of every other value in it, and
+   that is what quantile estimates are accurate to.  Updates
+   cost a log() and an increment.
+
+   Positive and negative values get a store each.  A store is a
+   contiguous run of bins, starting at index `lo`, and is never
+   more than `maxbins` wide; when it would have to be, the bins
+   nearest the bottom of the distribution are folded together,
+   which only costs accuracy at the (rarely asked after) lowest
+   quantiles. */
+struct s_store {
+	int32_t   lo;      /* index of counts[0]        */
+	uint32_t  n;       /* width; 0 if empty         */
+	uint64_t *counts;  /* maxbins of them, or NULL  */
+};
+
+struct tsdp_sketch {
+	double   alpha;
+	double   gamma;
+	double   inv_log_gamma;
+	uint32_t maxbins;
+
+	uint64_t count;
+	uint64_t zero;     /* |v| too small to index    */
+	double   min, max;
+
+	struct s_store pos;
+	struct s_store neg; /* indexed by |v|           */
+};
+
+static inline int32_t
+s_index(struct tsdp_sketch *s, double v)
+{
+	return (int32_t)ceil(log(v) * s->inv_log_gamma);
+}
+
+/* a representative value for bin `k`, within `alpha` of all
+   the values that fell into it */
+static inline double
+s_value(struct tsdp_sketch *s, int32_t k)
+{
+	return 2.0 * pow(s->gamma, k) / (s->gamma + 1.0);
+}
+
+/* add `c` to bin `k` of `st`.  If `top` is set, the bottom of
+   the distribution is at the top of the store (as it is for
+   negative values), and that's where bins get folded. */
+static int
+s_store_add(struct tsdp_sketch *s, struct s_store *st, int32_t k, uint64_t c, int top)
+{
+	uint64_t tmp[TSDP_SKETCH_MAX_BINS];
+	int64_t lo, hi, nlo, nhi, i, j;
+
+	if (!st->counts) {
+		st->counts = calloc(s->maxbins, sizeof(uint64_t));
+		if (!st->counts) return -1;
+	}
+	if (st->n == 0) {
+		st->lo = k;
+		st->n  = 1;
+		st->counts[0] = c;
+		return 0;
+	}
+
+	lo = st->lo;
+	hi = lo + st->n - 1;
+	if (k >= lo && k <= hi) {
+		st->counts[k - lo] += c;
+		return 0;
+	}
+
+	/* the range has to move, which is rare once a series has
+	   settled down; everything that falls off the end gets
+	   folded into the end bin */
+	nlo = k < lo ? k : lo;
+	nhi = k > hi ? k : hi;
+	if (nhi - nlo + 1 > s->maxbins) {
+		if (top) nhi = nlo + s->maxbins - 1;
+		else     nlo = nhi - s->maxbins + 1;
+	}
+
+	memset(tmp, 0, s->maxbins * sizeof(uint64_t));
+	for (i = lo; i <= hi; i++) {
+		j = i < nlo ? nlo : i > nhi ? nhi : i;
+		tmp[j - nlo] += st->counts[i - lo];
+	}
+	j = k < nlo ? nlo : k > nhi ? nhi : k;
+	tmp[j - nlo] += c;
+
+	memcpy(st->counts, tmp, s->maxbins * sizeof(uint64_t));
+	st->lo = nlo;
+	st->n  = nhi - nlo + 1;
+	return 0;
+}
+
+static int
+s_init(struct tsdp_sketch *s, double alpha, unsigned int maxbins)
+{
+	if (alpha == 0) alpha = SKETCH_DEFAULT_ALPHA;
+	if (maxbins == 0) maxbins = SKETCH_DEFAULT_BINS;
+	if (!(alpha > 0 && alpha < 1) || maxbins > TSDP_SKETCH_MAX_BINS) return -1;
+
+	s->alpha         = alpha;
+	s->gamma         = (1 + alpha) / (1 - alpha);
+	s->inv_log_gamma = 1.0 / log(s->gamma);
+	s->maxbins       = maxbins;
+	return 0;
+}
+
+
+/**
+  Allocates a new, empty quantile sketch, whose estimates are
+  accurate to within `alpha` of the true value (relatively; 0
+  picks a default of 2%), using no more than `maxbins` bins
+  (0 picks a default of 256) each for positive and negative
+  measurements, so that sketches never grow beyond a few KiB,
+  no matter how many measurements they see.
+
+  Sketches built with the same `alpha` can be merged (see
+  `tsdp_sketch_merge()`), and packed compactly for transport
+  (see `tsdp_sketch_pack()`).
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_sketch *
+tsdp_sketch_new(double alpha, unsigned int maxbins)
+{
+	struct tsdp_sketch *s;
+
+	errno = ENOMEM;
+	s = calloc(1, sizeof(struct tsdp_sketch));
+	if (!s) return NULL;
+
+	if (s_init(s, alpha, maxbins) != 0) {
+		free(s);
+		errno = EINVAL;
+		return NULL;
+	}
+	return s;
+}
+
+
+/**
+  Frees a quantile sketch.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_sketch_free(struct tsdp_sketch *s)
+{
+	if (!s) return;
+	free(s->pos.counts);
+	free(s->neg.counts);
+	free(s);
+}
+
+
+/**
+  Empties a quantile sketch, without giving back its memory.
+ **/
+void
+tsdp_sketch_clear(struct tsdp_sketch *s)
+{
+	if (!s) return;
+	if (s->pos.counts) memset(s->pos.counts, 0, s->maxbins * sizeof(uint64_t));
+	if (s->neg.counts) memset(s->neg.counts, 0, s->maxbins * sizeof(uint64_t));
+	s->pos.n = s->neg.n = 0;
+	s->count = s->zero = 0;
+}
+
+
+/**
+  Adds the measurement `v` to the sketch.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Measurements that are not finite fail with EINVAL.
+ **/
+int
+tsdp_sketch_add(struct tsdp_sketch *s, double v)
+{
+	int rc;
+
+	errno = EINVAL;
+	if (!s || !isfinite(v)) return -1;
+
+	if (v >= DBL_MIN)       rc = s_store_add(s, &s->pos, s_index(s,  v), 1, 0);
+	else if (v <= -DBL_MIN) rc = s_store_add(s, &s->neg, s_index(s, -v), 1, 1);
+	else                    rc = (s->zero++, 0);
+
+	errno = ENOMEM;
+	if (rc != 0) return -1;
+
+	if (s->count == 0 || v < s->min) s->min = v;
+	if (s->count == 0 || v > s->max) s->max = v;
+	s->count++;
+	return 0;
+}
+
+
+/**
+  Returns how many measurements the sketch has seen.
+ **/
+uint64_t
+tsdp_sketch_count(struct tsdp_sketch *s)
+{
+	return s ? s->count : 0;
+}
+
+
+/**
+  Estimates the `q`-quantile (0 <= q <= 1) of the measurements
+  the sketch has seen; 0.5 is the median, 0.99 the 99th
+  percentile, etc.  The minimum and maximum are exact.
+
+  Returns NaN if the sketch is empty, or `q` is out of range.
+ **/
+double
+tsdp_sketch_quantile(struct tsdp_sketch *s, double q)
+{
+	uint64_t rank, seen;
+	double v;
+	int32_t i;
+
+	if (!s || s->count == 0 || !(q >= 0 && q <= 1)) return NAN;
+	if (q == 0) return s->min;
+	if (q == 1) return s->max;
+
+	rank = (uint64_t)(q * (s->count - 1));
+	seen = 0;
+	v = s->max;
+
+	/* from the bottom: big negatives, zeros, then positives */
+	for (i = (int32_t)s->neg.n - 1; i >= 0; i--) {
+		seen += s->neg.counts[i];
+		if (seen > rank) { v = -s_value(s, s->neg.lo + i); goto done; }
+	}
+	seen += s->zero;
+	if (seen > rank) { v = 0.0; goto done; }
+	for (i = 0; i < (int32_t)s->pos.n; i++) {
+		seen += s->pos.counts[i];
+		if (seen > rank) { v = s_value(s, s->pos.lo + i); goto done; }
+	}
+
+done:
+	return v < s->min ? s->min : v > s->max ? s->max : v;
+}
+
+
+/**
+  Merges all of the measurements seen by `src` into `dst`, as
+  if `dst` had seen them itself.  Both sketches must have been
+  built with the same `alpha`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Sketches of different accuracy fail with EINVAL.
+ **/
+int
+tsdp_sketch_merge(struct tsdp_sketch *dst, struct tsdp_sketch *src)
+{
+	uint32_t i;
+
+	errno = EINVAL;
+	if (!dst || !src || dst->alpha != src->alpha) return -1;
+	if (src->count == 0) return 0;
+
+	errno = ENOMEM;
+	for (i = 0; i < src->pos.n; i++)
+		if (src->pos.counts[i] && s_store_add(dst, &dst->pos, src->pos.lo + i, src->pos.counts[i], 0) != 0)
+			return -1;
+	for (i = 0; i < src->neg.n; i++)
+		if (src->neg.counts[i] && s_store_add(dst, &dst->neg, src->neg.lo + i, src->neg.counts[i], 1) != 0)
+			return -1;
+
+	dst->zero += src->zero;
+	if (dst->count == 0 || src->min < dst->min) dst->min = src->min;
+	if (dst->count == 0 || src->max > dst->max) dst->max = src->max;
+	dst->count += src->count;
+	return 0;
+}
+
+static uint64_t
+s_bits(double d)
+{
+	uint64_t u;
+	memcpy(&u, &d, 8);
+	return u;
+}
+
+static double
+s_double(uint64_t u)
+{
+	double d;
+	memcpy(&d, &u, 8);
+	return d;
+}
+
+/* zig-zag, so that small negative indices stay small */
+#define ZIGZAG(i)   (((uint64_t)(i) << 1) ^ (uint64_t)((int64_t)(i) >> 63))
+#define UNZIGZAG(u) ((int64_t)((u) >> 1) ^ -(int64_t)((u) & 1))
+
+/**
+  Packs the sketch `s` into at most `len` octets of `buf`, in a
+  portable (byte-order independent) form that can be carried
+  in a single TSDP frame, and turned back into a sketch with
+  `tsdp_sketch_unpack()`.  Bin counts are variable-width, so
+  a sketch with the default 256 bins that has seen fewer than
+  2^21 measurements per bin packs into less than 2k octets.
+
+  Returns the number of octets needed to pack the sketch, which
+  may be more than `len`, in which case `buf` holds only the
+  first `len` of them (as for `tsdp_msg_pack()`), or -1 on
+  failure, and sets `errno`.
+ **/
+ssize_t
+tsdp_sketch_pack(void *buf, size_t len, struct tsdp_sketch *s)
+{
+	unsigned char tmp[VARINT_MAX + 8], *out = (unsigned char *)buf;
+	struct s_store *st;
+	size_t n, k;
+	ssize_t total;
+	uint32_t i;
+	int which;
+
+	errno = EINVAL;
+	if (!s || (!buf && len)) return -1;
+
+#define EMIT(p, l) do { \
+	k = (l); \
+	if ((size_t)total < len) memcpy(out + total, (p), (size_t)total + k <= len ? k : len - total); \
+	total += k; \
+} while (0)
+
+	total = 0;
+	tmp[0] = SKETCH_VERSION;                   EMIT(tmp, 1);
+	put64(tmp, s_bits(s->alpha));             EMIT(tmp, 8);
+	EMIT(tmp, putvar(tmp, s->maxbins));
+	EMIT(tmp, putvar(tmp, s->zero));
+	put64(tmp, s_bits(s->min));               EMIT(tmp, 8);
+	put64(tmp, s_bits(s->max));               EMIT(tmp, 8);
+
+	for (which = 0; which < 2; which++) {
+		st = which ? &s->neg : &s->pos;
+		EMIT(tmp, putvar(tmp, st->n));
+		if (!st->n) continue;
+		EMIT(tmp, putvar(tmp, ZIGZAG(st->lo)));
+		for (i = 0; i < st->n; i++) {
+			n = putvar(tmp, st->counts[i]);
+			EMIT(tmp, n);
+		}
+	}
+#undef EMIT
+	return total;
+}
+
+
+/**
+  Unpacks a sketch from the first `len` octets of `buf`, as
+  packed by `tsdp_sketch_pack()`.
+
+  The returned sketch must be freed by the caller, via
+  `tsdp_sketch_free()`, when no longer needed.
+
+  Returns NULL on failure, and sets `errno`.  Malformed or
+  truncated input fails with EINVAL.
+ **/
+struct tsdp_sketch *
+tsdp_sketch_unpack(const void *buf, size_t len)
+{
+	const unsigned char *p, *end;
+	struct tsdp_sketch *s;
+	struct s_store *st;
+	uint64_t u, n, lo, c;
+	uint32_t i;
+	int which;
+
+	errno = EINVAL;
+	if (!buf || len < 1 + 8 + 1 + 1 + 8 + 8) return NULL;
+	p = (const unsigned char *)buf;
+	end = p + len;
+	if (*p++ != SKETCH_VERSION) return NULL;
+
+	errno = ENOMEM;
+	s = calloc(1, sizeof(struct tsdp_sketch));
+	if (!s) return NULL;
+
+	errno = EINVAL;
+	u = get64(p); p += 8;
+	if (getvar(&p, end, &n) != 0 || n > TSDP_SKETCH_MAX_BINS) goto fail;
+	if (s_init(s, s_double(u), n ? n : 1) != 0) goto fail;
+	if (getvar(&p, end, &s->zero) != 0 || end - p < 16) goto fail;
+	s->min = s_double(get64(p)); p += 8;
+	s->max = s_double(get64(p)); p += 8;
+	s->count = s->zero;
+
+	for (which = 0; which < 2; which++) {
+		st = which ? &s->neg : &s->pos;
+		if (getvar(&p, end, &n) != 0 || n > s->maxbins) goto fail;
+		if (!n) continue;
+		if (getvar(&p, end, &lo) != 0
+		 || UNZIGZAG(lo) < INT32_MIN || UNZIGZAG(lo) + (int64_t)n - 1 > INT32_MAX) goto fail;
+
+		errno = ENOMEM;
+		st->counts = calloc(s->maxbins, sizeof(uint64_t));
+		if (!st->counts) goto fail;
+		errno = EINVAL;
+		st->lo = (int32_t)UNZIGZAG(lo);
+		st->n  = n;
+		for (i = 0; i < n; i++) {
+			if (getvar(&p, end, &c) != 0 || s->count + c < s->count) goto fail;
+			st->counts[i] = c;
+			s->count += c;
+		}
+	}
+	if (p != end) goto fail;
+	if (s->count && !(s->min <= s->max)) goto fail;
+	return s;
+
+fail:
+	tsdp_sketch_free(s);
+	return NULL;
+}
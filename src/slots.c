@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "slots.h"
+
+#define SLOTS_MIN_POOL 4096
+
+int
+slots_init(struct slots *t, size_t size, size_t nameoff, size_t min, size_t capacity)
+{
+	size_t n;
+
+	memset(t, 0, sizeof(struct slots));
+	for (n = min; n / 4 * 3 < capacity; n <<= 1)
+		;
+	t->size    = size;
+	t->nameoff = nameoff;
+	t->mask    = n - 1;
+	t->slots   = calloc(n, size);
+	return t->slots ? 0 : -1;
+}
+
+void
+slots_free(struct slots *t)
+{
+	free(t->slots);
+	t->slots = NULL;
+	namepool_free(&t->names);
+}
+
+/* returns the first empty slot at or after the home of `h` */
+static void *
+s_empty(struct slots *t, uint64_t h)
+{
+	char *slot;
+	size_t i;
+
+	for (i = h & t->mask; ; i = (i + 1) & t->mask) {
+		slot = t->slots + i * t->size;
+		if (!*(uint64_t *)slot) return slot;
+	}
+}
+
+static int
+s_grow(struct slots *t)
+{
+	char *old, *slot;
+	size_t i, n;
+
+	old = t->slots;
+	t->slots = calloc((t->mask + 1) * 2, t->size);
+	if (!t->slots) {
+		t->slots = old;
+		return -1;
+	}
+	n = t->mask + 1;
+	t->mask = 2 * n - 1;
+	for (i = 0; i < n; i++) {
+		slot = old + i * t->size;
+		if (!*(uint64_t *)slot) continue;
+		memcpy(s_empty(t, *(uint64_t *)slot), slot, t->size);
+	}
+	free(old);
+	return 0;
+}
+
+int
+namepool_intern(struct namepool *p, const char *name, size_t len, uint32_t *offset)
+{
+	char *buf;
+	size_t cap;
+
+	if (p->used + len + 1 > UINT32_MAX) return -1;
+	if (p->used + len + 1 > p->cap) {
+		for (cap = p->cap ? p->cap : SLOTS_MIN_POOL; cap < p->used + len + 1; cap *= 2)
+			;
+		buf = realloc(p->buf, cap);
+		if (!buf) return -1;
+		p->buf = buf;
+		p->cap = cap;
+	}
+	memcpy(p->buf + p->used, name, len);
+	p->buf[p->used + len] = '\0';
+	*offset = p->used;
+	p->used += len + 1;
+	return 0;
+}
+
+void
+namepool_free(struct namepool *p)
+{
+	free(p->buf);
+	memset(p, 0, sizeof(struct namepool));
+}
+
+/* copies the names of all occupied slots into a fresh pool,
+   leaving the dead ones behind, and repoints the slots */
+static int
+s_compact(struct slots *t)
+{
+	struct namepool p;
+	char *slot, *end;
+	uint32_t *name;
+
+	memset(&p, 0, sizeof(p));
+	p.cap = t->names.cap;
+	p.buf = malloc(p.cap);
+	if (!p.buf) return -1;
+
+	for (slot = t->slots, end = slot + (t->mask + 1) * t->size; slot < end; slot += t->size) {
+		if (!*(uint64_t *)slot) continue;
+		name = (uint32_t *)(slot + t->nameoff);
+		if (namepool_intern(&p, t->names.buf + *name, strlen(t->names.buf + *name), name) != 0) {
+			free(p.buf); /* can't happen; the live names fit before */
+			return -1;
+		}
+	}
+	free(t->names.buf);
+	t->names = p;
+	return 0;
+}
+
+void *
+slots_insert(struct slots *t, uint64_t h, const char *name, size_t len)
+{
+	char *slot;
+	uint32_t offset;
+
+	errno = ENOMEM;
+	if (t->n + 1 > (t->mask + 1) / 4 * 3 && s_grow(t) != 0) return NULL;
+
+	/* rather than grow the pool to make room, throw out the
+	   names of deleted slots, if that frees up enough of it
+	   (or if there is no more room for it to grow into) */
+	if (t->names.used + len + 1 > t->names.cap && t->names.dead > 0
+	 && (t->names.dead >= t->names.used / 2 || t->names.used + len + 1 > UINT32_MAX)
+	 && s_compact(t) != 0) return NULL;
+	if (namepool_intern(&t->names, name, len, &offset) != 0) return NULL;
+
+	slot = s_empty(t, h);
+	*(uint64_t *)slot = h;
+	*(uint32_t *)(slot + t->nameoff) = offset;
+	t->n++;
+	return slot;
+}
+
+void
+slots_delete(struct slots *t, void *slot)
+{
+	size_t i, j, home;
+	char *a, *b;
+
+	/* the name stays in the pool, until it is next compacted */
+	t->names.dead += strlen(slots_name(t, slot)) + 1;
+	i = ((char *)slot - t->slots) / t->size;
+	memset(slot, 0, t->size);
+	for (j = (i + 1) & t->mask; *(uint64_t *)(b = t->slots + j * t->size); j = (j + 1) & t->mask) {
+		home = *(uint64_t *)b & t->mask;
+		if (((j - home) & t->mask) >= ((j - i) & t->mask)) {
+			a = t->slots + i * t->size;
+			memcpy(a, b, t->size);
+			memset(b, 0, t->size);
+			i = j;
+		}
+	}
+	t->n--;
+}
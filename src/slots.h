@@ -0,0 +1,111 @@
+#ifndef TSDP_SLOTS_H
+#define TSDP_SLOTS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "hash.h"
+
+/* a pool of NUL-terminated names, each referred to by its
+   (uint32_t) offset into the pool, so that whatever refers
+   to them stays small.  Names are appended; those that are
+   released are only reclaimed by whoever holds the offsets
+   (see slots_insert()). */
+struct namepool {
+	char   *buf;
+	size_t  used, cap;
+	size_t  dead;     /* octets of released names         */
+};
+
+/* appends the first `len` octets of `name` to the pool, and
+   stores its offset in `offset`.  Returns 0 on success, or
+   -1 if we ran out of memory (or offsets). */
+int
+namepool_intern(struct namepool *p, const char *name, size_t len, uint32_t *offset);
+
+void
+namepool_free(struct namepool *p);
+
+/* an open-addressed table of fixed-size slots, stored inline,
+   for the per-series engines (DELTA rates, STATE, group-bys),
+   where every update is a random access into a table with
+   (maybe) millions of entries in it.
+
+   Each slot starts with the 64-bit hash of its name (0 if the
+   slot is empty), and holds the offset of that name in a
+   string pool, as a uint32_t, `nameoff` octets in.  Lookups
+   use linear probing, and compare names only on a hash hit;
+   deletions shift the slots after them back, so there are no
+   tombstones. */
+struct slots {
+	size_t  n;        /* slots in use                     */
+	size_t  mask;     /* number of slots - 1              */
+	size_t  size;     /* octets per slot                  */
+	size_t  nameoff;  /* where, in a slot, its name is    */
+	char   *slots;
+
+	struct namepool names;
+};
+
+static inline uint64_t
+slots_hash(const char *name, size_t len)
+{
+	uint64_t h = hashmix64(hash64(name, len));
+	return h ? h : 1; /* 0 marks an empty slot */
+}
+
+/* returns the NUL-terminated name of (occupied) `slot` */
+static inline const char *
+slots_name(struct slots *t, const void *slot)
+{
+	return t->names.buf + *(const uint32_t *)((const char *)slot + t->nameoff);
+}
+
+/* returns the slot for the first `len` octets of `name` (whose
+   hash is `h`), or else the empty slot that it would go into.
+   Slots for other names that happen to share the hash are
+   probed past, like any other. */
+static inline void *
+slots_find(struct slots *t, uint64_t h, const char *name, size_t len)
+{
+	uint64_t *slot;
+	const char *s;
+	size_t i;
+
+	for (i = h & t->mask; ; i = (i + 1) & t->mask) {
+		slot = (uint64_t *)(t->slots + i * t->size);
+		if (!*slot) return slot;
+		if (*slot != h) continue;
+		s = slots_name(t, slot);
+		if (strncmp(s, name, len) == 0 && s[len] == '\0') return slot;
+	}
+}
+
+/* sets up `t` for slots of `size` octets, with room for
+   `capacity` of them (at a load factor under 3/4), and no
+   fewer than `min` slots, which must be a power of 2.
+   Returns 0 on success, or -1 on failure. */
+int
+slots_init(struct slots *t, size_t size, size_t nameoff, size_t min, size_t capacity);
+
+void
+slots_free(struct slots *t);
+
+/* claims an empty slot for the first `len` octets of `name`
+   (whose hash is `h`, and which must not already have a slot;
+   see slots_find()), growing the table first if need be.
+   The names of deleted slots are reclaimed here, by compacting
+   the pool, once it is full and at least half of it is dead.
+   Returns the slot, zeroed but for its hash and name, or NULL
+   if we ran out of memory (and sets `errno`).  Pointers to
+   other slots are only valid until the next insertion. */
+void *
+slots_insert(struct slots *t, uint64_t h, const char *name, size_t len);
+
+/* empties (occupied) `slot`.  Pointers to other slots are
+   only valid until the next deletion. */
+void
+slots_delete(struct slots *t, void *slot);
+
+#endif
@@ -0,0 +1,327 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "slots.h"
+#include "submit.h"
+
+#define STATE_MIN_SLOTS        1024
+#define STATE_DEFAULT_CAPACITY 4096
+
+#define TRANSITION 0x40 /* BROADCAST STATE flag */
+
+/* one 32-octet slot per series, stored inline, so that two
+   of them share a cache line.  Summaries repeat themselves
+   endlessly ("ok", "disk full", ...), so they are interned
+   once, and each slot just holds the identifier; deciding if
+   an update is a transition is then a pair of integer
+   compares.  Names are canonicalized once, on the way in,
+   and live off to the side in a single string pool, ready to
+   go straight into outgoing BROADCAST frames. */
+struct s_slot {
+	uint64_t hash;     /* 0 if empty                          */
+	uint64_t ts;       /* when the current state was reported */
+	uint32_t name;     /* offset into the pool                */
+	uint32_t status;   /* status code                         */
+	uint32_t summary;  /* symbol table identifier             */
+	uint32_t _pad;
+};
+
+struct tsdp_state {
+	struct slots         t;
+	struct qname_symtab *summaries;
+};
+
+/* build a BROADCAST STATE for `slot`; if `was` is given, it
+   is the transition form, carrying the previous state. */
+static struct tsdp_msg *
+s_broadcast(struct tsdp_state *s, struct s_slot *slot, struct s_slot *was)
+{
+	struct tsdp_msg *m;
+	const char *name, *summary, *previous;
+
+	name    = slots_name(&s->t, slot);
+	summary = qname_symtab_string(s->summaries, slot->summary);
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_BROADCAST, was ? TRANSITION : 0, TSDP_PAYLOAD_STATE);
+	if (!m
+	 || tsdp_msg_extend(m, TSDP_FRAME_STRING, name,          strlen(name) + 1) != 0
+	 || tsdp_msg_extend(m, TSDP_FRAME_UINT,   &slot->status, 4) != 0
+	 || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &slot->ts,     8) != 0
+	 || tsdp_msg_extend(m, TSDP_FRAME_STRING, summary,       strlen(summary) + 1) != 0)
+		goto fail;
+
+	if (was) {
+		previous = qname_symtab_string(s->summaries, was->summary);
+		if (tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &was->ts, 8) != 0
+		 || tsdp_msg_extend(m, TSDP_FRAME_STRING, previous, strlen(previous) + 1) != 0)
+			goto fail;
+	}
+	return m;
+
+fail:
+	tsdp_msg_free(m);
+	errno = ENOMEM;
+	return NULL;
+}
+
+
+/**
+  Allocates a new STATE tracker, which remembers the current
+  status of each series it is told about (via SUBMIT STATE
+  messages), and turns each update into the appropriate
+  BROADCAST STATE (see `tsdp_state_update()`).
+
+  The table starts out with room for `capacity` series (0 picks
+  a default of 4096), and grows as needed.
+
+  STATE trackers are not thread-safe; callers must serialize
+  access to them.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_state *
+tsdp_state_new(size_t capacity)
+{
+	struct tsdp_state *s;
+
+	if (capacity == 0) capacity = STATE_DEFAULT_CAPACITY;
+
+	errno = ENOMEM;
+	s = calloc(1, sizeof(struct tsdp_state));
+	if (!s) return NULL;
+
+	s->summaries = qname_symtab_new();
+	if (slots_init(&s->t, sizeof(struct s_slot), offsetof(struct s_slot, name), STATE_MIN_SLOTS, capacity) != 0
+	 || !s->summaries) {
+		tsdp_state_free(s);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return s;
+}
+
+
+/**
+  Frees a STATE tracker.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_state_free(struct tsdp_state *s)
+{
+	if (!s) return;
+	qname_symtab_free(s->summaries);
+	slots_free(&s->t);
+	free(s);
+}
+
+
+/**
+  Returns how many series the tracker is following.
+ **/
+size_t
+tsdp_state_count(struct tsdp_state *s)
+{
+	return s ? s->t.n : 0;
+}
+
+
+/**
+  Records that the series named by the first `len` octets of
+  `name` was in state `status` at time `ts`, as described by
+  the first `slen` octets of `summary` (which may be NULL, for
+  no summary).  Names are compared as given, so callers should
+  canonicalize them first (`tsdp_state_submit()` does this
+  for SUBMIT STATE messages).
+
+  If `fn` is not NULL, it is called with the BROADCAST STATE
+  message to send out: the transition form (flag 0x40), which
+  also carries the timestamp and summary of the previous state,
+  if the status code changed, or the plain form otherwise.  The
+  message is freed once `fn` returns.  Updates older than the
+  current state are ignored, and broadcast nothing.
+
+  Distinct summaries are interned for the lifetime of the
+  tracker, so they should not embed ever-changing values.
+
+  Returns 1 if the update was a transition, 0 if not, or -1 on
+  failure, and sets `errno`.
+ **/
+int
+tsdp_state_update(struct tsdp_state *s, const char *name, size_t len, uint64_t ts,
+                  uint32_t status, const char *summary, size_t slen,
+                  void (*fn)(struct tsdp_msg *m, void *udata), void *udata)
+{
+	struct s_slot *slot, was;
+	struct tsdp_msg *m;
+	uint32_t id;
+	uint64_t h;
+	int transition;
+
+	errno = EINVAL;
+	if (!s || !name || len == 0 || len > QNAME_MAX_LEN) return -1;
+	if (!summary) summary = "", slen = 0;
+
+	h = slots_hash(name, len);
+	slot = slots_find(&s->t, h, name, len);
+	if (slot->hash && ts < slot->ts) return 0; /* stale */
+
+	id = qname_symtab_intern(s->summaries, summary, slen);
+	if (!id) return -1;
+
+	if (!slot->hash) {
+		slot = slots_insert(&s->t, h, name, len);
+		if (!slot) return -1;
+		slot->status = status;
+	}
+
+	was = *slot;
+	transition = slot->status != status;
+	slot->status  = status;
+	slot->summary = id;
+	slot->ts      = ts;
+
+	if (fn) {
+		m = s_broadcast(s, slot, transition ? &was : NULL);
+		if (!m) return -1;
+		fn(m, udata);
+		tsdp_msg_free(m);
+	}
+	return transition;
+}
+
+
+/**
+  Records the state carried by the SUBMIT STATE message `m`,
+  as for `tsdp_state_update()`.
+
+  Returns 1 if the update was a transition, 0 if not, or -1 on
+  failure, and sets `errno`.  Anything other than a well-formed
+  SUBMIT STATE fails with EINVAL.
+ **/
+int
+tsdp_state_submit(struct tsdp_state *s, struct tsdp_msg *m,
+                  void (*fn)(struct tsdp_msg *m, void *udata), void *udata)
+{
+	struct tsdp_frame *f;
+	char buf[QNAME_MAX_LEN + 1];
+	const char *summary;
+	size_t len, slen;
+
+	errno = EINVAL;
+	if (!s || !m || m->opcode != TSDP_OPCODE_SUBMIT || m->payload != TSDP_PAYLOAD_STATE) return -1;
+	if (m->nframes < 3 || m->nframes > 4
+	 || m->frames->type             != TSDP_FRAME_STRING
+	 || m->frames->next->type       != TSDP_FRAME_TSTAMP
+	 || m->frames->next->next->type != TSDP_FRAME_UINT || m->frames->next->next->length != 4)
+		return -1;
+
+	summary = NULL; slen = 0;
+	if (m->nframes == 4) {
+		f = m->last;
+		if (f->type != TSDP_FRAME_STRING) return -1;
+		summary = f->payload.string;
+		slen = strnlen(f->payload.string, f->length);
+	}
+
+	if (submit_name(m->frames, buf, &len) != 0) return -1;
+	return tsdp_state_update(s, buf, len, m->frames->next->payload.tstamp,
+	                         m->frames->next->next->payload.uint32, summary, slen, fn, udata);
+}
+
+
+/**
+  Copies the current status code, timestamp and summary of the
+  first `len` octets of `name` into `status`, `ts` and `summary`
+  (any of which may be NULL, if the caller is not interested).
+  The summary string remains valid for the lifetime of the
+  tracker.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Names that are not being tracked fail with ENOENT.
+ **/
+int
+tsdp_state_get(struct tsdp_state *s, const char *name, size_t len,
+               uint32_t *status, uint64_t *ts, const char **summary)
+{
+	struct s_slot *slot;
+
+	errno = EINVAL;
+	if (!s || !name) return -1;
+
+	errno = ENOENT;
+	slot = slots_find(&s->t, slots_hash(name, len), name, len);
+	if (!slot->hash) return -1;
+
+	if (status)  *status  = slot->status;
+	if (ts)      *ts      = slot->ts;
+	if (summary) *summary = qname_symtab_string(s->summaries, slot->summary);
+	return 0;
+}
+
+
+/**
+  Stops tracking the first `len` octets of `name` (in response
+  to a FORGET, say).  The next update for it will not be seen
+  as a transition.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Names that are not being tracked fail with ENOENT.
+ **/
+int
+tsdp_state_forget(struct tsdp_state *s, const char *name, size_t len)
+{
+	struct s_slot *slot;
+
+	errno = EINVAL;
+	if (!s || !name) return -1;
+
+	errno = ENOENT;
+	slot = slots_find(&s->t, slots_hash(name, len), name, len);
+	if (!slot->hash) return -1;
+
+	slots_delete(&s->t, slot);
+	return 0;
+}
+
+
+/**
+  Answers a REPLAY, by calling `fn` with a (non-transition)
+  BROADCAST STATE message for the current state of every series
+  being tracked, in no particular order.  Each message is freed
+  once `fn` returns.
+
+  This is a single sequential sweep of the table; nothing is
+  parsed, and nothing is looked up.
+
+  Returns how many messages were emitted, or -1 on failure, and
+  sets `errno`.
+ **/
+int
+tsdp_state_replay(struct tsdp_state *s, void (*fn)(struct tsdp_msg *m, void *udata), void *udata)
+{
+	struct s_slot *slot, *end;
+	struct tsdp_msg *m;
+	int n;
+
+	errno = EINVAL;
+	if (!s || !fn) return -1;
+
+	n = 0;
+	slot = (struct s_slot *)s->t.slots;
+	for (end = slot + s->t.mask + 1; slot < end; slot++) {
+		if (!slot->hash) continue;
+
+		m = s_broadcast(s, slot, NULL);
+		if (!m) return -1;
+		fn(m, udata);
+		tsdp_msg_free(m);
+		n++;
+	}
+	return n;
+}
@@ -0,0 +1,409 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "strmap.h"
+#include "chunk.h"
+#include "submit.h"
+
+/* each series is a chain of fixed-size chunks (see chunk.h);
+   appends only ever go to the tail chunk, and `enc` is where
+   the encoder left off in it. */
+struct s_series {
+	struct chunk *head, *tail;
+	uint64_t points;
+	struct chunk_encoder enc;
+};
+
+struct tsdp_store {
+	struct strmap *series;  /* name -> struct s_series *  */
+	uint64_t       points;
+	size_t         chunks;
+};
+
+static uint64_t
+s_bits(double v)
+{
+	uint64_t u;
+	memcpy(&u, &v, sizeof(u));
+	return u;
+}
+
+static double
+s_double(uint64_t u)
+{
+	double v;
+	memcpy(&v, &u, sizeof(v));
+	return v;
+}
+
+static int
+s_advance(struct tsdp_store_iter *it)
+{
+	struct chunk *c = it->chunk;
+
+	if (!c) return 0;
+	it->chunk = c->next;
+	it->first = c->first;
+	it->last  = c->last;
+	chunk_cursor_init(&it->cur, c->data, c->n, c->bits);
+	return 1;
+}
+
+struct s_each {
+	int (*fn)(const char *, size_t, struct chunk *, uint64_t, void *);
+	void *udata;
+};
+
+static int
+s_each(const void *key, size_t len, void *value, void *udata)
+{
+	struct s_each *e = (struct s_each *)udata;
+	struct s_series *ser = (struct s_series *)value;
+	return e->fn((const char *)key, len, ser->head, ser->points, e->udata);
+}
+
+int
+store_each(struct tsdp_store *s, int (*fn)(const char *name, size_t len, struct chunk *head, uint64_t points, void *udata), void *udata)
+{
+	struct s_each e = { fn, udata };
+	return strmap_each(s->series, s_each, &e);
+}
+
+static void
+s_free_series(void *p)
+{
+	struct s_series *s = (struct s_series *)p;
+	struct chunk *c, *next;
+
+	for (c = s->head; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	free(s);
+}
+
+
+/**
+  Allocates a new, empty, in-memory series store, which keeps
+  the history of each series (by qualified name) compressed,
+  in fixed-size chunks, at a few octets per point.
+
+  Series stores are not thread-safe; callers must serialize
+  access to them.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_store *
+tsdp_store_new(void)
+{
+	struct tsdp_store *s;
+
+	errno = ENOMEM;
+	s = calloc(1, sizeof(struct tsdp_store));
+	if (!s) return NULL;
+
+	s->series = strmap_new();
+	if (!s->series) {
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+
+/**
+  Frees a series store, and all of the history in it.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_store_free(struct tsdp_store *s)
+{
+	if (!s) return;
+	strmap_free(s->series, s_free_series);
+	free(s);
+}
+
+
+/**
+  Returns how many series the store holds.
+ **/
+size_t
+tsdp_store_count(struct tsdp_store *s)
+{
+	return s ? strmap_count(s->series) : 0;
+}
+
+
+/**
+  Returns how many points the store holds, across all series.
+ **/
+uint64_t
+tsdp_store_points(struct tsdp_store *s)
+{
+	return s ? s->points : 0;
+}
+
+
+/**
+  Returns how many octets of chunk memory the store holds,
+  across all series.
+ **/
+size_t
+tsdp_store_octets(struct tsdp_store *s)
+{
+	return s ? s->chunks * sizeof(struct chunk) : 0;
+}
+
+
+/**
+  Appends the point (`ts`, `v`) to the history of the series
+  named by the first `len` octets of `name`.  Names are compared
+  as given, so callers should canonicalize them first
+  (`tsdp_store_submit()` does this for SUBMIT messages).
+
+  Points must be appended in time order; more than one point
+  may share a timestamp.  The store does not care what units
+  timestamps are in, but everything built on it (rollup widths,
+  say) is in the same units: seconds, for points that come from
+  TSTAMP frames (see `tsdp_store_submit()`).
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Points older than the last one in the series fail with ERANGE.
+ **/
+int
+tsdp_store_append(struct tsdp_store *s, const char *name, size_t len, uint64_t ts, double v)
+{
+	struct s_series *ser;
+	struct chunk *c;
+	void **slot;
+
+	errno = EINVAL;
+	if (!s || !name || len == 0 || len > QNAME_MAX_LEN) return -1;
+
+	errno = ENOMEM;
+	slot = strmap_slot(s->series, name, len);
+	if (!slot) return -1;
+	if (!*slot && !(*slot = calloc(1, sizeof(struct s_series)))) {
+		strmap_del(s->series, name, len);
+		return -1;
+	}
+	ser = (struct s_series *)*slot;
+
+	errno = ERANGE;
+	c = ser->tail;
+	if (c && ts < c->last) return -1;
+
+	if (!c || chunk_append(c, &ser->enc, ts, s_bits(v)) != 0) {
+		errno = ENOMEM;
+		c = calloc(1, sizeof(struct chunk));
+		if (!c) {
+			if (!ser->head) s_free_series(strmap_del(s->series, name, len));
+			return -1;
+		}
+		if (ser->tail) ser->tail->next = c;
+		else           ser->head = c;
+		ser->tail = c;
+		s->chunks++;
+		chunk_append(c, &ser->enc, ts, s_bits(v));
+	}
+
+	ser->points++;
+	s->points++;
+	return 0;
+}
+
+
+/**
+  Appends the measurements of the SUBMIT SAMPLE or SUBMIT DELTA
+  message `m` to the history of its qualified name, as for
+  `tsdp_store_append()`.  Every measurement of a SAMPLE is
+  appended, each with the timestamp of the message.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Anything other than a well-formed SUBMIT SAMPLE or DELTA
+  fails with EINVAL.
+ **/
+int
+tsdp_store_submit(struct tsdp_store *s, struct tsdp_msg *m)
+{
+	struct tsdp_frame *f;
+	char buf[QNAME_MAX_LEN + 1];
+	size_t len;
+
+	errno = EINVAL;
+	if (!s || !m || m->opcode != TSDP_OPCODE_SUBMIT) return -1;
+	if (m->payload != TSDP_PAYLOAD_SAMPLE && m->payload != TSDP_PAYLOAD_DELTA) return -1;
+	if (m->nframes < 3
+	 || (m->payload == TSDP_PAYLOAD_DELTA && m->nframes != 3)
+	 || m->frames->type       != TSDP_FRAME_STRING
+	 || m->frames->next->type != TSDP_FRAME_TSTAMP)
+		return -1;
+	for (f = m->frames->next->next; f; f = f->next)
+		if (f->type != TSDP_FRAME_FLOAT || f->length != 8) return -1;
+
+	if (submit_name(m->frames, buf, &len) != 0) return -1;
+
+	for (f = m->frames->next->next; f; f = f->next)
+		if (tsdp_store_append(s, buf, len, m->frames->next->payload.tstamp, f->payload.float64) != 0)
+			return -1;
+	return 0;
+}
+
+
+/**
+  Discards the history of the first `len` octets of `name` (in
+  response to a FORGET, say).
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Names that are not in the store fail with ENOENT.
+ **/
+int
+tsdp_store_forget(struct tsdp_store *s, const char *name, size_t len)
+{
+	struct s_series *ser;
+	struct chunk *c;
+
+	errno = EINVAL;
+	if (!s || !name) return -1;
+
+	errno = ENOENT;
+	ser = strmap_del(s->series, name, len);
+	if (!ser) return -1;
+
+	for (c = ser->head; c; c = c->next)
+		s->chunks--;
+	s->points -= ser->points;
+	s_free_series(ser);
+	return 0;
+}
+
+
+/**
+  Starts reading the history of the first `len` octets of
+  `name`, from `from` to `until` (both inclusive), in time
+  order, via `tsdp_store_next()`.  Chunks that fall entirely
+  outside of the range are skipped without being decoded.
+
+  The store must not be modified while the iterator is in use.
+  The returned iterator must be freed by the caller, via
+  `tsdp_store_iter_free()`, when no longer needed.
+
+  Returns NULL on failure, and sets `errno`.  Names that are
+  not in the store fail with ENOENT.
+ **/
+struct tsdp_store_iter *
+tsdp_store_iter(struct tsdp_store *s, const char *name, size_t len, uint64_t from, uint64_t until)
+{
+	struct tsdp_store_iter *it;
+	struct s_series *ser;
+
+	errno = EINVAL;
+	if (!s || !name) return NULL;
+
+	errno = ENOENT;
+	ser = strmap_get(s->series, name, len);
+	if (!ser) return NULL;
+
+	errno = ENOMEM;
+	it = calloc(1, sizeof(struct tsdp_store_iter));
+	if (!it) return NULL;
+
+	it->advance = s_advance;
+	it->chunk   = ser->head;
+	it->from    = from;
+	it->until   = until;
+	return it;
+}
+
+
+/**
+  Decodes the next point of the iterator's range into `ts` and
+  `v`.  This works the same for iterators over a store, and
+  over a segment file (see `tsdp_segment_iter()`).
+
+  Returns 1 if there was a point, 0 at the end of the range.
+ **/
+int
+tsdp_store_next(struct tsdp_store_iter *it, uint64_t *ts, double *v)
+{
+	uint64_t t, u;
+
+	if (!it) return 0;
+	while (!it->done) {
+		if (!it->loaded) {
+			if (!it->advance(it) || it->first > it->until) break;
+			it->loaded = it->last >= it->from; /* skip it whole, if not */
+			continue;
+		}
+		if (!chunk_cursor_next(&it->cur, &t, &u)) {
+			it->loaded = 0;
+			continue;
+		}
+
+		if (t < it->from) continue;
+		if (t > it->until) break;
+		if (ts) *ts = t;
+		if (v)  *v  = s_double(u);
+		return 1;
+	}
+	it->done = 1;
+	return 0;
+}
+
+
+/**
+  Reads the next bucket of the iterator's range into `b`.  For
+  rollup segments (see `tsdp_segment_compact()`), that is the
+  minimum, maximum, sum and number of values in the next bucket,
+  timestamped with the start of the bucket.  Raw points (from a
+  store, or from a segment of raw points) each make a bucket of
+  their own, with a count of 1.
+
+  Returns 1 if there was a bucket, 0 at the end of the range.
+ **/
+int
+tsdp_store_bucket(struct tsdp_store_iter *it, struct tsdp_bucket *b)
+{
+	uint64_t ts;
+	double v[4];
+	int i;
+
+	if (!it || !b) return 0;
+	if (!it->width) {
+		if (!tsdp_store_next(it, &b->ts, &v[0])) return 0;
+		b->min = b->max = b->sum = v[0];
+		b->count = 1;
+		return 1;
+	}
+
+	for (i = 0; i < 4; i++) {
+		if (!tsdp_store_next(it, &ts, &v[i])) return 0;
+		if (i > 0 && ts != b->ts) {
+			it->done = 1; /* corrupt; stop here */
+			return 0;
+		}
+		b->ts = ts;
+	}
+	b->min   = v[0];
+	b->max   = v[1];
+	b->sum   = v[2];
+	b->count = (uint64_t)v[3];
+	return 1;
+}
+
+
+/**
+  Frees a series store iterator.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_store_iter_free(struct tsdp_store_iter *it)
+{
+	free(it);
+}
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "strmap.h"
+#include "hash.h"
+
+#define STRMAP_MIN_SLOTS 64
+
+struct s_entry {
+	uint64_t hash;
+	size_t   len;
+	char    *key;   /* NULL if the slot is empty */
+	void    *value;
+};
+
+struct strmap {
+	size_t n;       /* number of entries in use         */
+	size_t nslots;  /* size of slots[] (a power of 2)   */
+	struct s_entry *slots;
+};
+
+struct strmap *
+strmap_new(void)
+{
+	struct strmap *m;
+
+	m = calloc(1, sizeof(struct strmap));
+	if (!m) return NULL;
+
+	m->nslots = STRMAP_MIN_SLOTS;
+	m->slots  = calloc(m->nslots, sizeof(struct s_entry));
+	if (!m->slots) {
+		free(m);
+		return NULL;
+	}
+	return m;
+}
+
+void
+strmap_free(struct strmap *m, void (*destroy)(void *))
+{
+	size_t i;
+
+	if (!m) return;
+	for (i = 0; i < m->nslots; i++) {
+		if (!m->slots[i].key) continue;
+		if (destroy) destroy(m->slots[i].value);
+		free(m->slots[i].key);
+	}
+	free(m->slots);
+	free(m);
+}
+
+void
+strmap_clear(struct strmap *m, void (*destroy)(void *))
+{
+	size_t i;
+
+	if (!m) return;
+	for (i = 0; i < m->nslots; i++) {
+		if (!m->slots[i].key) continue;
+		if (destroy) destroy(m->slots[i].value);
+		free(m->slots[i].key);
+		m->slots[i].key = NULL;
+	}
+	m->n = 0;
+}
+
+size_t
+strmap_count(struct strmap *m)
+{
+	return m ? m->n : 0;
+}
+
+static struct s_entry *
+s_find(struct strmap *m, const void *key, size_t len, uint64_t h)
+{
+	size_t i, mask;
+
+	mask = m->nslots - 1;
+	for (i = h & mask; m->slots[i].key; i = (i + 1) & mask)
+		if (m->slots[i].hash == h && m->slots[i].len == len
+		 && memcmp(m->slots[i].key, key, len) == 0)
+			return &m->slots[i];
+	return &m->slots[i]; /* the empty slot it would go in */
+}
+
+static int
+s_grow(struct strmap *m)
+{
+	struct s_entry *old, *e;
+	size_t i, n;
+
+	old = m->slots;
+	n   = m->nslots;
+
+	m->slots = calloc(n * 2, sizeof(struct s_entry));
+	if (!m->slots) {
+		m->slots = old;
+		return -1;
+	}
+	m->nslots = n * 2;
+
+	for (i = 0; i < n; i++) {
+		if (!old[i].key) continue;
+		e = s_find(m, old[i].key, old[i].len, old[i].hash);
+		*e = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+void *
+strmap_get(struct strmap *m, const void *key, size_t len)
+{
+	struct s_entry *e;
+
+	if (!m) return NULL;
+	e = s_find(m, key, len, hash64(key, len));
+	return e->key ? e->value : NULL;
+}
+
+void **
+strmap_slot(struct strmap *m, const void *key, size_t len)
+{
+	struct s_entry *e;
+	uint64_t h;
+
+	errno = EINVAL;
+	if (!m) return NULL;
+
+	h = hash64(key, len);
+	e = s_find(m, key, len, h);
+	if (e->key) return &e->value;
+
+	/* keep the map no more than 3/4 full */
+	if ((m->n + 1) * 4 > m->nslots * 3) {
+		if (s_grow(m) != 0) return NULL;
+		e = s_find(m, key, len, h);
+	}
+
+	e->key = malloc(len ? len : 1);
+	if (!e->key) return NULL;
+	memcpy(e->key, key, len);
+	e->len   = len;
+	e->hash  = h;
+	e->value = NULL;
+	m->n++;
+	return &e->value;
+}
+
+void *
+strmap_del(struct strmap *m, const void *key, size_t len)
+{
+	struct s_entry *e;
+	size_t i, j, k, mask;
+	void *value;
+
+	if (!m) return NULL;
+	e = s_find(m, key, len, hash64(key, len));
+	if (!e->key) return NULL;
+
+	value = e->value;
+	free(e->key);
+	e->key = NULL;
+	m->n--;
+
+	/* backward-shift deletion: pull later members of the
+	   probe sequence into the hole, so lookups still work */
+	mask = m->nslots - 1;
+	i = e - m->slots;
+	for (j = (i + 1) & mask; m->slots[j].key; j = (j + 1) & mask) {
+		k = m->slots[j].hash & mask;
+		/* can the entry at j live in the hole at i?  only if its
+		   home slot k is not cyclically within (i, j] */
+		if ((j > i && (k <= i || k > j))
+		 || (j < i && (k <= i && k > j))) {
+			m->slots[i] = m->slots[j];
+			m->slots[j].key = NULL;
+			i = j;
+		}
+	}
+	return value;
+}
+
+int
+strmap_each(struct strmap *m, int (*fn)(const void *key, size_t len, void *value, void *udata), void *udata)
+{
+	size_t i;
+	int rc;
+
+	if (!m) return 0;
+	for (i = 0; i < m->nslots; i++) {
+		if (!m->slots[i].key) continue;
+		rc = fn(m->slots[i].key, m->slots[i].len, m->slots[i].value, udata);
+		if (rc != 0) return rc;
+	}
+	return 0;
+}
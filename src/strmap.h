@@ -0,0 +1,47 @@
+#ifndef TSDP_STRMAP_H
+#define TSDP_STRMAP_H
+
+#include <stddef.h>
+
+/* an open-addressed hash map from arbitrary octet strings
+   (which the map copies) to opaque pointers, for internal
+   use by the various indexes. */
+struct strmap;
+
+struct strmap *
+strmap_new(void);
+
+/* free the map, calling `destroy` (if not NULL) on each value */
+void
+strmap_free(struct strmap *m, void (*destroy)(void *));
+
+/* remove every entry, calling `destroy` (if not NULL) on each
+   value, but keep the slots allocated for reuse */
+void
+strmap_clear(struct strmap *m, void (*destroy)(void *));
+
+size_t
+strmap_count(struct strmap *m);
+
+/* returns the value stored under `key`, or NULL */
+void *
+strmap_get(struct strmap *m, const void *key, size_t len);
+
+/* returns the address of the value stored under `key`,
+   inserting it (with a NULL value) if it was not already
+   there, or NULL if we ran out of memory.  The address is
+   only valid until the next insertion or deletion. */
+void **
+strmap_slot(struct strmap *m, const void *key, size_t len);
+
+/* removes `key`, returning the value it had (or NULL) */
+void *
+strmap_del(struct strmap *m, const void *key, size_t len);
+
+/* calls `fn` for each entry, stopping early (and returning
+   what `fn` returned) if `fn` returns non-zero.  The map must
+   not be modified during iteration. */
+int
+strmap_each(struct strmap *m, int (*fn)(const void *key, size_t len, void *value, void *udata), void *udata);
+
+#endif
@@ -0,0 +1,757 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "strmap.h"
+#include "qkey.h"
+
+/* constraint kinds, as encoded in posting list keys */
+#define KIND_VALUE 'v'   /* key=value */
+#define KIND_NONE  '-'   /* key       */
+#define KIND_ANY   '*'   /* key=*     */
+
+/* longest posting list key we will build:
+   metric, key and value, plus delimiters */
+#define MAX_CONSTRAINT (3 * (QNAME_MAX_LEN + 1))
+
+struct s_sub {
+	struct qname *pattern;  /* our own copy; NULL if the slot is free */
+	unsigned int payloads;  /* TSDP_PAYLOAD_* mask                   */
+	void        *sub;       /* caller's subscriber handle            */
+	uint32_t     need;      /* distinct constraints to be met        */
+};
+
+struct s_postings {
+	uint32_t  n, max;
+	uint32_t *ids;
+};
+
+struct tsdp_subidx {
+	uint32_t      n, max;   /* subscription slots used / allocated */
+	struct s_sub *subs;
+	uint32_t     *count;    /* constraints met, per subscription,  */
+	uint32_t     *stamp;    /* ... valid if stamp[id] == gen       */
+	uint32_t      gen;
+
+	uint32_t     *free;     /* stack of recycled subscription ids  */
+	uint32_t      nfree;
+	uint32_t      live;     /* how many subscriptions are active   */
+
+	struct strmap *postings; /* (metric, key, value) -> postings    */
+	struct strmap *bare;     /* metric -> constraint-free patterns  */
+
+	/* match-result cache (see tsdp_subidx_cache) */
+	size_t          cached, cachemax;
+	struct s_entry *mru, *lru;
+	struct strmap  *cache;    /* payload + canonical name -> entry  */
+	struct strmap  *metrics;  /* metric -> first entry for it       */
+	uint64_t        hits, misses;
+
+	uint32_t       *found;    /* ids matched by the last lookup     */
+	size_t          maxfound;
+};
+
+struct s_entry {
+	struct s_entry *prev, *next;   /* LRU order, most recent first   */
+	struct s_entry *mprev, *mnext; /* other entries, same metric     */
+	struct qname   *name;
+	unsigned int    payload;
+	size_t          n;             /* how many subscriptions matched */
+	uint32_t       *ids;           /* ... and which ones they were   */
+	size_t          klen;
+	char            key[];         /* our key in the cache map       */
+};
+
+/* build the posting list key for one constraint into `buf`,
+   as the metric, a NUL, the kind of constraint, the key, a NUL
+   and the value (so that no two constraints share a key, even
+   if their keys and values run together); returns its length,
+   or 0 if it would not fit. */
+static size_t
+s_constraint(char *buf, const char *metric, const char *key, const char *value)
+{
+	size_t lm, lk, lv;
+	char kind;
+
+	if (!value)                        { kind = KIND_NONE; value = ""; }
+	else if (strcmp(value, "*") == 0)  { kind = KIND_ANY;  value = ""; }
+	else                                 kind = KIND_VALUE;
+
+	lm = strlen(metric);
+	lk = strlen(key);
+	lv = strlen(value);
+	if (lm + lk + lv + 3 > MAX_CONSTRAINT) return 0;
+
+	memcpy(buf, metric, lm);              buf[lm] = '\0';
+	buf[lm + 1] = kind;
+	memcpy(buf + lm + 2, key, lk);        buf[lm + 2 + lk] = '\0';
+	memcpy(buf + lm + lk + 3, value, lv);
+	return lm + lk + lv + 3;
+}
+
+static int
+s_post(struct strmap *map, const char *k, size_t len, uint32_t id)
+{
+	struct s_postings **slot, *p;
+	void *ids;
+
+	slot = (struct s_postings **)strmap_slot(map, k, len);
+	if (!slot) return -1;
+
+	if (!*slot) {
+		*slot = calloc(1, sizeof(struct s_postings));
+		if (!*slot) {
+			strmap_del(map, k, len);
+			return -1;
+		}
+	}
+	p = *slot;
+	if (p->n == p->max) {
+		ids = realloc(p->ids, (p->max ? p->max * 2 : 4) * sizeof(uint32_t));
+		if (!ids) return -1;
+		p->ids = ids;
+		p->max = p->max ? p->max * 2 : 4;
+	}
+	p->ids[p->n++] = id;
+	return 0;
+}
+
+static void
+s_unpost(struct strmap *map, const char *k, size_t len, uint32_t id)
+{
+	struct s_postings *p;
+	uint32_t i;
+
+	p = strmap_get(map, k, len);
+	if (!p) return;
+
+	for (i = 0; i < p->n; i++) {
+		if (p->ids[i] == id) {
+			p->ids[i] = p->ids[--p->n];
+			break;
+		}
+	}
+	if (p->n == 0) {
+		strmap_del(map, k, len);
+		free(p->ids);
+		free(p);
+	}
+}
+
+/* does pair `i` of `p` repeat an earlier constraint verbatim?
+   (pairs are sorted by key, so we need only look back) */
+static int
+s_repeat(struct qname *p, int i)
+{
+	int j;
+	for (j = i - 1; j >= 0 && strcmp(p->pairs[j].key, p->pairs[i].key) == 0; j--) {
+		if (!p->pairs[j].value || !p->pairs[i].value) {
+			if (p->pairs[j].value == p->pairs[i].value) return 1;
+			continue;
+		}
+		if (strcmp(p->pairs[j].value, p->pairs[i].value) == 0) return 1;
+	}
+	return 0;
+}
+
+static void
+s_postings_free(void *p)
+{
+	if (!p) return;
+	free(((struct s_postings *)p)->ids);
+	free(p);
+}
+
+/* remove subscription `id` from every posting list its
+   pattern would have put it on */
+static void
+s_unindex(struct tsdp_subidx *x, uint32_t id)
+{
+	struct qname *p;
+	char buf[MAX_CONSTRAINT];
+	size_t len;
+	int i;
+
+	p = x->subs[id].pattern;
+	if (p->i == 0) {
+		s_unpost(x->bare, p->metric, strlen(p->metric), id);
+		return;
+	}
+	for (i = 0; i < p->i; i++) {
+		if (s_repeat(p, i)) continue;
+		len = s_constraint(buf, p->metric, p->pairs[i].key, p->pairs[i].value);
+		if (len) s_unpost(x->postings, buf, len, id);
+	}
+}
+
+
+/* build the cache key for `q` and `payload` into `buf`;
+   returns its length, or 0 if it would not fit */
+static size_t
+s_cache_key(char *buf, size_t len, struct qname *q, unsigned int payload)
+{
+	size_t n;
+
+	memcpy(buf, &payload, sizeof(payload));
+	n = qname_key(q, buf + sizeof(payload), len - sizeof(payload));
+	return n ? n + sizeof(payload) : 0;
+}
+
+static void
+s_entry_free(void *e)
+{
+	if (!e) return;
+	qname_free(((struct s_entry *)e)->name);
+	free(((struct s_entry *)e)->ids);
+	free(e);
+}
+
+/* unlink `e` from the LRU list */
+static void
+s_unlink(struct tsdp_subidx *x, struct s_entry *e)
+{
+	if (e->prev) e->prev->next = e->next; else x->mru = e->next;
+	if (e->next) e->next->prev = e->prev; else x->lru = e->prev;
+	e->prev = e->next = NULL;
+}
+
+/* (re)link `e` at the head of the LRU list */
+static void
+s_touch(struct tsdp_subidx *x, struct s_entry *e)
+{
+	e->next = x->mru;
+	e->prev = NULL;
+	if (x->mru) x->mru->prev = e;
+	x->mru = e;
+	if (!x->lru) x->lru = e;
+}
+
+/* evict `e` from the cache */
+static void
+s_drop(struct tsdp_subidx *x, struct s_entry *e)
+{
+	void **head;
+
+	s_unlink(x, e);
+	if (e->mnext) e->mnext->mprev = e->mprev;
+	if (e->mprev) {
+		e->mprev->mnext = e->mnext;
+	} else {
+		head = strmap_slot(x->metrics, e->name->metric, strlen(e->name->metric));
+		if (head && e->mnext) *head = e->mnext;
+		else strmap_del(x->metrics, e->name->metric, strlen(e->name->metric));
+	}
+
+	strmap_del(x->cache, e->key, e->klen);
+	s_entry_free(e);
+	x->cached--;
+}
+
+/* evict every cached result that a new subscription for
+   `metric` (and `payloads`) could add itself to.  The index
+   only ever finds a subscription for qnames with the same
+   metric name, so we need not look any further than those,
+   but we do not try to second-guess the index any further. */
+static void
+s_invalidate(struct tsdp_subidx *x, const char *metric, unsigned int payloads)
+{
+	struct s_entry *e, *next;
+
+	if (!x->cache) return;
+	e = strmap_get(x->metrics, metric, strlen(metric));
+	for (; e; e = next) {
+		next = e->mnext;
+		if (e->payload & payloads)
+			s_drop(x, e);
+	}
+}
+
+/* evict every cached result that subscription `id` (for
+   `metric`) is a part of, before it goes away */
+static void
+s_forget(struct tsdp_subidx *x, const char *metric, uint32_t id)
+{
+	struct s_entry *e, *next;
+	size_t i;
+
+	if (!x->cache) return;
+	e = strmap_get(x->metrics, metric, strlen(metric));
+	for (; e; e = next) {
+		next = e->mnext;
+		for (i = 0; i < e->n; i++) {
+			if (e->ids[i] == id) {
+				s_drop(x, e);
+				break;
+			}
+		}
+	}
+}
+
+/* note that the `i`th match of a lookup was subscription `id`;
+   returns 0 on success, or -1 if we ran out of memory */
+static int
+s_found(struct tsdp_subidx *x, size_t i, uint32_t id)
+{
+	size_t max;
+	void *a;
+
+	if (i == x->maxfound) {
+		max = x->maxfound ? x->maxfound * 2 : 64;
+		a = realloc(x->found, max * sizeof(uint32_t));
+		if (!a) return -1;
+		x->found    = a;
+		x->maxfound = max;
+	}
+	x->found[i] = id;
+	return 0;
+}
+
+/* remember that `q` (and `payload`) matched the `n` subscriptions
+   in `ids`.  Failure to do so is not an error. */
+static void
+s_remember(struct tsdp_subidx *x, const char *key, size_t klen, struct qname *q, unsigned int payload,
+           uint32_t *ids, size_t n)
+{
+	struct s_entry *e, **slot, **head;
+
+	if (x->cached == x->cachemax)
+		s_drop(x, x->lru);
+
+	e = calloc(1, sizeof(struct s_entry) + klen);
+	if (!e) return;
+	e->name    = qname_dup(q);
+	e->payload = payload;
+	e->n       = n;
+	e->ids     = malloc((n ? n : 1) * sizeof(uint32_t));
+	e->klen    = klen;
+	memcpy(e->key, key, klen);
+	if (!e->name || !e->ids) goto fail;
+	memcpy(e->ids, ids, n * sizeof(uint32_t));
+
+	head = (struct s_entry **)strmap_slot(x->metrics, q->metric, strlen(q->metric));
+	if (!head) goto fail;
+	slot = (struct s_entry **)strmap_slot(x->cache, key, klen);
+	if (!slot) {
+		if (!*head) strmap_del(x->metrics, q->metric, strlen(q->metric));
+		goto fail;
+	}
+	*slot = e;
+
+	e->mnext = *head;
+	if (*head) (*head)->mprev = e;
+	*head = e;
+
+	s_touch(x, e);
+	x->cached++;
+	return;
+
+fail:
+	s_entry_free(e);
+}
+
+
+/**
+  Allocates a new, empty subscription index.
+
+  A subscription index maps qname patterns (as found in a
+  SUBSCRIBE message) to opaque subscriber handles, and can
+  find every subscriber whose pattern matches a given qname
+  (as found in a BROADCAST message) without having to try
+  each pattern in turn.
+
+  Subscription indexes are not thread-safe; callers must
+  serialize access to them (including lookups).
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_subidx *
+tsdp_subidx_new(void)
+{
+	struct tsdp_subidx *x;
+
+	x = calloc(1, sizeof(struct tsdp_subidx));
+	if (!x) return NULL;
+
+	x->postings = strmap_new();
+	x->bare     = strmap_new();
+	if (!x->postings || !x->bare) {
+		tsdp_subidx_free(x);
+		return NULL;
+	}
+	return x;
+}
+
+
+/**
+  Frees a subscription index, and its copies of all the
+  subscription patterns.  Subscriber handles are not touched.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_subidx_free(struct tsdp_subidx *x)
+{
+	uint32_t i;
+
+	if (!x) return;
+	for (i = 0; i < x->n; i++)
+		qname_free(x->subs[i].pattern);
+	strmap_free(x->postings, s_postings_free);
+	strmap_free(x->bare,     s_postings_free);
+	strmap_free(x->cache,    s_entry_free);
+	strmap_free(x->metrics,  NULL);
+	free(x->subs);
+	free(x->count);
+	free(x->stamp);
+	free(x->free);
+	free(x->found);
+	free(x);
+}
+
+
+/**
+  Adds a subscription for the subscriber `sub` to any qname
+  matching `pattern`, for the TSDP_PAYLOAD_* types set in the
+  `payloads` mask.  The index keeps its own copy of `pattern`.
+
+  Each of the pattern's key/value constraints (`key=value`,
+  `key=*` or a bare `key`) is indexed separately, under the
+  pattern's metric name; patterns without any constraints
+  are indexed by metric name alone.
+
+  Returns a (non-negative) subscription id, which can be
+  passed to `tsdp_subidx_remove()`, or -1 on failure, and
+  sets `errno`.
+ **/
+int
+tsdp_subidx_add(struct tsdp_subidx *x, struct qname *pattern, unsigned int payloads, void *sub)
+{
+	struct qname *p;
+	char buf[MAX_CONSTRAINT];
+	size_t len;
+	uint32_t id;
+	void *a;
+	int i;
+
+	errno = EINVAL;
+	if (!x || !pattern || !pattern->metric) return -1;
+	if (x->n == INT32_MAX && x->nfree == 0) return -1;
+
+	for (i = 0; i < pattern->i; i++)
+		if (!s_constraint(buf, pattern->metric, pattern->pairs[i].key, pattern->pairs[i].value))
+			return -1;
+
+	p = qname_dup(pattern);
+	if (!p) return -1;
+
+	if (x->nfree > 0) {
+		id = x->free[--x->nfree];
+
+	} else {
+		if (x->n == x->max) {
+			uint32_t max = x->max ? x->max * 2 : 64;
+#define grow(f) do { \
+	a = realloc((f), max * sizeof(*(f))); \
+	if (!a) goto fail; \
+	(f) = a; \
+} while (0)
+			grow(x->subs);
+			grow(x->count);
+			grow(x->stamp);
+			grow(x->free);
+#undef grow
+			memset(x->stamp + x->max, 0, (max - x->max) * sizeof(uint32_t));
+			x->max = max;
+		}
+		id = x->n++;
+	}
+
+	x->subs[id].pattern  = p;
+	x->subs[id].payloads = payloads;
+	x->subs[id].sub      = sub;
+	x->subs[id].need     = 0;
+
+	if (p->i == 0) {
+		if (s_post(x->bare, p->metric, strlen(p->metric), id) != 0)
+			goto unindex;
+	}
+	for (i = 0; i < p->i; i++) {
+		if (s_repeat(p, i)) continue;
+		x->subs[id].need++;
+		len = s_constraint(buf, p->metric, p->pairs[i].key, p->pairs[i].value);
+		if (s_post(x->postings, buf, len, id) != 0)
+			goto unindex;
+	}
+
+	s_invalidate(x, p->metric, payloads);
+	x->live++;
+	return (int)id;
+
+unindex:
+	s_unindex(x, id);
+	x->subs[id].pattern = NULL;
+	x->free[x->nfree++] = id;
+fail:
+	qname_free(p);
+	errno = ENOMEM;
+	return -1;
+}
+
+
+/**
+  Adds a subscription for the subscriber `sub`, based on the
+  pattern and payload mask of the SUBSCRIBE message `m`.
+
+  Returns a (non-negative) subscription id, or -1 on failure,
+  and sets `errno`.
+ **/
+int
+tsdp_subidx_subscribe(struct tsdp_subidx *x, struct tsdp_msg *m, void *sub)
+{
+	struct qname pattern;
+	char scratch[QNAME_MAX_LEN + 1];
+	int rc;
+
+	errno = EINVAL;
+	if (!x || !m || m->opcode != TSDP_OPCODE_SUBSCRIBE) return -1;
+	if (m->payload == 0 || m->nframes != 1 || m->frames->type != TSDP_FRAME_STRING) return -1;
+
+	/* STRING frames carry their NUL terminator */
+	if (qname_parse_into(&pattern, scratch, sizeof(scratch), m->frames->payload.string,
+	                     strnlen(m->frames->payload.string, m->frames->length)) != 0)
+		return -1;
+
+	rc = tsdp_subidx_add(x, &pattern, m->payload, sub);
+	qname_clear(&pattern);
+	return rc;
+}
+
+
+/**
+  Removes the subscription `id` (as returned by
+  `tsdp_subidx_add()`) from the index.  Its id may be
+  handed out again by later calls to `tsdp_subidx_add()`.
+
+  Returns 0 on success, or -1 (and sets `errno`) if there
+  is no such subscription.
+ **/
+int
+tsdp_subidx_remove(struct tsdp_subidx *x, int id)
+{
+	errno = EINVAL;
+	if (!x || id < 0 || (uint32_t)id >= x->n || !x->subs[id].pattern) return -1;
+
+	s_unindex(x, id);
+	s_forget(x, x->subs[id].pattern->metric, id);
+	qname_free(x->subs[id].pattern);
+	x->subs[id].pattern = NULL;
+	x->subs[id].sub     = NULL;
+	x->free[x->nfree++] = id;
+	x->live--;
+	return 0;
+}
+
+
+/**
+  Returns the pattern of subscription `id`, or NULL if there
+  is no such subscription.  The pattern belongs to the index.
+ **/
+struct qname *
+tsdp_subidx_pattern(struct tsdp_subidx *x, int id)
+{
+	if (!x || id < 0 || (uint32_t)id >= x->n) return NULL;
+	return x->subs[id].pattern;
+}
+
+
+/**
+  Returns how many subscriptions are in the index.
+ **/
+size_t
+tsdp_subidx_count(struct tsdp_subidx *x)
+{
+	return x ? x->live : 0;
+}
+
+
+/* find matching subscriptions the hard way, bypassing
+   the cache; see tsdp_subidx_lookup().  If `keep` is set,
+   the ids of all of them are kept in x->found, and `keep`
+   is cleared if there was not enough memory to do so. */
+static size_t
+s_lookup(struct tsdp_subidx *x, struct qname *q, unsigned int payload, void **subs, size_t max, int *keep)
+{
+	struct s_postings *p;
+	struct s_sub *s;
+	char buf[MAX_CONSTRAINT];
+	size_t found, len;
+	uint32_t j, id;
+	int i, k;
+
+	found = 0;
+
+#define match(id) do { \
+	s = &x->subs[(id)]; \
+	if ((s->payloads & payload) && (s->pattern->wild || q->i == s->pattern->i)) { \
+		if (found < max) subs[found] = s->sub; \
+		if (*keep && s_found(x, found, (id)) != 0) *keep = 0; \
+		found++; \
+	} \
+} while (0)
+
+	p = strmap_get(x->bare, q->metric, strlen(q->metric));
+	if (p)
+		for (j = 0; j < p->n; j++)
+			match(p->ids[j]);
+
+	if (++x->gen == 0) { /* wrapped; invalidate all counters */
+		memset(x->stamp, 0, x->max * sizeof(uint32_t));
+		x->gen = 1;
+	}
+
+	for (i = 0; i < q->i; i++) {
+		/* a pattern constraint is only met by the first
+		   occurrence of a key, as with qname_match() */
+		if (i > 0 && strcmp(q->pairs[i].key, q->pairs[i-1].key) == 0) continue;
+
+		for (k = 0; k < 2; k++) {
+			len = s_constraint(buf, q->metric, q->pairs[i].key, k == 0 ? q->pairs[i].value : "*");
+			if (!len || !(p = strmap_get(x->postings, buf, len))) continue;
+
+			for (j = 0; j < p->n; j++) {
+				id = p->ids[j];
+				if (x->stamp[id] != x->gen) {
+					x->stamp[id] = x->gen;
+					x->count[id] = 0;
+				}
+				if (++x->count[id] == x->subs[id].need)
+					match(id);
+			}
+			if (k == 0 && q->pairs[i].value && strcmp(q->pairs[i].value, "*") == 0)
+				break; /* already looked up key=* */
+		}
+	}
+#undef match
+
+	return found;
+}
+
+
+/**
+  Finds every subscription whose pattern matches the qname `q`
+  (with the semantics of `qname_match()`), and whose payload
+  mask shares a bit with `payload`, storing the subscriber
+  handles of the first `max` of them in `subs`.
+
+  Rather than trying each pattern, the index walks the posting
+  lists of just the constraints that `q` can satisfy (each of
+  its `key=value` pairs, and the `key=*` wildcards for each of
+  its keys), counting how many constraints of each pattern are
+  met along the way.  A pattern matches as soon as all of its
+  constraints are, and the arity of `q` is acceptable to it.
+  The cost of a lookup depends on the number of candidate
+  patterns sharing constraints with `q`, not on the number of
+  subscriptions in the index.
+
+  If a match-result cache has been enabled (see
+  `tsdp_subidx_cache()`), previous results for the same
+  qname and payload are reused.
+
+  Returns the total number of matching subscriptions, which
+  may be larger than `max`, in which case `subs` holds only
+  the first `max` of them (in no particular order).
+ **/
+size_t
+tsdp_subidx_lookup(struct tsdp_subidx *x, struct qname *q, unsigned int payload, void **subs, size_t max)
+{
+	char key[sizeof(unsigned int) + QKEY_MAX];
+	struct s_entry *e;
+	size_t klen, i, n;
+	int keep = 0;
+
+	if (!x || !q || !q->metric) return 0;
+	if (!subs) max = 0;
+
+	if (!x->cache || !(klen = s_cache_key(key, sizeof(key), q, payload)))
+		return s_lookup(x, q, payload, subs, max, &keep);
+
+	e = strmap_get(x->cache, key, klen);
+	if (e) {
+		x->hits++;
+		s_unlink(x, e);
+		s_touch(x, e);
+		for (i = 0; i < e->n && i < max; i++)
+			subs[i] = x->subs[e->ids[i]].sub;
+		return e->n;
+	}
+
+	x->misses++;
+	keep = 1;
+	n = s_lookup(x, q, payload, subs, max, &keep);
+	if (keep)
+		s_remember(x, key, klen, q, payload, x->found, n);
+	return n;
+}
+
+
+/**
+  Enables (or resizes) the match-result cache, which remembers
+  the subscribers that matched up to `entries` distinct qnames
+  (and payloads), so that repeat lookups for them cost a
+  single hash lookup.  The least recently used results are
+  evicted first.
+
+  Adding a subscription evicts the results for qnames with
+  the same metric name (and a payload it subscribes to);
+  removing one evicts just those results it was a part of.  An `entries` of 0 disables
+  (and empties) the cache.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_subidx_cache(struct tsdp_subidx *x, size_t entries)
+{
+	errno = EINVAL;
+	if (!x) return -1;
+
+	while (x->cached > entries)
+		s_drop(x, x->lru);
+	x->cachemax = entries;
+
+	if (entries == 0) {
+		strmap_free(x->cache,   s_entry_free);
+		strmap_free(x->metrics, NULL);
+		x->cache = x->metrics = NULL;
+		return 0;
+	}
+
+	if (!x->cache) {
+		x->cache   = strmap_new();
+		x->metrics = strmap_new();
+		if (!x->cache || !x->metrics) {
+			strmap_free(x->cache,   NULL);
+			strmap_free(x->metrics, NULL);
+			x->cache = x->metrics = NULL;
+			x->cachemax = 0;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+  Reports how many lookups were answered from the match-result
+  cache (`hits`) and how many had to consult the index
+  (`misses`), since the index was created.  Either pointer
+  may be NULL.
+ **/
+void
+tsdp_subidx_cache_stats(struct tsdp_subidx *x, uint64_t *hits, uint64_t *misses)
+{
+	if (hits)   *hits   = x ? x->hits   : 0;
+	if (misses) *misses = x ? x->misses : 0;
+}
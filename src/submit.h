@@ -0,0 +1,34 @@
+#ifndef TSDP_SUBMIT_H
+#define TSDP_SUBMIT_H
+
+#include <tsdp.h>
+#include <string.h>
+#include <errno.h>
+
+/* canonicalizes the qualified name in the STRING frame `f` (of
+   a SUBMIT message) into `buf`, which must have room for
+   QNAME_MAX_LEN + 1 octets, and stores its length in `len`.
+   Returns 0 on success, or -1 on failure, and sets `errno`;
+   names that do not parse, or are wildcards, fail with EINVAL. */
+static inline int
+submit_name(struct tsdp_frame *f, char buf[QNAME_MAX_LEN + 1], size_t *len)
+{
+	struct qname q;
+	char scratch[QNAME_MAX_LEN + 1];
+
+	/* STRING frames carry their NUL terminator */
+	if (qname_parse_into(&q, scratch, sizeof(scratch), f->payload.string,
+	                     strnlen(f->payload.string, f->length)) != 0)
+		return -1;
+	if (q.wild) {
+		qname_clear(&q);
+		errno = EINVAL;
+		return -1;
+	}
+	*len = qname_string_into(&q, buf, QNAME_MAX_LEN + 1);
+	qname_clear(&q);
+	errno = EINVAL;
+	return *len > QNAME_MAX_LEN ? -1 : 0;
+}
+
+#endif
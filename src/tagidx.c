@@ -0,0 +1,496 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "strmap.h"
+#include "bitmap.h"
+#include "qkey.h"
+
+/* kinds of term, as encoded in the first octet of each
+   posting list key */
+#define TERM_METRIC  'm'   /* metric name               */
+#define TERM_KEY     'k'   /* key, with or without value */
+#define TERM_VALUE   'v'   /* key=value                 */
+#define TERM_NONE    'n'   /* key, without a value      */
+#define TERM_ARITY   'a'   /* number of key/value pairs */
+
+/* longest term we will build: a key and a value, plus
+   the kind and delimiters */
+#define MAX_TERM (2 * (QNAME_MAX_LEN + 1) + 1)
+
+struct s_series {
+	struct qname *name;     /* our own copy; NULL if the slot is free */
+	unsigned int  payload;  /* TSDP_PAYLOAD_* type of the series      */
+};
+
+struct tsdp_tagidx {
+	uint32_t         n, max;   /* series slots used / allocated     */
+	struct s_series *series;
+
+	uint32_t        *free;     /* stack of recycled series ids      */
+	uint32_t         nfree;
+	uint32_t         live;     /* how many series are registered    */
+
+	struct strmap   *names;    /* payload + canonical name -> id+1  */
+	struct strmap   *postings; /* term -> bitmap of series ids      */
+};
+
+/* build a term into `buf`; returns its length,
+   or 0 if it would not fit */
+static size_t
+s_term(char *buf, char kind, const char *a, const char *b)
+{
+	size_t la, lb;
+
+	la = strlen(a);
+	lb = b ? strlen(b) : 0;
+	if (la + lb + 3 > MAX_TERM) return 0;
+
+	buf[0] = kind;
+	memcpy(buf + 1, a, la);
+	if (!b) return la + 1;
+
+	buf[la + 1] = '\0';
+	memcpy(buf + la + 2, b, lb);
+	return la + lb + 2;
+}
+
+static size_t
+s_arity(char *buf, int n)
+{
+	uint32_t u = (uint32_t)n;
+
+	buf[0] = TERM_ARITY;
+	memcpy(buf + 1, &u, sizeof(u));
+	return 1 + sizeof(u);
+}
+
+static int
+s_post(struct tsdp_tagidx *x, const char *t, size_t len, uint32_t id)
+{
+	struct bitmap **slot;
+
+	slot = (struct bitmap **)strmap_slot(x->postings, t, len);
+	if (!slot) return -1;
+
+	if (!*slot) {
+		*slot = bitmap_new();
+		if (!*slot) {
+			strmap_del(x->postings, t, len);
+			return -1;
+		}
+	}
+	return bitmap_add(*slot, id);
+}
+
+static void
+s_unpost(struct tsdp_tagidx *x, const char *t, size_t len, uint32_t id)
+{
+	struct bitmap *b;
+
+	b = strmap_get(x->postings, t, len);
+	if (!b) return;
+
+	bitmap_remove(b, id);
+	if (bitmap_count(b) == 0) {
+		strmap_del(x->postings, t, len);
+		bitmap_free(b);
+	}
+}
+
+static void
+s_bitmap_free(void *b)
+{
+	bitmap_free((struct bitmap *)b);
+}
+
+/* (un)post series `id` under every term of its name.  Only
+   the first occurrence of each key counts, as with
+   qname_match(). */
+static int
+s_index(struct tsdp_tagidx *x, uint32_t id, int add)
+{
+	struct qname *q;
+	char buf[MAX_TERM];
+	size_t len;
+	int i;
+
+#define post(l) do { \
+	len = (l); \
+	if (!add) s_unpost(x, buf, len, id); \
+	else if (s_post(x, buf, len, id) != 0) return -1; \
+} while (0)
+
+	q = x->series[id].name;
+	post(s_term(buf, TERM_METRIC, q->metric, NULL));
+	post(s_arity(buf, q->i));
+
+	for (i = 0; i < q->i; i++) {
+		if (i > 0 && strcmp(q->pairs[i].key, q->pairs[i-1].key) == 0) continue;
+
+		post(s_term(buf, TERM_KEY, q->pairs[i].key, NULL));
+		if (q->pairs[i].value) post(s_term(buf, TERM_VALUE, q->pairs[i].key, q->pairs[i].value));
+		else                   post(s_term(buf, TERM_NONE,  q->pairs[i].key, NULL));
+	}
+#undef post
+
+	return 0;
+}
+
+/* build the lookup key for a series in the name registry
+   (see qname_key(), for why not the canonical string) */
+static size_t
+s_name(char *buf, size_t len, struct qname *q, unsigned int payload)
+{
+	uint16_t p = (uint16_t)payload;
+	size_t n;
+
+	memcpy(buf, &p, sizeof(p));
+	n = qname_key(q, buf + sizeof(p), len - sizeof(p));
+	return n ? n + sizeof(p) : 0;
+}
+
+
+/**
+  Allocates a new, empty tag index.
+
+  A tag index registers series (a qualified name, and the
+  TSDP_PAYLOAD_* type of the measurements made against it),
+  assigning each a small integer id, and keeps an inverted
+  index from every metric name, key and key/value pair to the
+  (compressed) set of series ids that have it.  Patterns, like
+  those found in FORGET messages, can then be resolved by
+  intersecting a handful of sets, rather than trying each
+  series in turn.
+
+  Tag indexes are not thread-safe; callers must serialize
+  access to them (including selects).
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_tagidx *
+tsdp_tagidx_new(void)
+{
+	struct tsdp_tagidx *x;
+
+	x = calloc(1, sizeof(struct tsdp_tagidx));
+	if (!x) return NULL;
+
+	x->names    = strmap_new();
+	x->postings = strmap_new();
+	if (!x->names || !x->postings) {
+		tsdp_tagidx_free(x);
+		return NULL;
+	}
+	return x;
+}
+
+
+/**
+  Frees a tag index, and its copies of all the series names.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_tagidx_free(struct tsdp_tagidx *x)
+{
+	uint32_t i;
+
+	if (!x) return;
+	for (i = 0; i < x->n; i++)
+		qname_free(x->series[i].name);
+	strmap_free(x->names, NULL);
+	strmap_free(x->postings, s_bitmap_free);
+	free(x->series);
+	free(x->free);
+	free(x);
+}
+
+
+/**
+  Registers the series `q` (of type `payload`), returning its
+  (non-negative) id.  If the series is already registered,
+  its existing id is returned.  The index keeps its own copy
+  of `q`.
+
+  Series names cannot contain wildcards.
+
+  Returns -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_tagidx_add(struct tsdp_tagidx *x, struct qname *q, unsigned int payload)
+{
+	char name[sizeof(uint16_t) + QKEY_MAX], buf[MAX_TERM];
+	void **slot, *a;
+	size_t len;
+	uint32_t id;
+	int i;
+
+	errno = EINVAL;
+	if (!x || !q || !q->metric || q->wild || payload == 0) return -1;
+	for (i = 0; i < q->i; i++) {
+		if (q->pairs[i].value && strcmp(q->pairs[i].value, "*") == 0) return -1;
+		if (!s_term(buf, TERM_VALUE, q->pairs[i].key, q->pairs[i].value)) return -1;
+	}
+	if (!s_term(buf, TERM_METRIC, q->metric, NULL)) return -1;
+
+	len = s_name(name, sizeof(name), q, payload);
+	if (!len) return -1;
+
+	slot = strmap_slot(x->names, name, len);
+	if (!slot) goto nomem;
+	if (*slot) return (int)((uintptr_t)*slot - 1);
+
+	if (x->nfree > 0) {
+		id = x->free[--x->nfree];
+
+	} else {
+		if (x->n == INT32_MAX) goto fail;
+		if (x->n == x->max) {
+			uint32_t max = x->max ? x->max * 2 : 256;
+			a = realloc(x->series, max * sizeof(struct s_series));
+			if (!a) goto fail;
+			x->series = a;
+			a = realloc(x->free, max * sizeof(uint32_t));
+			if (!a) goto fail;
+			x->free = a;
+			x->max = max;
+		}
+		id = x->n++;
+	}
+
+	x->series[id].name    = qname_dup(q);
+	x->series[id].payload = payload;
+	if (!x->series[id].name || s_index(x, id, 1) != 0) {
+		if (x->series[id].name) s_index(x, id, 0);
+		qname_free(x->series[id].name);
+		x->series[id].name = NULL;
+		x->free[x->nfree++] = id;
+		goto fail;
+	}
+
+	*slot = (void *)(uintptr_t)(id + 1);
+	x->live++;
+	return (int)id;
+
+fail:
+	strmap_del(x->names, name, len);
+nomem:
+	errno = ENOMEM;
+	return -1;
+}
+
+
+/**
+  Looks up the id of series `q` (of type `payload`).
+
+  Returns -1 (and sets `errno` to ENOENT) if there is
+  no such series.
+ **/
+int
+tsdp_tagidx_lookup(struct tsdp_tagidx *x, struct qname *q, unsigned int payload)
+{
+	char name[sizeof(uint16_t) + QKEY_MAX];
+	size_t len;
+	void *id;
+
+	errno = EINVAL;
+	if (!x || !q || !q->metric) return -1;
+
+	errno = ENOENT;
+	len = s_name(name, sizeof(name), q, payload);
+	if (!len || !(id = strmap_get(x->names, name, len))) return -1;
+	return (int)((uintptr_t)id - 1);
+}
+
+
+/**
+  Removes the series `id` from the index.  Its id may be
+  handed out again by later calls to `tsdp_tagidx_add()`.
+
+  Returns 0 on success, or -1 (and sets `errno`) if there
+  is no such series.
+ **/
+int
+tsdp_tagidx_remove(struct tsdp_tagidx *x, int id)
+{
+	char name[sizeof(uint16_t) + QKEY_MAX];
+	size_t len;
+
+	errno = EINVAL;
+	if (!x || id < 0 || (uint32_t)id >= x->n || !x->series[id].name) return -1;
+
+	len = s_name(name, sizeof(name), x->series[id].name, x->series[id].payload);
+	strmap_del(x->names, name, len);
+	s_index(x, id, 0);
+
+	qname_free(x->series[id].name);
+	x->series[id].name = NULL;
+	x->free[x->nfree++] = id;
+	x->live--;
+	return 0;
+}
+
+
+/**
+  Returns the name of series `id`, or NULL if there is no
+  such series.  The name belongs to the index.
+ **/
+struct qname *
+tsdp_tagidx_series(struct tsdp_tagidx *x, int id)
+{
+	if (!x || id < 0 || (uint32_t)id >= x->n) return NULL;
+	return x->series[id].name;
+}
+
+
+/**
+  Returns the TSDP_PAYLOAD_* type of series `id`, or 0 if
+  there is no such series.
+ **/
+unsigned int
+tsdp_tagidx_payload(struct tsdp_tagidx *x, int id)
+{
+	if (!x || id < 0 || (uint32_t)id >= x->n || !x->series[id].name) return 0;
+	return x->series[id].payload;
+}
+
+
+/**
+  Returns how many series are registered in the index.
+ **/
+size_t
+tsdp_tagidx_count(struct tsdp_tagidx *x)
+{
+	return x ? x->live : 0;
+}
+
+
+static int
+s_by_count(const void *a, const void *b)
+{
+	uint64_t na = bitmap_count(*(struct bitmap * const *)a),
+	         nb = bitmap_count(*(struct bitmap * const *)b);
+	return na < nb ? -1 : na > nb ? 1 : 0;
+}
+
+/* resolve `pattern` to a new bitmap of matching series ids
+   (of any payload type), by intersecting the postings for
+   each of its constraints, smallest first. */
+static struct bitmap *
+s_resolve(struct tsdp_tagidx *x, struct qname *pattern)
+{
+	struct bitmap *sets[QNAME_MAX_PAIRS + 2], *result;
+	char buf[MAX_TERM];
+	size_t len;
+	int i, n;
+
+#define term(l) do { \
+	len = (l); \
+	sets[n] = len ? strmap_get(x->postings, buf, len) : NULL; \
+	if (!sets[n++]) return bitmap_new(); /* nothing can match */ \
+} while (0)
+
+	n = 0;
+	term(s_term(buf, TERM_METRIC, pattern->metric, NULL));
+	if (!pattern->wild) term(s_arity(buf, pattern->i));
+
+	for (i = 0; i < pattern->i; i++) {
+		if (!pattern->pairs[i].value)
+			term(s_term(buf, TERM_NONE, pattern->pairs[i].key, NULL));
+		else if (strcmp(pattern->pairs[i].value, "*") == 0)
+			term(s_term(buf, TERM_KEY, pattern->pairs[i].key, NULL));
+		else
+			term(s_term(buf, TERM_VALUE, pattern->pairs[i].key, pattern->pairs[i].value));
+	}
+#undef term
+
+	qsort(sets, n, sizeof(struct bitmap *), s_by_count);
+	result = bitmap_copy(sets[0]);
+	for (i = 1; result && i < n && bitmap_count(result) > 0; i++) {
+		if (bitmap_and(result, sets[i]) != 0) {
+			bitmap_free(result);
+			return NULL;
+		}
+	}
+	return result;
+}
+
+struct s_select {
+	struct tsdp_tagidx *x;
+	unsigned int payloads;
+	int (*fn)(int, void *);
+	void *udata;
+	int found;
+	int forget;
+};
+
+static int
+s_selected(uint32_t id, void *udata)
+{
+	struct s_select *s = (struct s_select *)udata;
+
+	if (!(s->x->series[id].payload & s->payloads)) return 0;
+	s->found++;
+	if (s->forget) tsdp_tagidx_remove(s->x, id);
+	else if (s->fn) return s->fn(id, s->udata);
+	return 0;
+}
+
+
+/**
+  Finds every series whose name matches `pattern` (with the
+  semantics of `qname_match()`), and whose type is in the
+  `payloads` mask, calling `fn` with the id of each, in
+  ascending order.  If `fn` returns non-zero, the search
+  stops early.  `fn` may be NULL, to just count matches.
+
+  This is how wildcard FORGET and REPLAY requests, and
+  queries, pick their series.
+
+  Returns the number of matching series visited, or -1 on
+  failure, and sets `errno`.
+ **/
+int
+tsdp_tagidx_select(struct tsdp_tagidx *x, struct qname *pattern, unsigned int payloads,
+                   int (*fn)(int id, void *udata), void *udata)
+{
+	struct s_select s = { x, payloads, fn, udata, 0, 0 };
+	struct bitmap *b;
+
+	errno = EINVAL;
+	if (!x || !pattern || !pattern->metric) return -1;
+
+	b = s_resolve(x, pattern);
+	if (!b) return -1;
+	bitmap_each(b, s_selected, &s);
+	bitmap_free(b);
+	return s.found;
+}
+
+
+/**
+  Removes every series whose name matches `pattern`, and
+  whose type is in the `payloads` mask, as for a FORGET.
+
+  Returns the number of series removed, or -1 on failure,
+  and sets `errno`.
+ **/
+int
+tsdp_tagidx_forget(struct tsdp_tagidx *x, struct qname *pattern, unsigned int payloads)
+{
+	struct s_select s = { x, payloads, NULL, NULL, 0, 1 };
+	struct bitmap *b;
+
+	errno = EINVAL;
+	if (!x || !pattern || !pattern->metric) return -1;
+
+	b = s_resolve(x, pattern);
+	if (!b) return -1;
+	bitmap_each(b, s_selected, &s);
+	bitmap_free(b);
+	return s.found;
+}
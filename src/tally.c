@@ -0,0 +1,490 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "debug.h"
+#include "hash.h"
+#include "strmap.h"
+#include "submit.h"
+
+#define TALLY_DEFAULT_SHARDS      16
+#define TALLY_DEFAULT_CAPACITY  4096
+#define TALLY_MIN_SLOTS           16
+
+/* the hot path is lock-free: a thread announces itself to the
+   shard it is about to touch (via `writers`), claims a slot by
+   compare-and-swapping its hash in, and adds to the count
+   atomically.  Flushing swaps the current window for a fresh
+   one, and only has to wait for the writers that were already
+   in the old one to finish, before draining it.
+
+   Slots are never deleted within a window, so the table only
+   fills up; once it is 3/4 full, new names spill into a
+   mutex-protected map, and the table is grown when the window
+   is next recycled. */
+
+struct s_slot {
+	uint64_t hash;   /* 0 if empty                          */
+	uint64_t count;
+	char    *name;   /* set (just) after the hash is claimed */
+};
+
+struct s_shard {
+	uint64_t         writers;  /* threads in this shard, right now */
+	uint64_t         used;     /* slots claimed                    */
+	size_t           mask;     /* number of slots - 1              */
+	struct s_slot   *slots;
+
+	pthread_mutex_t  lock;     /* guards the spill map             */
+	struct strmap   *spill;    /* name -> uint64_t *, when full    */
+	size_t           spilled;
+
+	char pad[64];              /* keep writers off each others' lines */
+};
+
+struct s_window {
+	struct s_shard *shards;
+};
+
+struct tsdp_tally {
+	uint32_t         window;   /* width, for the UINT/4 frame  */
+	int              nshards;  /* a power of 2                 */
+
+	struct s_window  windows[2];
+	struct s_window *current;
+
+	pthread_mutex_t  flushing; /* one flush at a time          */
+};
+
+/* a shard is live (and must be freed) once its slots are set,
+   which they only ever are once everything else is in place */
+static int
+s_shard_init(struct s_shard *s, size_t slots)
+{
+	struct s_slot *a;
+	size_t n;
+
+	for (n = TALLY_MIN_SLOTS; n < slots; n <<= 1)
+		;
+	if (pthread_mutex_init(&s->lock, NULL) != 0)
+		return -1;
+	a        = calloc(n, sizeof(struct s_slot));
+	s->spill = strmap_new();
+	if (!a || !s->spill) {
+		free(a);
+		strmap_free(s->spill, NULL);
+		s->spill = NULL;
+		pthread_mutex_destroy(&s->lock);
+		return -1;
+	}
+	s->slots = a;
+	s->mask  = n - 1;
+	return 0;
+}
+
+static void
+s_shard_clear(struct s_shard *s)
+{
+	size_t i;
+
+	for (i = 0; i <= s->mask; i++)
+		free(s->slots[i].name);
+	memset(s->slots, 0, (s->mask + 1) * sizeof(struct s_slot));
+	s->used = 0;
+}
+
+static void
+s_shard_free(struct s_shard *s)
+{
+	if (!s->slots) return;
+	s_shard_clear(s);
+	free(s->slots);
+	strmap_free(s->spill, free);
+	pthread_mutex_destroy(&s->lock);
+}
+
+static int
+s_window_init(struct tsdp_tally *t, struct s_window *w, size_t capacity)
+{
+	int i;
+
+	w->shards = calloc(t->nshards, sizeof(struct s_shard));
+	if (!w->shards) return -1;
+
+	/* room for `capacity` names at a load factor of 1/2 */
+	for (i = 0; i < t->nshards; i++)
+		if (s_shard_init(&w->shards[i], 2 * capacity / t->nshards) != 0) return -1;
+	return 0;
+}
+
+static void
+s_window_free(struct tsdp_tally *t, struct s_window *w)
+{
+	int i;
+
+	if (!w->shards) return;
+	for (i = 0; i < t->nshards; i++)
+		s_shard_free(&w->shards[i]);
+	free(w->shards);
+}
+
+static int
+s_spill(struct s_shard *s, const char *name, size_t len, uint64_t inc)
+{
+	uint64_t **v;
+	int rc;
+
+	rc = -1;
+	pthread_mutex_lock(&s->lock);
+	v = (uint64_t **)strmap_slot(s->spill, name, len);
+	if (v && !*v) {
+		*v = calloc(1, sizeof(uint64_t));
+		if (*v) s->spilled++;
+		else    strmap_del(s->spill, name, len);
+	}
+	if (v && *v) {
+		**v += inc;
+		rc = 0;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	if (rc != 0) errno = ENOMEM;
+	return rc;
+}
+
+/* add `inc` to `name` in shard `s`; the caller is a writer */
+static int
+s_add(struct s_shard *s, uint64_t h, const char *name, size_t len, uint64_t inc)
+{
+	struct s_slot *slot;
+	uint64_t cur, zero;
+	size_t i, probes;
+	char *copy;
+
+	copy = NULL;
+	for (i = (h >> 16) & s->mask, probes = 0; probes <= s->mask; i = (i + 1) & s->mask, probes++) {
+		slot = &s->slots[i];
+		cur = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+
+		if (cur == 0) {
+			if (__atomic_load_n(&s->used, __ATOMIC_RELAXED) >= (s->mask + 1) / 4 * 3) break;
+
+			if (!copy) {
+				copy = malloc(len + 1);
+				if (!copy) {
+					errno = ENOMEM;
+					return -1;
+				}
+				memcpy(copy, name, len);
+				copy[len] = '\0';
+			}
+
+			zero = 0;
+			if (__atomic_compare_exchange_n(&slot->hash, &zero, h, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				__atomic_store_n(&slot->name, copy, __ATOMIC_RELEASE);
+				__atomic_add_fetch(&s->used, 1, __ATOMIC_RELAXED);
+				__atomic_add_fetch(&slot->count, inc, __ATOMIC_RELAXED);
+				return 0;
+			}
+			cur = zero; /* somebody beat us to it; with what? */
+		}
+
+		if (cur == h) {
+			free(copy);
+			__atomic_add_fetch(&slot->count, inc, __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+
+	free(copy);
+	return s_spill(s, name, len, inc);
+}
+
+/* state for draining (quiescent) shards into BROADCAST TALLY messages */
+struct s_emit {
+	struct tsdp_tally *t;
+	uint64_t ts;
+	void (*fn)(struct tsdp_msg *, void *);
+	void *udata;
+	int n;
+};
+
+static int
+s_emit(struct s_emit *e, const char *name, size_t len, uint64_t count)
+{
+	struct tsdp_msg *m;
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_BROADCAST, 0, TSDP_PAYLOAD_TALLY);
+	if (!m) return -1;
+	if (tsdp_msg_extend(m, TSDP_FRAME_STRING, name,         len + 1) != 0
+	 || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &e->ts,       8)       != 0
+	 || tsdp_msg_extend(m, TSDP_FRAME_UINT,   &e->t->window, 4)      != 0
+	 || tsdp_msg_extend(m, TSDP_FRAME_UINT,   &count,       8)       != 0) {
+		tsdp_msg_free(m);
+		return -1;
+	}
+	e->fn(m, e->udata);
+	tsdp_msg_free(m);
+	e->n++;
+	return 0;
+}
+
+/* move the spilled count for `key` into the table, if the
+   (quiescent) shard has a slot for it */
+static int
+s_unspill(const void *key, size_t len, void *value, void *udata)
+{
+	struct s_shard *s = (struct s_shard *)udata;
+	uint64_t h;
+	size_t i;
+
+	h = hashmix64(hash64(key, len));
+	if (h == 0) h = 1;
+	for (i = (h >> 16) & s->mask; s->slots[i].hash; i = (i + 1) & s->mask) {
+		if (s->slots[i].hash == h) {
+			s->slots[i].count += *(uint64_t *)value;
+			*(uint64_t *)value = 0;
+			break;
+		}
+	}
+	return 0;
+}
+
+static int
+s_emit_spill(const void *key, size_t len, void *value, void *udata)
+{
+	char name[QNAME_MAX_LEN + 1];
+
+	if (len > QNAME_MAX_LEN || *(uint64_t *)value == 0) return 0;
+	memcpy(name, key, len);
+	name[len] = '\0';
+	return s_emit((struct s_emit *)udata, name, len, *(uint64_t *)value);
+}
+
+
+/**
+  Allocates a new TALLY aggregation engine, which sums the
+  increments of SUBMIT TALLY messages, per qualified name,
+  over windows `window` seconds wide, for broadcast (see
+  `tsdp_tally_flush()`).
+
+  Counters are spread across `shards` hash tables (0 picks a
+  default of 16; otherwise it is rounded up to a power of 2),
+  sized to hold `capacity` names per window without locking
+  (0 picks a default of 4096).  Windows that see more names
+  than that still count them, but more slowly, and the engine
+  grows to fit as the windows are recycled.
+
+  Any number of threads may add to a TALLY engine at once,
+  without locking, while another flushes it.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_tally *
+tsdp_tally_new(unsigned int window, size_t capacity, int shards)
+{
+	struct tsdp_tally *t;
+	int n;
+
+	errno = EINVAL;
+	if (window == 0 || shards < 0 || shards > 65536) return NULL;
+	if (shards == 0) shards = TALLY_DEFAULT_SHARDS;
+	if (capacity == 0) capacity = TALLY_DEFAULT_CAPACITY;
+	for (n = 1; n < shards; n <<= 1)
+		;
+
+	errno = ENOMEM;
+	t = calloc(1, sizeof(struct tsdp_tally));
+	if (!t) return NULL;
+	t->window  = window;
+	t->nshards = n;
+
+	if (pthread_mutex_init(&t->flushing, NULL) != 0) {
+		free(t);
+		return NULL;
+	}
+	if (s_window_init(t, &t->windows[0], capacity) != 0
+	 || s_window_init(t, &t->windows[1], capacity) != 0) {
+		tsdp_tally_free(t);
+		return NULL;
+	}
+	t->current = &t->windows[0];
+	return t;
+}
+
+
+/**
+  Frees a TALLY aggregation engine, discarding whatever has
+  not been flushed.  No other threads may be using it.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_tally_free(struct tsdp_tally *t)
+{
+	if (!t) return;
+	s_window_free(t, &t->windows[0]);
+	s_window_free(t, &t->windows[1]);
+	pthread_mutex_destroy(&t->flushing);
+	free(t);
+}
+
+
+/**
+  Adds `inc` to the tally for the first `len` octets of `name`,
+  in the current window.  Names are compared as given, so
+  callers should canonicalize them first (`tsdp_tally_submit()`
+  does this for SUBMIT TALLY messages).  Names are identified
+  by a 64-bit hash; colliding names are counted as one.
+
+  This takes no locks (unless the window is over capacity),
+  and may be called from any number of threads at once.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_tally_add(struct tsdp_tally *t, const char *name, size_t len, uint64_t inc)
+{
+	struct s_window *w;
+	struct s_shard *s;
+	uint64_t h;
+	int rc;
+
+	errno = EINVAL;
+	if (!t || !name || len == 0 || len > QNAME_MAX_LEN) return -1;
+
+	h = hashmix64(hash64(name, len));
+	if (h == 0) h = 1; /* 0 marks an empty slot */
+
+	/* announce ourselves to the shard in the current window,
+	   then make sure that it was still current when we did;
+	   otherwise, a flush may already be draining it. */
+	for (;;) {
+		w = __atomic_load_n(&t->current, __ATOMIC_SEQ_CST);
+		s = &w->shards[h & (t->nshards - 1)];
+		__atomic_add_fetch(&s->writers, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&t->current, __ATOMIC_SEQ_CST) == w) break;
+		__atomic_sub_fetch(&s->writers, 1, __ATOMIC_SEQ_CST);
+	}
+
+	rc = s_add(s, h, name, len, inc);
+	__atomic_sub_fetch(&s->writers, 1, __ATOMIC_RELEASE);
+	return rc;
+}
+
+
+/**
+  Adds the increment (or 1, if it has none) of the SUBMIT TALLY
+  message `m` to the tally for its qualified name, as for
+  `tsdp_tally_add()`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Anything other than a well-formed SUBMIT TALLY fails with
+  EINVAL.
+ **/
+int
+tsdp_tally_submit(struct tsdp_tally *t, struct tsdp_msg *m)
+{
+	char buf[QNAME_MAX_LEN + 1];
+	uint64_t inc;
+	size_t len;
+
+	errno = EINVAL;
+	if (!t || !m || m->opcode != TSDP_OPCODE_SUBMIT || m->payload != TSDP_PAYLOAD_TALLY) return -1;
+	if (m->nframes < 2 || m->nframes > 3
+	 || m->frames->type       != TSDP_FRAME_STRING
+	 || m->frames->next->type != TSDP_FRAME_TSTAMP)
+		return -1;
+
+	inc = 1;
+	if (m->nframes == 3) {
+		if (m->last->type != TSDP_FRAME_UINT || m->last->length != 8) return -1;
+		inc = m->last->payload.uint64;
+	}
+
+	if (submit_name(m->frames, buf, &len) != 0) return -1;
+
+	return tsdp_tally_add(t, buf, len, inc);
+}
+
+
+/**
+  Closes the current window, and starts a new one, then calls
+  `fn` with a BROADCAST TALLY message for each name counted in
+  the window just closed (in no particular order), stamped
+  with `ts` and the window width.  Each message is freed once
+  `fn` returns.
+
+  Threads adding to the engine are never stopped; they move
+  on to the new window, and the flush waits only for those
+  that were part-way through an addition to the old one.
+
+  Returns how many messages were emitted, or -1 on failure,
+  and sets `errno`.  Either way, the closed window is reset,
+  ready for reuse.
+ **/
+int
+tsdp_tally_flush(struct tsdp_tally *t, uint64_t ts, void (*fn)(struct tsdp_msg *m, void *udata), void *udata)
+{
+	struct s_window *old;
+	struct s_shard *s;
+	struct s_emit e;
+	size_t i, want;
+	int j, rc;
+
+	errno = EINVAL;
+	if (!t || !fn) return -1;
+
+	pthread_mutex_lock(&t->flushing);
+	old = t->current;
+	__atomic_store_n(&t->current, old == &t->windows[0] ? &t->windows[1] : &t->windows[0], __ATOMIC_SEQ_CST);
+
+	e.t = t; e.ts = ts; e.fn = fn; e.udata = udata; e.n = 0;
+	rc = 0;
+	for (j = 0; j < t->nshards; j++) {
+		s = &old->shards[j];
+		while (__atomic_load_n(&s->writers, __ATOMIC_SEQ_CST) != 0)
+			sched_yield();
+
+		/* a name can (rarely) be both spilled and in the table,
+		   if it was added by two threads as the table filled up */
+		if (s->spilled)
+			strmap_each(s->spill, s_unspill, s);
+
+		for (i = 0; i <= s->mask; i++)
+			if (s->slots[i].name && s->slots[i].count > 0 && rc == 0)
+				rc = s_emit(&e, s->slots[i].name, strlen(s->slots[i].name), s->slots[i].count);
+		if (rc == 0)
+			rc = strmap_each(s->spill, s_emit_spill, &e);
+
+		/* recycle the window, growing it if it overflowed */
+		want = s->used + s->spilled;
+		s_shard_clear(s);
+		if (s->spilled) {
+			struct s_slot *slots;
+			size_t n;
+
+			for (n = s->mask + 1; n < 2 * want; n <<= 1)
+				;
+			slots = calloc(n, sizeof(struct s_slot));
+			if (slots) {
+				free(s->slots);
+				s->slots = slots;
+				s->mask  = n - 1;
+			}
+			strmap_clear(s->spill, free);
+			s->spilled = 0;
+		}
+	}
+	pthread_mutex_unlock(&t->flushing);
+
+	if (rc != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return e.n;
+}
@@ -0,0 +1,533 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "hash.h"
+
+/* Space-Saving, over a "stream summary": counters with equal
+   counts share a bucket, and the buckets are kept in a doubly
+   linked list, in ascending order of count.  Counting one more
+   observation moves a counter (at most) into the next bucket
+   along, and the counter to evict is always in the first
+   bucket, so both are O(1). */
+
+struct s_bucket {
+	uint64_t          count;
+	struct s_counter *first;       /* counters with this count    */
+	struct s_bucket  *prev, *next; /* neighbours, by count        */
+};
+
+struct s_counter {
+	struct tsdp_topk_item item;    /* item.count == bucket->count */
+	char                 *buf;     /* item.key lives here         */
+	size_t                cap;     /* octets allocated to buf     */
+
+	struct s_bucket      *bucket;
+	struct s_counter     *prev, *next; /* siblings in the bucket  */
+};
+
+struct tsdp_topk {
+	size_t            k;          /* how many counters we have    */
+	size_t            n;          /* how many are in use          */
+	uint64_t          total;      /* observations, ever           */
+
+	struct s_counter *counters;   /* [k]                          */
+	struct s_bucket  *buckets;    /* [k]; never need more         */
+	struct s_bucket  *free;       /* unused buckets, via next     */
+	struct s_bucket  *min;        /* smallest count; list head    */
+
+	uint32_t         *table;      /* hash -> counter index + 1    */
+	size_t            mask;       /* table size - 1               */
+};
+
+#define s_index(t,c) ((uint32_t)((c) - (t)->counters))
+
+static struct s_counter *
+s_find(struct tsdp_topk *t, uint64_t hash, size_t *slot)
+{
+	size_t i;
+
+	for (i = hash & t->mask; t->table[i]; i = (i + 1) & t->mask) {
+		if (t->counters[t->table[i] - 1].item.hash == hash) {
+			if (slot) *slot = i;
+			return &t->counters[t->table[i] - 1];
+		}
+	}
+	if (slot) *slot = i;
+	return NULL;
+}
+
+static void
+s_unindex(struct tsdp_topk *t, struct s_counter *c)
+{
+	size_t i, j, home;
+
+	if (!s_find(t, c->item.hash, &i)) return;
+
+	/* backward-shift deletion, so lookups never need tombstones */
+	t->table[i] = 0;
+	for (j = (i + 1) & t->mask; t->table[j]; j = (j + 1) & t->mask) {
+		home = t->counters[t->table[j] - 1].item.hash & t->mask;
+		if (((j - home) & t->mask) >= ((j - i) & t->mask)) {
+			t->table[i] = t->table[j];
+			t->table[j] = 0;
+			i = j;
+		}
+	}
+}
+
+static void
+s_link(struct s_bucket *b, struct s_counter *c)
+{
+	c->bucket = b;
+	c->prev = NULL;
+	c->next = b->first;
+	if (b->first) b->first->prev = c;
+	b->first = c;
+	c->item.count = b->count;
+}
+
+static void
+s_unlink(struct s_counter *c)
+{
+	if (c->prev) c->prev->next = c->next;
+	else         c->bucket->first = c->next;
+	if (c->next) c->next->prev = c->prev;
+	c->prev = c->next = NULL;
+}
+
+/* take a bucket for `count` off of the free list, and splice
+   it into the list just after `at` (or at the head, if NULL) */
+static struct s_bucket *
+s_bucket(struct tsdp_topk *t, struct s_bucket *at, uint64_t count)
+{
+	struct s_bucket *b;
+
+	b = t->free;
+	t->free = b->next;
+
+	b->count = count;
+	b->first = NULL;
+	b->prev  = at;
+	b->next  = at ? at->next : t->min;
+	if (b->next) b->next->prev = b;
+	if (at) at->next = b;
+	else    t->min   = b;
+	return b;
+}
+
+static void
+s_release(struct tsdp_topk *t, struct s_bucket *b)
+{
+	if (b->prev) b->prev->next = b->next;
+	else         t->min        = b->next;
+	if (b->next) b->next->prev = b->prev;
+
+	b->next = t->free;
+	t->free = b;
+}
+
+/* link the (unlinked) counter `c` into the bucket for `count`,
+   searching forward from just after `from` (or from the head) */
+static void
+s_place(struct tsdp_topk *t, struct s_counter *c, struct s_bucket *from, uint64_t count)
+{
+	struct s_bucket *at, *next;
+
+	at   = from;
+	next = from ? from->next : t->min;
+	while (next && next->count <= count) {
+		at   = next;
+		next = next->next;
+	}
+	if (!at || at->count != count)
+		at = s_bucket(t, at, count);
+	s_link(at, c);
+}
+
+/* add `w` to the count of the (linked) counter `c` */
+static void
+s_bump(struct tsdp_topk *t, struct s_counter *c, uint64_t w)
+{
+	struct s_bucket *b = c->bucket;
+	uint64_t count = b->count + w;
+
+	/* alone, and not catching up with the next bucket? */
+	if (!c->prev && !c->next && (!b->next || b->next->count > count)) {
+		b->count = c->item.count = count;
+		return;
+	}
+
+	s_unlink(c);
+	if (!b->first) {
+		/* release before placing, in case every bucket is in use */
+		struct s_bucket *prev = b->prev;
+		s_release(t, b);
+		b = prev;
+	}
+	s_place(t, c, b, count);
+}
+
+static int
+s_observe(struct tsdp_topk *t, uint64_t hash, const char *key, size_t len, int opcode, int payload)
+{
+	struct s_counter *c;
+	size_t slot;
+	char *buf;
+	int i;
+
+	t->total++;
+	c = s_find(t, hash, &slot);
+	if (!c) {
+		c = t->n < t->k ? &t->counters[t->n] : t->min->first;
+		if (len + 1 > c->cap) {
+			buf = realloc(c->buf, len + 1);
+			if (!buf) {
+				t->total--;
+				errno = ENOMEM;
+				return -1;
+			}
+			c->buf = buf;
+			c->cap = len + 1;
+		}
+
+		if (t->n < t->k) {
+			t->n++;
+			memset(&c->item, 0, sizeof(c->item));
+			s_place(t, c, NULL, 0);
+
+		} else {
+			/* evict the (a) least frequent item; whatever comes
+			   next inherits its count, as the bound on how much
+			   we might be overestimating by */
+			s_unindex(t, c);
+			s_find(t, hash, &slot);
+			memset(&c->item, 0, sizeof(c->item));
+			c->item.count = c->item.error = c->bucket->count;
+		}
+
+		memcpy(c->buf, key, len);
+		c->buf[len] = '\0';
+		c->item.key  = c->buf;
+		c->item.hash = hash;
+		t->table[slot] = s_index(t, c) + 1;
+	}
+
+	s_bump(t, c, 1);
+	c->item.opcodes[opcode]++;
+	for (i = 0; i < 16; i++)
+		if (payload & (1 << i)) c->item.payloads[i]++;
+	return 0;
+}
+
+
+/**
+  Allocates a new heavy-hitter tracker, which keeps (at most)
+  `k` counters, using the Space-Saving algorithm to estimate
+  which keys (qualified names, client addresses, etc.) have
+  been observed most often.
+
+  Any key observed more than N/k times, out of N observations,
+  is guaranteed to be tracked.  Each count is an overestimate,
+  by no more than the item's `error`, and updates (and memory
+  use) are O(1), no matter how many distinct keys there are.
+
+  Keys are identified by a 64-bit hash; colliding keys are
+  counted as one.
+
+  Trackers are not thread-safe.  Give each thread its own,
+  and combine them periodically with `tsdp_topk_merge()`.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_topk *
+tsdp_topk_new(size_t k)
+{
+	struct tsdp_topk *t;
+	size_t i, size;
+
+	errno = EINVAL;
+	if (k == 0 || k > UINT32_MAX / 4) return NULL;
+
+	errno = ENOMEM;
+	t = calloc(1, sizeof(struct tsdp_topk));
+	if (!t) return NULL;
+
+	for (size = 16; size < 2 * k; size <<= 1)
+		;
+	t->k        = k;
+	t->mask     = size - 1;
+	t->counters = calloc(k, sizeof(struct s_counter));
+	t->buckets  = calloc(k, sizeof(struct s_bucket));
+	t->table    = calloc(size, sizeof(uint32_t));
+	if (!t->counters || !t->buckets || !t->table) {
+		tsdp_topk_free(t);
+		return NULL;
+	}
+
+	for (i = 0; i < k; i++)
+		t->buckets[i].next = i + 1 < k ? &t->buckets[i + 1] : NULL;
+	t->free = t->buckets;
+	return t;
+}
+
+
+/**
+  Frees a heavy-hitter tracker.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_topk_free(struct tsdp_topk *t)
+{
+	size_t i;
+
+	if (!t) return;
+	if (t->counters)
+		for (i = 0; i < t->k; i++)
+			free(t->counters[i].buf);
+	free(t->counters);
+	free(t->buckets);
+	free(t->table);
+	free(t);
+}
+
+
+/**
+  Records one observation of the first `len` octets of `key`,
+  attributed to `opcode`, and each of the TSDP_PAYLOAD_* bits
+  set in `payload` (which may be 0).
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_topk_observe(struct tsdp_topk *t, const char *key, size_t len, int opcode, int payload)
+{
+	errno = EINVAL;
+	if (!t || !key || !tsdp_opcode_ok(opcode)) return -1;
+	if (payload < 0 || payload > 0xffff) return -1;
+
+	return s_observe(t, hashmix64(hash64(key, len)), key, len, opcode, payload);
+}
+
+
+/**
+  Records one observation of the decoded message `m`, keyed
+  by the canonical form of the qualified name in its first
+  frame (so that `cpu a=1,b=2` and `cpu b=2,a=1` count as the
+  same series), and attributed to its opcode and payload.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Messages that do not lead with a qualified name (like
+  HEARTBEATs) fail with EINVAL.
+ **/
+int
+tsdp_topk_observe_msg(struct tsdp_topk *t, struct tsdp_msg *m)
+{
+	struct qname q;
+	char scratch[QNAME_MAX_LEN + 1], buf[QNAME_MAX_LEN + 1];
+	size_t len;
+
+	errno = EINVAL;
+	if (!t || !m) return -1;
+	if (m->nframes < 1 || m->frames->type != TSDP_FRAME_STRING) return -1;
+
+	/* STRING frames carry their NUL terminator */
+	if (qname_parse_into(&q, scratch, sizeof(scratch), m->frames->payload.string,
+	                     strnlen(m->frames->payload.string, m->frames->length)) != 0)
+		return -1;
+
+	len = qname_string_into(&q, buf, sizeof(buf));
+	qname_clear(&q);
+	errno = EINVAL;
+	if (len >= sizeof(buf)) return -1;
+
+	return tsdp_topk_observe(t, buf, len, m->opcode, m->payload);
+}
+
+
+/**
+  Returns the estimated count for the first `len` octets of
+  `key`, or 0 if it is not amongst the tracked items.  Since
+  only the top `k` are tracked, 0 means "not often", not
+  "never".
+ **/
+uint64_t
+tsdp_topk_estimate(struct tsdp_topk *t, const char *key, size_t len)
+{
+	struct s_counter *c;
+
+	if (!t || !key) return 0;
+	c = s_find(t, hashmix64(hash64(key, len)), NULL);
+	return c ? c->item.count : 0;
+}
+
+
+/**
+  Returns the total number of observations made, which puts
+  the counts of the tracked items into perspective.
+ **/
+uint64_t
+tsdp_topk_total(struct tsdp_topk *t)
+{
+	return t ? t->total : 0;
+}
+
+
+/**
+  Copies (up to) the `max` most frequent items, in descending
+  order of estimated count, into `items`.  The `key` of each
+  points into the tracker, and is only valid until it is next
+  updated, merged into, or freed.
+
+  Each item's per-opcode and per-payload breakdown covers only
+  the observations made while it has been tracked, so the
+  opcode counts add up to `count - error`.  Payload counts are
+  indexed by bit position (`payloads[0]` for SAMPLE, up to
+  `payloads[5]` for FACT).
+
+  Returns how many items are being tracked, which may be more
+  than `max`.
+ **/
+size_t
+tsdp_topk_list(struct tsdp_topk *t, struct tsdp_topk_item *items, size_t max)
+{
+	struct s_bucket *b;
+	struct s_counter *c;
+	size_t n;
+
+	if (!t) return 0;
+	if (!items) max = 0;
+
+	for (b = t->min; b && b->next; b = b->next)
+		;
+	for (n = 0; b && n < max; b = b->prev)
+		for (c = b->first; c && n < max; c = c->next)
+			items[n++] = c->item;
+	return t->n;
+}
+
+static int
+s_count_cmp(const void *a, const void *b)
+{
+	const struct tsdp_topk_item *x = &((const struct s_counter *)a)->item,
+	                            *y = &((const struct s_counter *)b)->item;
+
+	if (x->count != y->count) return x->count > y->count ? -1 : 1;
+	if (x->hash  != y->hash)  return x->hash  < y->hash  ? -1 : 1;
+	return 0;
+}
+
+
+/**
+  Merges the counts in `src` into `dst`, so that `dst` tracks
+  the heavy hitters of both streams, as if it had seen them
+  all.  Items tracked by only one side are assumed to have
+  been seen as often as the least frequent item on the other
+  (if it was full), which keeps the error bounds honest.
+
+  `src` is left untouched.  The merge costs O(k log k), so it
+  is meant for periodically folding per-thread trackers into
+  a shared one, not for the ingest path itself.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  On failure, `dst` is unchanged.
+ **/
+int
+tsdp_topk_merge(struct tsdp_topk *dst, struct tsdp_topk *src)
+{
+	struct s_counter *tmp, *c, *had;
+	struct s_bucket *tail;
+	uint64_t min_dst, min_src;
+	size_t i, n, keep, slot;
+	int j;
+
+	errno = EINVAL;
+	if (!dst || !src || dst == src) return -1;
+
+	errno = ENOMEM;
+	tmp = calloc(dst->n + src->n + 1, sizeof(struct s_counter));
+	if (!tmp) return -1;
+
+	min_dst = dst->n == dst->k ? dst->min->count : 0;
+	min_src = src->n == src->k ? src->min->count : 0;
+
+	/* tmp[i] mirrors dst->counters[i], so that common items
+	   can be found via dst's (as yet untouched) table */
+	for (i = 0; i < dst->n; i++) {
+		tmp[i] = dst->counters[i];
+		tmp[i].item.count += min_src;
+		tmp[i].item.error += min_src;
+	}
+	n = dst->n;
+
+	for (i = 0; i < src->n; i++) {
+		c = &src->counters[i];
+		if ((had = s_find(dst, c->item.hash, NULL)) != NULL) {
+			c = &tmp[s_index(dst, had)];
+			c->item.count += src->counters[i].item.count - min_src;
+			c->item.error += src->counters[i].item.error - min_src;
+			for (j = 0; j <= TSDP_OPCODE_SUBSCRIBE; j++)
+				c->item.opcodes[j] += src->counters[i].item.opcodes[j];
+			for (j = 0; j < 16; j++)
+				c->item.payloads[j] += src->counters[i].item.payloads[j];
+			continue;
+		}
+
+		tmp[n] = *c;
+		tmp[n].cap = strlen(c->item.key) + 1;
+		tmp[n].buf = malloc(tmp[n].cap);
+		if (!tmp[n].buf) {
+			while (n-- > dst->n) free(tmp[n].buf);
+			free(tmp);
+			return -1;
+		}
+		memcpy(tmp[n].buf, c->item.key, tmp[n].cap);
+		tmp[n].item.key    = tmp[n].buf;
+		tmp[n].item.count += min_dst;
+		tmp[n].item.error += min_dst;
+		n++;
+	}
+
+	/* keep the top k, and rebuild dst around them */
+	qsort(tmp, n, sizeof(struct s_counter), s_count_cmp);
+	keep = n < dst->k ? n : dst->k;
+	for (i = keep; i < n; i++)
+		free(tmp[i].buf);
+
+	/* dst's buffers have all either moved into tmp, or been
+	   freed; counters it never used don't have any */
+	for (i = 0; i < dst->n; i++) {
+		dst->counters[i].buf = NULL;
+		dst->counters[i].cap = 0;
+	}
+
+	memset(dst->table, 0, (dst->mask + 1) * sizeof(uint32_t));
+	for (i = 0; i < dst->k; i++)
+		dst->buckets[i].next = i + 1 < dst->k ? &dst->buckets[i + 1] : NULL;
+	dst->free = dst->buckets;
+	dst->min  = NULL;
+
+	tail = NULL;
+	for (i = keep; i-- > 0; ) {
+		c = &dst->counters[keep - 1 - i];
+		*c = tmp[i];
+		c->bucket = NULL;
+		c->prev = c->next = NULL;
+
+		if (!tail || tail->count != c->item.count)
+			tail = s_bucket(dst, tail, c->item.count);
+		s_link(tail, c);
+
+		s_find(dst, c->item.hash, &slot);
+		dst->table[slot] = s_index(dst, c) + 1;
+	}
+
+	dst->n = keep;
+	dst->total += src->total;
+	free(tmp);
+	return 0;
+}
@@ -0,0 +1,400 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+
+/* four wheels of 256 slots each.  A timer due within 256 ticks
+   sits in the innermost wheel, in the slot for its deadline;
+   one due later sits in an outer wheel, in the slot for the
+   block of 256 (or 65536, or 2^24) ticks containing it, and
+   is cascaded inwards when that block comes around.  Timers
+   due further out than the outermost wheel can reach wait in
+   its furthest slot, and are placed again when cascaded. */
+#define WHEEL_BITS    8
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS  4
+#define WHEEL_FIRING  WHEEL_LEVELS  /* pseudo-level: the firing queue */
+
+#define T_FREE    0
+#define T_ARMED   1
+#define T_FIRING  2
+
+struct s_timer {
+	uint64_t deadline;
+	void    *data;
+	int32_t  prev, next;  /* siblings in the slot, or -1     */
+	uint8_t  state;       /* T_*                             */
+	uint8_t  level;       /* 0 .. WHEEL_LEVELS-1, or FIRING  */
+	uint8_t  slot;
+};
+
+struct tsdp_wheel {
+	uint64_t        now;
+	size_t          armed;                 /* timers in slots       */
+	size_t          count[WHEEL_LEVELS];   /* ... per wheel         */
+
+	int32_t         slots[WHEEL_LEVELS][WHEEL_SLOTS];
+	int32_t         firing;                /* expired, not yet fired */
+
+	struct s_timer *timers;
+	size_t          ntimers;               /* allocated             */
+	int32_t         free;                  /* unused, via next      */
+};
+
+static int32_t *
+s_head(struct tsdp_wheel *w, struct s_timer *t)
+{
+	return t->level == WHEEL_FIRING ? &w->firing : &w->slots[t->level][t->slot];
+}
+
+static void
+s_unlink(struct tsdp_wheel *w, int32_t id)
+{
+	struct s_timer *t = &w->timers[id];
+
+	if (t->prev >= 0) w->timers[t->prev].next = t->next;
+	else              *s_head(w, t)           = t->next;
+	if (t->next >= 0) w->timers[t->next].prev = t->prev;
+
+	if (t->level != WHEEL_FIRING) {
+		w->armed--;
+		w->count[t->level]--;
+	}
+}
+
+static void
+s_push(struct tsdp_wheel *w, int32_t id, int level, int slot)
+{
+	struct s_timer *t = &w->timers[id];
+
+	t->level = level;
+	t->slot  = slot;
+	t->prev  = -1;
+	t->next  = *s_head(w, t);
+	if (t->next >= 0) w->timers[t->next].prev = id;
+	*s_head(w, t) = id;
+
+	if (level != WHEEL_FIRING) {
+		w->armed++;
+		w->count[level]++;
+	}
+}
+
+/* put timer `id` into the right slot, treating its deadline
+   as no earlier than `min` */
+static void
+s_place(struct tsdp_wheel *w, int32_t id, uint64_t min)
+{
+	uint64_t d = w->timers[id].deadline;
+	int l;
+
+	if (d < min) d = min;
+	for (l = 0; l < WHEEL_LEVELS; l++)
+		if ((d >> (l * WHEEL_BITS)) - (w->now >> (l * WHEEL_BITS)) < WHEEL_SLOTS)
+			break;
+
+	if (l == WHEEL_LEVELS) {
+		/* too far out; wait in the furthest slot we have */
+		l = WHEEL_LEVELS - 1;
+		d = ((w->now >> (l * WHEEL_BITS)) + WHEEL_MASK) << (l * WHEEL_BITS);
+	}
+	s_push(w, id, l, (d >> (l * WHEEL_BITS)) & WHEEL_MASK);
+}
+
+/* move one tick forward, cascading outer wheels inwards and
+   queueing up whatever is due */
+static void
+s_tick(struct tsdp_wheel *w)
+{
+	int32_t id, next;
+	int l, top, slot;
+
+	w->now++;
+	for (top = 0; top < WHEEL_LEVELS - 1; top++)
+		if ((w->now >> (top * WHEEL_BITS + WHEEL_BITS)) << (top * WHEEL_BITS + WHEEL_BITS) != w->now)
+			break;
+
+	/* outermost first, so that cascaded timers land in
+	   slots that have yet to be cascaded (or fired) */
+	for (l = top; l > 0; l--) {
+		slot = (w->now >> (l * WHEEL_BITS)) & WHEEL_MASK;
+		for (id = w->slots[l][slot]; id >= 0; id = next) {
+			next = w->timers[id].next;
+			s_unlink(w, id);
+			s_place(w, id, w->now);
+		}
+	}
+
+	slot = w->now & WHEEL_MASK;
+	for (id = w->slots[0][slot]; id >= 0; id = next) {
+		next = w->timers[id].next;
+		s_unlink(w, id);
+		s_push(w, id, WHEEL_FIRING, 0);
+	}
+}
+
+static int32_t
+s_alloc(struct tsdp_wheel *w)
+{
+	struct s_timer *timers;
+	size_t i, n;
+	int32_t id;
+
+	if (w->free < 0) {
+		n = w->ntimers ? w->ntimers * 2 : 64;
+		if (n > INT32_MAX) return -1;
+		timers = realloc(w->timers, n * sizeof(struct s_timer));
+		if (!timers) return -1;
+		memset(timers + w->ntimers, 0, (n - w->ntimers) * sizeof(struct s_timer));
+		for (i = n; i-- > w->ntimers; ) {
+			timers[i].next = w->free;
+			w->free = (int32_t)i;
+		}
+		w->timers  = timers;
+		w->ntimers = n;
+	}
+
+	id = w->free;
+	w->free = w->timers[id].next;
+	return id;
+}
+
+static void
+s_release(struct tsdp_wheel *w, int32_t id)
+{
+	w->timers[id].state = T_FREE;
+	w->timers[id].data  = NULL;
+	w->timers[id].next  = w->free;
+	w->free = id;
+}
+
+
+/**
+  Allocates a new timing wheel, starting at time `now`.
+
+  Timing wheels keep track of many deadlines (client
+  heartbeats, window flushes, series TTLs, etc.), with O(1)
+  arming, re-arming and cancellation, and expire them in
+  batches as time is advanced (see `tsdp_wheel_advance()`).
+
+  Time is measured in ticks, which are whatever the caller
+  wants them to be; TSDP timestamps are in seconds.  Deadlines
+  are exact to the tick, however far out they are.
+
+  Timing wheels are not thread-safe; callers must serialize
+  access to them.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_wheel *
+tsdp_wheel_new(uint64_t now)
+{
+	struct tsdp_wheel *w;
+
+	w = calloc(1, sizeof(struct tsdp_wheel));
+	if (!w) return NULL;
+
+	memset(w->slots, 0xff, sizeof(w->slots)); /* all -1 */
+	w->firing = -1;
+	w->free   = -1;
+	w->now    = now;
+	return w;
+}
+
+
+/**
+  Frees a timing wheel, and all of its timers, without
+  firing any of them.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_wheel_free(struct tsdp_wheel *w)
+{
+	if (!w) return;
+	free(w->timers);
+	free(w);
+}
+
+
+/**
+  Returns the current time of the wheel, as of the last call
+  to `tsdp_wheel_advance()`.  During an expiry callback, this
+  is the tick at which the timer fired.
+ **/
+uint64_t
+tsdp_wheel_now(struct tsdp_wheel *w)
+{
+	return w ? w->now : 0;
+}
+
+
+/**
+  Returns how many timers are currently armed.
+ **/
+size_t
+tsdp_wheel_count(struct tsdp_wheel *w)
+{
+	return w ? w->armed : 0;
+}
+
+
+/**
+  Arms a new timer, to fire at `deadline`, passing `data` to
+  the expiry callback.  Deadlines that have already passed
+  fire on the next tick.
+
+  Returns the (non-negative) timer id on success, or -1 on
+  failure, and sets `errno`.  Ids are reused once the timers
+  they identify have fired or been cancelled.
+ **/
+int
+tsdp_wheel_arm(struct tsdp_wheel *w, uint64_t deadline, void *data)
+{
+	int32_t id;
+
+	errno = EINVAL;
+	if (!w) return -1;
+
+	errno = ENOMEM;
+	if ((id = s_alloc(w)) < 0) return -1;
+
+	w->timers[id].deadline = deadline;
+	w->timers[id].data     = data;
+	w->timers[id].state    = T_ARMED;
+	s_place(w, id, w->now + 1);
+	return id;
+}
+
+
+/**
+  Moves the deadline of timer `id` to `deadline`.  Timers can
+  be re-armed from within their own expiry callback (to make
+  them periodic), or else they are released once it returns.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_wheel_rearm(struct tsdp_wheel *w, int id, uint64_t deadline)
+{
+	errno = EINVAL;
+	if (!w || id < 0 || (size_t)id >= w->ntimers) return -1;
+	if (w->timers[id].state == T_FREE) return -1;
+
+	/* armed timers may be in a slot, or queued up to fire;
+	   firing ones (in their callback) are in neither */
+	if (w->timers[id].state == T_ARMED)
+		s_unlink(w, id);
+
+	w->timers[id].deadline = deadline;
+	w->timers[id].state    = T_ARMED;
+	s_place(w, id, w->now + 1);
+	return 0;
+}
+
+
+/**
+  Cancels timer `id`, so that it never fires, and releases it.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_wheel_cancel(struct tsdp_wheel *w, int id)
+{
+	errno = EINVAL;
+	if (!w || id < 0 || (size_t)id >= w->ntimers) return -1;
+	if (w->timers[id].state == T_FREE) return -1;
+
+	if (w->timers[id].state == T_ARMED)
+		s_unlink(w, id);
+	s_release(w, id);
+	return 0;
+}
+
+
+/**
+  Re-arms timer `id` (a client's liveness deadline) in response
+  to the HEARTBEAT message `m`, so that it fires `timeout` ticks
+  from now, unless another heartbeat arrives first.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Messages that are not well-formed HEARTBEATs fail with
+  EINVAL, leaving the deadline where it was.
+ **/
+int
+tsdp_wheel_heartbeat(struct tsdp_wheel *w, int id, struct tsdp_msg *m, uint64_t timeout)
+{
+	errno = EINVAL;
+	if (!w || !m || m->opcode != TSDP_OPCODE_HEARTBEAT) return -1;
+	if (m->nframes != 2
+	 || m->frames->type       != TSDP_FRAME_TSTAMP || m->frames->length       != 8
+	 || m->frames->next->type != TSDP_FRAME_UINT   || m->frames->next->length != 8)
+		return -1;
+
+	return tsdp_wheel_rearm(w, id, w->now + timeout);
+}
+
+
+/**
+  Advances the wheel to time `now`, calling `fn` for each timer
+  that comes due along the way, in deadline order, with its id,
+  the `data` it was armed with, and `udata`.
+
+  Skipping over stretches of time with nothing due costs
+  nothing, so there is no need to call this on every tick.
+  Timers may be armed, re-armed and cancelled from within `fn`
+  (including ones due in the same batch).
+
+  Returns how many timers fired.
+ **/
+size_t
+tsdp_wheel_advance(struct tsdp_wheel *w, uint64_t now,
+                   void (*fn)(int id, void *data, void *udata), void *udata)
+{
+	struct s_timer *t;
+	uint64_t next;
+	size_t fired;
+	int32_t id;
+	int l;
+
+	if (!w) return 0;
+
+	fired = 0;
+	while (w->now < now) {
+		/* skip ahead to the next tick that could possibly
+		   matter: the next cascade of the innermost wheel
+		   with anything in it */
+		for (l = 0; l < WHEEL_LEVELS && w->count[l] == 0; l++)
+			;
+		if (l == WHEEL_LEVELS) {
+			w->now = now;
+			break;
+		}
+		if (l > 0) {
+			next = ((w->now >> (l * WHEEL_BITS)) + 1) << (l * WHEEL_BITS);
+			if (next == 0 || next > now) {
+				w->now = now;
+				break;
+			}
+			w->now = next - 1;
+		}
+		s_tick(w);
+
+		while ((id = w->firing) >= 0) {
+			t = &w->timers[id];
+			s_unlink(w, id);
+			t->state = T_FIRING;
+			fired++;
+			if (fn) fn(id, t->data, udata);
+
+			/* `fn` may have grown (and moved) the timers */
+			if (w->timers[id].state == T_FIRING)
+				s_release(w, id);
+		}
+	}
+	return fired;
+}
@@ -0,0 +1,426 @@
+#include <tsdp.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "strmap.h"
+#include "slots.h"
+#include "submit.h"
+
+#define WINDOW_MIN_SERIES 1024
+
+/* per-series accumulators, stored column-wise, by dense series
+   id: the hot path touches one element of each column, and the
+   window-close sweeps run down whole columns at a time, which
+   the compiler can turn into straight vector code.
+
+   Variance is tracked by the shifted-data method: deviations
+   are taken from the first measurement of the window (which is
+   close enough to the mean to avoid catastrophic cancellation,
+   unlike the textbook sum-of-squares formula), so that the
+   mean and variance of every series fall out of a single
+   branch-free pass, with no per-measurement division (as
+   Welford's method needs). */
+struct tsdp_window {
+	uint32_t       window;  /* width, for the UINT/4 frame        */
+	struct strmap *series;  /* name -> id + 1                     */
+	size_t         n, cap;  /* series in use, and allocated       */
+
+	uint64_t      *counts;  /* 0 if nothing seen in this window   */
+	double        *sums;
+	double        *mins;
+	double        *maxs;
+	double        *shifts;  /* first measurement of the window    */
+	double        *devs;    /* sum of (v - shift)                 */
+	double        *sqdevs;  /* sum of (v - shift)^2               */
+
+	uint32_t      *names;   /* id -> offset into the pool         */
+	struct namepool pool;   /* names; none are ever forgotten     */
+};
+
+static int
+s_resize(void **p, size_t n, size_t size)
+{
+	void *q = realloc(*p, n * size);
+	if (!q) return -1;
+	*p = q;
+	return 0;
+}
+
+/* a BROADCAST SAMPLE message, with room in its STRING frame for
+   any name, and six FLOAT frames, for flush to fill in */
+static struct tsdp_msg *
+s_template(struct tsdp_window *w, uint64_t ts)
+{
+	struct tsdp_msg *m;
+	char blank[QNAME_MAX_LEN + 1];
+	double zero = 0;
+	int i, rc;
+
+	memset(blank, 0, sizeof(blank));
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_BROADCAST, 0, TSDP_PAYLOAD_SAMPLE);
+	if (!m) return NULL;
+
+	rc = tsdp_msg_extend(m, TSDP_FRAME_STRING, blank,      sizeof(blank)) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts,        8) != 0
+	  || tsdp_msg_extend(m, TSDP_FRAME_UINT,   &w->window, 4) != 0;
+	for (i = 0; rc == 0 && i < 6; i++)
+		rc = tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &zero, 8) != 0;
+	if (rc) {
+		tsdp_msg_free(m);
+		return NULL;
+	}
+	return m;
+}
+
+
+/**
+  Allocates a new window store, which summarizes SAMPLE
+  measurements per series, like `tsdp_sample_new()`, but keeps
+  its accumulators as columns indexed by a dense series id (see
+  `tsdp_window_series()`), so that closing a window -- computing
+  the means and variances, building the broadcasts and resetting
+  for the next window -- is a handful of sequential sweeps,
+  whatever the number of series.
+
+  The store starts out with room for `capacity` series (0 picks
+  a default), and grows as needed.  Series are never forgotten.
+
+  Window stores are not thread-safe; callers must serialize
+  access to them.
+
+  Returns NULL on failure, and sets `errno`.
+ **/
+struct tsdp_window *
+tsdp_window_new(unsigned int window, size_t capacity)
+{
+	struct tsdp_window *w;
+
+	errno = EINVAL;
+	if (window == 0) return NULL;
+	if (capacity < WINDOW_MIN_SERIES) capacity = WINDOW_MIN_SERIES;
+
+	errno = ENOMEM;
+	w = calloc(1, sizeof(struct tsdp_window));
+	if (!w) return NULL;
+
+	w->window = window;
+	w->cap    = capacity;
+	w->series = strmap_new();
+	if (!w->series
+	 || s_resize((void **)&w->counts, capacity, sizeof(uint64_t)) != 0
+	 || s_resize((void **)&w->sums,   capacity, sizeof(double))   != 0
+	 || s_resize((void **)&w->mins,   capacity, sizeof(double))   != 0
+	 || s_resize((void **)&w->maxs,   capacity, sizeof(double))   != 0
+	 || s_resize((void **)&w->shifts, capacity, sizeof(double))   != 0
+	 || s_resize((void **)&w->devs,   capacity, sizeof(double))   != 0
+	 || s_resize((void **)&w->sqdevs, capacity, sizeof(double))   != 0
+	 || s_resize((void **)&w->names,  capacity, sizeof(uint32_t)) != 0) {
+		tsdp_window_free(w);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return w;
+}
+
+
+/**
+  Frees a window store, discarding whatever has not been
+  flushed.
+
+  It is not an error to pass a NULL pointer.
+ **/
+void
+tsdp_window_free(struct tsdp_window *w)
+{
+	if (!w) return;
+	strmap_free(w->series, NULL);
+	free(w->counts);
+	free(w->sums);
+	free(w->mins);
+	free(w->maxs);
+	free(w->shifts);
+	free(w->devs);
+	free(w->sqdevs);
+	free(w->names);
+	namepool_free(&w->pool);
+	free(w);
+}
+
+
+/**
+  Returns how many series the store has seen.
+ **/
+size_t
+tsdp_window_count(struct tsdp_window *w)
+{
+	return w ? w->n : 0;
+}
+
+
+/**
+  Returns the dense series id (counting up from 0, in the order
+  that series are first seen) for the first `len` octets of
+  `name`, allocating one if need be.  Names are compared as
+  given, so callers should canonicalize them first.
+
+  Callers that see the same series over and over can look its
+  id up once, and hand it to `tsdp_window_add()` thereafter.
+
+  Returns -1 on failure, and sets `errno`.
+ **/
+int
+tsdp_window_series(struct tsdp_window *w, const char *name, size_t len)
+{
+	void **slot;
+	size_t cap;
+
+	errno = EINVAL;
+	if (!w || !name || len == 0 || len > QNAME_MAX_LEN) return -1;
+
+	errno = ENOMEM;
+	slot = strmap_slot(w->series, name, len);
+	if (!slot) return -1;
+	if (*slot) return (int)((uintptr_t)*slot - 1);
+	if (w->n == INT32_MAX) goto fail;
+
+	if (w->n == w->cap) {
+		cap = w->cap * 2;
+		if (s_resize((void **)&w->counts, cap, sizeof(uint64_t)) != 0
+		 || s_resize((void **)&w->sums,   cap, sizeof(double))   != 0
+		 || s_resize((void **)&w->mins,   cap, sizeof(double))   != 0
+		 || s_resize((void **)&w->maxs,   cap, sizeof(double))   != 0
+		 || s_resize((void **)&w->shifts, cap, sizeof(double))   != 0
+		 || s_resize((void **)&w->devs,   cap, sizeof(double))   != 0
+		 || s_resize((void **)&w->sqdevs, cap, sizeof(double))   != 0
+		 || s_resize((void **)&w->names,  cap, sizeof(uint32_t)) != 0)
+			goto fail; /* whatever did grow, stays grown */
+		w->cap = cap;
+	}
+	if (namepool_intern(&w->pool, name, len, &w->names[w->n]) != 0) goto fail;
+
+	w->counts[w->n] = 0;
+	*slot = (void *)(uintptr_t)(++w->n);
+	return (int)(w->n - 1);
+
+fail:
+	strmap_del(w->series, name, len);
+	errno = ENOMEM;
+	return -1;
+}
+
+
+/**
+  Returns the name of series `id`, which belongs to the store.
+
+  Returns NULL if there is no such series.
+ **/
+const char *
+tsdp_window_name(struct tsdp_window *w, int id)
+{
+	if (!w || id < 0 || (size_t)id >= w->n) return NULL;
+	return w->pool.buf + w->names[id];
+}
+
+
+/**
+  Adds the `n` measurements in `v` to the summary for series
+  `id`, in the current window.
+
+  Measurements that are not a number (NaN) are ignored.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Unknown series ids fail with ENOENT.
+ **/
+int
+tsdp_window_add(struct tsdp_window *w, int id, const double *v, size_t n)
+{
+	double d, sum, lo, hi, dev, sqdev, shift;
+	uint64_t count;
+	size_t i;
+
+	errno = EINVAL;
+	if (!w || (n && !v)) return -1;
+
+	errno = ENOENT;
+	if (id < 0 || (size_t)id >= w->n) return -1;
+
+	/* work on locals, and write each column back once */
+	count = w->counts[id];
+	if (count == 0) {
+		for (i = 0; i < n && v[i] != v[i]; i++)
+			;
+		if (i == n) return 0;
+		sum = dev = sqdev = 0;
+		lo = hi = shift = v[i];
+	} else {
+		i     = 0;
+		sum   = w->sums[id];
+		lo    = w->mins[id];
+		hi    = w->maxs[id];
+		shift = w->shifts[id];
+		dev   = w->devs[id];
+		sqdev = w->sqdevs[id];
+	}
+
+	for (; i < n; i++) {
+		if (v[i] != v[i]) continue;
+		count++;
+		sum   += v[i];
+		lo     = v[i] < lo ? v[i] : lo;
+		hi     = v[i] > hi ? v[i] : hi;
+		d      = v[i] - shift;
+		dev   += d;
+		sqdev += d * d;
+	}
+
+	w->counts[id] = count;
+	w->sums[id]   = sum;
+	w->mins[id]   = lo;
+	w->maxs[id]   = hi;
+	w->shifts[id] = shift;
+	w->devs[id]   = dev;
+	w->sqdevs[id] = sqdev;
+	return 0;
+}
+
+
+/**
+  Adds the measurements of the SUBMIT SAMPLE message `m` to the
+  summary for its qualified name, as for `tsdp_window_add()`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Anything other than a well-formed SUBMIT SAMPLE fails with
+  EINVAL.
+ **/
+int
+tsdp_window_submit(struct tsdp_window *w, struct tsdp_msg *m)
+{
+	struct tsdp_frame *f;
+	char buf[QNAME_MAX_LEN + 1];
+	double v;
+	size_t len;
+	int id;
+
+	errno = EINVAL;
+	if (!w || !m || m->opcode != TSDP_OPCODE_SUBMIT || m->payload != TSDP_PAYLOAD_SAMPLE) return -1;
+	if (m->nframes < 3
+	 || m->frames->type       != TSDP_FRAME_STRING
+	 || m->frames->next->type != TSDP_FRAME_TSTAMP)
+		return -1;
+	for (f = m->frames->next->next; f; f = f->next)
+		if (f->type != TSDP_FRAME_FLOAT || f->length != 8) return -1;
+
+	if (submit_name(m->frames, buf, &len) != 0) return -1;
+
+	if ((id = tsdp_window_series(w, buf, len)) < 0) return -1;
+	for (f = m->frames->next->next; f; f = f->next) {
+		v = f->payload.float64;
+		if (tsdp_window_add(w, id, &v, 1) != 0) return -1;
+	}
+	return 0;
+}
+
+
+/**
+  Copies the summary of the current window for series `id`
+  into `stats`.
+
+  Returns 0 on success, or -1 on failure, and sets `errno`.
+  Unknown series ids fail with ENOENT.
+ **/
+int
+tsdp_window_get(struct tsdp_window *w, int id, struct tsdp_sample_stats *stats)
+{
+	double n, var;
+
+	errno = EINVAL;
+	if (!w || !stats) return -1;
+
+	errno = ENOENT;
+	if (id < 0 || (size_t)id >= w->n) return -1;
+
+	memset(stats, 0, sizeof(*stats));
+	if ((stats->count = w->counts[id]) == 0) return 0;
+
+	n   = (double)w->counts[id];
+	var = (w->sqdevs[id] - w->devs[id] * w->devs[id] / n) / (n > 1 ? n - 1 : 1);
+	stats->min      = w->mins[id];
+	stats->max      = w->maxs[id];
+	stats->sum      = w->sums[id];
+	stats->mean     = w->shifts[id] + w->devs[id] / n;
+	stats->variance = n > 1 && var > 0 ? var : 0.0;
+	return 0;
+}
+
+
+/**
+  Closes the current window, and starts a new one, calling `fn`
+  with a BROADCAST SAMPLE message for each series that saw any
+  measurements in the window just closed (in series id order),
+  laid out as for `tsdp_sample_flush()`: min, max, sum, count,
+  mean and variance.
+
+  A single message is rewritten in place for each series, to
+  keep allocation out of the sweep; `fn` must neither free it
+  nor hold on to it past its return.
+
+  Returns how many messages were emitted, or -1 on failure,
+  and sets `errno`.  Either way, every series is reset for the
+  next window.
+ **/
+int
+tsdp_window_flush(struct tsdp_window *w, uint64_t ts, void (*fn)(struct tsdp_msg *m, void *udata), void *udata)
+{
+	struct tsdp_msg *m;
+	struct tsdp_frame *name, *f;
+	double n, c;
+	size_t i, len;
+	int emitted;
+
+	errno = EINVAL;
+	if (!w || !fn) return -1;
+
+	/* means and variances, computed in place of the deviations,
+	   which the next window starts over anyway */
+	for (i = 0; i < w->n; i++) {
+		c = (double)w->counts[i];
+		n = c > 1 ? c : 1;
+		w->sqdevs[i] = (w->sqdevs[i] - w->devs[i] * w->devs[i] / n) / (c > 1 ? c - 1 : 1);
+		w->sqdevs[i] = c > 1 && w->sqdevs[i] > 0 ? w->sqdevs[i] : 0;
+		w->devs[i]   = w->shifts[i] + w->devs[i] / n;
+	}
+
+	m = s_template(w, ts);
+	if (!m) {
+		memset(w->counts, 0, w->n * sizeof(uint64_t));
+		errno = ENOMEM;
+		return -1;
+	}
+
+	name = m->frames;
+	for (emitted = 0, i = 0; i < w->n; i++) {
+		if (w->counts[i] == 0) continue;
+
+		len = strlen(w->pool.buf + w->names[i]);
+		memcpy(name->data, w->pool.buf + w->names[i], len + 1);
+		name->length = len + 1;
+
+		f = name->next->next->next;
+		f->payload.float64 = w->mins[i];   f = f->next;
+		f->payload.float64 = w->maxs[i];   f = f->next;
+		f->payload.float64 = w->sums[i];   f = f->next;
+		f->payload.float64 = (double)w->counts[i]; f = f->next;
+		f->payload.float64 = w->devs[i];   f = f->next;
+		f->payload.float64 = w->sqdevs[i];
+
+		fn(m, udata);
+		emitted++;
+	}
+	tsdp_msg_free(m);
+
+	memset(w->counts, 0, w->n * sizeof(uint64_t));
+	return emitted;
+}
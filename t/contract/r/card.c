@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+static int
+near(uint64_t got, uint64_t want, double tolerance)
+{
+	double d = (double)got - (double)want;
+	if (d < 0) d = -d;
+	return d <= tolerance * want;
+}
+
+static int
+s_count(const char *metric, const char *key, uint64_t estimate, void *udata)
+{
+	(*(int *)udata)++;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_card *c;
+	struct tsdp_msg *m;
+	struct qname *q;
+	char buf[256];
+	uint64_t ts = 1495394786;
+	int i, n;
+
+	if (tsdp_card_new(3) != NULL || tsdp_card_new(17) != NULL) return 1;
+	c = tsdp_card_new(0);
+	if (!c) return 2;
+
+	/* a runaway metric: a unique request id per series */
+	for (i = 0; i < 100000; i++) {
+		snprintf(buf, sizeof(buf), "web.requests host=web%02d,req=%08x", i % 50, i * 2654435761u);
+		q = qname_parse(buf);
+		if (!q || tsdp_card_observe(c, q) != 0) return 3;
+		qname_free(q);
+	}
+	/* a well-behaved one, seen over and over */
+	for (i = 0; i < 100000; i++) {
+		snprintf(buf, sizeof(buf), "cpu host=web%02d,type=%s", i % 10, i % 3 ? "user" : "system");
+		q = qname_parse(buf);
+		if (!q || tsdp_card_observe(c, q) != 0) return 4;
+		qname_free(q);
+	}
+
+	if (!near(tsdp_card_estimate(c, "web.requests", NULL), 100000, 0.05)) {
+		fprintf(stderr, "oops.  estimated %lu web.requests series (not ~100000)\n",
+			tsdp_card_estimate(c, "web.requests", NULL));
+		return 5;
+	}
+	if (!near(tsdp_card_estimate(c, "web.requests", "req"), 100000, 0.05)) return 6;
+	if (!near(tsdp_card_estimate(c, "web.requests", "host"), 50, 0.05)) {
+		fprintf(stderr, "oops.  estimated %lu web.requests hosts (not ~50)\n",
+			tsdp_card_estimate(c, "web.requests", "host"));
+		return 7;
+	}
+	if (!near(tsdp_card_estimate(c, "cpu", NULL), 20, 0.05)) {
+		fprintf(stderr, "oops.  estimated %lu cpu series (not ~20)\n", tsdp_card_estimate(c, "cpu", NULL));
+		return 8;
+	}
+	if (!near(tsdp_card_estimate(c, "cpu", "type"), 2, 0.01)) return 9;
+	if (tsdp_card_estimate(c, "mem", NULL) != 0) return 10;
+	if (tsdp_card_estimate(c, "cpu", "req") != 0) return 11;
+
+	n = 0;
+	if (tsdp_card_each(c, s_count, &n) != 0 || n != 6) {
+		fprintf(stderr, "oops.  visited %d sketches (not 6)\n", n);
+		return 12;
+	}
+
+	/* observing SUBMIT messages */
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_TALLY);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "mem host=db01", 14) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0) return 13;
+	if (tsdp_card_observe_msg(c, m) != 0) return 14;
+	if (tsdp_card_estimate(c, "mem", NULL) != 1) return 15;
+	m->opcode = TSDP_OPCODE_FORGET;
+	if (tsdp_card_observe_msg(c, m) != -1) return 16;
+	tsdp_msg_free(m);
+
+	/* reporting */
+	m = tsdp_card_sample(c, "cpu", "type", ts);
+	if (!m || tsdp_msg_opcode(m) != TSDP_OPCODE_SUBMIT || tsdp_msg_payload(m) != TSDP_PAYLOAD_SAMPLE) return 17;
+	if (tsdp_msg_nframes(m) != 3) return 18;
+	if (strcmp(m->frames->payload.string, "tsdp.cardinality key=type,metric=cpu") != 0) return 19;
+	if (m->frames->next->payload.tstamp != ts) return 20;
+	if (m->last->payload.float64 != 2.0) return 21;
+	tsdp_msg_free(m);
+
+	m = tsdp_card_fact(c, "mem", NULL);
+	if (!m || tsdp_msg_payload(m) != TSDP_PAYLOAD_FACT || tsdp_msg_nframes(m) != 2) return 22;
+	if (strcmp(m->frames->payload.string, "tsdp.cardinality metric=mem") != 0) return 23;
+	if (strcmp(m->last->payload.string, "1") != 0) return 24;
+	q = qname_parse(m->frames->payload.string);
+	if (!q) return 25;
+	qname_free(q);
+	tsdp_msg_free(m);
+
+	tsdp_card_free(c);
+	tsdp_card_free(NULL);
+	return 0;
+}
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <tsdp.h>
+
+#define NSERIES 20
+#define NPOINTS 7200  /* two hours, at one per second */
+#define NSEGS   3
+
+/* widths are in the units of the timestamps, which are in
+   seconds, coming from SUBMIT messages */
+#define MINUTE  60
+#define HOUR    3600
+
+static const uint64_t when = 1495394786;
+static unsigned char vals[NSERIES][NPOINTS];
+
+/* series 0, 3, 6, ... are missing from the middle segment */
+static int
+present(int k, int i)
+{
+	return k % 3 != 0 || i / (NPOINTS / NSEGS) != 1;
+}
+
+static const char *
+name(int k)
+{
+	static char buf[64];
+	snprintf(buf, sizeof(buf), "cpu host=h%d", k);
+	return buf;
+}
+
+/* stores the measurement `v` for the series `k`, at `ts`, as
+   a SUBMIT SAMPLE message would have it */
+static int
+submit(struct tsdp_store *s, int k, uint64_t ts, double v)
+{
+	struct tsdp_msg *m;
+	int rc;
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_SAMPLE);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, name(k), strlen(name(k)) + 1) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &v, 8) != 0) {
+		tsdp_msg_free(m);
+		return -1;
+	}
+	rc = tsdp_store_submit(s, m);
+	tsdp_msg_free(m);
+	return rc;
+}
+
+/* writes `s` (or compacts `in`) to `path` and opens the result */
+static struct tsdp_segment *
+save(const char *path, struct tsdp_store *s, struct tsdp_segment **in, size_t n, uint64_t width)
+{
+	int fd, rc;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) return NULL;
+	rc = s ? tsdp_segment_write(s, fd) : tsdp_segment_compact(in, n, width, 0, fd);
+	close(fd);
+	return rc == 0 ? tsdp_segment_open(path) : NULL;
+}
+
+/* checks every bucket of every series in `seg` against vals[] */
+static int
+check(struct tsdp_segment *seg, uint64_t width)
+{
+	struct tsdp_store_iter *it;
+	struct tsdp_bucket b;
+	uint64_t ts, start, count;
+	double min, max, sum;
+	int k, i, n;
+
+	if (tsdp_segment_width(seg) != width || tsdp_segment_count(seg) != NSERIES) return -1;
+	for (k = 0; k < NSERIES; k++) {
+		it = tsdp_segment_iter(seg, name(k), strlen(name(k)), 0, UINT64_MAX);
+		if (!it) return -1;
+
+		for (i = 0, n = 0; i < NPOINTS; ) {
+			if (!present(k, i)) { i++; continue; }
+			ts    = when + (uint64_t)i;
+			start = width ? ts - ts % width : ts;
+			count = 0;
+			min   = 1e9; max = -1e9; sum = 0;
+			for (; i < NPOINTS && (width ? when + (uint64_t)i - start < width : count == 0); i++) {
+				if (!present(k, i)) continue;
+				if (vals[k][i] < min) min = vals[k][i];
+				if (vals[k][i] > max) max = vals[k][i];
+				sum += vals[k][i];
+				count++;
+			}
+			if (!tsdp_store_bucket(it, &b)) {
+				fprintf(stderr, "oops.  '%s' ran out of buckets at #%d\n", name(k), n);
+				tsdp_store_iter_free(it);
+				return -1;
+			}
+			if (b.ts != start || b.count != count || b.min != min || b.max != max || b.sum != sum) {
+				fprintf(stderr, "oops.  '%s' bucket #%d is (%lu: %lu, %g, %g, %g), not (%lu: %lu, %g, %g, %g)\n",
+				        name(k), n, (unsigned long)b.ts, (unsigned long)b.count, b.min, b.max, b.sum,
+				        (unsigned long)start, (unsigned long)count, min, max, sum);
+				tsdp_store_iter_free(it);
+				return -1;
+			}
+			n++;
+		}
+		if (tsdp_store_bucket(it, &b)) {
+			tsdp_store_iter_free(it);
+			return -1;
+		}
+		tsdp_store_iter_free(it);
+	}
+	return 0;
+}
+
+static long
+slurp(const char *path, char **buf)
+{
+	FILE *f;
+	long size;
+
+	f = fopen(path, "r");
+	if (!f || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) return -1;
+	rewind(f);
+	*buf = malloc(size ? size : 1);
+	if (!*buf || fread(*buf, 1, size, f) != (size_t)size) return -1;
+	fclose(f);
+	return size;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_store *s;
+	struct tsdp_store_iter *it;
+	struct tsdp_segment *segs[NSEGS], *raw, *minutes, *hours, *part, *tiers[3];
+	struct tsdp_compactor *c;
+	struct tsdp_bucket b;
+	struct timespec t0, t1;
+	char path[NSEGS + 5][64], *x, *y;
+	long nx, ny;
+	double elapsed;
+	int fd, i, k, seg;
+
+	for (i = 0; i < NSEGS + 5; i++)
+		snprintf(path[i], sizeof(path[i]), "/tmp/tsdp-compact.%d.%d", (int)getpid(), i);
+
+	srand(42);
+	for (k = 0; k < NSERIES; k++)
+		for (i = 0; i < NPOINTS; i++)
+			vals[k][i] = rand() % 100;
+
+	/* three successive segments' worth of per-second data */
+	for (seg = 0; seg < NSEGS; seg++) {
+		s = tsdp_store_new();
+		if (!s) return 1;
+		for (k = 0; k < NSERIES; k++)
+			for (i = seg * NPOINTS / NSEGS; i < (seg + 1) * NPOINTS / NSEGS; i++)
+				if (present(k, i) && submit(s, k, when + (uint64_t)i, vals[k][i]) != 0)
+					return 2;
+
+		/* raw points read as buckets of one */
+		it = tsdp_store_iter(s, name(1), strlen(name(1)), 0, UINT64_MAX);
+		if (!it || !tsdp_store_bucket(it, &b)) return 3;
+		if (b.count != 1 || b.min != vals[1][seg * NPOINTS / NSEGS] || b.min != b.max || b.min != b.sum) return 4;
+		tsdp_store_iter_free(it);
+
+		segs[seg] = save(path[seg], s, NULL, 0, 0);
+		if (!segs[seg]) return 5;
+		tsdp_store_free(s);
+	}
+
+	/* merged, as-is */
+	raw = save(path[NSEGS], NULL, segs, NSEGS, 0);
+	if (!raw || check(raw, 0) != 0) return 6;
+
+	/* rolled up to 1m, and then from 1m to 1h */
+	minutes = save(path[NSEGS + 1], NULL, segs, NSEGS, MINUTE);
+	if (!minutes || check(minutes, MINUTE) != 0) return 7;
+	hours = save(path[NSEGS + 2], NULL, &minutes, 1, HOUR);
+	if (!hours || check(hours, HOUR) != 0) return 8;
+	if (tsdp_segment_points(hours) * 100 > tsdp_segment_points(raw)) return 9;
+
+	/* rollups only ever get coarser */
+	fd = open(path[NSEGS + 3], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) return 10;
+	if (tsdp_segment_compact(&hours, 1, MINUTE, 0, fd) != -1 || errno != EINVAL) return 11;
+	if (tsdp_segment_compact(&minutes, 1, 0, 0, fd) != -1 || errno != EINVAL) return 12;
+	if (tsdp_segment_compact(&minutes, 1, 90, 0, fd) != -1 || errno != EINVAL) return 13;
+	if (tsdp_segment_compact(segs, 0, 0, 0, fd) != -1 || errno != EINVAL) return 14;
+	close(fd);
+
+	/* queries read the coarsest tier that will do */
+	tiers[0] = raw; tiers[1] = hours; tiers[2] = minutes;
+	if (tsdp_segment_pick(tiers, 3, when, when + NPOINTS - 1, 0) != raw) return 15;
+	if (tsdp_segment_pick(tiers, 3, when, when + NPOINTS - 1, 1) != raw) return 16;
+	if (tsdp_segment_pick(tiers, 3, when, when + NPOINTS - 1, 5 * MINUTE) != minutes) return 17;
+	if (tsdp_segment_pick(tiers, 3, when, when + NPOINTS - 1, 24 * HOUR) != hours) return 18;
+	if (tsdp_segment_pick(tiers, 3, 0, when - when % HOUR - 1, 24 * HOUR) != NULL || errno != ENOENT) return 19;
+	if (tsdp_segment_pick(tiers, 1, when + HOUR, when + HOUR, 24 * HOUR) != raw) return 20;
+
+	/* ... so long as it covers the whole range; if none do,
+	   the finest one reaches furthest */
+	if (tsdp_segment_pick(tiers, 3, when, when + 2 * NPOINTS, 24 * HOUR) != raw) return 21;
+	if (tsdp_segment_pick(tiers, 3, 0, when + NPOINTS - 1, 24 * HOUR) != raw) return 22;
+	part = save(path[NSEGS + 4], NULL, segs, 1, HOUR);
+	if (!part) return 23;
+	tiers[1] = part;
+	if (tsdp_segment_pick(tiers, 3, when, when + NPOINTS - 1, 24 * HOUR) != minutes) return 24;
+	if (tsdp_segment_pick(tiers, 3, when, when + NPOINTS / NSEGS - 1, 24 * HOUR) != part) return 25;
+
+	/* in the background, throttled to take at least 1/4s */
+	nx = slurp(path[NSEGS], &x);
+	if (nx <= 0) return 26;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	c = tsdp_compactor_start(segs, NSEGS, 0, nx * 4, path[NSEGS + 3]);
+	if (!c || tsdp_compactor_wait(c) != 0) return 27;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	if (elapsed < 0.2) {
+		fprintf(stderr, "oops.  %ld octets at %ld/s took only %gs\n", nx, nx * 4, elapsed);
+		return 28;
+	}
+	ny = slurp(path[NSEGS + 3], &y);
+	if (ny != nx || memcmp(x, y, nx) != 0) return 29;
+	free(x);
+	free(y);
+
+	c = tsdp_compactor_start(segs, NSEGS, 0, 0, "/tmp/nonexistent/compacted");
+	if (!c || tsdp_compactor_wait(c) != -1 || errno != ENOENT) return 30;
+	if (tsdp_compactor_wait(NULL) != -1 || errno != EINVAL) return 31;
+
+	for (seg = 0; seg < NSEGS; seg++)
+		tsdp_segment_free(segs[seg]);
+	tsdp_segment_free(raw);
+	tsdp_segment_free(minutes);
+	tsdp_segment_free(hours);
+	tsdp_segment_free(part);
+	for (i = 0; i < NSEGS + 5; i++)
+		unlink(path[i]);
+	return 0;
+}
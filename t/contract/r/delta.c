@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define NSERIES 100000
+
+static double rates[NSERIES];
+static int emitted;
+
+static void
+collect(struct tsdp_msg *m, void *udata)
+{
+	int id;
+
+	emitted++;
+	if (tsdp_msg_nframes(m) != 4
+	 || m->frames->next->next->payload.uint32 != 10
+	 || sscanf(m->frames->payload.string, "net.bytes id=%d", &id) != 1
+	 || id < 0 || id >= NSERIES)
+		return;
+	rates[id] = m->last->payload.float64;
+}
+
+static void
+keep(struct tsdp_msg *m, void *udata)
+{
+	struct tsdp_msg **copy = (struct tsdp_msg **)udata;
+	struct tsdp_frame *f;
+
+	if (*copy) return;
+	*copy = tsdp_msg_new(TSDP_PROTOCOL_V1, tsdp_msg_opcode(m), m->flags, tsdp_msg_payload(m));
+	if (!*copy) return;
+	for (f = m->frames; f; f = f->next)
+		tsdp_msg_extend(*copy, f->type,
+			f->type == TSDP_FRAME_STRING ? (void *)f->data : (void *)&f->payload, f->length);
+}
+
+/* how much of the heap is in use, if we can tell (or 0) */
+static size_t
+heap(void)
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+	struct mallinfo2 mi = mallinfo2();
+	return mi.uordblks + mi.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_delta *d;
+	struct tsdp_msg *m, *out;
+	char name[64];
+	double x, inc;
+	uint64_t ts = 1495394786;
+	size_t before;
+	int i, k;
+
+	if (tsdp_delta_new(0, 0) != NULL) return 1;
+	d = tsdp_delta_new(10, 0);
+	if (!d) return 2;
+
+	/* the first value is only a baseline */
+	if (tsdp_delta_update(d, "c", 1, 100, 1000.0) != 0) return 3;
+	if (tsdp_delta_get(d, "c", 1, &inc) != 0 || inc != 0.0) return 4;
+	if (tsdp_delta_update(d, "c", 1, 101, 1500.0) != 0) return 5;
+	if (tsdp_delta_get(d, "c", 1, &inc) != 0 || inc != 500.0) return 6;
+
+	/* reset: back to zero, then up to 200 */
+	if (tsdp_delta_update(d, "c", 1, 102, 200.0) != 0) return 7;
+	if (tsdp_delta_get(d, "c", 1, &inc) != 0 || inc != 700.0) return 8;
+
+	/* 32-bit wraparound: 2^32 - 100, then 50 */
+	if (tsdp_delta_update(d, "c", 1, 103, 4294967196.0) != 0) return 9;
+	if (tsdp_delta_get(d, "c", 1, &inc) != 0 || inc != 700.0 + 4294966996.0) return 10;
+	if (tsdp_delta_update(d, "c", 1, 104, 50.0) != 0) return 11;
+	if (tsdp_delta_get(d, "c", 1, &inc) != 0 || inc != 700.0 + 4294966996.0 + 150.0) {
+		fprintf(stderr, "oops.  increase after 32-bit wrap is %f\n", inc);
+		return 12;
+	}
+
+	/* stale values are ignored */
+	if (tsdp_delta_update(d, "c", 1, 90, 1e12) != 0) return 13;
+	if (tsdp_delta_get(d, "c", 1, &inc) != 0 || inc != 700.0 + 4294966996.0 + 150.0) return 14;
+	if (tsdp_delta_get(d, "x", 1, &inc) != -1) return 15;
+
+	if (tsdp_delta_forget(d, "c", 1) != 0 || tsdp_delta_forget(d, "c", 1) != -1) return 16;
+	if (tsdp_delta_count(d) != 0) return 17;
+	tsdp_delta_free(d);
+
+	/* lots of series, over a few windows */
+	d = tsdp_delta_new(10, 16);
+	if (!d) return 18;
+	for (i = 0; i < NSERIES; i++) {
+		snprintf(name, sizeof(name), "net.bytes id=%d", i);
+		if (tsdp_delta_update(d, name, strlen(name), ts, i * 10.0) != 0) return 19;
+	}
+	if (tsdp_delta_count(d) != NSERIES) return 20;
+	if (tsdp_delta_flush(d, ts, collect, NULL) != 0) return 21; /* baselines only */
+
+	for (i = 0; i < NSERIES; i++) {
+		snprintf(name, sizeof(name), "net.bytes id=%d", i);
+		if (tsdp_delta_update(d, name, strlen(name), ts + 5, i * 10.0 + i) != 0) return 22;
+		if (i % 2 == 0 && tsdp_delta_update(d, name, strlen(name), ts + 9, i * 10.0 + 3 * i) != 0) return 23;
+	}
+	if (tsdp_delta_flush(d, ts + 10, collect, NULL) != NSERIES || emitted != NSERIES) return 24;
+	for (i = 0; i < NSERIES; i++) {
+		if (rates[i] != (i % 2 == 0 ? 3 * i : i) / 10.0) {
+			fprintf(stderr, "oops.  id=%d rate is %f (not %f)\n", i, rates[i], (i % 2 == 0 ? 3 * i : i) / 10.0);
+			return 25;
+		}
+	}
+
+	/* every other series goes quiet */
+	emitted = 0;
+	for (i = 0; i < NSERIES; i += 2) {
+		snprintf(name, sizeof(name), "net.bytes id=%d", i);
+		if (tsdp_delta_update(d, name, strlen(name), ts + 15, i * 10.0 + 4 * i) != 0) return 26;
+	}
+	if (tsdp_delta_flush(d, ts + 20, collect, NULL) != NSERIES / 2 || emitted != NSERIES / 2) return 27;
+	if (rates[0] != 0.0 || rates[2] != 0.2 || rates[1000] != 100.0) return 28;
+	tsdp_delta_free(d);
+
+	/* series come and go, without the names of those that went
+	   piling up, or those that stayed getting mixed up */
+	d = tsdp_delta_new(10, 0);
+	if (!d) return 40;
+	for (i = 0; i < 100; i++) {
+		snprintf(name, sizeof(name), "net.bytes id=%d", i);
+		if (tsdp_delta_update(d, name, strlen(name), ts, 0.0) != 0) return 41;
+	}
+	before = 0;
+	for (k = 0; k < 200; k++) {
+		for (i = 0; i < 1000; i++) {
+			snprintf(name, sizeof(name), "net.churn id=%d", k * 1000 + i);
+			if (tsdp_delta_update(d, name, strlen(name), ts, 1.0) != 0) return 42;
+		}
+		for (i = 0; i < 1000; i++) {
+			snprintf(name, sizeof(name), "net.churn id=%d", k * 1000 + i);
+			if (tsdp_delta_forget(d, name, strlen(name)) != 0) return 43;
+		}
+		if (k == 19) before = heap();
+	}
+	if (tsdp_delta_count(d) != 100) return 44;
+	if (heap() > before + 256 * 1024) {
+		fprintf(stderr, "oops.  heap grew from %lu to %lu octets\n", (unsigned long)before, (unsigned long)heap());
+		return 45;
+	}
+	emitted = 0;
+	memset(rates, 0, sizeof(rates));
+	for (i = 0; i < 100; i++) {
+		snprintf(name, sizeof(name), "net.bytes id=%d", i);
+		if (tsdp_delta_update(d, name, strlen(name), ts + 10, i * 10.0) != 0) return 46;
+	}
+	if (tsdp_delta_flush(d, ts + 10, collect, NULL) != 100 || emitted != 100) return 47;
+	for (i = 0; i < 100; i++)
+		if (rates[i] != (double)i) return 48;
+	tsdp_delta_free(d);
+
+	/* SUBMIT DELTA in, BROADCAST DELTA out */
+	d = tsdp_delta_new(60, 0);
+	if (!d) return 29;
+	for (i = 0; i < 2; i++) {
+		m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_DELTA);
+		x = i ? 1200.0 : 600.0;
+		ts += 30;
+		if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, i ? "if rx=1,dev=eth0" : "if dev=eth0,rx=1", 17) != 0
+		       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0
+		       || tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &x, 8) != 0) return 30;
+		if (tsdp_delta_submit(d, m) != 0) return 31;
+		m->payload = TSDP_PAYLOAD_SAMPLE;
+		if (tsdp_delta_submit(d, m) != -1) return 32;
+		tsdp_msg_free(m);
+	}
+
+	out = NULL;
+	if (tsdp_delta_flush(d, ts, keep, &out) != 1 || !out) return 33;
+	if (tsdp_msg_opcode(out) != TSDP_OPCODE_BROADCAST || tsdp_msg_payload(out) != TSDP_PAYLOAD_DELTA) return 34;
+	if (tsdp_msg_nframes(out) != 4) return 35;
+	if (strcmp(out->frames->payload.string, "if dev=eth0,rx=1") != 0) return 36;
+	if (out->frames->next->payload.tstamp != ts) return 37;
+	if (out->frames->next->next->length != 4 || out->frames->next->next->payload.uint32 != 60) return 38;
+	if (out->last->payload.float64 != 10.0) return 39;
+	tsdp_msg_free(out);
+	tsdp_delta_free(d);
+
+	tsdp_delta_free(NULL);
+	return 0;
+}
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <tsdp.h>
+
+#define NSERIES 10000
+
+struct seen {
+	int    n, bad;
+	double total;
+};
+
+static void
+record(struct tsdp_msg *m, void *udata)
+{
+	struct seen *s = (struct seen *)udata;
+	struct qname *q;
+
+	s->n++;
+	if (tsdp_msg_opcode(m) != TSDP_OPCODE_BROADCAST || tsdp_msg_payload(m) != TSDP_PAYLOAD_SAMPLE
+	 || tsdp_msg_nframes(m) != 4 || m->frames->next->next->payload.uint32 != 60) {
+		s->bad++;
+		return;
+	}
+	/* group names are themselves qualified names */
+	q = qname_parse(m->frames->payload.string);
+	if (!q || q->wild) s->bad++;
+	qname_free(q);
+	s->total += m->last->payload.float64;
+}
+
+static uint64_t now = 1495394786;
+
+static int
+submit(struct tsdp_groupby *g, int payload, const char *name, double v)
+{
+	struct tsdp_msg *m;
+	uint64_t ts = now, inc = v;
+	int rc;
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, payload);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, name, strlen(name) + 1) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0) return -2;
+	if (payload == TSDP_PAYLOAD_TALLY ? v > 0 && tsdp_msg_extend(m, TSDP_FRAME_UINT, &inc, 8) != 0
+	                                  : tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &v, 8) != 0) return -2;
+	rc = tsdp_groupby_submit(g, m);
+	tsdp_msg_free(m);
+	return rc;
+}
+
+static int
+is(struct tsdp_groupby *g, const char *group, double want)
+{
+	double got;
+
+	if (tsdp_groupby_get(g, group, strlen(group), &got) != 0) {
+		fprintf(stderr, "oops.  no such group '%s'\n", group);
+		return 0;
+	}
+	if (got != want) {
+		fprintf(stderr, "oops.  group '%s' is %g (not %g)\n", group, got, want);
+		return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_groupby *g;
+	struct qname *q;
+	struct seen seen;
+	const char *dc[]   = { "dc" };
+	const char *both[] = { "host", "dc" };
+	const char *dup[]  = { "dc", "dc" };
+	char name[64];
+	double v;
+	int i;
+
+	if (tsdp_groupby_new("requests *", dc, 1, 0, 60) != NULL) return 1;
+	if (tsdp_groupby_new("requests *", dc, 1, TSDP_GROUPBY_SUM, 0) != NULL) return 2;
+	if (tsdp_groupby_new("requests *", dup, 2, TSDP_GROUPBY_SUM, 60) != NULL || errno != EINVAL) return 3;
+	if (tsdp_groupby_new("", dc, 1, TSDP_GROUPBY_SUM, 60) != NULL) return 4;
+
+	/* sum(requests) by (dc) */
+	g = tsdp_groupby_new("requests *", dc, 1, TSDP_GROUPBY_SUM, 60);
+	if (!g) return 5;
+	if (submit(g, TSDP_PAYLOAD_SAMPLE, "requests dc=us-east,host=a", 1) != 1) return 6;
+	if (submit(g, TSDP_PAYLOAD_SAMPLE, "requests host=b,dc=us-east", 2) != 1) return 7;
+	if (submit(g, TSDP_PAYLOAD_DELTA,  "requests dc=eu,host=c", 1000) != 0) return 8; /* baseline */
+	if (submit(g, TSDP_PAYLOAD_DELTA,  "requests host=c,dc=eu", 1010) != 1) return 46;
+	if (submit(g, TSDP_PAYLOAD_TALLY,  "requests dc=eu,host=d", 5) != 1) return 9;
+	if (submit(g, TSDP_PAYLOAD_TALLY,  "requests dc=eu,host=d", 0) != 1) return 10; /* no increment */
+	if (submit(g, TSDP_PAYLOAD_SAMPLE, "requests host=e", 7) != 1) return 11;
+	if (submit(g, TSDP_PAYLOAD_SAMPLE, "cpu dc=eu,host=c", 99) != 0) return 12;
+	if (submit(g, TSDP_PAYLOAD_SAMPLE, "requests dc=eu,*", 99) != -1) return 13;
+	if (submit(g, TSDP_PAYLOAD_EVENT,  "requests dc=eu,host=c", 99) != -1) return 14;
+
+	if (tsdp_groupby_count(g) != 3) return 15;
+	if (!is(g, "requests dc=us-east", 3)) return 16;
+	if (!is(g, "requests dc=eu", 16)) return 17;
+	if (!is(g, "requests dc", 7)) return 18;
+	if (tsdp_groupby_get(g, "cpu dc=eu", 9, &v) != -1 || errno != ENOENT) return 19;
+
+	memset(&seen, 0, sizeof(seen));
+	if (tsdp_groupby_flush(g, 1495394846, record, &seen) != 3) return 20;
+	if (seen.n != 3 || seen.bad != 0 || seen.total != 26) return 21;
+
+	/* groups carry over, but their values do not */
+	if (tsdp_groupby_get(g, "requests dc=eu", 14, &v) != -1) return 22;
+	if (tsdp_groupby_flush(g, 1495394906, record, &seen) != 0) return 23;
+	if (tsdp_groupby_count(g) != 3) return 24;
+	tsdp_groupby_free(g);
+
+	/* max(cpu) by (dc, host), whatever the order of the keys */
+	g = tsdp_groupby_new("cpu *", both, 2, TSDP_GROUPBY_MAX, 60);
+	if (!g) return 25;
+	q = qname_parse("cpu zone=1,host=a,dc=eu");
+	if (!q) return 26;
+	for (i = 0; i < 5; i++)
+		if (tsdp_groupby_add(g, q, i * 2.5) != 1) return 27;
+	if (tsdp_groupby_add(g, q, 0.0 / 0.0) != -1) return 28;
+	qname_free(q);
+	if (!is(g, "cpu dc=eu,host=a", 10)) return 29;
+	tsdp_groupby_free(g);
+
+	/* avg(latency) by (dc), across lots of series */
+	g = tsdp_groupby_new("latency *", dc, 1, TSDP_GROUPBY_MEAN, 60);
+	if (!g) return 30;
+	for (i = 0; i < NSERIES; i++) {
+		snprintf(name, sizeof(name), "latency dc=dc%d,host=h%d", i % 10, i);
+		if (submit(g, TSDP_PAYLOAD_SAMPLE, name, i % 10 * 100 + (i / 10) % 2) != 1) return 31;
+	}
+	if (tsdp_groupby_count(g) != 10) return 32;
+	for (i = 0; i < 10; i++) {
+		snprintf(name, sizeof(name), "latency dc=dc%d", i);
+		if (!is(g, name, i * 100 + 0.5)) return 33;
+	}
+	tsdp_groupby_free(g);
+
+	/* count(disk) by a key none of them have, all in one group;
+	   there has to be some key to name the group for, though */
+	if (tsdp_groupby_new("disk *", NULL, 0, TSDP_GROUPBY_COUNT, 60) != NULL || errno != EINVAL) return 34;
+	g = tsdp_groupby_new("disk *", dc, 1, TSDP_GROUPBY_COUNT, 60);
+	if (!g) return 37;
+	for (i = 0; i < 100; i++) {
+		snprintf(name, sizeof(name), "disk host=h%d", i);
+		if (submit(g, TSDP_PAYLOAD_SAMPLE, name, i) != 1) return 35;
+	}
+	if (!is(g, "disk dc", 100)) return 36;
+	memset(&seen, 0, sizeof(seen));
+	if (tsdp_groupby_flush(g, 1495394846, record, &seen) != 1 || seen.bad != 0) return 38;
+	tsdp_groupby_free(g);
+
+	/* series that lack some grouping keys are named for the rest */
+	g = tsdp_groupby_new("cpu *", both, 2, TSDP_GROUPBY_SUM, 60);
+	if (!g) return 39;
+	if (submit(g, TSDP_PAYLOAD_SAMPLE, "cpu host=a,zone=1", 1) != 1) return 40;
+	if (submit(g, TSDP_PAYLOAD_SAMPLE, "cpu dc,host=a", 2) != 1) return 41;
+	if (submit(g, TSDP_PAYLOAD_SAMPLE, "cpu dc=eu", 4) != 1) return 42;
+	if (submit(g, TSDP_PAYLOAD_SAMPLE, "cpu a=1,z=2", 8) != 1) return 43;
+	if (!is(g, "cpu dc,host=a", 3) || !is(g, "cpu dc=eu,host", 4) || !is(g, "cpu dc,host", 8)) return 44;
+	memset(&seen, 0, sizeof(seen));
+	if (tsdp_groupby_flush(g, 1495394846, record, &seen) != 3 || seen.bad != 0) return 45;
+	tsdp_groupby_free(g);
+
+	/* DELTA counters fold in how far they went up, not how high */
+	g = tsdp_groupby_new("net *", dc, 1, TSDP_GROUPBY_SUM, 60);
+	if (!g) return 47;
+	if (submit(g, TSDP_PAYLOAD_DELTA, "net dc=eu,host=a", 5e9) != 0) return 48;
+	if (submit(g, TSDP_PAYLOAD_DELTA, "net dc=eu,host=b", 4294967000.0) != 0) return 49;
+	now++;
+	if (submit(g, TSDP_PAYLOAD_DELTA, "net dc=eu,host=a", 5e9 + 100) != 1) return 50;
+	if (submit(g, TSDP_PAYLOAD_DELTA, "net dc=eu,host=b", 200) != 1) return 51; /* wrapped */
+	if (!is(g, "net dc=eu", 100 + 296 + 200)) return 52;
+	if (submit(g, TSDP_PAYLOAD_DELTA, "net dc=eu,host=a", 50) != 1) return 53; /* reset */
+	if (!is(g, "net dc=eu", 100 + 296 + 200 + 50)) return 54;
+	now--;
+	if (submit(g, TSDP_PAYLOAD_DELTA, "net dc=eu,host=a", 1e12) != 0) return 55; /* stale */
+	now++;
+	if (submit(g, TSDP_PAYLOAD_DELTA, "cpu dc=eu,host=a", 1) != 0) return 56;
+
+	/* forgotten series start over from a new baseline */
+	if (tsdp_groupby_forget(g, "net dc=eu,host=a", 16) != 0) return 57;
+	if (tsdp_groupby_forget(g, "net dc=eu,host=a", 16) != -1 || errno != ENOENT) return 58;
+	if (submit(g, TSDP_PAYLOAD_DELTA, "net dc=eu,host=a", 1e6) != 0) return 59;
+	if (submit(g, TSDP_PAYLOAD_DELTA, "net dc=eu,host=a", 1e6 + 4) != 1) return 60;
+	if (!is(g, "net dc=eu", 100 + 296 + 200 + 50 + 4)) return 61;
+	tsdp_groupby_free(g);
+
+	tsdp_groupby_free(NULL);
+	return 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <tsdp.h>
+
+static struct tsdp_msg *
+repack(struct tsdp_msg *m)
+{
+	size_t len, left;
+	void *buf;
+	struct tsdp_msg *copy;
+
+	len = tsdp_msg_pack(NULL, 0, m);
+	buf = malloc(len);
+	if (!buf) return NULL;
+	tsdp_msg_pack(buf, len, m);
+	copy = tsdp_msg_unpack(buf, len, &left);
+	free(buf);
+	return copy;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_histogram *h, *fine, *copy;
+	struct tsdp_msg *m, *wire;
+	double bad[] = { 1, 10, 5 };
+	double latency[] = { 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, INFINITY };
+	double coarse[]  = { 0.01, 0.1, 1, INFINITY };
+	double many[TSDP_HISTOGRAM_MAX_BUCKETS + 1];
+	size_t i;
+
+	if (tsdp_histogram_new(bad, 3) != NULL) return 1;
+	if (tsdp_histogram_new(latency, 0) != NULL) return 2;
+	for (i = 0; i <= TSDP_HISTOGRAM_MAX_BUCKETS; i++) many[i] = i;
+	if (tsdp_histogram_new(many, TSDP_HISTOGRAM_MAX_BUCKETS + 1) != NULL) return 3;
+
+	h = tsdp_histogram_new(coarse, 3); /* nothing above 1s */
+	if (!h) return 4;
+	if (tsdp_histogram_buckets(h) != 3 || tsdp_histogram_bound(h, 2) != 1.0) return 5;
+	if (tsdp_histogram_bound(h, 3) == tsdp_histogram_bound(h, 3)) return 6; /* NaN */
+	if (tsdp_histogram_observe(h, 0.01, 1) != 0 || tsdp_histogram_count(h, 0) != 1) return 7; /* inclusive */
+	if (tsdp_histogram_observe(h, 0.011, 2) != 0 || tsdp_histogram_count(h, 1) != 2) return 8;
+	if (tsdp_histogram_observe(h, -5, 1) != 0 || tsdp_histogram_count(h, 0) != 2) return 9;
+	if (tsdp_histogram_observe(h, 2.0, 1) != -1) return 10;
+	if (tsdp_histogram_observe(h, NAN, 1) != -1) return 11;
+	if (tsdp_histogram_total(h) != 4) return 12;
+	tsdp_histogram_free(h);
+
+	/* agents observe at fine granularity ... */
+	fine = tsdp_histogram_new(latency, 9);
+	if (!fine) return 13;
+	for (i = 0; i < 100000; i++)
+		if (tsdp_histogram_observe(fine, (i % 1000) / 500.0, 1) != 0) return 14;
+	if (tsdp_histogram_observe(fine, 0.001, 70000) != 0) return 15;
+	if (tsdp_histogram_count(fine, 8) != 49900 || tsdp_histogram_count(fine, 0) != 70000 + 300) return 16;
+
+	/* ... and ship whole distributions in a single message */
+	m = tsdp_histogram_to_msg(fine, TSDP_OPCODE_SUBMIT, "http.latency path=/", 1495394786, 0);
+	if (!m || tsdp_msg_nframes(m) != 2 + 2 * 9) return 17;
+	if (m->frames->next->next->next->length != 4) return 18; /* 70300 needs UINT/4 */
+	if (m->last->length != 2) return 19;                       /* 49900 fits in UINT/2 */
+	wire = repack(m);
+	if (!wire || !tsdp_msg_valid(wire)) return 20;
+	tsdp_msg_free(m);
+
+	copy = tsdp_histogram_from_msg(wire);
+	if (!copy || tsdp_histogram_buckets(copy) != 9) return 21;
+	for (i = 0; i < 9; i++) {
+		if (tsdp_histogram_bound(copy, i) != latency[i]) return 22;
+		if (tsdp_histogram_count(copy, i) != tsdp_histogram_count(fine, i)) return 23;
+	}
+	tsdp_msg_free(wire);
+
+	/* servers merge them, at the same or coarser granularity */
+	if (tsdp_histogram_merge(copy, fine) != 0) return 24;
+	if (tsdp_histogram_count(copy, 8) != 99800) return 25;
+	h = tsdp_histogram_new(coarse, 4);
+	if (!h) return 26;
+	if (tsdp_histogram_merge(h, copy) != 0) return 27;
+	if (tsdp_histogram_total(h) != tsdp_histogram_total(copy)) return 28;
+	if (tsdp_histogram_count(h, 0) != tsdp_histogram_count(copy, 0) + tsdp_histogram_count(copy, 1)) return 29;
+	if (tsdp_histogram_merge(copy, h) != -1) return 30;
+	if (tsdp_histogram_count(copy, 8) != 99800) return 31;
+
+	m = tsdp_histogram_to_msg(h, TSDP_OPCODE_BROADCAST, "http.latency path=/", 1495394786, 60);
+	if (!m || tsdp_msg_nframes(m) != 3 + 2 * 4) return 32;
+	wire = repack(m);
+	if (!wire || !tsdp_msg_valid(wire)) return 33;
+	if (wire->frames->next->next->payload.uint32 != 60) return 34;
+	tsdp_msg_free(m);
+	tsdp_histogram_free(copy);
+	copy = tsdp_histogram_from_msg(wire);
+	if (!copy || tsdp_histogram_total(copy) != tsdp_histogram_total(h)) return 35;
+	tsdp_msg_free(wire);
+
+	if (tsdp_histogram_to_msg(h, TSDP_OPCODE_FORGET, "x", 0, 0) != NULL) return 36;
+	tsdp_histogram_clear(h);
+	if (tsdp_histogram_total(h) != 0 || tsdp_histogram_buckets(h) != 4) return 37;
+
+	tsdp_histogram_free(h);
+	tsdp_histogram_free(copy);
+	tsdp_histogram_free(fine);
+	tsdp_histogram_free(NULL);
+	return 0;
+}
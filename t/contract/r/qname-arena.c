@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+#define N 5000
+
+static int
+check(struct qname_arena *a, const char *how)
+{
+	char want[64], got[64];
+	size_t i;
+
+	if (!a) {
+		fprintf(stderr, "oops.  %s returned a NULL arena\n", how);
+		return 1;
+	}
+	if (a->n != N + 1 || a->failed != 1) {
+		fprintf(stderr, "oops.  %s parsed %lu names, %lu failures (not %d names, 1 failure)\n",
+			how, a->n, a->failed, N + 1);
+		return 1;
+	}
+	for (i = 0; i < N; i++) {
+		snprintf(want, sizeof(want), "cpu env=prod,host=h%lu", i);
+		qname_string_into(&a->names[i], got, sizeof(got));
+		if (strcmp(got, want) != 0) {
+			fprintf(stderr, "oops.  %s names[%lu] is '%s' (not '%s')\n", how, i, got, want);
+			return 1;
+		}
+	}
+	if (a->names[N].metric != NULL) {
+		fprintf(stderr, "oops.  %s didn't zero the slot of an unparseable name\n", how);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct qname_arena *a;
+	const char **s;
+	char *lines, *p;
+	size_t i;
+
+	s = calloc(N + 1, sizeof(char *));
+	lines = p = malloc((N + 1) * 64);
+	for (i = 0; i < N; i++) {
+		s[i] = p;
+		p += sprintf(p, "cpu host=h%lu,env=prod", i) + 1;
+	}
+	s[N] = "bad =name";
+
+	a = qname_parse_many(s, N + 1, 1);
+	if (check(a, "qname_parse_many()") != 0) return 1;
+	qname_arena_free(a);
+
+	a = qname_parse_many(s, N + 1, 4);
+	if (check(a, "qname_parse_many(4 threads)") != 0) return 2;
+	qname_arena_free(a);
+
+	/* turn the NUL-separated strings into newline-separated lines,
+	   with some blank lines and carriage returns thrown in */
+	for (p = lines; p < s[N - 1] + strlen(s[N - 1]); p++)
+		if (!*p) *p = '\n';
+	p = lines + (s[N - 1] - lines) + strlen(s[N - 1]);
+	p += sprintf(p, "\r\n\n\nbad =name\n");
+
+	a = qname_parse_lines(lines, p - lines, 3);
+	if (check(a, "qname_parse_lines()") != 0) return 3;
+	qname_arena_free(a);
+
+	a = qname_parse_many(s, 0, 8);
+	if (!a || a->n != 0) {
+		fprintf(stderr, "oops.  qname_parse_many() didn't handle an empty input set\n");
+		return 4;
+	}
+	qname_arena_free(a);
+	qname_arena_free(NULL);
+
+	free(lines);
+	free(s);
+	return 0;
+}
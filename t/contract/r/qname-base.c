@@ -4,8 +4,8 @@
 
 int main(int argc, char **argv)
 {
-	struct qname *qn;
-	char s[8192], *out;
+	struct qname *qn, into;
+	char s[8192], scratch[16], *out;
 
 	qn = qname_parse(NULL);
 	if (qn != NULL) {
@@ -58,5 +58,35 @@ int main(int argc, char **argv)
 		return 9;
 	}
 
+	if (qname_parse_into(&into, scratch, sizeof(scratch), "cpu a=b,c=d", 11) != 0) {
+		fprintf(stderr, "oops.  qname_parse_into() failed to parse 'cpu a=b,c=d' into a 16-octet scratch buffer\n");
+		return 10;
+	}
+	if (strcmp(qname_get(&into, "c"), "d") != 0) {
+		fprintf(stderr, "oops.  qname_parse_into() yielded c='%s' (not 'd')\n", qname_get(&into, "c"));
+		return 11;
+	}
+	qname_clear(&into);
+	if (into.flat != NULL || into.i != 0) {
+		fprintf(stderr, "oops.  qname_clear() didn't reset the qname structure\n");
+		return 12;
+	}
+
+	if (qname_parse_into(&into, scratch, 11, "cpu a=b,c=d", 11) == 0) {
+		fprintf(stderr, "oops.  qname_parse_into() didn't fail with a scratch buffer too small for the NUL\n");
+		return 13;
+	}
+	if (qname_parse_into(&into, scratch, sizeof(scratch), "cpu a=b,c=d,e=f", 7) != 0
+	 || strcmp(qname_get(&into, "a"), "b") != 0 || into.i != 1) {
+		fprintf(stderr, "oops.  qname_parse_into() didn't stop after the first 7 octets of input\n");
+		return 14;
+	}
+	qname_clear(&into);
+
+	if (qname_parse_into(&into, s, sizeof(s), s, 4096) == 0) {
+		fprintf(stderr, "oops.  qname_parse_into() didn't fail with a qname that was 4096 octets long\n");
+		return 15;
+	}
+
 	return 0;
 }
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+int main(int argc, char **argv)
+{
+	struct qname *qn;
+	char buf[64], *s;
+	size_t n;
+
+	qn = qname_parse("cpu host=a,env=prod");
+	if (!qn) {
+		fprintf(stderr, "oops.  unable to parse 'cpu host=a,env=prod'\n");
+		return 1;
+	}
+
+	/* the cache is filled at parse time, not by readers */
+	if (!qn->canon || strcmp(qn->canon, "cpu env=prod,host=a") != 0) {
+		fprintf(stderr, "oops.  qname_parse() didn't cache the canonical form\n");
+		return 11;
+	}
+
+	n = qname_string_into(qn, NULL, 0);
+	if (n != strlen("cpu env=prod,host=a")) {
+		fprintf(stderr, "oops.  qname_string_into(NULL, 0) sized the canonical form at %lu octets (not %lu)\n",
+			n, strlen("cpu env=prod,host=a"));
+		return 2;
+	}
+	if (qname_string_into(qn, buf, 8) != n || strcmp(buf, "cpu env") != 0) {
+		fprintf(stderr, "oops.  qname_string_into() didn't truncate to 'cpu env' (got '%s')\n", buf);
+		return 3;
+	}
+
+	s = qname_string(qn);
+	if (!s || strcmp(s, "cpu env=prod,host=a") != 0) {
+		fprintf(stderr, "oops.  qname_string() yielded '%s' (not 'cpu env=prod,host=a')\n", s);
+		return 4;
+	}
+	free(s);
+	if (!qn->canon || qn->clen != n) {
+		fprintf(stderr, "oops.  qname_string() lost the cached canonical form\n");
+		return 5;
+	}
+	if (qname_string_into(qn, buf, sizeof(buf)) != n || strcmp(buf, "cpu env=prod,host=a") != 0) {
+		fprintf(stderr, "oops.  qname_string_into() yielded '%s' from the cache\n", buf);
+		return 6;
+	}
+
+	/* mutation has to invalidate the cache */
+	if (qname_set(qn, "env", "dev") != 0) {
+		fprintf(stderr, "oops.  qname_set() failed\n");
+		return 7;
+	}
+	s = qname_string(qn);
+	if (!s || strcmp(s, "cpu env=dev,host=a") != 0) {
+		fprintf(stderr, "oops.  qname_string() after qname_set() yielded stale '%s'\n", s);
+		return 8;
+	}
+	free(s);
+
+	if (qname_unset(qn, "host") != 0) {
+		fprintf(stderr, "oops.  qname_unset() failed\n");
+		return 9;
+	}
+	qname_string_into(qn, buf, sizeof(buf));
+	if (strcmp(buf, "cpu env=dev") != 0) {
+		fprintf(stderr, "oops.  qname_string_into() after qname_unset() yielded stale '%s'\n", buf);
+		return 10;
+	}
+	if (!qn->canon || strcmp(qn->canon, "cpu env=dev") != 0) {
+		fprintf(stderr, "oops.  qname_unset() didn't re-cache the canonical form\n");
+		return 12;
+	}
+
+	/* once the flat buffer has grown, it has room for the
+	   cache, so that overwrites don't have to allocate */
+	if (qname_set(qn, "region", "us-east-1") != 0 || qname_set(qn, "zone", "a") != 0) {
+		fprintf(stderr, "oops.  qname_set() failed to add keys\n");
+		return 13;
+	}
+	s = qn->flat;
+	for (n = 0; n < 100; n++) {
+		if (qname_set(qn, "region", n % 2 ? "us-west-2" : "eu-west-1") != 0) {
+			fprintf(stderr, "oops.  qname_set() failed to overwrite\n");
+			return 14;
+		}
+		if (qn->flat != s || !qn->canon || qn->canon < qn->flat || qn->canon >= qn->flat + qn->cap) {
+			fprintf(stderr, "oops.  overwrite #%lu moved the flat buffer, or cached off of it\n", n);
+			return 15;
+		}
+	}
+	if (strcmp(qn->canon, "cpu env=dev,region=us-west-2,zone=a") != 0) {
+		fprintf(stderr, "oops.  qname_set() cached '%s'\n", qn->canon);
+		return 16;
+	}
+
+	qname_free(qn);
+	return 0;
+}
@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+int main(int argc, char **argv)
+{
+	char buf[8192], scratch[QNAME_MAX_LEN + 1], *nl;
+	struct qname qn;
+
+	memset(&qn, 0, sizeof(qn));
+	while ( (fgets(buf, 8192, stdin)) != NULL ) {
+		/* parse without the newline, and without a NUL terminator,
+		   the way we would out of a TSDP STRING frame */
+		nl = strrchr(buf, '\n');
+		qname_clear(&qn);
+		if (qname_parse_into(&qn, scratch, sizeof(scratch), buf, nl ? nl - buf : strlen(buf)) != 0) {
+			printf("%s\n", qname_string(NULL));
+			continue;
+		}
+		memset(buf, 0, 8192);
+		printf("%s\n", qname_string(&qn));
+	}
+	qname_clear(&qn);
+	return 0;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+#define WANT(q,s,n) do { \
+	char __buf[256]; \
+	qname_string_into((q), __buf, sizeof(__buf)); \
+	if (strcmp(__buf, (s)) != 0) { \
+		fprintf(stderr, "oops.  expected '%s', but got '%s'\n", (s), __buf); \
+		return (n); \
+	} \
+} while (0)
+
+int main(int argc, char **argv)
+{
+	struct qname qn, *dup;
+	char scratch[64], *flat;
+
+	/* plenty of slack: everything happens in scratch */
+	if (qname_parse_into(&qn, scratch, sizeof(scratch), "cpu host=web1,env=production", 28) != 0) {
+		fprintf(stderr, "oops.  unable to parse 'cpu host=web1,env=production'\n");
+		return 1;
+	}
+	flat = qn.flat;
+
+	if (qname_set(&qn, "env", "prod") != 0) return 2;   /* shrinks in place  */
+	WANT(&qn, "cpu env=prod,host=web1", 3);
+	if (qname_set(&qn, "dc", "us-east") != 0) return 4; /* appends to slack  */
+	WANT(&qn, "cpu dc=us-east,env=prod,host=web1", 5);
+	if (qname_unset(&qn, "host") != 0) return 6;        /* never allocates   */
+	WANT(&qn, "cpu dc=us-east,env=prod", 7);
+
+	if (qn.flat != flat || !qn.borrowed) {
+		fprintf(stderr, "oops.  small modifications moved the qname out of its scratch buffer\n");
+		return 8;
+	}
+
+	/* run out of slack: copy-on-write to the heap */
+	if (qname_set(&qn, "region", "a-rather-long-region-name-that-will-not-fit") != 0) return 9;
+	WANT(&qn, "cpu dc=us-east,env=prod,region=a-rather-long-region-name-that-will-not-fit", 10);
+	if (qn.flat == flat || qn.borrowed) {
+		fprintf(stderr, "oops.  outgrowing the scratch buffer didn't copy the qname to the heap\n");
+		return 11;
+	}
+	if (strcmp(scratch, "cpu") != 0) {
+		fprintf(stderr, "oops.  outgrowing the scratch buffer clobbered it\n");
+		return 12;
+	}
+
+	/* ... after which there is slack to spare */
+	flat = qn.flat;
+	if (qname_set(&qn, "rack", "r12") != 0) return 13;
+	if (qn.flat != flat) {
+		fprintf(stderr, "oops.  growing the qname didn't leave slack for the next modification\n");
+		return 14;
+	}
+
+	/* values that point into the qname itself */
+	if (qname_set(&qn, "zone", qname_get(&qn, "region")) != 0) return 15;
+	WANT(&qn, "cpu dc=us-east,env=prod,rack=r12,region=a-rather-long-region-name-that-will-not-fit,"
+	          "zone=a-rather-long-region-name-that-will-not-fit", 16);
+
+	dup = qname_dup(&qn);
+	qname_clear(&qn);
+	WANT(dup, "cpu dc=us-east,env=prod,rack=r12,region=a-rather-long-region-name-that-will-not-fit,"
+	          "zone=a-rather-long-region-name-that-will-not-fit", 17);
+	qname_free(dup);
+
+	/* building a name up from nothing */
+	dup = qname_new();
+	if (qname_set(dup, "a", "b") != 0 || qname_set(dup, "c", NULL) != 0) return 18;
+	if (qname_get(dup, "a") == NULL || strcmp(qname_get(dup, "a"), "b") != 0) return 19;
+	qname_free(dup);
+
+	return 0;
+}
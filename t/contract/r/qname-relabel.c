@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+int main(int argc, char **argv)
+{
+	struct tsdp_relabel *r;
+	struct qname *q;
+	char buf[QNAME_MAX_LEN + 1], small[8];
+	size_t n;
+
+	if (argc != 3) {
+		fprintf(stderr, "incorrect usage.  try %s 'drop a; rename b c' cpu a=b,b=c\n", argv[0]);
+		return 2;
+	}
+
+	r = tsdp_relabel_compile(argv[1]);
+	if (!r) {
+		fprintf(stdout, "<invalid rules>\n");
+		return 0;
+	}
+
+	q = qname_parse(argv[2]);
+	if (!q) {
+		fprintf(stderr, "failed to parse qname '%s'\n", argv[2]);
+		return 3;
+	}
+
+	n = tsdp_relabel_apply(r, q, buf, sizeof(buf));
+	if (n == 0) {
+		fprintf(stdout, "<no pairs>\n");
+		return 0;
+	}
+	if (n != strlen(buf)) {
+		fprintf(stderr, "tsdp_relabel_apply() returned %lu for '%s'\n", n, buf);
+		return 4;
+	}
+
+	/* truncation behaves like qname_string_into() */
+	if (tsdp_relabel_apply(r, q, small, sizeof(small)) != n
+	 || strlen(small) != sizeof(small) - 1 || strncmp(small, buf, sizeof(small) - 1) != 0) {
+		fprintf(stderr, "tsdp_relabel_apply() truncated '%s' to '%s'\n", buf, small);
+		return 5;
+	}
+	if (tsdp_relabel_apply(r, q, NULL, 0) != n) {
+		fprintf(stderr, "tsdp_relabel_apply() mis-sized '%s'\n", buf);
+		return 6;
+	}
+
+	/* the result must be canonical */
+	qname_free(q);
+	q = qname_parse(buf);
+	if (!q || strcmp(qname_string(q), buf) != 0) {
+		fprintf(stderr, "'%s' is not in canonical form\n", buf);
+		return 7;
+	}
+
+	fprintf(stdout, "%s\n", buf);
+	tsdp_relabel_free(r);
+	return 0;
+}
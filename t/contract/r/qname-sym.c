@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+static int
+base(void)
+{
+	struct qname_symtab *t;
+	struct qname *q;
+	struct qname_sym *s, *s2;
+	uint32_t id, id2;
+	char buf[64];
+	int i;
+
+	t = qname_symtab_new();
+	if (!t) {
+		fprintf(stderr, "oops.  qname_symtab_new() failed\n");
+		return 1;
+	}
+
+	id = qname_symtab_intern(t, "host=", 4);
+	if (id <= QNAME_SYM_ANY) {
+		fprintf(stderr, "oops.  qname_symtab_intern() handed out a reserved id (%u)\n", id);
+		return 2;
+	}
+	if (qname_symtab_intern(t, "host", 4) != id || qname_symtab_lookup(t, "host", 4) != id) {
+		fprintf(stderr, "oops.  re-interning 'host' yielded a different id\n");
+		return 3;
+	}
+	if (qname_symtab_lookup(t, "env", 3) != 0) {
+		fprintf(stderr, "oops.  qname_symtab_lookup() found 'env', which was never interned\n");
+		return 4;
+	}
+	if (strcmp(qname_symtab_string(t, id), "host") != 0) {
+		fprintf(stderr, "oops.  qname_symtab_string() yielded '%s' (not 'host')\n", qname_symtab_string(t, id));
+		return 5;
+	}
+
+	/* enough symbols to force a few rehashes */
+	for (i = 0; i < 10000; i++) {
+		snprintf(buf, sizeof(buf), "value%d", i);
+		id2 = qname_symtab_intern(t, buf, strlen(buf));
+		if (qname_symtab_lookup(t, buf, strlen(buf)) != id2 || strcmp(qname_symtab_string(t, id2), buf) != 0) {
+			fprintf(stderr, "oops.  symbol '%s' didn't survive interning\n", buf);
+			return 6;
+		}
+	}
+	if (qname_symtab_size(t) != 10001 || qname_symtab_lookup(t, "host", 4) != id) {
+		fprintf(stderr, "oops.  symbol table holds %lu symbols (not 10001) after growth\n", qname_symtab_size(t));
+		return 7;
+	}
+
+	q = qname_parse("cpu zone=*,env=prod,host=a,flag,*");
+	s = qname_sym_new(t, q);
+	if (!s || s->n != 4 || !s->wild) {
+		fprintf(stderr, "oops.  qname_sym_new() failed to symbolize 'cpu zone=*,env=prod,host=a,flag,*'\n");
+		return 8;
+	}
+	for (i = 1; i < s->n; i++) {
+		if (s->pairs[i-1].key >= s->pairs[i].key) {
+			fprintf(stderr, "oops.  qname_sym_new() didn't order pairs by key id\n");
+			return 9;
+		}
+	}
+	qname_sym_string_into(t, s, buf, sizeof(buf));
+	if (strcmp(buf, "cpu env=prod,flag,host=a,zone=*,*") != 0) {
+		fprintf(stderr, "oops.  qname_sym_string_into() yielded '%s'\n", buf);
+		return 10;
+	}
+	/* QNAME_SYM_NONE is not a metric or key, only a missing value */
+	id = s->metric;
+	s->metric = QNAME_SYM_NONE;
+	if (qname_sym_string_into(t, s, buf, sizeof(buf)) != 0 || buf[0] != '\0') {
+		fprintf(stderr, "oops.  qname_sym_string_into() rendered a NONE metric\n");
+		return 12;
+	}
+	s->metric = id;
+	id = s->pairs[0].key;
+	s->pairs[0].key = QNAME_SYM_NONE;
+	if (qname_sym_string_into(t, s, buf, sizeof(buf)) != 0 || buf[0] != '\0') {
+		fprintf(stderr, "oops.  qname_sym_string_into() rendered a NONE key\n");
+		return 13;
+	}
+	s->pairs[0].key = id;
+
+	s2 = qname_sym_new(t, q);
+	if (!qname_sym_equal(s, s2)) {
+		fprintf(stderr, "oops.  symbolizing the same qname twice yielded different results\n");
+		return 11;
+	}
+
+	free(s);
+	free(s2);
+	qname_free(q);
+	qname_symtab_free(t);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct qname_symtab *t;
+	struct qname *a, *b;
+	struct qname_sym *sa, *sb;
+	int rc;
+
+	if (argc == 1) return base();
+	if (argc != 5) {
+		fprintf(stderr, "incorrect usage.  try %s match a=b '~' c=d\n", argv[0]);
+		return 2;
+	}
+
+	t = qname_symtab_new();
+	a = strcmp(argv[2], "<nil>") == 0 ? NULL : qname_parse(argv[2]);
+	b = strcmp(argv[4], "<nil>") == 0 ? NULL : qname_parse(argv[4]);
+	sa = a ? qname_sym_new(t, a) : NULL;
+	sb = b ? qname_sym_new(t, b) : NULL;
+	if (strcmp(argv[1], "equiv") == 0) rc = qname_sym_equal(sa, sb);
+	else                               rc = qname_sym_match(sa, sb);
+	free(sa);
+	free(sb);
+	qname_free(a);
+	qname_free(b);
+	qname_symtab_free(t);
+
+	switch (argv[3][0]) {
+	case '~': return (rc ? 0 : 1);
+	case '!': return (rc ? 1 : 0);
+	}
+	fprintf(stderr, "incorrect usage.  comparison must be '~' or '!' (not '%c')\n", argv[3][0]);
+	return 2;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <tsdp.h>
+
+#define N 20000
+
+static const char *METRICS[] = { "cpu.user", "cpu.system", "mem.free", "disk.io" };
+
+static char *strings[N];
+static struct qname *names[N];
+
+static int
+s_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+struct walk {
+	const char *prefix;
+	size_t n;
+	char last[QNAME_MAX_LEN + 1];
+	int bad;
+};
+
+static int
+s_walk(const char *name, size_t len, void *udata)
+{
+	struct walk *w = (struct walk *)udata;
+
+	if (strncmp(name, w->prefix, strlen(w->prefix)) != 0 || strlen(name) != len
+	 || (w->n > 0 && strcmp(w->last, name) >= 0))
+		w->bad = 1;
+	strcpy(w->last, name);
+	w->n++;
+	return 0;
+}
+
+static int
+s_stop(const char *name, size_t len, void *udata)
+{
+	return 1;
+}
+
+static int
+check(struct tsdp_qset *s, size_t n)
+{
+	char buf[QNAME_MAX_LEN + 1];
+	struct qname *q;
+	struct walk w;
+	size_t i, j, want;
+
+	if (tsdp_qset_count(s) != n) {
+		fprintf(stderr, "oops.  set holds %lu names (not %lu)\n", tsdp_qset_count(s), n);
+		return 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		q = qname_parse(strings[i]);
+		if (tsdp_qset_find(s, q) != (int64_t)i) {
+			fprintf(stderr, "oops.  '%s' found at %ld (not %lu)\n", strings[i], (long)tsdp_qset_find(s, q), i);
+			return 2;
+		}
+		qname_free(q);
+
+		if (tsdp_qset_get(s, i, buf, sizeof(buf)) != strlen(strings[i]) || strcmp(buf, strings[i]) != 0) {
+			fprintf(stderr, "oops.  name #%lu is '%s' (not '%s')\n", i, buf, strings[i]);
+			return 3;
+		}
+	}
+	if (tsdp_qset_get(s, n, buf, sizeof(buf)) != 0 || errno != ENOENT) return 4;
+	if (n > 0 && tsdp_qset_get(s, 0, buf, 4) != strlen(strings[0])) return 5;
+	if (n > 0 && (strlen(buf) != 3 || strncmp(buf, strings[0], 3) != 0)) return 6;
+
+	/* things that aren't there */
+	q = qname_parse("cpu.user host=nonesuch");
+	if (tsdp_qset_find(s, q) != -1 || errno != ENOENT) return 7;
+	qname_free(q);
+	q = qname_parse("aaa a=b");
+	if (tsdp_qset_find(s, q) != -1) return 8;
+	qname_free(q);
+	q = qname_parse("zzz a=b");
+	if (tsdp_qset_find(s, q) != -1) return 9;
+	qname_free(q);
+
+	for (i = 0; i < 4; i++) {
+		memset(&w, 0, sizeof(w));
+		w.prefix = METRICS[i];
+		if (tsdp_qset_metric(s, METRICS[i], s_walk, &w) != (int64_t)w.n || w.bad) return 10;
+
+		for (j = want = 0; j < n; j++)
+			if (strncmp(strings[j], METRICS[i], strlen(METRICS[i])) == 0
+			 && strings[j][strlen(METRICS[i])] == ' ')
+				want++;
+		if (w.n != want) {
+			fprintf(stderr, "oops.  found %lu '%s' names (not %lu)\n", w.n, METRICS[i], want);
+			return 11;
+		}
+	}
+
+	/* "cpu" is not a metric, but it is a prefix */
+	memset(&w, 0, sizeof(w));
+	w.prefix = "cpu";
+	if (tsdp_qset_metric(s, "cpu", s_walk, &w) != 0) return 12;
+	if (tsdp_qset_prefix(s, "cpu", s_walk, &w) != (int64_t)w.n || w.bad) return 13;
+	for (j = want = 0; j < n; j++)
+		if (strncmp(strings[j], "cpu", 3) == 0) want++;
+	if (w.n != want) return 14;
+
+	if (n > 0 && tsdp_qset_prefix(s, "", s_stop, NULL) != 1) return 15;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_qset *s, *m;
+	char buf[256], path[] = "/tmp/qset.XXXXXX";
+	size_t i, n, total;
+	int fd, rc;
+	FILE *f;
+
+	for (i = 0; i < N; i++) {
+		snprintf(buf, sizeof(buf), "%s host=web%05lu.example.com,env=%s,dc=dc%lu",
+			METRICS[i % 4], (i * 7919) % (N / 2), i % 3 ? "prod" : "staging", i % 5);
+		names[i] = qname_parse(buf);
+		if (!names[i]) return 1;
+	}
+
+	s = tsdp_qset_build(names, N);
+	if (!s) return 2;
+
+	/* our expectations: canonical forms, sorted and deduplicated */
+	for (i = total = 0; i < N; i++)
+		strings[i] = qname_string(names[i]);
+	qsort(strings, N, sizeof(char *), s_cmp);
+	for (i = n = 0; i < N; i++)
+		if (n == 0 || strcmp(strings[i], strings[n-1]) != 0)
+			strings[n++] = strings[i];
+		else
+			free(strings[i]);
+	for (i = 0; i < n; i++)
+		total += strlen(strings[i]);
+
+	if ((rc = check(s, n)) != 0) return 10 + rc;
+	if (tsdp_qset_size(s) * 2 > total) {
+		fprintf(stderr, "oops.  front-coded set takes %lu octets, for %lu octets of names\n",
+			tsdp_qset_size(s), total);
+		return 3;
+	}
+
+	/* round-trip through the on-disk form */
+	fd = mkstemp(path);
+	if (fd < 0 || tsdp_qset_write(s, fd) != 0) return 4;
+	close(fd);
+	m = tsdp_qset_open(path);
+	if (!m) return 5;
+	if ((rc = check(m, n)) != 0) return 30 + rc;
+	tsdp_qset_free(m);
+
+	/* garbage is rejected */
+	f = fopen(path, "r+");
+	if (!f || fwrite("TSDPQSEX", 1, 8, f) != 8) return 6;
+	fclose(f);
+	if (tsdp_qset_open(path) != NULL || errno != EINVAL) return 7;
+	truncate(path, 20);
+	if (tsdp_qset_open(path) != NULL || errno != EINVAL) return 8;
+	unlink(path);
+	if (tsdp_qset_open(path) != NULL || errno != ENOENT) return 9;
+
+	tsdp_qset_free(s);
+	for (i = 0; i < n; i++)
+		free(strings[i]);
+	for (i = 0; i < N; i++)
+		qname_free(names[i]);
+
+	/* the empty set */
+	s = tsdp_qset_build(NULL, 0);
+	if (!s || (rc = check(s, 0)) != 0) return 50 + rc;
+	tsdp_qset_free(s);
+	tsdp_qset_free(NULL);
+	return 0;
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <tsdp.h>
+
+#define NVALUES 10000
+
+static int
+close_to(double got, double want, double tolerance)
+{
+	return fabs(got - want) <= tolerance * (fabs(want) > 1 ? fabs(want) : 1);
+}
+
+static void
+keep(struct tsdp_msg *m, void *udata)
+{
+	struct tsdp_msg **copy = (struct tsdp_msg **)udata;
+	struct tsdp_frame *f;
+
+	if (*copy) return;
+	*copy = tsdp_msg_new(TSDP_PROTOCOL_V1, tsdp_msg_opcode(m), m->flags, tsdp_msg_payload(m));
+	if (!*copy) return;
+	for (f = m->frames; f; f = f->next)
+		tsdp_msg_extend(*copy, f->type,
+			f->type == TSDP_FRAME_STRING ? (void *)f->data : (void *)&f->payload, f->length);
+}
+
+static void
+count(struct tsdp_msg *m, void *udata)
+{
+	(*(int *)udata)++;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_sample *s;
+	struct tsdp_sample_stats st;
+	struct tsdp_msg *m, *out;
+	struct tsdp_frame *f;
+	double v[NVALUES], sum, mean, var, lo, hi, nan, x;
+	uint64_t ts = 1495394786;
+	int i, j, n;
+
+	if (tsdp_sample_new(0) != NULL) return 1;
+	s = tsdp_sample_new(60);
+	if (!s) return 2;
+
+	/* a large offset, and a tiny spread; the textbook
+	   E[x^2] - E[x]^2 formula is hopeless here */
+	srand(42);
+	for (i = 0; i < NVALUES; i++)
+		v[i] = 1e9 + (double)rand() / RAND_MAX;
+
+	sum = 0; lo = hi = v[0];
+	for (i = 0; i < NVALUES; i++) {
+		sum += v[i];
+		if (v[i] < lo) lo = v[i];
+		if (v[i] > hi) hi = v[i];
+	}
+	mean = sum / NVALUES;
+	for (var = 0, i = 0; i < NVALUES; i++)
+		var += (v[i] - mean) * (v[i] - mean);
+	var /= NVALUES - 1;
+
+	/* in uneven bulk runs, one at a time, and interleaved */
+	for (i = 0, j = 1; i < NVALUES; i += j, j = j * 3 % 97 + 1)
+		if (tsdp_sample_add(s, "bulk", 4, v + i, i + j > NVALUES ? NVALUES - i : j) != 0) return 3;
+	for (i = 0; i < NVALUES; i++)
+		if (tsdp_sample_add(s, "single", 6, v + i, 1) != 0) return 4;
+
+	for (i = 0; i < 2; i++) {
+		if (tsdp_sample_get(s, i ? "single" : "bulk", i ? 6 : 4, &st) != 0) return 5;
+		if (st.count != NVALUES || st.min != lo || st.max != hi) return 6;
+		if (!close_to(st.sum, sum, 1e-12) || !close_to(st.mean, mean, 1e-12)) return 7;
+		if (!close_to(st.variance, var, 1e-6)) {
+			fprintf(stderr, "oops.  %s variance is %g (not %g)\n", i ? "single" : "bulk", st.variance, var);
+			return 8;
+		}
+	}
+
+	/* NaNs are skipped */
+	nan = NAN;
+	x = 2.0;
+	if (tsdp_sample_add(s, "nan", 3, &nan, 1) != 0) return 9;
+	if (tsdp_sample_get(s, "nan", 3, &st) != 0 || st.count != 0) return 10;
+	v[0] = 1.0; v[1] = NAN; v[2] = 3.0; v[3] = NAN; v[4] = NAN; v[5] = 5.0; v[6] = 7.0;
+	if (tsdp_sample_add(s, "nan", 3, v, 7) != 0) return 11;
+	if (tsdp_sample_get(s, "nan", 3, &st) != 0) return 12;
+	if (st.count != 4 || st.sum != 16.0 || st.mean != 4.0 || st.min != 1.0 || st.max != 7.0) return 13;
+	if (!close_to(st.variance, 20.0 / 3, 1e-12)) return 14;
+	if (tsdp_sample_get(s, "none", 4, &st) != -1) return 15;
+
+	n = 0;
+	if (tsdp_sample_flush(s, ts, count, &n) != 3 || n != 3) return 16;
+	tsdp_sample_free(s);
+
+	/* SUBMIT SAMPLE in, BROADCAST SAMPLE out */
+	s = tsdp_sample_new(60);
+	if (!s) return 17;
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_SAMPLE);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "cpu b=2,a=1", 12) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0) return 18;
+	for (i = 1; i <= 200; i++) {
+		x = i;
+		if (tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &x, 8) != 0) return 19;
+	}
+	if (tsdp_sample_submit(s, m) != 0) return 20;
+	m->payload = TSDP_PAYLOAD_TALLY;
+	if (tsdp_sample_submit(s, m) != -1) return 21;
+	tsdp_msg_free(m);
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_SAMPLE);
+	x = 0.0;
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "cpu a=1,b=2", 12) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &x, 8) != 0) return 22;
+	if (tsdp_sample_submit(s, m) != 0) return 23;
+	tsdp_msg_free(m);
+
+	out = NULL;
+	if (tsdp_sample_flush(s, ts, keep, &out) != 1 || !out) return 24;
+	if (tsdp_msg_opcode(out) != TSDP_OPCODE_BROADCAST || tsdp_msg_payload(out) != TSDP_PAYLOAD_SAMPLE) return 25;
+	if (tsdp_msg_nframes(out) != 9) return 26;
+	f = out->frames;
+	if (f->type != TSDP_FRAME_STRING || strcmp(f->payload.string, "cpu a=1,b=2") != 0) return 27;
+	f = f->next;
+	if (f->type != TSDP_FRAME_TSTAMP || f->payload.tstamp != ts) return 28;
+	f = f->next;
+	if (f->type != TSDP_FRAME_UINT || f->length != 4 || f->payload.uint32 != 60) return 29;
+	{
+		/* min, max, sum, count, mean, variance of 0 .. 200 */
+		double want[6] = { 0, 200, 20100, 201, 100, 3383.5 };
+		for (i = 0, f = f->next; i < 6; i++, f = f->next) {
+			if (!f || f->type != TSDP_FRAME_FLOAT || !close_to(f->payload.float64, want[i], 1e-12)) {
+				fprintf(stderr, "oops.  measurement #%d is %g (not %g)\n", i, f ? f->payload.float64 : 0, want[i]);
+				return 30;
+			}
+		}
+	}
+	tsdp_msg_free(out);
+
+	/* the next window starts from scratch */
+	n = 0;
+	if (tsdp_sample_flush(s, ts + 60, count, &n) != 0 || n != 0) return 31;
+	if (tsdp_sample_get(s, "cpu a=1,b=2", 11, &st) != 0 || st.count != 0) return 32;
+	x = 42.0;
+	if (tsdp_sample_add(s, "cpu a=1,b=2", 11, &x, 1) != 0) return 33;
+	if (tsdp_sample_get(s, "cpu a=1,b=2", 11, &st) != 0) return 34;
+	if (st.count != 1 || st.min != 42.0 || st.max != 42.0 || st.mean != 42.0 || st.variance != 0.0) return 35;
+	tsdp_sample_free(s);
+
+	/* quantiles, on request */
+	s = tsdp_sample_new(60);
+	if (!s) return 36;
+	{
+		double qs[TSDP_SAMPLE_MAX_QUANTILES + 1] = { 0.5, 0.99, 1.5 };
+		if (tsdp_sample_quantiles(s, qs, TSDP_SAMPLE_MAX_QUANTILES + 1) != -1) return 37;
+		if (tsdp_sample_quantiles(s, qs, 3) != -1) return 38;
+		if (tsdp_sample_quantiles(s, qs, 2) != 0) return 39;
+	}
+	for (i = 1; i <= 1000; i++) {
+		x = i;
+		if (tsdp_sample_add(s, "latency", 7, &x, 1) != 0) return 40;
+	}
+	for (i = 0; i < NVALUES; i++)
+		v[i] = 1000 + i % 1000 + 1;
+	if (tsdp_sample_add(s, "latency", 7, v, NVALUES) != 0) return 41;
+	if (tsdp_sketch_count(tsdp_sample_sketch(s, "latency", 7)) != NVALUES + 1000) return 42;
+	if (tsdp_sample_sketch(s, "nope", 4) != NULL) return 43;
+
+	out = NULL;
+	if (tsdp_sample_flush(s, ts, keep, &out) != 1 || !out) return 44;
+	if (tsdp_msg_nframes(out) != 11) return 45;
+	for (i = 0, f = out->frames; i < 9; i++, f = f->next)
+		;
+	if (!close_to(f->payload.float64, 1450, 0.02) || !close_to(f->next->payload.float64, 1989, 0.02)) {
+		fprintf(stderr, "oops.  p50 is %g, p99 is %g\n", f->payload.float64, f->next->payload.float64);
+		return 46;
+	}
+	tsdp_msg_free(out);
+	if (tsdp_sketch_count(tsdp_sample_sketch(s, "latency", 7)) != 0) return 47;
+	tsdp_sample_free(s);
+
+	tsdp_sample_free(NULL);
+	return 0;
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <tsdp.h>
+
+#define NSERIES 200
+#define NPOINTS 5000
+
+/* compares a series, over [from, until], between the store and
+   the segment; returns how many points they agree on, or -1 */
+static long
+same(struct tsdp_store *s, struct tsdp_segment *seg, const char *name, uint64_t from, uint64_t until)
+{
+	struct tsdp_store_iter *a, *b;
+	uint64_t ta, tb;
+	double va, vb;
+	long n;
+	int ra, rb;
+
+	a = tsdp_store_iter(s, name, strlen(name), from, until);
+	b = tsdp_segment_iter(seg, name, strlen(name), from, until);
+	if (!a || !b) {
+		fprintf(stderr, "oops.  no iterator for '%s'\n", name);
+		tsdp_store_iter_free(a);
+		tsdp_store_iter_free(b);
+		return -1;
+	}
+	for (n = 0; ; n++) {
+		ra = tsdp_store_next(a, &ta, &va);
+		rb = tsdp_store_next(b, &tb, &vb);
+		if (ra != rb || (ra && (ta != tb || memcmp(&va, &vb, sizeof(va)) != 0))) {
+			fprintf(stderr, "oops.  '%s' point %ld differs\n", name, n);
+			n = -1;
+			break;
+		}
+		if (!ra) break;
+	}
+	tsdp_store_iter_free(a);
+	tsdp_store_iter_free(b);
+	return n;
+}
+
+static int
+spew(const char *path, const void *buf, size_t len)
+{
+	int fd, rc;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) return -1;
+	rc = write(fd, buf, len) == (ssize_t)len ? 0 : -1;
+	close(fd);
+	return rc;
+}
+
+/* reads every point of every series in the segment at
+   `path`, returning how many there were, or -1 */
+static long
+drain(const char *path)
+{
+	struct tsdp_segment *seg;
+	struct tsdp_store_iter *it;
+	struct tsdp_bucket b;
+	const char *name;
+	long n;
+	size_t i;
+
+	seg = tsdp_segment_open(path);
+	if (!seg) return -1;
+	for (n = 0, i = 0; (name = tsdp_segment_series(seg, i)) != NULL; i++) {
+		it = tsdp_segment_iter(seg, name, strlen(name), 0, UINT64_MAX);
+		if (!it) continue;
+		while (tsdp_store_bucket(it, &b))
+			n++;
+		tsdp_store_iter_free(it);
+	}
+	tsdp_segment_free(seg);
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_store *s;
+	struct tsdp_segment *seg;
+	char path[64], bad[64], name[64], *buf;
+	const char *prev, *cur;
+	uint64_t t, lo, hi, when = 1495394786000, latest = 0;
+	long n, size, all;
+	int fd, i, k;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/tmp/tsdp-segment.%d", (int)getpid());
+	snprintf(bad,  sizeof(bad),  "/tmp/tsdp-segment.%d.bad", (int)getpid());
+
+	srand(42);
+	s = tsdp_store_new();
+	if (!s) return 1;
+	for (k = 0; k < NSERIES; k++) {
+		snprintf(name, sizeof(name), "cpu host=h%d", (k * 7919) % NSERIES);
+		for (t = when, i = 0; i < NPOINTS / (1 + k % 5); i++) {
+			t += rand() % 10 ? 10000 : (uint64_t)rand();
+			if (tsdp_store_append(s, name, strlen(name), t, rand() % 3 ? 40 + rand() % 20 : (double)rand() / rand()) != 0) return 2;
+		}
+		if (t > latest) latest = t;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) return 3;
+	if (tsdp_segment_write(s, fd) != 0) return 4;
+	close(fd);
+	if (tsdp_segment_write(s, -1) != -1 || errno != EINVAL) return 5;
+
+	seg = tsdp_segment_open(path);
+	if (!seg) return 6;
+	if (tsdp_segment_count(seg) != NSERIES || tsdp_segment_points(seg) != tsdp_store_points(s)) return 7;
+	if (tsdp_segment_span(seg, &lo, &hi) != 0 || lo <= when || lo > when + 10000 || hi != latest) return 31;
+
+	/* series come out sorted, and agree with the store, point for point */
+	for (prev = NULL, i = 0; i < NSERIES; i++, prev = cur) {
+		cur = tsdp_segment_series(seg, i);
+		if (!cur || (prev && strcmp(prev, cur) >= 0)) return 8;
+		if (same(s, seg, cur, 0, UINT64_MAX) <= 0) return 9;
+		if (same(s, seg, cur, when + rand() % 1000000, when + 1000000 + rand() % 10000000) < 0) return 10;
+		if (same(s, seg, cur, UINT64_MAX, UINT64_MAX) != 0) return 11;
+		if (same(s, seg, cur, hi + 1, UINT64_MAX) != 0) return 32;
+		if (same(s, seg, cur, 0, lo - 1) != 0) return 33;
+		if (same(s, seg, cur, hi, lo) != 0) return 34;
+		for (k = 0; k < 10; k++) {
+			t = lo + (uint64_t)rand() * 1000 % (hi - lo);
+			if (same(s, seg, cur, t, t + rand() % 100000) < 0) return 35;
+		}
+		if (!tsdp_segment_has(seg, cur, strlen(cur))) return 36;
+	}
+
+	/* the bloom filter rules out (almost) all absent series */
+	for (n = 0, i = 0; i < 10000; i++) {
+		snprintf(name, sizeof(name), "cpu host=x%d", i);
+		n += tsdp_segment_has(seg, name, strlen(name));
+	}
+	if (n > 300) {
+		fprintf(stderr, "oops.  %ld of 10000 absent series got past the bloom filter\n", n);
+		return 37;
+	}
+	if (tsdp_segment_series(seg, NSERIES) != NULL) return 12;
+	if (tsdp_segment_iter(seg, "cpu host=zz", 11, 0, UINT64_MAX) != NULL || errno != ENOENT) return 13;
+	if (tsdp_segment_iter(seg, "cpu host=h1", 10, 0, UINT64_MAX) != NULL || errno != ENOENT) return 14;
+	tsdp_segment_free(seg);
+
+	/* an empty store makes for an empty (but valid) segment */
+	tsdp_store_free(s);
+	s = tsdp_store_new();
+	if (!s) return 15;
+	fd = open(bad, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || tsdp_segment_write(s, fd) != 0) return 16;
+	close(fd);
+	seg = tsdp_segment_open(bad);
+	if (!seg || tsdp_segment_count(seg) != 0 || tsdp_segment_points(seg) != 0) return 17;
+	if (tsdp_segment_span(seg, &lo, &hi) != -1 || errno != ENOENT) return 38;
+	if (tsdp_segment_has(seg, "cpu host=h1", 11)) return 39;
+	tsdp_segment_free(seg);
+	tsdp_store_free(s);
+
+	/* truncated and mangled segments are refused */
+	f = fopen(path, "r");
+	if (!f || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 64) return 18;
+	buf = malloc(size);
+	rewind(f);
+	if (!buf || fread(buf, 1, size, f) != (size_t)size) return 19;
+	fclose(f);
+
+	for (n = 0; n < 64; n += 7) {
+		if (spew(bad, buf, n) != 0) return 20;
+		if (tsdp_segment_open(bad) != NULL || errno != EINVAL) return 21;
+	}
+	if (spew(bad, buf, size / 2) != 0) return 22;
+	if (tsdp_segment_open(bad) != NULL || errno != EINVAL) return 23;
+
+	buf[0] ^= 0xff;
+	if (spew(bad, buf, size) != 0) return 24;
+	if (tsdp_segment_open(bad) != NULL || errno != EINVAL) return 25;
+	buf[0] ^= 0xff;
+	buf[11] ^= 0x01;
+	if (spew(bad, buf, size) != 0) return 26;
+	if (tsdp_segment_open(bad) != NULL || errno != EINVAL) return 27;
+	buf[11] ^= 0x01;
+	buf[47] ^= 0x10;
+	if (spew(bad, buf, size) != 0) return 28;
+	if (tsdp_segment_open(bad) != NULL || errno != EINVAL) return 29;
+	buf[47] ^= 0x10;
+	buf[83] ^= 0x01;
+	if (spew(bad, buf, size) != 0) return 40;
+	if (tsdp_segment_open(bad) != NULL || errno != EINVAL) return 41;
+	buf[83] ^= 0x01;
+
+	/* block index entries are only checked as they are read;
+	   blocks whose bit counts are out of bounds (or too small
+	   for even a single point) are cut short, not overrun */
+	all = drain(path);
+	if (all <= 0) return 42;
+	t = 0;
+	for (i = 40; i < 48; i++)
+		t = t << 8 | (unsigned char)buf[i];
+	for (k = 0; k < 3; k++) {
+		unsigned char *e = (unsigned char *)buf + t + 28, orig[4];
+		uint32_t bits = k == 0 ? 0xffffffff : k == 1 ? 0xfffffff9 : 64;
+
+		memcpy(orig, e, 4);
+		e[0] = bits >> 24; e[1] = bits >> 16; e[2] = bits >> 8; e[3] = bits;
+		if (spew(bad, buf, size) != 0) return 43;
+		n = drain(bad);
+		if (n < 0 || n >= all) return 44;
+		memcpy(e, orig, 4);
+	}
+	if (spew(bad, buf, size) != 0 || drain(bad) != all) return 45;
+	free(buf);
+
+	if (tsdp_segment_open("/tmp/nonexistent/segment") != NULL || errno != ENOENT) return 30;
+
+	unlink(path);
+	unlink(bad);
+	tsdp_segment_free(NULL);
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <tsdp.h>
+
+#define NVALUES 100000
+
+static double v[NVALUES], sorted[NVALUES];
+
+static int
+cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* is every estimate within `alpha` of the true quantile? */
+static int
+accurate(struct tsdp_sketch *s, const double *vs, size_t n, double alpha, double from)
+{
+	static const double qs[] = { 0.0, 0.01, 0.05, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 0.99, 0.999, 1.0 };
+	double want, got;
+	size_t i;
+
+	memcpy(sorted, vs, n * sizeof(double));
+	qsort(sorted, n, sizeof(double), cmp);
+	for (i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+		if (qs[i] < from) continue;
+		want = sorted[(size_t)(qs[i] * (n - 1))];
+		got  = tsdp_sketch_quantile(s, qs[i]);
+		if (fabs(got - want) > alpha * fabs(want) + 1e-9) {
+			fprintf(stderr, "oops.  q%g is %g (not %g)\n", qs[i], got, want);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_sketch *s, *a, *b, *c;
+	unsigned char buf[8192];
+	ssize_t n;
+	int i;
+
+	if (tsdp_sketch_new(1.5, 0) != NULL) return 1;
+	if (tsdp_sketch_new(0, TSDP_SKETCH_MAX_BINS + 1) != NULL) return 2;
+
+	s = tsdp_sketch_new(0, 0);
+	if (!s) return 3;
+	if (tsdp_sketch_quantile(s, 0.5) == tsdp_sketch_quantile(s, 0.5)) return 4; /* NaN */
+	if (tsdp_sketch_add(s, INFINITY) != -1 || tsdp_sketch_add(s, NAN) != -1) return 5;
+	if (tsdp_sketch_count(s) != 0) return 6;
+
+	/* latencies, spread over four orders of magnitude */
+	srand(42);
+	for (i = 0; i < NVALUES; i++) {
+		v[i] = pow(10, 4.0 * rand() / RAND_MAX);
+		if (tsdp_sketch_add(s, v[i]) != 0) return 7;
+	}
+	if (tsdp_sketch_count(s) != NVALUES) return 8;
+	if (!accurate(s, v, NVALUES, 0.02, 0)) return 9;
+	if (tsdp_sketch_quantile(s, 1.5) == tsdp_sketch_quantile(s, 1.5)) return 10;
+
+	/* packed, it fits in a single frame, and comes back intact */
+	n = tsdp_sketch_pack(buf, sizeof(buf), s);
+	if (n <= 0 || n > 4095) {
+		fprintf(stderr, "oops.  packed sketch is %zd octets\n", n);
+		return 11;
+	}
+	if (tsdp_sketch_pack(buf, 10, s) != n) return 12;
+	if (tsdp_sketch_pack(buf, sizeof(buf), s) != n) return 13;
+	if (tsdp_sketch_unpack(buf, n - 1) != NULL) return 14;
+	buf[0] = 0xff;
+	if (tsdp_sketch_unpack(buf, n) != NULL) return 15;
+	buf[0] = 1;
+	a = tsdp_sketch_unpack(buf, n);
+	if (!a || tsdp_sketch_count(a) != NVALUES) return 16;
+	for (i = 0; i <= 100; i++)
+		if (tsdp_sketch_quantile(a, i / 100.0) != tsdp_sketch_quantile(s, i / 100.0)) return 17;
+	tsdp_sketch_free(a);
+
+	/* split across shards, and merged back together */
+	a = tsdp_sketch_new(0, 0);
+	b = tsdp_sketch_new(0, 0);
+	if (!a || !b) return 18;
+	for (i = 0; i < NVALUES; i++)
+		if (tsdp_sketch_add(i % 3 ? a : b, v[i]) != 0) return 19;
+	if (tsdp_sketch_merge(a, b) != 0 || tsdp_sketch_count(a) != NVALUES) return 20;
+	for (i = 0; i <= 100; i++)
+		if (tsdp_sketch_quantile(a, i / 100.0) != tsdp_sketch_quantile(s, i / 100.0)) return 21;
+	c = tsdp_sketch_new(0.05, 0);
+	if (!c || tsdp_sketch_merge(a, c) != -1) return 22;
+	tsdp_sketch_free(a);
+	tsdp_sketch_free(b);
+	tsdp_sketch_free(c);
+
+	/* negatives, and zeros */
+	tsdp_sketch_clear(s);
+	if (tsdp_sketch_count(s) != 0) return 23;
+	for (i = 0; i < NVALUES; i++) {
+		v[i] = (double)(rand() % 201 - 100);
+		if (tsdp_sketch_add(s, v[i]) != 0) return 24;
+	}
+	if (!accurate(s, v, NVALUES, 0.02, 0)) return 25;
+	if (tsdp_sketch_quantile(s, 0.0) != -100.0 || tsdp_sketch_quantile(s, 1.0) != 100.0) return 26;
+	tsdp_sketch_free(s);
+
+	/* memory stays bounded, no matter the spread; only the
+	   lowest quantiles suffer for it */
+	s = tsdp_sketch_new(0.01, 64);
+	if (!s) return 27;
+	for (i = 0; i < NVALUES; i++) {
+		v[i] = pow(10, 12.0 * rand() / RAND_MAX - 6);
+		if (tsdp_sketch_add(s, v[i]) != 0) return 28;
+	}
+	n = tsdp_sketch_pack(buf, sizeof(buf), s);
+	if (n <= 0 || n > 64 * 3 + 64) return 29;
+	if (!accurate(s, v, NVALUES, 0.01, 0.99)) return 30;
+	if (tsdp_sketch_quantile(s, 0.0) != sorted[0]) return 31;
+	tsdp_sketch_free(s);
+
+	tsdp_sketch_free(NULL);
+	return 0;
+}
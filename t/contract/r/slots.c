@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "slots.h"
+
+struct s_slot {
+	uint64_t hash;
+	uint32_t name;
+	uint32_t value;
+};
+
+/* looks `name` up, by the hash `h` we pretend it has */
+static struct s_slot *
+s_find(struct slots *t, uint64_t h, const char *name)
+{
+	return (struct s_slot *)slots_find(t, h, name, strlen(name));
+}
+
+static struct s_slot *
+s_insert(struct slots *t, uint64_t h, const char *name, uint32_t value)
+{
+	struct s_slot *slot;
+
+	slot = (struct s_slot *)slots_insert(t, h, name, strlen(name));
+	if (slot) slot->value = value;
+	return slot;
+}
+
+int main(int argc, char **argv)
+{
+	struct slots t;
+	struct s_slot *slot;
+	char name[32];
+	uint32_t i;
+
+	if (slots_init(&t, sizeof(struct s_slot), offsetof(struct s_slot, name), 16, 0) != 0) return 1;
+
+	/* names that share a hash still get slots of their own */
+	if (!s_insert(&t, 42, "cpu host=a", 1)) return 2;
+	if (s_find(&t, 42, "cpu host=b")->hash) return 3;
+	if (!s_insert(&t, 42, "cpu host=b", 2)) return 4;
+	if (!s_insert(&t, 42, "cpu host", 3)) return 5;
+	if (t.n != 3) return 6;
+
+	if (s_find(&t, 42, "cpu host=a")->value != 1) return 7;
+	if (s_find(&t, 42, "cpu host=b")->value != 2) return 8;
+	if (s_find(&t, 42, "cpu host")->value != 3) return 9;
+	if (s_find(&t, 42, "cpu host=")->hash) return 10; /* prefix of one, extension of another */
+	if (s_find(&t, 43, "cpu host=a")->hash) return 11;
+
+	/* deleting one leaves the others reachable */
+	slots_delete(&t, s_find(&t, 42, "cpu host=a"));
+	if (s_find(&t, 42, "cpu host=a")->hash) return 12;
+	if (s_find(&t, 42, "cpu host=b")->value != 2) return 13;
+	if (s_find(&t, 42, "cpu host")->value != 3) return 14;
+
+	/* ... and so does growing the table, around them */
+	for (i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "mem host=h%u", i);
+		if (!s_insert(&t, 1 + i % 7, name, 100 + i)) return 15;
+	}
+	for (i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "mem host=h%u", i);
+		slot = s_find(&t, 1 + i % 7, name);
+		if (!slot->hash || slot->value != 100 + i || strcmp(slots_name(&t, slot), name) != 0) {
+			fprintf(stderr, "oops.  lost '%s' among its colliding neighbours\n", name);
+			return 16;
+		}
+	}
+	if (s_find(&t, 42, "cpu host=b")->value != 2) return 17;
+	if (s_find(&t, 42, "cpu host")->value != 3) return 18;
+
+	slots_free(&t);
+	return 0;
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+#define NSERIES 50000
+
+struct seen {
+	int      n;
+	int      flags;
+	int      nframes;
+	char     name[256];
+	uint32_t status;
+	uint64_t ts, prev_ts;
+	char     summary[256], previous[256];
+};
+
+static void
+record(struct tsdp_msg *m, void *udata)
+{
+	struct seen *s = (struct seen *)udata;
+	struct tsdp_frame *f;
+
+	s->n++;
+	s->flags   = m->flags;
+	s->nframes = tsdp_msg_nframes(m);
+	s->prev_ts = 0;
+	s->previous[0] = '\0';
+	if (tsdp_msg_opcode(m) != TSDP_OPCODE_BROADCAST || tsdp_msg_payload(m) != TSDP_PAYLOAD_STATE) {
+		s->nframes = -1;
+		return;
+	}
+
+	f = m->frames;
+	if (f->type != TSDP_FRAME_STRING) { s->nframes = -1; return; }
+	snprintf(s->name, sizeof(s->name), "%s", f->payload.string);
+	f = f->next;
+	if (f->type != TSDP_FRAME_UINT || f->length != 4) { s->nframes = -1; return; }
+	s->status = f->payload.uint32;
+	f = f->next;
+	if (f->type != TSDP_FRAME_TSTAMP) { s->nframes = -1; return; }
+	s->ts = f->payload.tstamp;
+	f = f->next;
+	if (f->type != TSDP_FRAME_STRING) { s->nframes = -1; return; }
+	snprintf(s->summary, sizeof(s->summary), "%s", f->payload.string);
+	if (!(f = f->next)) return;
+	if (f->type != TSDP_FRAME_TSTAMP) { s->nframes = -1; return; }
+	s->prev_ts = f->payload.tstamp;
+	f = f->next;
+	if (!f || f->type != TSDP_FRAME_STRING) { s->nframes = -1; return; }
+	snprintf(s->previous, sizeof(s->previous), "%s", f->payload.string);
+}
+
+static void
+tick(struct tsdp_msg *m, void *udata)
+{
+	int id;
+
+	if (tsdp_msg_nframes(m) == 4 && m->flags == 0
+	 && sscanf(m->frames->payload.string, "host id=%d", &id) == 1
+	 && id >= 0 && id < NSERIES
+	 && m->frames->next->payload.uint32 == (uint32_t)(id % 4))
+		((char *)udata)[id]++;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_state *s;
+	struct tsdp_msg *m;
+	struct seen seen;
+	const char *summary;
+	char name[64], *replayed;
+	uint64_t ts = 1495394786, when;
+	uint32_t status;
+	int i;
+
+	s = tsdp_state_new(0);
+	if (!s) return 1;
+
+	/* the first state is not a transition */
+	memset(&seen, 0, sizeof(seen));
+	if (tsdp_state_update(s, "disk", 4, 100, 0, "ok", 2, record, &seen) != 0) return 2;
+	if (seen.n != 1 || seen.flags != 0 || seen.nframes != 4) return 3;
+	if (strcmp(seen.name, "disk") != 0 || seen.status != 0 || seen.ts != 100 || strcmp(seen.summary, "ok") != 0) return 4;
+
+	/* neither is the same state again, even with a new summary */
+	if (tsdp_state_update(s, "disk", 4, 110, 0, "still ok", 8, record, &seen) != 0) return 5;
+	if (seen.n != 2 || seen.flags != 0 || seen.nframes != 4 || seen.ts != 110) return 6;
+	if (strcmp(seen.summary, "still ok") != 0) return 7;
+
+	/* but a new status code is */
+	if (tsdp_state_update(s, "disk", 4, 120, 2, "disk full", 9, record, &seen) != 1) return 8;
+	if (seen.n != 3 || seen.flags != 0x40 || seen.nframes != 6) return 9;
+	if (seen.status != 2 || seen.ts != 120 || strcmp(seen.summary, "disk full") != 0) return 10;
+	if (seen.prev_ts != 110 || strcmp(seen.previous, "still ok") != 0) return 11;
+
+	/* stale updates are ignored */
+	if (tsdp_state_update(s, "disk", 4, 105, 0, "ok", 2, record, &seen) != 0) return 12;
+	if (seen.n != 3) return 13;
+	if (tsdp_state_get(s, "disk", 4, &status, &when, &summary) != 0) return 14;
+	if (status != 2 || when != 120 || strcmp(summary, "disk full") != 0) return 15;
+	if (tsdp_state_get(s, "nope", 4, NULL, NULL, NULL) != -1) return 16;
+
+	/* no summary at all, and no callback */
+	if (tsdp_state_update(s, "disk", 4, 130, 0, NULL, 0, NULL, NULL) != 1) return 17;
+	if (tsdp_state_get(s, "disk", 4, NULL, NULL, &summary) != 0 || strcmp(summary, "") != 0) return 18;
+
+	/* forgotten series start over */
+	if (tsdp_state_forget(s, "disk", 4) != 0 || tsdp_state_forget(s, "disk", 4) != -1) return 19;
+	if (tsdp_state_count(s) != 0) return 20;
+	if (tsdp_state_update(s, "disk", 4, 140, 1, "warn", 4, NULL, NULL) != 0) return 21;
+	tsdp_state_free(s);
+
+	/* SUBMIT STATE in, BROADCAST STATE out */
+	s = tsdp_state_new(16);
+	if (!s) return 22;
+	for (i = 0; i < 2; i++) {
+		status = i;
+		m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_STATE);
+		if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, i ? "cpu b=2,a=1" : "cpu a=1,b=2", 12) != 0
+		       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0
+		       || tsdp_msg_extend(m, TSDP_FRAME_UINT, &status, 4) != 0) return 23;
+		if (i && tsdp_msg_extend(m, TSDP_FRAME_STRING, "load is high", 13) != 0) return 24;
+		if (tsdp_state_submit(s, m, record, &seen) != i) return 25;
+		m->payload = TSDP_PAYLOAD_EVENT;
+		if (tsdp_state_submit(s, m, record, &seen) != -1) return 26;
+		tsdp_msg_free(m);
+		ts++;
+	}
+	if (tsdp_state_count(s) != 1) return 27;
+	if (seen.flags != 0x40 || seen.nframes != 6 || strcmp(seen.name, "cpu a=1,b=2") != 0) return 28;
+	if (strcmp(seen.summary, "load is high") != 0 || strcmp(seen.previous, "") != 0) return 29;
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_STATE);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "cpu a=1,*", 10) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_UINT, &status, 4) != 0) return 30;
+	if (tsdp_state_submit(s, m, record, &seen) != -1) return 31;
+	tsdp_msg_free(m);
+	tsdp_state_free(s);
+
+	/* lots of series, replayed */
+	s = tsdp_state_new(0);
+	if (!s) return 32;
+	for (i = 0; i < NSERIES; i++) {
+		snprintf(name, sizeof(name), "host id=%d", i);
+		if (tsdp_state_update(s, name, strlen(name), ts, 0, "ok", 2, NULL, NULL) != 0) return 33;
+		if (tsdp_state_update(s, name, strlen(name), ts + 1, i % 4, i % 4 ? "not ok" : "ok", i % 4 ? 6 : 2, NULL, NULL) != (i % 4 != 0)) return 34;
+	}
+	if (tsdp_state_count(s) != NSERIES) return 35;
+
+	replayed = calloc(NSERIES, 1);
+	if (!replayed) return 36;
+	if (tsdp_state_replay(s, tick, replayed) != NSERIES) return 37;
+	for (i = 0; i < NSERIES; i++) {
+		if (replayed[i] != 1) {
+			fprintf(stderr, "oops.  id=%d was replayed %d times\n", i, replayed[i]);
+			return 38;
+		}
+	}
+	free(replayed);
+	tsdp_state_free(s);
+
+	tsdp_state_free(NULL);
+	return 0;
+}
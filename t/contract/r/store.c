@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <tsdp.h>
+
+#define NPOINTS 100000
+#define NHOURS  3
+
+static uint64_t ts[NPOINTS];
+static double   vs[NPOINTS];
+
+/* how many points in [from, until]; checks them against ts[]/vs[] */
+static long
+scan(struct tsdp_store *s, const char *name, uint64_t from, uint64_t until)
+{
+	struct tsdp_store_iter *it;
+	uint64_t t;
+	double v;
+	long n, i;
+
+	it = tsdp_store_iter(s, name, strlen(name), from, until);
+	if (!it) return -1;
+	for (i = 0; i < NPOINTS && ts[i] < from; i++)
+		;
+	for (n = 0; tsdp_store_next(it, &t, &v); n++, i++) {
+		if (i >= NPOINTS || t != ts[i] || memcmp(&v, &vs[i], sizeof(v)) != 0) {
+			fprintf(stderr, "oops.  point %ld is (%lu, %g), not (%lu, %g)\n", i,
+			        (unsigned long)t, v, (unsigned long)ts[i], vs[i]);
+			tsdp_store_iter_free(it);
+			return -1;
+		}
+	}
+	tsdp_store_iter_free(it);
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_store *s;
+	struct tsdp_store_iter *it;
+	struct tsdp_msg *m;
+	char name[64];
+	double v, odd[] = { 0.0, -0.0, INFINITY, -INFINITY, NAN, 1e-300, -1e300, 3.14159 };
+	uint64_t t, when = 1495394786000;
+	int i, j, k;
+
+	s = tsdp_store_new();
+	if (!s) return 1;
+	if (tsdp_store_iter(s, "nope", 4, 0, UINT64_MAX) != NULL || errno != ENOENT) return 2;
+
+	/* irregular timestamps (jitter, gaps, repeats), and values
+	   from the well-behaved to the pathological */
+	srand(42);
+	for (t = when, i = 0; i < NPOINTS; i++) {
+		switch (rand() % 10) {
+		case 0:  t += 0; break;
+		case 1:  t += 1 + rand() % 100000; break;
+		case 2:  t += (uint64_t)rand() * 1000; break;
+		default: t += 10000 + rand() % 50 - 25; break;
+		}
+		switch (rand() % 6) {
+		case 0:  vs[i] = odd[rand() % 8]; break;
+		case 1:  vs[i] = (double)rand() / rand(); break;
+		case 2:  vs[i] = i > 0 ? vs[i - 1] : 0; break;
+		default: vs[i] = 40 + rand() % 20; break;
+		}
+		ts[i] = t;
+		if (tsdp_store_append(s, "cpu host=a", 10, ts[i], vs[i]) != 0) return 3;
+	}
+	if (tsdp_store_append(s, "cpu host=a", 10, ts[0], 1.0) != -1 || errno != ERANGE) return 4;
+	if (tsdp_store_count(s) != 1 || tsdp_store_points(s) != NPOINTS) return 5;
+
+	if (scan(s, "cpu host=a", 0, UINT64_MAX) != NPOINTS) return 6;
+	for (k = 0; k < 20; k++) {
+		i = rand() % NPOINTS;
+		j = i + rand() % (NPOINTS - i);
+		if (scan(s, "cpu host=a", ts[i], ts[j]) < j - i + 1) return 7;
+	}
+	if (scan(s, "cpu host=a", ts[NPOINTS - 1] + 1, UINT64_MAX) != 0) return 8;
+	if (scan(s, "cpu host=a", 0, ts[0] - 1) != 0) return 9;
+
+	if (tsdp_store_forget(s, "cpu host=a", 10) != 0) return 10;
+	if (tsdp_store_forget(s, "cpu host=a", 10) != -1 || errno != ENOENT) return 11;
+	if (tsdp_store_count(s) != 0 || tsdp_store_points(s) != 0 || tsdp_store_octets(s) != 0) return 12;
+
+	/* SUBMIT SAMPLE and DELTA in */
+	for (i = 0; i < 2; i++) {
+		m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, i ? TSDP_PAYLOAD_DELTA : TSDP_PAYLOAD_SAMPLE);
+		if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "net b=2,a=1", 12) != 0
+		       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &when, 8) != 0
+		       || tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &odd[7], 8) != 0) return 13;
+		if (!i && tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &odd[6], 8) != 0) return 14;
+		if (tsdp_store_submit(s, m) != 0) return 15;
+		m->payload = TSDP_PAYLOAD_TALLY;
+		if (tsdp_store_submit(s, m) != -1) return 16;
+		tsdp_msg_free(m);
+	}
+	it = tsdp_store_iter(s, "net a=1,b=2", 11, 0, UINT64_MAX);
+	if (!it) return 17;
+	for (i = 0; tsdp_store_next(it, &t, &v); i++)
+		if (t != when || v != (i == 1 ? odd[6] : odd[7])) return 18;
+	if (i != 3) return 19;
+	tsdp_store_iter_free(it);
+	tsdp_store_free(s);
+
+	/* hours of per-second gauges and counters fit in a few
+	   octets per point */
+	s = tsdp_store_new();
+	if (!s) return 20;
+	for (k = 0; k < 50; k++) {
+		v = 0;
+		for (i = 0; i < NHOURS * 3600; i++) {
+			snprintf(name, sizeof(name), "load host=h%d", k);
+			if (tsdp_store_append(s, name, strlen(name), when + i * 1000, 40 + rand() % 20) != 0) return 21;
+			snprintf(name, sizeof(name), "packets host=h%d", k);
+			v += rand() % 10;
+			if (tsdp_store_append(s, name, strlen(name), when + i * 1000, v) != 0) return 22;
+		}
+	}
+	if (tsdp_store_points(s) != 100 * NHOURS * 3600) return 23;
+	if ((double)tsdp_store_octets(s) / tsdp_store_points(s) > 3.0) {
+		fprintf(stderr, "oops.  %lu points took %lu octets\n",
+		        (unsigned long)tsdp_store_points(s), (unsigned long)tsdp_store_octets(s));
+		return 24;
+	}
+	tsdp_store_free(s);
+
+	tsdp_store_free(NULL);
+	tsdp_store_iter_free(NULL);
+	return 0;
+}
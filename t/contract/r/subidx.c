@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <tsdp.h>
+
+#define MAX_SUBS 4096
+
+static struct qname *patterns[MAX_SUBS];
+static unsigned int  payloads[MAX_SUBS];
+static int           ids[MAX_SUBS];
+
+static int
+s_cmp(const void *a, const void *b)
+{
+	return (int)(*(const intptr_t *)a - *(const intptr_t *)b);
+}
+
+/* look `q` up in the index, and check the results against
+   a brute-force walk of every pattern with qname_match() */
+static int
+check(struct tsdp_subidx *x, int nsubs, struct qname *q, unsigned int payload, int verbose)
+{
+	void *got[MAX_SUBS];
+	intptr_t a[MAX_SUBS], b[MAX_SUBS];
+	size_t i, n, m;
+
+	n = tsdp_subidx_lookup(x, q, payload, got, MAX_SUBS);
+	for (i = 0; i < n; i++) a[i] = (intptr_t)got[i];
+	qsort(a, n, sizeof(intptr_t), s_cmp);
+
+	for (i = m = 0; i < (size_t)nsubs; i++)
+		if (patterns[i] && (payloads[i] & payload) && qname_match(q, patterns[i]))
+			b[m++] = (intptr_t)(i + 1);
+
+	if (verbose) {
+		printf("%s:", qname_string(q));
+		for (i = 0; i < n; i++) printf(" %ld", (long)a[i]);
+		printf("\n");
+	}
+	if (n != m || memcmp(a, b, n * sizeof(intptr_t)) != 0) {
+		fprintf(stderr, "oops.  index found %lu subscribers for '%s'; brute force found %lu\n",
+			n, qname_string(q), m);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+base(void)
+{
+	struct tsdp_subidx *x;
+	struct tsdp_msg *m;
+	struct qname *q;
+	void *subs[4];
+	int id;
+
+	x = tsdp_subidx_new();
+	if (!x) return 1;
+
+	q = qname_parse("cpu host=a");
+	if (tsdp_subidx_add(x, q, TSDP_PAYLOAD_SAMPLE, (void *)1) != 0) return 2;
+	if (tsdp_subidx_count(x) != 1) return 3;
+	if (!qname_equal(tsdp_subidx_pattern(x, 0), q)) return 4;
+	qname_free(q); /* the index keeps its own copy */
+
+	q = qname_parse("cpu host=a");
+	if (tsdp_subidx_lookup(x, q, TSDP_PAYLOAD_SAMPLE, subs, 4) != 1 || subs[0] != (void *)1) return 5;
+	if (tsdp_subidx_lookup(x, q, TSDP_PAYLOAD_TALLY,  subs, 4) != 0) return 6;
+	/* a short `subs` still yields the full count */
+	if (tsdp_subidx_lookup(x, q, TSDP_PAYLOAD_ALL, NULL, 0) != 1) return 7;
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBSCRIBE, 0, TSDP_PAYLOAD_TALLY);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "cpu host=*", 11) != 0) return 8;
+	id = tsdp_subidx_subscribe(x, m, (void *)2);
+	if (id != 1) return 9;
+	if (tsdp_subidx_lookup(x, q, TSDP_PAYLOAD_TALLY, subs, 4) != 1 || subs[0] != (void *)2) return 10;
+
+	/* only SUBSCRIBE messages can subscribe */
+	m->opcode = TSDP_OPCODE_BROADCAST;
+	if (tsdp_subidx_subscribe(x, m, (void *)3) != -1) return 11;
+
+	if (tsdp_subidx_remove(x, 0) != 0)  return 12;
+	if (tsdp_subidx_remove(x, 0) != -1) return 13;
+	if (tsdp_subidx_remove(x, 7) != -1) return 14;
+	if (tsdp_subidx_count(x) != 1)      return 15;
+	if (tsdp_subidx_lookup(x, q, TSDP_PAYLOAD_ALL, subs, 4) != 1 || subs[0] != (void *)2) return 16;
+
+	/* freed ids are recycled */
+	if (tsdp_subidx_add(x, q, TSDP_PAYLOAD_ALL, (void *)4) != 0) return 17;
+	if (tsdp_subidx_lookup(x, q, TSDP_PAYLOAD_ALL, subs, 4) != 2) return 18;
+
+	if (tsdp_subidx_add(NULL, q, TSDP_PAYLOAD_ALL, NULL) != -1) return 19;
+	if (tsdp_subidx_add(x, NULL, TSDP_PAYLOAD_ALL, NULL) != -1) return 20;
+
+	tsdp_subidx_free(x);
+	tsdp_subidx_free(NULL);
+	return 0;
+}
+
+static int
+cached(void)
+{
+	struct tsdp_subidx *x;
+	struct qname *a, *b, *p;
+	void *subs[4];
+	uint64_t hits, misses;
+	int id;
+
+	x = tsdp_subidx_new();
+	if (!x || tsdp_subidx_cache(x, 2) != 0) return 1;
+
+	p = qname_parse("cpu host=*");
+	if (tsdp_subidx_add(x, p, TSDP_PAYLOAD_SAMPLE, (void *)1) != 0) return 2;
+
+	a = qname_parse("cpu host=a");
+	b = qname_parse("mem host=a");
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 4) != 1) return 3;
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 4) != 1 || subs[0] != (void *)1) return 4;
+	if (tsdp_subidx_lookup(x, b, TSDP_PAYLOAD_SAMPLE, subs, 4) != 0) return 5;
+	if (tsdp_subidx_lookup(x, b, TSDP_PAYLOAD_SAMPLE, subs, 4) != 0) return 6;
+	tsdp_subidx_cache_stats(x, &hits, &misses);
+	if (hits != 2 || misses != 2) return 7;
+
+	/* subscribing to mem doesn't disturb cpu results */
+	qname_free(p);
+	p = qname_parse("mem host=a");
+	id = tsdp_subidx_add(x, p, TSDP_PAYLOAD_SAMPLE, (void *)2);
+	if (id != 1) return 8;
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 4) != 1) return 9;
+	if (tsdp_subidx_lookup(x, b, TSDP_PAYLOAD_SAMPLE, subs, 4) != 1 || subs[0] != (void *)2) return 10;
+	tsdp_subidx_cache_stats(x, &hits, &misses);
+	if (hits != 3 || misses != 3) return 11;
+
+	/* ... and neither do subscriptions for other payloads */
+	if (tsdp_subidx_add(x, p, TSDP_PAYLOAD_TALLY, (void *)3) != 2) return 12;
+	if (tsdp_subidx_lookup(x, b, TSDP_PAYLOAD_SAMPLE, subs, 4) != 1) return 13;
+	tsdp_subidx_cache_stats(x, &hits, &misses);
+	if (hits != 4 || misses != 3) return 14;
+
+	if (tsdp_subidx_remove(x, id) != 0) return 15;
+	if (tsdp_subidx_lookup(x, b, TSDP_PAYLOAD_SAMPLE, subs, 4) != 0) return 16;
+	tsdp_subidx_cache_stats(x, &hits, &misses);
+	if (hits != 4 || misses != 4) return 17;
+
+	/* a third qname evicts the least recently used */
+	qname_free(p);
+	p = qname_parse("disk host=a");
+	if (tsdp_subidx_lookup(x, p, TSDP_PAYLOAD_SAMPLE, subs, 4) != 0) return 18;
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 4) != 1) return 19;
+	tsdp_subidx_cache_stats(x, &hits, &misses);
+	if (hits != 4 || misses != 6) return 20;
+
+	/* results larger than the caller's buffer are cached whole */
+	if (tsdp_subidx_add(x, a, TSDP_PAYLOAD_SAMPLE, (void *)4) < 0) return 21;
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 1) != 2) return 22;
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 4) != 2) return 23;
+	tsdp_subidx_cache_stats(x, &hits, &misses);
+	if (hits != 5 || misses != 7) return 24;
+
+	if (tsdp_subidx_cache(x, 0) != 0) return 25;
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 4) != 2) return 26;
+	tsdp_subidx_cache_stats(x, &hits, &misses);
+	if (hits != 5 || misses != 7) return 27;
+
+	/* removal evicts whatever the subscription was found in,
+	   and its id can be handed out again without stale hits */
+	if (tsdp_subidx_cache(x, 4) != 0) return 28;
+	qname_free(p);
+	qname_free(a);
+	qname_free(b);
+	p = qname_parse("cpu a=vb");
+	a = qname_parse("cpu av=b");
+	b = qname_parse("cpu a=vb");
+	id = tsdp_subidx_add(x, p, TSDP_PAYLOAD_SAMPLE, (void *)5);
+	if (id < 0) return 29;
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 4) != 0) return 30;
+	if (tsdp_subidx_lookup(x, b, TSDP_PAYLOAD_SAMPLE, subs, 4) != 1 || subs[0] != (void *)5) return 31;
+	if (tsdp_subidx_remove(x, id) != 0) return 32;
+	qname_free(p);
+	p = qname_parse("disk host=a");
+	if (tsdp_subidx_add(x, p, TSDP_PAYLOAD_SAMPLE, (void *)6) != id) return 33;
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 4) != 0) return 34;
+	if (tsdp_subidx_lookup(x, b, TSDP_PAYLOAD_SAMPLE, subs, 4) != 0) return 35;
+	if (tsdp_subidx_lookup(x, p, TSDP_PAYLOAD_SAMPLE, subs, 4) != 1 || subs[0] != (void *)6) return 36;
+
+	/* names that render the same, but for an escaped separator,
+	   are cached apart */
+	qname_free(p);
+	qname_free(a);
+	p = qname_parse("cpu a,b=c");
+	a = qname_parse("cpu a\\,b=c");
+	if (tsdp_subidx_add(x, p, TSDP_PAYLOAD_SAMPLE, (void *)7) < 0) return 37;
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 4) != 0) return 38;
+	if (tsdp_subidx_lookup(x, p, TSDP_PAYLOAD_SAMPLE, subs, 4) != 1 || subs[0] != (void *)7) return 39;
+	if (tsdp_subidx_lookup(x, a, TSDP_PAYLOAD_SAMPLE, subs, 4) != 0) return 40;
+	qname_free(p);
+	qname_free(a);
+	qname_free(b);
+
+	tsdp_subidx_free(x);
+	return 0;
+}
+
+/* random patterns and names, over a tiny vocabulary,
+   so that lots of them overlap */
+static const char *METRICS[] = { "cpu", "mem", "*" };
+static const char *KEYS[]    = { "a", "b", "c", "d" };
+static const char *VALUES[]  = { "x", "y", NULL, "*" };
+
+static struct qname *
+s_random(int pattern)
+{
+	char buf[256];
+	int i, n, k, used;
+	size_t off;
+
+	off = snprintf(buf, sizeof(buf), "%s", METRICS[rand() % (pattern ? 3 : 2)]);
+	n = rand() % 4;
+	used = 0;
+	for (i = 0; i < n; i++) {
+		k = rand() % 4;
+		if (used & (1 << k)) continue;
+		used |= 1 << k;
+		off += snprintf(buf + off, sizeof(buf) - off, "%s%s", i ? "," : " ", KEYS[k]);
+		if (VALUES[rand() % (pattern ? 4 : 3)]) {
+			const char *v = VALUES[rand() % (pattern ? 4 : 2)];
+			if (v) off += snprintf(buf + off, sizeof(buf) - off, "=%s", v);
+		}
+	}
+	if (pattern && rand() % 4 == 0)
+		off += snprintf(buf + off, sizeof(buf) - off, "%s*", off > 3 && strchr(buf, ' ') ? "," : " ");
+	return qname_parse(buf);
+}
+
+static int
+random_check(int seed, size_t cache)
+{
+	struct tsdp_subidx *x;
+	struct qname *q;
+	int i, j, n;
+
+	srand(seed);
+	x = tsdp_subidx_new();
+	if (!x) return 1;
+	if (cache && tsdp_subidx_cache(x, cache) != 0) return 1;
+
+	n = 0;
+	for (i = 0; i < 2000; i++) {
+		switch (rand() % 4) {
+		case 0: /* unsubscribe someone */
+			j = rand() % (n + 1);
+			if (j < n && patterns[j]) {
+				if (tsdp_subidx_remove(x, ids[j]) != 0) return 2;
+				qname_free(patterns[j]);
+				patterns[j] = NULL;
+			}
+			break;
+
+		case 1: /* subscribe someone */
+			if (n == MAX_SUBS) break;
+			patterns[n] = s_random(1);
+			if (!patterns[n]) break;
+			payloads[n] = 1 + rand() % 3;
+			ids[n] = tsdp_subidx_add(x, patterns[n], payloads[n], (void *)(intptr_t)(n + 1));
+			if (ids[n] < 0) return 3;
+			n++;
+			break;
+
+		default: /* route a broadcast */
+			q = s_random(0);
+			if (!q) break;
+			if (check(x, n, q, 1 + rand() % 3, 0) != 0) return 4;
+			qname_free(q);
+			break;
+		}
+	}
+
+	tsdp_subidx_free(x);
+	return 0;
+}
+
+/* reads directives from standard input:
+
+     + PAYLOADS PATTERN   subscribe (subscriber ids count up from 1)
+     - ID                 unsubscribe
+     ? PAYLOAD QNAME      route, printing matching subscribers
+
+ */
+static int
+script(void)
+{
+	struct tsdp_subidx *x;
+	struct qname *q;
+	char line[8192], *s;
+	unsigned int p;
+	int n, id;
+
+	x = tsdp_subidx_new();
+	if (!x) return 1;
+
+	n = 0;
+	while (fgets(line, sizeof(line), stdin)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (!*line) continue;
+
+		switch (line[0]) {
+		case '+':
+			p = strtoul(line + 2, &s, 16);
+			patterns[n] = qname_parse(s + 1);
+			if (!patterns[n]) {
+				printf("bad pattern '%s'\n", s + 1);
+				return 2;
+			}
+			payloads[n] = p;
+			ids[n] = tsdp_subidx_add(x, patterns[n], p, (void *)(intptr_t)(n + 1));
+			n++;
+			break;
+
+		case '-':
+			id = atoi(line + 2) - 1;
+			if (id < 0 || id >= n || !patterns[id] || tsdp_subidx_remove(x, ids[id]) != 0) {
+				printf("bad unsubscribe '%s'\n", line);
+				return 3;
+			}
+			qname_free(patterns[id]);
+			patterns[id] = NULL;
+			break;
+
+		case '?':
+			p = strtoul(line + 2, &s, 16);
+			q = qname_parse(s + 1);
+			if (!q) {
+				printf("bad qname '%s'\n", s + 1);
+				return 4;
+			}
+			if (check(x, n, q, p, 1) != 0) return 5;
+			qname_free(q);
+			break;
+		}
+	}
+
+	tsdp_subidx_free(x);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 2 && strcmp(argv[1], "base") == 0)
+		return base();
+	if (argc == 3 && strcmp(argv[1], "random") == 0)
+		return random_check(atoi(argv[2]), 0);
+	if (argc == 4 && strcmp(argv[1], "random") == 0)
+		return random_check(atoi(argv[2]), atoi(argv[3]));
+	if (argc == 2 && strcmp(argv[1], "cache") == 0)
+		return cached();
+	return script();
+}
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+static int
+s_collect(int id, void *udata)
+{
+	int **ids = (int **)udata;
+	*(*ids)++ = id;
+	return 0;
+}
+
+static int
+s_stop(int id, void *udata)
+{
+	return 1;
+}
+
+static int
+base(void)
+{
+	struct tsdp_tagidx *x;
+	struct qname *q, *p;
+	int id, ids[8], *next;
+
+	x = tsdp_tagidx_new();
+	if (!x) return 1;
+
+	q = qname_parse("cpu host=a,env=prod");
+	id = tsdp_tagidx_add(x, q, TSDP_PAYLOAD_SAMPLE);
+	if (id != 0) return 2;
+	if (tsdp_tagidx_add(x, q, TSDP_PAYLOAD_SAMPLE) != 0) return 3; /* same series */
+	if (tsdp_tagidx_add(x, q, TSDP_PAYLOAD_TALLY)  != 1) return 4; /* different type */
+	if (tsdp_tagidx_count(x) != 2) return 5;
+	if (tsdp_tagidx_lookup(x, q, TSDP_PAYLOAD_TALLY) != 1) return 6;
+	if (tsdp_tagidx_lookup(x, q, TSDP_PAYLOAD_STATE) != -1) return 7;
+	if (!qname_equal(tsdp_tagidx_series(x, 1), q)) return 8;
+	if (tsdp_tagidx_payload(x, 1) != TSDP_PAYLOAD_TALLY) return 9;
+	qname_free(q); /* the index keeps its own copy */
+
+	/* series cannot be wildcards */
+	q = qname_parse("cpu host=*");
+	if (tsdp_tagidx_add(x, q, TSDP_PAYLOAD_SAMPLE) != -1) return 10;
+	qname_free(q);
+	q = qname_parse("cpu host=a,*");
+	if (tsdp_tagidx_add(x, q, TSDP_PAYLOAD_SAMPLE) != -1) return 11;
+
+	/* ... but patterns can */
+	p = qname_parse("cpu host=*,*");
+	next = ids;
+	if (tsdp_tagidx_select(x, p, TSDP_PAYLOAD_ALL, s_collect, &next) != 2) return 12;
+	if (next - ids != 2 || ids[0] != 0 || ids[1] != 1) return 13;
+	if (tsdp_tagidx_select(x, p, TSDP_PAYLOAD_TALLY, NULL, NULL) != 1) return 14;
+	if (tsdp_tagidx_select(x, p, TSDP_PAYLOAD_ALL, s_stop, NULL) != 1) return 15;
+
+	if (tsdp_tagidx_forget(x, p, TSDP_PAYLOAD_SAMPLE) != 1) return 16;
+	if (tsdp_tagidx_count(x) != 1) return 17;
+	if (tsdp_tagidx_series(x, 0) != NULL) return 18;
+	if (tsdp_tagidx_remove(x, 0) != -1) return 19;
+	if (tsdp_tagidx_remove(x, 1) != 0) return 20;
+	if (tsdp_tagidx_count(x) != 0) return 21;
+	if (tsdp_tagidx_select(x, p, TSDP_PAYLOAD_ALL, NULL, NULL) != 0) return 22;
+	qname_free(p);
+
+	/* freed ids are recycled */
+	if (tsdp_tagidx_add(x, q, TSDP_PAYLOAD_ALL) != -1) return 23;
+	qname_free(q);
+	q = qname_parse("mem host=b");
+	id = tsdp_tagidx_add(x, q, TSDP_PAYLOAD_SAMPLE);
+	if (id != 0 && id != 1) return 24;
+	qname_free(q);
+
+	/* names that render the same, but for an escaped separator,
+	   are different series */
+	q = qname_parse("cpu a,b=c");
+	p = qname_parse("cpu a\\,b=c");
+	id = tsdp_tagidx_add(x, q, TSDP_PAYLOAD_SAMPLE);
+	if (id < 0) return 25;
+	if (tsdp_tagidx_add(x, p, TSDP_PAYLOAD_SAMPLE) == id) return 26;
+	if (tsdp_tagidx_lookup(x, p, TSDP_PAYLOAD_SAMPLE) == id) return 27;
+	if (!qname_equal(tsdp_tagidx_series(x, tsdp_tagidx_lookup(x, p, TSDP_PAYLOAD_SAMPLE)), p)) return 28;
+	if (tsdp_tagidx_forget(x, q, TSDP_PAYLOAD_SAMPLE) != 1) return 29;
+	if (tsdp_tagidx_lookup(x, p, TSDP_PAYLOAD_SAMPLE) < 0) return 30;
+	qname_free(q);
+	qname_free(p);
+
+	tsdp_tagidx_free(x);
+	tsdp_tagidx_free(NULL);
+	return 0;
+}
+
+/* lots of series, over a small vocabulary, so that the
+   posting lists for common terms get dense */
+#define NSERIES 40000
+
+static const char *METRICS[] = { "cpu", "mem", "disk" };
+static const char *KEYS[]    = { "host", "env", "dc", "rack" };
+
+static struct qname *
+s_random(int pattern)
+{
+	char buf[256];
+	int i, n, used, k, v;
+	size_t off;
+
+	off = snprintf(buf, sizeof(buf), "%s", METRICS[rand() % 3]);
+	n = 1 + rand() % 4;
+	used = 0;
+	for (i = 0; i < n; i++) {
+		k = rand() % 4;
+		if (used & (1 << k)) continue;
+		used |= 1 << k;
+		off += snprintf(buf + off, sizeof(buf) - off, "%s%s", used == (1 << k) ? " " : ",", KEYS[k]);
+		v = rand() % (pattern ? 12 : 10);
+		if (v == 10)       off += snprintf(buf + off, sizeof(buf) - off, "=*");
+		else if (v == 11)  ; /* bare key */
+		else if (k == 0)   off += snprintf(buf + off, sizeof(buf) - off, "=h%d", rand() % 5000);
+		else if (v != 9)   off += snprintf(buf + off, sizeof(buf) - off, "=%c", 'a' + v);
+	}
+	if (pattern && rand() % 2 == 0)
+		off += snprintf(buf + off, sizeof(buf) - off, ",*");
+	return qname_parse(buf);
+}
+
+static int
+random_check(int seed)
+{
+	static struct qname *series[NSERIES];
+	static int ids[NSERIES], got[NSERIES];
+	static char want[NSERIES];
+	struct tsdp_tagidx *x;
+	struct qname *p;
+	int i, j, n, m, *next;
+
+	srand(seed);
+	x = tsdp_tagidx_new();
+	if (!x) return 1;
+
+	memset(ids, 0xff, sizeof(ids));
+	for (i = 0; i < NSERIES; i++) {
+		series[i] = s_random(0);
+		if (!series[i]) continue;
+		ids[i] = tsdp_tagidx_add(x, series[i], TSDP_PAYLOAD_SAMPLE);
+		if (ids[i] < 0) return 2;
+	}
+
+	for (i = 0; i < 200; i++) {
+		p = s_random(1);
+		if (!p) continue;
+
+		next = got;
+		n = tsdp_tagidx_select(x, p, TSDP_PAYLOAD_ALL, s_collect, &next);
+
+		/* brute force, for comparison.  series registered
+		   twice (with the same name) share an id. */
+		memset(want, 0, sizeof(want));
+		for (j = m = 0; j < NSERIES; j++)
+			if (series[j] && ids[j] >= 0 && !want[ids[j]] && qname_match(series[j], p))
+				want[ids[j]] = 1, m++;
+
+		if (n != m) {
+			fprintf(stderr, "oops.  '%s' selected %d series; brute force found %d\n",
+				qname_string(p), n, m);
+			return 3;
+		}
+		for (j = 0; j < n; j++) {
+			if (!want[got[j]]) {
+				fprintf(stderr, "oops.  '%s' selected '%s', which doesn't match\n",
+					qname_string(p), qname_string(tsdp_tagidx_series(x, got[j])));
+				return 4;
+			}
+			if (j > 0 && got[j] <= got[j-1]) {
+				fprintf(stderr, "oops.  '%s' selected ids out of order\n", qname_string(p));
+				return 5;
+			}
+		}
+
+		/* forget a fraction of what we find */
+		if (i % 10 == 0) {
+			if (tsdp_tagidx_forget(x, p, TSDP_PAYLOAD_SAMPLE) != n) return 6;
+			if (tsdp_tagidx_select(x, p, TSDP_PAYLOAD_ALL, NULL, NULL) != 0) return 7;
+			for (j = 0; j < NSERIES; j++)
+				if (series[j] && qname_match(series[j], p))
+					ids[j] = -1;
+		}
+		qname_free(p);
+	}
+
+	tsdp_tagidx_free(x);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 2 && strcmp(argv[1], "base") == 0)
+		return base();
+	if (argc == 3 && strcmp(argv[1], "random") == 0)
+		return random_check(atoi(argv[2]));
+	fprintf(stderr, "USAGE: %s (base|random SEED)\n", argv[0]);
+	return 1;
+}
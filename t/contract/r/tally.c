@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <tsdp.h>
+
+#define NTHREADS    8
+#define NNAMES   2000
+#define NADDS  200000
+
+static uint64_t want[NNAMES], got[NNAMES];
+static int seen[NNAMES], flushes, errors;
+static struct tsdp_tally *T;
+static int done;
+
+static void
+collect(struct tsdp_msg *m, void *udata)
+{
+	int id;
+
+	if (tsdp_msg_nframes(m) != 4
+	 || m->frames->next->next->payload.uint32 != 10
+	 || m->frames->next->payload.tstamp != (uint64_t)flushes
+	 || sscanf(m->frames->payload.string, "tally.test id=%d", &id) != 1
+	 || id < 0 || id >= NNAMES) {
+		errors++;
+		return;
+	}
+	if (seen[id] == flushes) {
+		fprintf(stderr, "oops.  id=%d emitted twice in flush #%d\n", id, flushes);
+		errors++;
+	}
+	seen[id] = flushes;
+	got[id] += m->last->payload.uint64;
+}
+
+static void *
+adder(void *arg)
+{
+	char name[64];
+	int i, id, me = *(int *)arg;
+
+	for (i = 0; i < NADDS; i++) {
+		id = (i * 7 + me * 13) % NNAMES;
+		snprintf(name, sizeof(name), "tally.test id=%d", id);
+		if (tsdp_tally_add(T, name, strlen(name), (i % 3) + 1) != 0) {
+			errors++;
+			break;
+		}
+	}
+	__atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+static void
+one(struct tsdp_msg *m, void *udata)
+{
+	struct tsdp_msg **copy = (struct tsdp_msg **)udata;
+
+	if (*copy) {
+		errors++;
+		return;
+	}
+	*copy = tsdp_msg_new(TSDP_PROTOCOL_V1, tsdp_msg_opcode(m), m->flags, tsdp_msg_payload(m));
+	if (!*copy
+	 || tsdp_msg_extend(*copy, TSDP_FRAME_STRING, m->frames->payload.string, m->frames->length) != 0
+	 || tsdp_msg_extend(*copy, TSDP_FRAME_UINT, &m->last->payload.uint64, 8) != 0)
+		errors++;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t tids[NTHREADS];
+	int ids[NTHREADS];
+	struct tsdp_msg *m, *out;
+	uint64_t ts = 1495394786, inc = 5;
+	int i, j;
+
+	if (tsdp_tally_new(0, 0, 0) != NULL) return 1;
+
+	/* a single series, spelled two ways */
+	T = tsdp_tally_new(60, 0, 0);
+	if (!T) return 2;
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_TALLY);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "cpu b=2,a=1", 12) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_UINT, &inc, 8) != 0) return 3;
+	if (tsdp_tally_submit(T, m) != 0) return 4;
+	tsdp_msg_free(m);
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_TALLY);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "cpu a=1,b=2", 12) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0) return 5;
+	if (tsdp_tally_submit(T, m) != 0) return 6;
+	m->payload = TSDP_PAYLOAD_SAMPLE;
+	if (tsdp_tally_submit(T, m) != -1) return 7;
+	tsdp_msg_free(m);
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_TALLY);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "cpu a=1,*", 10) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0) return 8;
+	if (tsdp_tally_submit(T, m) != -1) return 9;
+	tsdp_msg_free(m);
+
+	out = NULL;
+	if (tsdp_tally_flush(T, ts, one, &out) != 1 || !out || errors) return 10;
+	if (tsdp_msg_opcode(out) != TSDP_OPCODE_BROADCAST || tsdp_msg_payload(out) != TSDP_PAYLOAD_TALLY) return 11;
+	if (strcmp(out->frames->payload.string, "cpu a=1,b=2") != 0) return 12;
+	if (out->last->payload.uint64 != 6) return 13;
+	tsdp_msg_free(out);
+	out = NULL;
+	if (tsdp_tally_flush(T, ts, one, &out) != 0 || out) return 14;
+	tsdp_tally_free(T);
+
+	/* lots of threads, lots of names (more than it has room
+	   for, at first), and flushes happening all the while */
+	T = tsdp_tally_new(10, 64, 4);
+	if (!T) return 15;
+	for (i = 0; i < NNAMES; i++) seen[i] = -1;
+	for (i = 0; i < NTHREADS; i++)
+		for (j = 0; j < NADDS; j++)
+			want[(j * 7 + i * 13) % NNAMES] += (j % 3) + 1;
+
+	for (i = 0; i < NTHREADS; i++) {
+		ids[i] = i;
+		if (pthread_create(&tids[i], NULL, adder, &ids[i]) != 0) return 16;
+	}
+	for (flushes = 0; flushes < 50 || __atomic_load_n(&done, __ATOMIC_SEQ_CST) < NTHREADS; flushes++)
+		if (tsdp_tally_flush(T, flushes, collect, NULL) < 0) return 17;
+	for (i = 0; i < NTHREADS; i++)
+		pthread_join(tids[i], NULL);
+	if (tsdp_tally_flush(T, flushes, collect, NULL) < 0) return 18;
+	flushes++;
+	if (tsdp_tally_flush(T, flushes, collect, NULL) != 0) return 19;
+	if (errors) return 20;
+
+	for (i = 0; i < NNAMES; i++) {
+		if (got[i] != want[i]) {
+			fprintf(stderr, "oops.  id=%d tallied %lu (not %lu)\n", i, got[i], want[i]);
+			return 21;
+		}
+	}
+	tsdp_tally_free(T);
+
+	tsdp_tally_free(NULL);
+	return 0;
+}
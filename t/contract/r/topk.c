@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+#define NHOT     5
+#define NNOISE   30000
+
+static const int hot[NHOT] = { 5000, 4000, 3000, 2000, 1000 };
+
+static int
+observe(struct tsdp_topk *t, int which)
+{
+	char buf[64];
+
+	if (which < NHOT) snprintf(buf, sizeof(buf), "cpu host=hot%d", which);
+	else              snprintf(buf, sizeof(buf), "cpu host=n%d", which - NHOT);
+	return tsdp_topk_observe(t, buf, strlen(buf), TSDP_OPCODE_SUBMIT,
+		which == 1 && (which + rand()) % 2 ? TSDP_PAYLOAD_TALLY : TSDP_PAYLOAD_SAMPLE);
+}
+
+/* are the hot keys the top NHOT, in order, with honest bounds? */
+static int
+check(struct tsdp_topk *t, const char *what)
+{
+	struct tsdp_topk_item items[NHOT];
+	char want[64];
+	uint64_t sum;
+	int i, j;
+
+	if (tsdp_topk_list(t, items, NHOT) < NHOT) return 0;
+	for (i = 0; i < NHOT; i++) {
+		snprintf(want, sizeof(want), "cpu host=hot%d", i);
+		if (strcmp(items[i].key, want) != 0) {
+			fprintf(stderr, "oops.  %s: #%d is '%s' (not '%s')\n", what, i + 1, items[i].key, want);
+			return 0;
+		}
+		if (items[i].count < (uint64_t)hot[i] || items[i].count - items[i].error > (uint64_t)hot[i]) {
+			fprintf(stderr, "oops.  %s: '%s' counted %lu (error %lu), but was seen %d times\n",
+				what, want, items[i].count, items[i].error, hot[i]);
+			return 0;
+		}
+		for (sum = 0, j = 0; j <= TSDP_OPCODE_SUBSCRIBE; j++)
+			sum += items[i].opcodes[j];
+		if (sum != items[i].count - items[i].error || items[i].opcodes[TSDP_OPCODE_SUBMIT] != sum) {
+			fprintf(stderr, "oops.  %s: '%s' opcodes add up to %lu (not %lu)\n",
+				what, want, sum, items[i].count - items[i].error);
+			return 0;
+		}
+		if (items[i].payloads[0] + items[i].payloads[1] != sum) return 0;
+		if (i == 1 && items[i].payloads[1] == 0) return 0;
+		if (i != 1 && items[i].payloads[1] != 0) return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_topk *t, *a, *b;
+	struct tsdp_topk_item items[4];
+	struct tsdp_msg *m;
+	int *stream, n, i, j, x;
+	uint64_t ts = 1495394786;
+
+	if (tsdp_topk_new(0) != NULL) return 1;
+
+	/* exact behaviour, with room for only two */
+	t = tsdp_topk_new(2);
+	if (!t) return 2;
+	if (tsdp_topk_observe(t, "a", 1, TSDP_OPCODE_SUBMIT, 0) != 0
+	 || tsdp_topk_observe(t, "a", 1, TSDP_OPCODE_FORGET, 0) != 0
+	 || tsdp_topk_observe(t, "b", 1, TSDP_OPCODE_SUBMIT, 0) != 0
+	 || tsdp_topk_observe(t, "c", 1, TSDP_OPCODE_SUBMIT, 0) != 0) return 3;
+	if (tsdp_topk_observe(t, "d", 1, 42, 0) != -1) return 4;
+	if (tsdp_topk_list(t, items, 4) != 2) return 5;
+	if (tsdp_topk_estimate(t, "b", 1) != 0) return 6;    /* evicted by c */
+	if (tsdp_topk_estimate(t, "c", 1) != 2) return 7;    /* ... inheriting its count */
+	for (i = 0; i < 2; i++) {
+		if (items[i].count != 2) return 8;
+		if (strcmp(items[i].key, "a") == 0 && (items[i].error != 0 || items[i].opcodes[TSDP_OPCODE_FORGET] != 1)) return 9;
+		if (strcmp(items[i].key, "c") == 0 && (items[i].error != 1 || items[i].opcodes[TSDP_OPCODE_SUBMIT] != 1)) return 10;
+	}
+	if (tsdp_topk_total(t) != 4) return 11;
+	if (tsdp_topk_merge(t, t) != -1) return 12;
+	tsdp_topk_free(t);
+
+	/* a few heavy hitters, lost in a sea of one-offs */
+	n = NNOISE;
+	for (i = 0; i < NHOT; i++) n += hot[i];
+	stream = calloc(n, sizeof(int));
+	if (!stream) return 13;
+	for (x = 0, i = 0; i < NHOT; i++)
+		for (j = 0; j < hot[i]; j++)
+			stream[x++] = i;
+	for (i = 0; i < NNOISE; i++)
+		stream[x++] = NHOT + i;
+	srand(42);
+	for (i = n - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		x = stream[i]; stream[i] = stream[j]; stream[j] = x;
+	}
+
+	t = tsdp_topk_new(100);
+	a = tsdp_topk_new(100);
+	b = tsdp_topk_new(100);
+	if (!t || !a || !b) return 14;
+	for (i = 0; i < n; i++) {
+		if (observe(t, stream[i]) != 0) return 15;
+		if (observe(i % 2 ? a : b, stream[i]) != 0) return 16;
+	}
+	if (tsdp_topk_total(t) != (uint64_t)n) return 17;
+	if (!check(t, "single")) return 18;
+
+	/* per-thread trackers, merged */
+	if (tsdp_topk_merge(a, b) != 0) return 19;
+	if (tsdp_topk_total(a) != (uint64_t)n) return 20;
+	if (tsdp_topk_list(a, NULL, 0) != 100) return 21;
+	if (!check(a, "merged")) return 22;
+	tsdp_topk_free(a);
+	tsdp_topk_free(b);
+	tsdp_topk_free(t);
+	free(stream);
+
+	/* decoded messages are keyed by canonical name */
+	t = tsdp_topk_new(10);
+	if (!t) return 23;
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_SAMPLE);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "cpu b=2,a=1", 12) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0) return 24;
+	if (tsdp_topk_observe_msg(t, m) != 0) return 25;
+	tsdp_msg_free(m);
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_FORGET, 0, TSDP_PAYLOAD_SAMPLE | TSDP_PAYLOAD_TALLY);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "cpu a=1,b=2", 12) != 0) return 26;
+	if (tsdp_topk_observe_msg(t, m) != 0) return 27;
+	tsdp_msg_free(m);
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_HEARTBEAT, 0, 0);
+	if (!m || tsdp_topk_observe_msg(t, m) != -1) return 28;
+	tsdp_msg_free(m);
+
+	if (tsdp_topk_estimate(t, "cpu a=1,b=2", 11) != 2) return 29;
+	if (tsdp_topk_list(t, items, 4) != 1) return 30;
+	if (items[0].opcodes[TSDP_OPCODE_SUBMIT] != 1 || items[0].opcodes[TSDP_OPCODE_FORGET] != 1) return 31;
+	if (items[0].payloads[0] != 2 || items[0].payloads[1] != 1) return 32;
+	tsdp_topk_free(t);
+
+	tsdp_topk_free(NULL);
+	return 0;
+}
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tsdp.h>
+
+#define NTIMERS 100000
+
+struct rec {
+	int      id;
+	uint64_t due;      /* when it should fire    */
+	int      live;     /* armed, not yet fired   */
+	int      fired;    /* how many times         */
+	int      repeat;   /* re-arm this many times */
+};
+
+static struct rec recs[NTIMERS];
+static struct tsdp_wheel *W;
+static int errors;
+static uint64_t seed = 42;
+
+static uint64_t
+rnd(uint64_t n)
+{
+	seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (seed >> 17) % n;
+}
+
+static uint64_t
+delta(void)
+{
+	switch (rnd(5)) {
+	case 0:  return rnd(300);
+	case 1:  return rnd(70000);
+	case 2:  return rnd(1ULL << 25);
+	case 3:  return rnd(1ULL << 34);
+	default: return rnd(5000);
+	}
+}
+
+/* where `deadline` would land, arming at the wheel's now */
+static uint64_t
+due(uint64_t deadline)
+{
+	uint64_t now = tsdp_wheel_now(W);
+	return deadline > now ? deadline : now + 1;
+}
+
+static void
+expired(int id, void *data, void *udata)
+{
+	struct rec *r = (struct rec *)data;
+	uint64_t d;
+
+	(*(int *)udata)++;
+	if (!r->live || r->id != id || tsdp_wheel_now(W) != r->due) {
+		if (errors++ < 10)
+			fprintf(stderr, "oops.  timer %d (live %d) fired at %lu, but was due at %lu\n",
+				id, r->live, tsdp_wheel_now(W), r->due);
+	}
+	r->fired++;
+	r->live = 0;
+
+	if (r->repeat > 0) {
+		r->repeat--;
+		d = tsdp_wheel_now(W) + 1 + rnd(1000);
+		if (tsdp_wheel_rearm(W, id, d) != 0) errors++;
+		r->due  = due(d);
+		r->live = 1;
+	}
+}
+
+static void
+once(int id, void *data, void *udata)
+{
+	if (tsdp_wheel_now(W) != *(uint64_t *)udata) errors++;
+	(*(int *)data)++;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_msg *m;
+	uint64_t now, d, ts = 1495394786, u = 30;
+	int i, n, fired, count;
+
+	W = tsdp_wheel_new(1000);
+	if (!W) return 1;
+	if (tsdp_wheel_rearm(W, 0, 2000) != -1 || tsdp_wheel_cancel(W, 0) != -1) return 2;
+
+	for (i = 0; i < NTIMERS; i++) {
+		d = i % 100 == 0 ? 900 : 1000 + delta(); /* some already past */
+		recs[i].id = tsdp_wheel_arm(W, d, &recs[i]);
+		if (recs[i].id < 0) return 3;
+		recs[i].due    = due(d);
+		recs[i].live   = 1;
+		recs[i].repeat = i % 7 == 0 ? 3 : 0;
+	}
+	if (tsdp_wheel_count(W) != NTIMERS) return 4;
+
+	fired = 0;
+	for (now = 1000, n = 0; n < 5000; n++) {
+		/* shuffle some deadlines around, and cancel others */
+		for (i = 0; i < 20; i++) {
+			struct rec *r = &recs[rnd(NTIMERS)];
+			if (!r->live) continue;
+			if (rnd(4) == 0) {
+				if (tsdp_wheel_cancel(W, r->id) != 0) return 5;
+				r->live = 0;
+			} else {
+				d = now + delta();
+				if (tsdp_wheel_rearm(W, r->id, d) != 0) return 6;
+				r->due = due(d);
+			}
+		}
+		now += n % 100 == 0 ? rnd(1ULL << 24) : rnd(2000);
+		tsdp_wheel_advance(W, now, expired, &fired);
+		if (tsdp_wheel_now(W) != now) return 7;
+	}
+	tsdp_wheel_advance(W, now + (1ULL << 36), expired, &fired);
+	if (errors) return 8;
+
+	for (count = 0, i = 0; i < NTIMERS; i++) {
+		if (recs[i].live) {
+			fprintf(stderr, "oops.  timer %d never fired (due at %lu)\n", recs[i].id, recs[i].due);
+			return 9;
+		}
+		if (recs[i].fired > 4) return 10;
+		count += recs[i].fired;
+	}
+	if (count != fired || tsdp_wheel_count(W) != 0) return 11;
+	tsdp_wheel_free(W);
+
+	/* a long way out */
+	W = tsdp_wheel_new(0);
+	if (!W) return 12;
+	count = 0;
+	d = (1ULL << 40) - 5;
+	if (tsdp_wheel_arm(W, d, &count) < 0) return 13;
+	if (tsdp_wheel_advance(W, d - 1, once, &d) != 0 || count != 0) return 14;
+	if (tsdp_wheel_advance(W, 1ULL << 40, once, &d) != 1 || count != 1) return 15;
+	if (errors) return 16;
+	tsdp_wheel_free(W);
+
+	/* heartbeats push liveness deadlines out */
+	W = tsdp_wheel_new(1000);
+	if (!W) return 17;
+	count = 0;
+	i = tsdp_wheel_arm(W, 1030, &count);
+	if (i < 0) return 18;
+
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_HEARTBEAT, 0, 0);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_UINT,   &u,  8) != 0) return 19;
+	d = 1050;
+	if (tsdp_wheel_advance(W, 1020, once, &d) != 0) return 20;
+	if (tsdp_wheel_heartbeat(W, i, m, 30) != 0) return 21;
+	if (tsdp_wheel_advance(W, 1049, once, &d) != 0 || count != 0) return 22;
+	if (tsdp_wheel_advance(W, 1060, once, &d) != 1 || count != 1) return 23;
+	if (tsdp_wheel_heartbeat(W, i, m, 30) != -1) return 24; /* fired, and released */
+	m->opcode = TSDP_OPCODE_SUBMIT;
+	i = tsdp_wheel_arm(W, 2000, &count);
+	if (tsdp_wheel_heartbeat(W, i, m, 30) != -1) return 25;
+	tsdp_msg_free(m);
+	if (errors) return 26;
+	tsdp_wheel_free(W);
+
+	tsdp_wheel_free(NULL);
+	return 0;
+}
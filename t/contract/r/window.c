@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <tsdp.h>
+
+#define NSERIES (1 << 20)
+
+struct seen {
+	int    n, bad;
+	char   name[256];
+	double f[6];
+};
+
+static void
+record(struct tsdp_msg *m, void *udata)
+{
+	struct seen *s = (struct seen *)udata;
+	struct tsdp_frame *f;
+	int i;
+
+	s->n++;
+	if (tsdp_msg_opcode(m) != TSDP_OPCODE_BROADCAST || tsdp_msg_payload(m) != TSDP_PAYLOAD_SAMPLE
+	 || tsdp_msg_nframes(m) != 9 || m->frames->length != strlen(m->frames->payload.string) + 1
+	 || m->frames->next->payload.tstamp != 1495394846 || m->frames->next->next->payload.uint32 != 60) {
+		s->bad++;
+		return;
+	}
+	if (snprintf(s->name, sizeof(s->name), "%s", m->frames->payload.string) >= (int)sizeof(s->name)) {
+		s->bad++;
+		return;
+	}
+	for (i = 0, f = m->frames->next->next->next; f; f = f->next, i++)
+		s->f[i] = f->payload.float64;
+}
+
+static void
+count(struct tsdp_msg *m, void *udata)
+{
+	(*(int *)udata)++;
+}
+
+static int
+near(double a, double b)
+{
+	return fabs(a - b) <= 1e-9 * (fabs(a) > fabs(b) ? fabs(a) : fabs(b)) + 1e-12;
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdp_window *w;
+	struct tsdp_sample *s;
+	struct tsdp_sample_stats a, b;
+	struct tsdp_msg *m;
+	struct seen seen;
+	char name[64];
+	double v[16], big[] = { 1e9 + 1, 1e9 + 2, 1e9 + 3, 1e9 + 4 };
+	uint64_t ts = 1495394786;
+	clock_t start;
+	int i, j, id, n;
+
+	if (tsdp_window_new(0, 0) != NULL) return 1;
+	w = tsdp_window_new(60, 0);
+	if (!w) return 2;
+
+	/* dense ids, in order of first appearance */
+	if (tsdp_window_series(w, "cpu a=1", 7) != 0) return 3;
+	if (tsdp_window_series(w, "cpu a=2", 7) != 1) return 4;
+	if (tsdp_window_series(w, "cpu a=1", 7) != 0) return 5;
+	if (tsdp_window_count(w) != 2) return 6;
+	if (strcmp(tsdp_window_name(w, 1), "cpu a=2") != 0 || tsdp_window_name(w, 2) != NULL) return 7;
+	if (tsdp_window_add(w, 2, big, 1) != -1 || errno != ENOENT) return 8;
+	if (tsdp_window_get(w, 0, &a) != 0 || a.count != 0) return 9;
+
+	/* same summaries as the SAMPLE engine, NaNs and all */
+	s = tsdp_sample_new(60);
+	if (!s) return 10;
+	srand(42);
+	for (i = 0; i < 200; i++) {
+		snprintf(name, sizeof(name), "latency id=%d", i % 20);
+		for (j = 0; j < 16; j++)
+			v[j] = j == 7 && i % 3 == 0 ? NAN : (double)(rand() % 10000) / 7.0;
+		id = tsdp_window_series(w, name, strlen(name));
+		if (id < 0 || tsdp_window_add(w, id, v, 1 + i % 16) != 0) return 11;
+		if (tsdp_sample_add(s, name, strlen(name), v, 1 + i % 16) != 0) return 12;
+	}
+	for (i = 0; i < 20; i++) {
+		snprintf(name, sizeof(name), "latency id=%d", i);
+		if (tsdp_window_get(w, tsdp_window_series(w, name, strlen(name)), &a) != 0) return 13;
+		if (tsdp_sample_get(s, name, strlen(name), &b) != 0) return 14;
+		if (a.count != b.count || a.min != b.min || a.max != b.max || !near(a.sum, b.sum)
+		 || !near(a.mean, b.mean) || !near(a.variance, b.variance)) {
+			fprintf(stderr, "oops.  %s is n=%lu mean=%g var=%g (not n=%lu mean=%g var=%g)\n", name,
+			        (unsigned long)a.count, a.mean, a.variance, (unsigned long)b.count, b.mean, b.variance);
+			return 15;
+		}
+	}
+	tsdp_sample_free(s);
+
+	/* large values, small spread */
+	if (tsdp_window_add(w, 1, big, 4) != 0) return 16;
+	if (tsdp_window_get(w, 1, &a) != 0 || a.mean != 1e9 + 2.5 || !near(a.variance, 5.0 / 3.0)) return 17;
+
+	/* SUBMIT SAMPLE in ... */
+	m = tsdp_msg_new(TSDP_PROTOCOL_V1, TSDP_OPCODE_SUBMIT, 0, TSDP_PAYLOAD_SAMPLE);
+	if (!m || tsdp_msg_extend(m, TSDP_FRAME_STRING, "cpu b=2,a=1", 12) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_TSTAMP, &ts, 8) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &big[0], 8) != 0
+	       || tsdp_msg_extend(m, TSDP_FRAME_FLOAT, &big[3], 8) != 0) return 18;
+	if (tsdp_window_submit(w, m) != 0) return 19;
+	m->payload = TSDP_PAYLOAD_TALLY;
+	if (tsdp_window_submit(w, m) != -1) return 20;
+	tsdp_msg_free(m);
+	id = tsdp_window_series(w, "cpu a=1,b=2", 11);
+	if (id != 22 || tsdp_window_get(w, id, &a) != 0 || a.count != 2 || a.sum != 2e9 + 5) return 21;
+
+	/* ... BROADCAST SAMPLE out */
+	memset(&seen, 0, sizeof(seen));
+	if (tsdp_window_flush(w, 1495394846, record, &seen) != 22) return 22;
+	if (seen.n != 22 || seen.bad != 0) return 23;
+	if (strcmp(seen.name, "cpu a=1,b=2") != 0) return 24; /* last, by id */
+	if (seen.f[0] != 1e9 + 1 || seen.f[1] != 1e9 + 4 || seen.f[2] != 2e9 + 5
+	 || seen.f[3] != 2 || seen.f[4] != 1e9 + 2.5 || !near(seen.f[5], 4.5)) return 25;
+	if (tsdp_window_get(w, id, &a) != 0 || a.count != 0) return 26;
+	if (tsdp_window_flush(w, 1495394906, record, &seen) != 0 || seen.n != 22) return 27;
+	tsdp_window_free(w);
+
+	/* a million series, flushed in one sweep */
+	w = tsdp_window_new(60, NSERIES);
+	if (!w) return 28;
+	for (i = 0; i < NSERIES; i++) {
+		snprintf(name, sizeof(name), "x id=%d", i);
+		v[0] = i;
+		id = tsdp_window_series(w, name, strlen(name));
+		if (id != i || tsdp_window_add(w, id, v, 1) != 0) return 29;
+	}
+	for (n = 0; n < 3; n++) {
+		start = clock();
+		j = 0;
+		if (tsdp_window_flush(w, 1495394846, count, &j) != NSERIES || j != NSERIES) return 30;
+		if ((double)(clock() - start) / CLOCKS_PER_SEC > 1.0) {
+			fprintf(stderr, "oops.  flushing %d series took %gs\n", NSERIES,
+			        (double)(clock() - start) / CLOCKS_PER_SEC);
+			return 31;
+		}
+		for (i = 0; i < NSERIES; i++) {
+			v[0] = i;
+			if (tsdp_window_add(w, i, v, 1) != 0) return 32;
+		}
+	}
+	tsdp_window_free(w);
+
+	tsdp_window_free(NULL);
+	return 0;
+}